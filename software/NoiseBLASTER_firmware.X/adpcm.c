@@ -0,0 +1,382 @@
+/*
+ * File:   adpcm.c
+ *
+ * Created on October 17, 2026
+ *
+ * IMA and Microsoft ADPCM, 4 bits a sample, so a quarter of the card
+ * bandwidth of 16 bit PCM. Each block starts with every channel's state,
+ * which is all that has to be kept between calls. The codes are read in as
+ * they're decoded, into one buffer every decoder shares, and decoded
+ * straight into the buffers the DAC is sent from.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "adpcm.h"
+#include "wav.h"
+#include "fat.h"
+
+// IMA step sizes, and how far each code moves through them
+static const int16_t adpcm_ima_steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int8_t adpcm_ima_index_steps[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// MS predictors (in 256ths) and how each code scales the step size (also in 256ths)
+static const int16_t adpcm_ms_coef1[ADPCM_MS_NUM_COEFS] = { 256, 512, 0, 192, 240, 460, 392 };
+static const int16_t adpcm_ms_coef2[ADPCM_MS_NUM_COEFS] = { 0, -256, 0, 64, 0, -208, -232 };
+
+static const int16_t adpcm_ms_adaptation[16] = {
+    230, 230, 230, 230, 307, 409, 512, 614,
+    768, 614, 512, 409, 307, 230, 230, 230
+};
+
+// Keeps the MS step size from overflowing when it's scaled up
+#define ADPCM_MS_MAX_DELTA (0x7FFFFFFF / 768)
+
+// Codes read for the frames being decoded, by whichever decoder is running
+// Both tracks of a crossfade decode one after the other, so one is enough.
+static uint8_t adpcm_codes[ADPCM_BUFFER_SIZE];
+
+#define ADPCM_CLAMP16(x) (((x) > 32767) ? 32767 : (((x) < -32768) ? -32768 : (x)))
+
+/**
+ * Checks whether a track is ADPCM that can be played
+ *
+ * @param info The track's format
+ */
+bool Adpcm_Supported(const struct WavInfo * info)
+{
+    uint16_t header_size = (info->format == WAV_FORMAT_IMA_ADPCM) ? ADPCM_IMA_HEADER_SIZE : ADPCM_MS_HEADER_SIZE;
+
+    return (info->format == WAV_FORMAT_IMA_ADPCM || info->format == WAV_FORMAT_ADPCM) && info->bits_per_sample == 4 &&
+            info->channels >= 1 && info->channels <= 2 &&
+            info->block_align > header_size * info->channels && info->block_align <= ADPCM_MAX_BLOCK_SIZE;
+}
+
+/**
+ * Works out how many frames a block holds
+ *
+ * @param format WAV_FORMAT_IMA_ADPCM or WAV_FORMAT_ADPCM
+ * @param channels 1 or 2
+ * @param size Bytes in the block, at least its header
+ */
+static uint16_t Adpcm_BlockFrames(uint16_t format, uint8_t channels, uint32_t size)
+{
+    // The header sample, then 8 for every 4 bytes each channel has
+    if(format == WAV_FORMAT_IMA_ADPCM)
+        return 1 + (((size - (ADPCM_IMA_HEADER_SIZE * channels)) / (4 * channels)) * 8);
+
+    // The two header samples, then one for every nibble
+    return 2 + (((size - (ADPCM_MS_HEADER_SIZE * channels)) * 2) / channels);
+}
+
+/**
+ * Counts the frames in a track
+ *
+ * The data is a whole number of blocks, so they all hold the same number.
+ *
+ * @param info The track's format, which Adpcm_Supported has to have passed
+ */
+uint32_t Adpcm_CountFrames(const struct WavInfo * info)
+{
+    return (info->data_size / info->block_align) * Adpcm_BlockFrames(info->format, info->channels, info->block_align);
+}
+
+/**
+ * Sets a decoder up for a track
+ *
+ * @param dec The decoder
+ * @param info The track's format, which Adpcm_Supported has to have passed
+ */
+void Adpcm_Init(struct AdpcmDecoder * dec, const struct WavInfo * info)
+{
+    dec->format = info->format;
+    dec->channels = info->channels;
+    dec->block_align = info->block_align;
+    dec->block_frames = 0;
+    dec->frame = 0;
+    dec->block_left = 0;
+}
+
+/**
+ * Reads the next block's header and sets each channel up from it
+ *
+ * Whatever was left of the last block (a few bytes too few for another
+ * frame) is read past first.
+ *
+ * @return False at the end of the track
+ */
+static bool Adpcm_LoadBlock(struct AdpcmDecoder * dec, struct FatStream * stream)
+{
+    uint8_t channels = dec->channels;
+    uint16_t header_size = ((dec->format == WAV_FORMAT_IMA_ADPCM) ? ADPCM_IMA_HEADER_SIZE : ADPCM_MS_HEADER_SIZE) * channels;
+    const uint8_t * header = adpcm_codes + dec->block_left;
+    uint32_t size;
+    uint8_t c, predictor;
+
+    size = Fat_StreamRead(stream, adpcm_codes, dec->block_left + header_size);
+
+    dec->frame = 0;
+    dec->block_frames = 0;
+
+    if(size < dec->block_left + header_size)
+        return false;
+
+    // The data is a whole number of blocks
+    size = header_size + stream->bytes_left;
+    if(size > dec->block_align)
+        size = dec->block_align;
+
+    if(dec->format == WAV_FORMAT_IMA_ADPCM)
+    {
+        for(c = 0; c < channels; c++)
+        {
+            dec->sample1[c] = (int16_t)(header[4 * c] | (header[(4 * c) + 1] << 8));
+            dec->step_index[c] = (header[(4 * c) + 2] > 88) ? 88 : header[(4 * c) + 2];
+        }
+    }
+    else
+    {
+        for(c = 0; c < channels; c++)
+        {
+            predictor = header[c];
+            if(predictor >= ADPCM_MS_NUM_COEFS)
+                predictor = 0;
+
+            dec->coef1[c] = adpcm_ms_coef1[predictor];
+            dec->coef2[c] = adpcm_ms_coef2[predictor];
+            dec->delta[c] = (int16_t)(header[channels + (2 * c)] | (header[channels + (2 * c) + 1] << 8));
+            dec->sample1[c] = (int16_t)(header[(3 * channels) + (2 * c)] | (header[(3 * channels) + (2 * c) + 1] << 8));
+            dec->sample2[c] = (int16_t)(header[(5 * channels) + (2 * c)] | (header[(5 * channels) + (2 * c) + 1] << 8));
+        }
+    }
+
+    dec->block_frames = Adpcm_BlockFrames(dec->format, channels, size);
+    dec->block_left = size - header_size;
+
+    return true;
+}
+
+/**
+ * Reads the next codes of the block into adpcm_codes
+ *
+ * If the card can't give them all, the rest are zero. Nothing is read for
+ * none, as a read that gets nothing ends the stream.
+ */
+static const uint8_t * Adpcm_ReadCodes(struct AdpcmDecoder * dec, struct FatStream * stream, uint16_t num_bytes)
+{
+    uint32_t size;
+
+    if(num_bytes == 0)
+        return adpcm_codes;
+
+    size = Fat_StreamRead(stream, adpcm_codes, num_bytes);
+
+    if(size < num_bytes)
+        memset(adpcm_codes + size, 0, num_bytes - size);
+    dec->block_left -= num_bytes;
+
+    return adpcm_codes;
+}
+
+/**
+ * Decodes one IMA code for a channel
+ *
+ * @return The new sample
+ */
+static inline int16_t Adpcm_ImaNibble(struct AdpcmDecoder * dec, uint8_t c, uint8_t nibble)
+{
+    int32_t step = adpcm_ima_steps[dec->step_index[c]];
+    int32_t diff = step >> 3;
+    int32_t sample;
+    int8_t index;
+
+    if(nibble & 4)
+        diff += step;
+    if(nibble & 2)
+        diff += step >> 1;
+    if(nibble & 1)
+        diff += step >> 2;
+
+    sample = (nibble & 8) ? dec->sample1[c] - diff : dec->sample1[c] + diff;
+    dec->sample1[c] = ADPCM_CLAMP16(sample);
+
+    index = dec->step_index[c] + adpcm_ima_index_steps[nibble];
+    dec->step_index[c] = (index < 0) ? 0 : ((index > 88) ? 88 : index);
+
+    return dec->sample1[c];
+}
+
+/**
+ * Decodes one MS code for a channel
+ *
+ * @return The new sample
+ */
+static inline int16_t Adpcm_MsNibble(struct AdpcmDecoder * dec, uint8_t c, uint8_t nibble)
+{
+    int32_t prediction = ((int32_t)dec->sample1[c] * dec->coef1[c]) + ((int32_t)dec->sample2[c] * dec->coef2[c]);
+    int32_t sample;
+
+    // Divides by 256 rounding towards zero, like the reference decoder
+    prediction = (prediction + ((prediction >> 31) & 0xFF)) >> 8;
+
+    // The code is a signed 4 bit number of steps
+    sample = prediction + ((((int32_t)nibble ^ 8) - 8) * dec->delta[c]);
+
+    dec->sample2[c] = dec->sample1[c];
+    dec->sample1[c] = ADPCM_CLAMP16(sample);
+
+    dec->delta[c] = (adpcm_ms_adaptation[nibble] * dec->delta[c]) >> 8;
+    if(dec->delta[c] < 16)
+        dec->delta[c] = 16;
+    else if(dec->delta[c] > ADPCM_MS_MAX_DELTA)
+        dec->delta[c] = ADPCM_MS_MAX_DELTA;
+
+    return dec->sample1[c];
+}
+
+/**
+ * Decodes the next frames of an IMA block
+ *
+ * After the header each channel has 4 bytes (8 codes, low nibble first) in
+ * turn. A group of them is kept in the decoder until all 8 frames are done.
+ */
+static void Adpcm_DecodeIma(struct AdpcmDecoder * dec, struct FatStream * stream, int16_t * out, uint16_t num_frames)
+{
+    const uint8_t channels = dec->channels;
+    const uint8_t * data;
+    uint16_t frame = dec->frame, code;
+    uint8_t c, byte;
+
+    dec->frame += num_frames;
+
+    if(frame == 0)
+    {
+        out[0] = dec->sample1[0];
+        out[1] = dec->sample1[channels - 1];
+        out += 2;
+        frame++;
+        num_frames--;
+    }
+
+    // Every group that starts in these frames
+    code = frame - 1;
+    data = Adpcm_ReadCodes(dec, stream, (((code + num_frames + 7) >> 3) - ((code + 7) >> 3)) * 4 * channels);
+
+    while(num_frames-- > 0)
+    {
+        if((code & 7) == 0)
+        {
+            memcpy(dec->group, data, 4 * channels);
+            data += 4 * channels;
+        }
+
+        for(c = 0; c < channels; c++)
+        {
+            byte = dec->group[(4 * c) + ((code & 7) >> 1)];
+            out[c] = Adpcm_ImaNibble(dec, c, (code & 1) ? (byte >> 4) : (byte & 0xF));
+        }
+
+        if(channels == 1)
+            out[1] = out[0];
+
+        out += 2;
+        code++;
+    }
+}
+
+/**
+ * Decodes the next frames of an MS block
+ *
+ * The header's samples come out oldest first, then there's a code for
+ * each channel in turn, high nibble first.
+ */
+static void Adpcm_DecodeMs(struct AdpcmDecoder * dec, struct FatStream * stream, int16_t * out, uint16_t num_frames)
+{
+    const uint8_t channels = dec->channels;
+    const uint8_t * data;
+    uint16_t frame = dec->frame, code;
+    uint8_t c;
+
+    dec->frame += num_frames;
+
+    for(; frame < 2 && num_frames > 0; frame++, num_frames--)
+    {
+        out[0] = (frame == 0) ? dec->sample2[0] : dec->sample1[0];
+        out[1] = (frame == 0) ? dec->sample2[channels - 1] : dec->sample1[channels - 1];
+        out += 2;
+    }
+
+    if(num_frames == 0)
+        return;
+
+    // Every byte that starts in these frames, a mono one can be half done
+    code = (frame - 2) * channels;
+    data = Adpcm_ReadCodes(dec, stream, ((code + (num_frames * channels) + 1) >> 1) - ((code + 1) >> 1));
+
+    while(num_frames-- > 0)
+    {
+        for(c = 0; c < channels; c++, code++)
+        {
+            if((code & 1) == 0)
+                dec->group[0] = *data++;
+            out[c] = Adpcm_MsNibble(dec, c, (code & 1) ? (dec->group[0] & 0xF) : (dec->group[0] >> 4));
+        }
+
+        if(channels == 1)
+            out[1] = out[0];
+
+        out += 2;
+    }
+}
+
+/**
+ * Decodes frames from a track into 16 bit stereo, reading codes as needed
+ *
+ * @param dec The track's decoder
+ * @param stream The track's data
+ * @param out Where to put the frames
+ * @param num_frames The most frames to decode
+ *
+ * @return How many frames were decoded, short only at the end of the track
+ */
+uint32_t Adpcm_Read(struct AdpcmDecoder * dec, struct FatStream * stream, int16_t * out, uint32_t num_frames)
+{
+    uint32_t made = 0, count;
+
+    while(made < num_frames)
+    {
+        if(dec->frame == dec->block_frames && !Adpcm_LoadBlock(dec, stream))
+            break;
+
+        count = dec->block_frames - dec->frame;
+        if(count > num_frames - made)
+            count = num_frames - made;
+
+        // As many as the codes fit in adpcm_codes, with a group either side
+        if(count > ADPCM_BUFFER_FRAMES(dec->channels))
+            count = ADPCM_BUFFER_FRAMES(dec->channels);
+
+        if(dec->format == WAV_FORMAT_IMA_ADPCM)
+            Adpcm_DecodeIma(dec, stream, out, count);
+        else
+            Adpcm_DecodeMs(dec, stream, out, count);
+
+        out += count * 2;
+        made += count;
+    }
+
+    return made;
+}
@@ -0,0 +1,61 @@
+/*
+ * File:   adpcm.h
+ *
+ * Created on October 17, 2026
+ */
+
+#ifndef ADPCM_H
+#define	ADPCM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "wav.h"
+#include "fat.h"
+
+// Biggest block (block_align) that can be played, 2048 bytes a channel is
+// what encoders use at 44.1KHz
+#define ADPCM_MAX_BLOCK_SIZE 4096
+
+// Bytes at the start of each block for each channel's starting state
+#define ADPCM_IMA_HEADER_SIZE 4
+#define ADPCM_MS_HEADER_SIZE 7
+
+// Bytes of codes read at a time, shared by every decoder
+#define ADPCM_BUFFER_SIZE 512
+
+// Frames whose codes are sure to fit in ADPCM_BUFFER_SIZE, wherever they start
+// (a channel's code is half a byte, and a block of IMA is read 8 frames at a time)
+#define ADPCM_BUFFER_FRAMES(channels) (((ADPCM_BUFFER_SIZE * 2U) / (channels)) - 16)
+
+// Number of predictors every MS ADPCM file has (the standard ones)
+#define ADPCM_MS_NUM_COEFS 7
+
+// Decodes IMA (0x11) or Microsoft (0x02) ADPCM a block at a time
+struct AdpcmDecoder {
+    uint16_t format;
+    uint8_t channels;
+    uint16_t block_align;
+    uint16_t block_frames;      // Frames in the block that's loaded
+    uint16_t frame;             // Next frame of it to decode
+    uint16_t block_left;        // Bytes of it still to read
+
+    // Each channel's state
+    int16_t sample1[2];         // Last sample (IMA's predictor)
+    int16_t sample2[2];         // The one before that (MS only)
+    int32_t delta[2];           // Step size (MS only)
+    int16_t coef1[2];           // Predictor (MS only)
+    int16_t coef2[2];
+    uint8_t step_index[2];      // Into the step table (IMA only)
+
+    // Codes of the frames being decoded that are read but not all used
+    // yet, a group of both channels for IMA and a byte for MS
+    uint8_t group[8];
+};
+
+bool Adpcm_Supported(const struct WavInfo * info);
+uint32_t Adpcm_CountFrames(const struct WavInfo * info);
+void Adpcm_Init(struct AdpcmDecoder * dec, const struct WavInfo * info);
+uint32_t Adpcm_Read(struct AdpcmDecoder * dec, struct FatStream * stream, int16_t * out, uint32_t num_frames);
+
+#endif	/* ADPCM_H */
+
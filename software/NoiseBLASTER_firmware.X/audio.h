@@ -0,0 +1,50 @@
+/*
+ * File:   audio.h
+ *
+ * Created on October 17, 2026
+ */
+
+#ifndef AUDIO_H
+#define	AUDIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// What the DAC is sent: 16 bit stereo, word aligned for the conversion kernels
+typedef struct {
+    int16_t left;
+    int16_t right;
+} __attribute__((aligned(4))) AudioFrame;
+
+// Frames in each block the DMA sends, 2.9ms at 44.1KHz
+#define AUDIO_BLOCK_FRAMES 128
+
+// Blocks queued between the decoder and the DMA, a power of two up to 128
+// Each one costs 512 bytes of RAM and rides out another 2.9ms of card stall
+// at 44.1KHz. As measured on the host (tools/test_ring), 16 gets through
+// stalls of 42ms playing PCM, ADPCM or QOA, and 36ms playing FLAC with 4096
+// frame blocks, whose first channel decodes in one burst. 8 got through
+// only 19ms and 12ms.
+#ifndef AUDIO_RING_BLOCKS
+#define AUDIO_RING_BLOCKS 16
+#endif
+#define AUDIO_RING_MASK (AUDIO_RING_BLOCKS - 1)
+
+// Decoded blocks waiting to go out
+// The counts run on forever and wrap, so the main loop only ever writes the
+// head and the DMA interrupt only ever writes the tail.
+struct AudioRing {
+    AudioFrame blocks[AUDIO_RING_BLOCKS][AUDIO_BLOCK_FRAMES];
+    volatile uint8_t head;      // Blocks filled
+    volatile uint8_t tail;      // Blocks sent
+    volatile bool sending;      // Whether the DMA is on the tail block rather than silence
+    volatile uint32_t underruns;    // Blocks of silence sent because the ring ran dry
+};
+
+extern struct AudioRing audio_ring;
+
+// Blocks filled and not yet sent, counting the one going out
+#define AUDIO_RING_FILLED() ((uint8_t)(audio_ring.head - audio_ring.tail))
+
+#endif	/* AUDIO_H */
+
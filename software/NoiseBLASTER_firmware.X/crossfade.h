@@ -0,0 +1,36 @@
+/*
+ * File:   crossfade.h
+ *
+ * Created on October 17, 2026
+ */
+
+#ifndef CROSSFADE_H
+#define	CROSSFADE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The gain curve is stored at this many steps, the ones in between are interpolated
+#define CROSSFADE_STEPS 64
+
+// Position through the fade, as a Q24 fraction of a step
+#define CROSSFADE_POS_BITS 24
+#define CROSSFADE_POS_END ((uint32_t)CROSSFADE_STEPS << CROSSFADE_POS_BITS)
+
+// Mixes the end of one track into the start of the next over a set number
+// of frames, keeping its place from one block to the next
+struct Crossfade {
+    uint32_t length;            // Frames the fade lasts
+    uint32_t done;              // Frames of it mixed so far
+
+    uint32_t pos;               // Through the curve, from 0 to CROSSFADE_POS_END
+    uint32_t pos_error;         // Remainder of pos, in 1/length of a Q24 step
+    uint32_t step;              // How far pos moves for each frame
+    uint32_t step_error;
+};
+
+void Crossfade_Start(struct Crossfade * fade, uint32_t length);
+void Crossfade_Mix(struct Crossfade * fade, int16_t * out, const int16_t * in, uint32_t num_frames);
+
+#endif	/* CROSSFADE_H */
+
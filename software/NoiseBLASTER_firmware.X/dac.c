@@ -8,16 +8,47 @@
 #include <plib.h>
 #include "dac.h"
 #include "i2c.h"
+#include "sysclk.h"
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 uint8_t current_volume;
 
+/*
+ * Every sample rate the DAC can be clocked for
+ * 
+ * The 44.1KHz family runs straight off the 16.9344MHz crystal (384fs), which
+ * is exact. There's no crystal for the 48KHz family, so REFCLKO's fractional
+ * divider makes 12.2893MHz (256fs) out of SYSCLK, which plays 108ppm fast.
+ * The rates the DAC has no setting for are made by halving its MCLK (CLKIN).
+ */
+static const struct DacClockPlan dac_clock_plans[] = {
+    //  fs     REFCLKO source   div  trim  BRG  CLKIN   SR    BOSR          de-emphasis
+    {  8000, DAC_REFO_SYSCLK,   1,  414,  23, DAC_RATE_BITS(0, 0x3, 0), DAC_DEEMPHASIS_NONE },
+    { 16000, DAC_REFO_SYSCLK,   1,  414,  11, DAC_RATE_BITS(1, 0x6, 0), DAC_DEEMPHASIS_NONE },
+    { 22050, DAC_REFO_POSC,     0,    0,  11, DAC_RATE_BITS(1, 0x8, 1), DAC_DEEMPHASIS_NONE },
+    { 24000, DAC_REFO_SYSCLK,   1,  414,   7, DAC_RATE_BITS(1, 0x0, 0), DAC_DEEMPHASIS_NONE },
+    { 32000, DAC_REFO_SYSCLK,   1,  414,   5, DAC_RATE_BITS(0, 0x6, 0), DAC_DEEMPHASIS_32K },
+    { 44100, DAC_REFO_POSC,     0,    0,   5, DAC_RATE_BITS(0, 0x8, 1), DAC_DEEMPHASIS_44K1 },
+    { 48000, DAC_REFO_SYSCLK,   1,  414,   3, DAC_RATE_BITS(0, 0x0, 0), DAC_DEEMPHASIS_48K },
+    { 88200, DAC_REFO_POSC,     0,    0,   2, DAC_RATE_BITS(0, 0xF, 1), DAC_DEEMPHASIS_NONE },
+    { 96000, DAC_REFO_SYSCLK,   1,  414,   1, DAC_RATE_BITS(0, 0x7, 0), DAC_DEEMPHASIS_NONE },
+};
+
+// What the DAC and SPI1 are clocked for right now
+static const struct DacClockPlan * dac_plan = NULL;
+static bool dac_muted = false;
+
+static void DAC_ApplyClockPlan(const struct DacClockPlan * plan);
+
 /**
  * Initialize the DAC
  */
 void InitDAC()
 {
+    dac_plan = DAC_FindClockPlan(DAC_DEFAULT_SAMPLE_RATE);
+    
     InitI2C();
     DAC_Reset();
     DAC_LineInMuteControl(1); //Line in muted
@@ -26,7 +57,7 @@ void InitDAC()
     DAC_DigitalControl(0); //Digital mute off
     DAC_PowerDownControl(0, 0, 1, 0, 0, 1);// Power on, clock on, oscillator off, outputs on, dac on, line in off
     DAC_DigitalAudioInterface(0, 0, 0); //Slave, lr_swap off, lrp... check lrp, function default 16 bit and i2s
-    DAC_SampleRateControl(0, 0); //No Dividers
+    DAC_SampleRateControl(0, dac_plan->rate_bits); //44.1 kHz until a track says otherwise
     DAC_Digital_Interface_Activation(1);    // Activate the digital interface
     
     //DAC should be fully configured now
@@ -39,33 +70,134 @@ void InitDAC()
  */
 void InitI2S()
 {
-    // Set up the REFCLKO
-    REFOCONbits.ROSEL = 2;  // Based off of primary oscillator
-    REFOTRIMbits.ROTRIM = 256;  // This will make a divisor of 1, aka, no divisor
-    REFOCONbits.DIVSWEN = 1;    // Switch to the new trim value
-    REFOCONbits.OE = 1;
-    REFOCONbits.ON = 1;
-    
     // Reset everything
     SPI1CONbits.ON = 0;
     SPI1CON2 = 0;
     SPI1BRG = 0;
     
     // Setup SPI1
-    int rData = SPI1BUF;        // Clear out the receive buffer
+    (void)SPI1BUF;              // Clear out the receive buffer
     SPI1CONbits.ENHBUF = 1;     // We want a FIFO buffer
     SPI1CONbits.MCLKSEL = 1;    // Use REFCLK for BCLK (SCK) generation
     SPI1STATbits.SPIROV = 0;    // Clear overflow bit
     SPI1CON2bits.AUDMOD = 0;    // I2S mode
     SPI1CON2bits.AUDEN = 1;     // Enable the Audio mode
     SPI1CON2bits.AUDMONO = 0;
-    SPI1BRG = 5;                // 1.4112MHz BCLK (44.1KHz * 16bits * 2)
     SPI1CONbits.STXISEL = 3;    // Trigger an interrupt when FIFO isn't full
     SPI1CONbits.MSTEN = 1;      // Master Mode
     SPI1CONbits.CKP = 1;        // Need this for I2S mode
     SPI1CONbits.MODE16 = 0;     // Need this for I2S mode
     SPI1CONbits.MODE32 = 0;     // Need this for I2S mode
-    SPI1CONbits.ON = 1;         // Start transmitting
+    
+    // Set up REFCLKO and BCLK, then start transmitting
+    DAC_ApplyClockPlan(dac_plan);
+}
+
+/**
+ * Switches REFCLKO and SPI1's BCLK over to a clock plan
+ * 
+ * SPI1 is stopped while REFCLKO changes so it never sees a half switched
+ * clock, and is started again afterwards.
+ * 
+ * @param plan The plan to switch to
+ */
+static void DAC_ApplyClockPlan(const struct DacClockPlan * plan)
+{
+    SPI1CONbits.ON = 0;
+    
+    // The source can only be changed while REFCLKO is off and has stopped
+    REFOCONbits.ON = 0;
+    while(REFOCONbits.ACTIVE);
+    
+    REFOCONbits.ROSEL = plan->refo_source;
+    REFOCONbits.RODIV = plan->refo_div;
+    REFOTRIMbits.ROTRIM = plan->refo_trim;
+    REFOCONbits.OE = 1;
+    REFOCONbits.ON = 1;
+    REFOCONbits.DIVSWEN = 1;    // Switch to the new divisor and trim value
+    while(REFOCONbits.DIVSWEN);
+    
+    SPI1BRG = plan->spi_brg;
+    SPI1CONbits.ON = 1;
+}
+
+/**
+ * Looks up how to clock the DAC for a sample rate
+ * 
+ * @param sample_rate The rate in Hz
+ * 
+ * @return The clock plan, or NULL if the DAC can't be clocked for the rate
+ */
+const struct DacClockPlan * DAC_FindClockPlan(uint32_t sample_rate)
+{
+    unsigned int i;
+    
+    for(i = 0; i < sizeof(dac_clock_plans) / sizeof(dac_clock_plans[0]); i++)
+    {
+        if(dac_clock_plans[i].sample_rate == sample_rate)
+            return &dac_clock_plans[i];
+    }
+    
+    return NULL;
+}
+
+/**
+ * Finds the rate to resample a track to when the DAC can't play it as it is
+ * 
+ * That's the lowest rate at or above the track's, so nothing is lost off the
+ * top, or the highest rate there is for tracks above all of them.
+ * 
+ * @param sample_rate The track's rate in Hz
+ * 
+ * @return A rate there's a clock plan for
+ */
+uint32_t DAC_ClosestSampleRate(uint32_t sample_rate)
+{
+    unsigned int i;
+    
+    // The plans are in order of rate
+    for(i = 0; i < sizeof(dac_clock_plans) / sizeof(dac_clock_plans[0]); i++)
+    {
+        if(dac_clock_plans[i].sample_rate >= sample_rate)
+            return dac_clock_plans[i].sample_rate;
+    }
+    
+    return dac_clock_plans[i - 1].sample_rate;
+}
+
+/**
+ * Reclocks REFCLKO, SPI1 and the DAC for a new sample rate
+ * 
+ * Nothing is touched if the rate isn't changing. Otherwise the DAC is muted
+ * and its digital interface stopped only while everything is reprogrammed,
+ * then put back how it was.
+ * 
+ * @param sample_rate The rate in Hz
+ * 
+ * @return False if there's no clock plan for the rate (nothing is changed)
+ */
+bool DAC_SetSampleRate(uint32_t sample_rate)
+{
+    const struct DacClockPlan * plan = DAC_FindClockPlan(sample_rate);
+    bool was_muted = dac_muted;
+    
+    if(plan == NULL)
+        return false;
+    
+    if(plan == dac_plan)
+        return true;
+    
+    DAC_DigitalControl(true);
+    DAC_Digital_Interface_Activation(0);
+    
+    DAC_ApplyClockPlan(plan);
+    dac_plan = plan;
+    DAC_SampleRateControl(0, plan->rate_bits);
+    
+    DAC_Digital_Interface_Activation(1);
+    DAC_DigitalControl(was_muted);
+    
+    return true;
 }
 
 /**
@@ -123,12 +255,14 @@ void DAC_AnalogControl(bool DAC_select, bool bypass)
 /**
  * Writes to the digital control register
  * 
+ * De-emphasis is set for the current sample rate.
+ * 
  * @param DAC_mute Set true to digitally mute the DAC
  */
-//HARDCODED 44.1 kHz
 void DAC_DigitalControl(bool DAC_mute)
 {
-    DAC_Write(Digital_Path_Control, (DAC_mute << 3) | (1 << 2) );
+    DAC_Write(Digital_Path_Control, (DAC_mute << 3) | (dac_plan->deemphasis << 1) );
+    dac_muted = DAC_mute;
 }
 
 /**
@@ -163,12 +297,12 @@ void DAC_DigitalAudioInterface(bool master, bool lr_swap, bool lrp)
  * Writes to the sample rate control register
  * 
  * @param clock_out_div Set to true to turn on the clock output divider
- * @param clock_in_div Set to true to turn on the clock input divider
+ * @param rate_bits The clock input divider, SR and BOSR bits (DAC_RATE_BITS)
  */
-//HARDCODED normal mode, 384 fs, 16.9344 MHz, 44.1 kHz, clk_in_div should be 0
-void DAC_SampleRateControl(bool clk_out_div, bool clk_in_div)
+//HARDCODED normal mode
+void DAC_SampleRateControl(bool clk_out_div, uint8_t rate_bits)
 {
-    DAC_Write(Sample_Rate_Control, clk_out_div << 7 | clk_in_div << 6 | 1 << 5 | 1 << 1);
+    DAC_Write(Sample_Rate_Control, clk_out_div << 7 | (rate_bits & 0x7E));
 }
 
 /**
@@ -9,6 +9,7 @@
 #define	DAC_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 //TLV320DAC23 With CSn pulled low in I2C Mode
 #define DAC_Address 0x34 //0x1A << 1
@@ -26,6 +27,35 @@
 #define Digital_Interface_Activation 0x09
 #define Reset_Register 0x0A
 
+// Sample rate control register: CLKIN halves MCLK, SR picks the rate, BOSR is 384fs (272fs USB)
+#define DAC_RATE_BITS(clkin, sr, bosr) (((clkin) << 6) | ((sr) << 2) | ((bosr) << 1))
+
+// Digital path de-emphasis (DEEMP bits)
+#define DAC_DEEMPHASIS_NONE 0
+#define DAC_DEEMPHASIS_32K 1
+#define DAC_DEEMPHASIS_44K1 2
+#define DAC_DEEMPHASIS_48K 3
+
+// REFCLKO sources (ROSEL)
+#define DAC_REFO_SYSCLK 0
+#define DAC_REFO_POSC 2
+
+#define DAC_DEFAULT_SAMPLE_RATE 44100
+
+// How to clock the DAC and the I2S module (SPI1) for one sample rate
+// REFCLKO is both the DAC's MCLK and what SPI1 makes BCLK from:
+//   REFCLKO = source / (2 * (refo_div + refo_trim / 512)), or the source itself when refo_div is zero
+//   BCLK = REFCLKO / (2 * (spi_brg + 1)) = 32 * fs (16 bit stereo)
+struct DacClockPlan {
+    uint32_t sample_rate;
+    uint8_t refo_source;
+    uint16_t refo_div;
+    uint16_t refo_trim;
+    uint8_t spi_brg;
+    uint8_t rate_bits;      // For the sample rate control register
+    uint8_t deemphasis;
+};
+
 // Function Prototypes
 void InitDAC();
 void InitI2S();
@@ -36,9 +66,12 @@ void DAC_AnalogControl(bool DAC_select, bool bypass);
 void DAC_DigitalControl(bool DAC_mute);
 void DAC_PowerDownControl(bool DAC_power, bool DAC_clk, bool DAC_osc, bool DAC_out, bool DAC_dac, bool DAC_line_in);
 void DAC_DigitalAudioInterface(bool master, bool lr_swap, bool lrp);
-void DAC_SampleRateControl(bool clk_out_div, bool clk_in_div);
+void DAC_SampleRateControl(bool clk_out_div, uint8_t rate_bits);
 void DAC_Digital_Interface_Activation(bool on);
 void DAC_Reset();
+const struct DacClockPlan * DAC_FindClockPlan(uint32_t sample_rate);
+bool DAC_SetSampleRate(uint32_t sample_rate);
+uint32_t DAC_ClosestSampleRate(uint32_t sample_rate);
 
 // Volume Control Helper Functions
 void DAC_VolumeUP();
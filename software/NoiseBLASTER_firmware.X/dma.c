@@ -8,18 +8,13 @@
 #include "sd.h"
 #include "uart.h"
 #include "timer.h"
+#include "audio.h"
 
-// Which buffer that was just sent out
-enum buffer_type { FRONT, BACK };
-extern volatile enum buffer_type cur_buffer;
+// Nothing new is sent while paused
+extern volatile bool playing;
 
-// Flags to tell main thread to update data
-extern volatile bool frontbuffer_done_sending;
-extern volatile bool backbuffer_done_sending;
-
-// Buffers to store audio data
-extern int16_t frontbuffer[SECTOR_SIZE];
-extern int16_t backbuffer[SECTOR_SIZE];
+// Sent whenever there's no block ready (the DMA can read it from flash)
+static const AudioFrame audio_silence[AUDIO_BLOCK_FRAMES];
 
 /**
  * Initialize the DMA
@@ -33,9 +28,9 @@ void InitDMA(void)
     
     DMACONSET = 0x8000;     // Enable the DMA controller
     
-    DCH0SSA = KVA_TO_PA(frontbuffer);  // Source address is front buffer for audio
+    DCH0SSA = KVA_TO_PA(audio_silence);  // Source address is silence until the first block is ready
     DCH0DSA = KVA_TO_PA(&SPI1BUF);   // Destination is SPI1 transmit register
-    DCH0SSIZ = 512;   // Size of buffer
+    DCH0SSIZ = sizeof(audio_silence);   // Size of a block
     DCH0DSIZ = 2;   // Size of SPI transmit register (16-bit mode)
     DCH0CSIZ = 2;   // Two bytes per SPI transfer request
 
@@ -64,22 +59,27 @@ void DmaCh0Int(void)
     DmaChnClrIntFlag(0);
     DCH0INTCLR = 0x8;   // Clear block transfer complete interrupt
     
-    // If we just sent the front buffer, notify main thread
-    if(cur_buffer == FRONT)
+    // The block that just went out can be refilled
+    if(audio_ring.sending)
     {
-        // Start sending backbuffer
-        DCH0SSA = KVA_TO_PA(backbuffer);
-        cur_buffer = BACK;
-        
-        frontbuffer_done_sending = true;
+        audio_ring.tail++;
+    }
+    
+    // Start sending the next block, or silence if the main loop has fallen behind
+    if(playing && audio_ring.head != audio_ring.tail)
+    {
+        DCH0SSA = KVA_TO_PA(audio_ring.blocks[audio_ring.tail & AUDIO_RING_MASK]);
+        audio_ring.sending = true;
     }
     else
     {
-        // Start sending frontbuffer
-        DCH0SSA = KVA_TO_PA(frontbuffer);
-        cur_buffer = FRONT;
+        DCH0SSA = KVA_TO_PA(audio_silence);
+        audio_ring.sending = false;
         
-        backbuffer_done_sending = true;
+        if(playing)
+        {
+            audio_ring.underruns++;
+        }
     }
 
     // Re-enable the channel, a start IRQ will trigger a transfer
@@ -1,10 +1,52 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "fat.h"
 #include "sd.h"
 
+// Number of FAT entries in one FAT sector
+#define FAT16_ENTRIES_PER_SECTOR (SECTOR_SIZE / 2)
+#define FAT32_ENTRIES_PER_SECTOR (SECTOR_SIZE / 4)
+
+// exFAT FAT entries at or above this are bad clusters or the end of a chain
+#define EXFAT_BAD_CLUSTER 0xFFFFFFF7
+
+// Volumes with fewer clusters than this are FAT16 (or FAT12), more is FAT32
+#define FAT16_MAX_CLUSTERS 65525
+
+// Volumes with fewer clusters than this are FAT12, which isn't supported
+#define FAT12_MAX_CLUSTERS 4085
+
+// Window of whole FAT sectors used to follow cluster chains, tagged by sector
+// number (zero means the slot is empty, the MBR is never part of a FAT)
+static uint8_t fat_window[FAT_WINDOW_SECTORS][SECTOR_SIZE];
+static uint32_t fat_window_sector[FAT_WINDOW_SECTORS];
+static uint32_t fat_window_last_used[FAT_WINDOW_SECTORS];
+static uint32_t fat_window_tick = 0;
+
 // Function prototypes
 static enum FatFileType GetFileType(unsigned char first);
+static uint8_t * Fat_WindowLookup(uint32_t sector_num);
+static bool IsRegularEntry(struct Fat16Entry * entry);
+static bool IsSubdirEntry(struct Fat16Entry * entry);
+static bool IsContiguousEntry(struct FatPartition * fat, struct Fat16Entry * entry);
+static bool Fat_ReadBootSector(struct FatPartition * fat);
+static bool Fat_ReadExFatBootSector(struct FatPartition * fat);
+static void Fat_ReadFsInfo(struct FatPartition * fat);
+static struct Fat16Entry * Fat_NextSlot(struct FatDirIter * dir);
+static struct Fat16Entry * Fat_NextExFatEntry(struct FatDirIter * dir);
+static void Fat_TranslateStream(struct Fat16Entry * entry, struct ExFatStreamEntry * stream);
+static uint32_t Fat_FindFreeRun(struct FatPartition * fat, uint32_t num_clusters);
+static bool Fat_WriteChain(struct FatPartition * fat, uint32_t first, uint32_t num_clusters);
+static bool Fat_FreeChain(struct FatPartition * fat, uint32_t cluster);
+static bool Fat_WriteFsInfo(struct FatPartition * fat);
+static uint32_t Fat_ReadFatEntry(struct FatPartition * fat, uint32_t cluster);
+static uint32_t Fat_DecodeFatEntry(struct FatPartition * fat, uint8_t * sector, uint32_t index);
+static uint32_t Fat_NextCluster(struct FatFile * file);
+static uint32_t Fat_RunLeft(struct FatFile * file);
+static void Fat_BuildExtents(struct FatFile * file, bool contiguous);
+static void Fat_WalkChain(struct FatFile * file, uint32_t until, uint32_t max_sectors);
+static void Fat_SeekCluster(struct FatFile * file, uint32_t target);
 
 #define HAS_MBR
 bool OpenFirstFatPartition(struct FatPartition * fat)
@@ -17,103 +59,682 @@ bool OpenFirstFatPartition(struct FatPartition * fat)
     
     int i = 0;
     // Read the partition tables from the MBR
-    SD_ReadData(tables, 0x1BE, sizeof(struct PartitionTable) * MAX_MBR_PARTITIONS);
+    SD_ReadCached(tables, 0x1BE, sizeof(struct PartitionTable) * MAX_MBR_PARTITIONS);
 
     for(i = 0; i < MAX_MBR_PARTITIONS && !found_fat_partition; ++i) {
-        // If it's one of the FAT16 partition types, start filling it with data
-        if (tables[i].partition_type == 4 || tables[i].partition_type == 6 || tables[i].partition_type == 14) {
-            found_fat_partition = true;
+        // If it's one of the FAT16, FAT32 or exFAT partition types, start filling it with data
+        // (exFAT shares its type with NTFS, so the boot sector has the final say)
+        if (tables[i].partition_type == 4 || tables[i].partition_type == 6 || tables[i].partition_type == 14 ||
+                tables[i].partition_type == 11 || tables[i].partition_type == 12 || tables[i].partition_type == 7) {
             fat->start_sector = tables[i].start_sector;
             fat->partition_type = tables[i].partition_type;
-
-            // Read boot sector then calculate helper values
-            SD_ReadData(&(fat->boot), SECTOR_SIZE * fat->start_sector, sizeof(struct Fat16BootSector));
-            fat->cluster_size = fat->boot.num_sectors_per_cluster * fat->boot.sector_size;
-            fat->fat_start = fat->boot.sector_size * (fat->boot.reserved_sectors + fat->start_sector);
-            fat->root_start = fat->fat_start + (fat->boot.sector_size * (fat->boot.fat_num_sectors * fat->boot.num_fats));
-            fat->data_start = fat->root_start + (uint32_t)(fat->boot.num_root_entries * sizeof(struct Fat16Entry));
+            found_fat_partition = Fat_ReadBootSector(fat);
         }
     }
 #else
-    // If the SD Card starts off with a boot sector instead of MBR, assume it's FAT16
-    found_fat_partition = true;
+    // If the SD Card starts off with a boot sector instead of MBR, the boot
+    // sector itself tells us whether it's FAT16, FAT32 or exFAT
     fat->start_sector = 0;
-    fat->partition_type = 6;    // Assuming Fat16
-
-    // Read boot sector then calculate helper values
-    SD_ReadData(&(fat->boot), 0, sizeof(struct Fat16BootSector));
-    fat->cluster_size = fat->boot.num_sectors_per_cluster * fat->boot.sector_size;
-    fat->fat_start = fat->boot.sector_size * (fat->boot.reserved_sectors + fat->start_sector);
-    fat->root_start = fat->fat_start + (fat->boot.sector_size * (fat->boot.fat_num_sectors * fat->boot.num_fats));
-    fat->data_start = fat->root_start + (uint32_t)(fat->boot.num_root_entries * sizeof(struct Fat16Entry));
+    fat->partition_type = 6;    // Assuming Fat16 until the boot sector says otherwise
+    found_fat_partition = Fat_ReadBootSector(fat);
+    if(fat->fs_type == FAT_FS_FAT32)
+        fat->partition_type = 12;
+    else if(fat->fs_type == FAT_FS_EXFAT)
+        fat->partition_type = 7;
 #endif
     
     return found_fat_partition;
 }
 
-uint16_t GetFilesByExt(struct FatPartition * fat, struct FatFile * files, uint16_t num_files, char * ext)
+/**
+ * Reads the boot sector of a partition and calculates the helper values
+ * 
+ * The FAT type is decided by the number of data clusters (like every other
+ * FAT driver does), not by the partition type or the label in the boot sector.
+ * exFAT is recognised by its OEM name.
+ * 
+ * @param fat The partition to read, start_sector and partition_type must be set
+ * 
+ * @return False if the partition isn't a filesystem we can read (including
+ *         FAT12 and sector sizes other than SECTOR_SIZE)
+ */
+static bool Fat_ReadBootSector(struct FatPartition * fat)
 {
-    struct Fat16Entry entry;
-    unsigned int i = 0;
+    uint32_t fat_num_sectors, total_sectors, root_sectors, data_sectors;
+    uint64_t overhead;
+
+    SD_ReadCached(&(fat->boot), (uint64_t)SECTOR_SIZE * fat->start_sector, sizeof(struct Fat32BootSector));
+
+    if(strncmp(fat->exboot.oem, "EXFAT   ", 8) == 0)
+        return Fat_ReadExFatBootSector(fat);
+
+    // Anything else with the exFAT partition type is NTFS
+    if(fat->partition_type == 7)
+        return false;
+
+    // Everything else is addressed in SECTOR_SIZE units, so a zeroed or
+    // foreign boot sector stops here rather than dividing by zero below
+    if(fat->boot.sector_size != SECTOR_SIZE || fat->boot.num_sectors_per_cluster == 0 || fat->boot.num_fats == 0)
+        return false;
+
+    // FAT32 leaves the 16-bit fields zero and uses the 32-bit ones instead
+    fat_num_sectors = (fat->boot.fat_num_sectors != 0) ? fat->boot.fat_num_sectors : fat->boot32.fat_num_sectors;
+    total_sectors = (fat->boot.total_sectors_short != 0) ? fat->boot.total_sectors_short : fat->boot.total_num_sectors;
+    root_sectors = (fat->boot.num_root_entries * sizeof(struct Fat16Entry) + fat->boot.sector_size - 1) / fat->boot.sector_size;
+    overhead = fat->boot.reserved_sectors + ((uint64_t)fat->boot.num_fats * fat_num_sectors) + root_sectors;
+    if(fat_num_sectors == 0 || overhead >= total_sectors)
+        return false;
+    data_sectors = total_sectors - (uint32_t)overhead;
+
+    fat->cluster_size = fat->boot.num_sectors_per_cluster * fat->boot.sector_size;
+    fat->cluster_sectors = fat->boot.num_sectors_per_cluster;
+    fat->fat_num_sectors = fat_num_sectors;
+    fat->num_clusters = data_sectors / fat->boot.num_sectors_per_cluster;
+    fat->fat_start = (uint64_t)fat->boot.sector_size * (fat->boot.reserved_sectors + fat->start_sector);
+    fat->root_start = fat->fat_start + ((uint64_t)fat->boot.sector_size * fat_num_sectors * fat->boot.num_fats);
+    fat->data_start = fat->root_start + ((uint64_t)root_sectors * fat->boot.sector_size);
+    fat->free_clusters = 0xFFFFFFFF;
+    fat->next_free = 0xFFFFFFFF;
+
+    // FAT12 packs entries into 12 bits, which the chain walker can't follow
+    if(fat->num_clusters < FAT12_MAX_CLUSTERS)
+        return false;
+
+    if(fat->num_clusters < FAT16_MAX_CLUSTERS)
+    {
+        fat->fs_type = FAT_FS_FAT16;
+        fat->root_cluster = 0;
+    }
+    else
+    {
+        fat->fs_type = FAT_FS_FAT32;
+        fat->root_cluster = fat->boot32.root_cluster;
+        if(fat->root_cluster < 2 || fat->root_cluster >= fat->num_clusters + 2)
+            return false;
+        Fat_ReadFsInfo(fat);
+    }
+
+    return true;
+}
+
+/**
+ * Calculates the helper values for an exFAT partition from its boot sector
+ * 
+ * @param fat The partition, with the boot sector already read in
+ * 
+ * @return False if the sector size isn't one we can handle
+ */
+static bool Fat_ReadExFatBootSector(struct FatPartition * fat)
+{
+    if(fat->exboot.bytes_per_sector_shift != 9 || fat->exboot.sectors_per_cluster_shift > 16)
+        return false;
+
+    fat->fs_type = FAT_FS_EXFAT;
+    fat->cluster_sectors = 1 << fat->exboot.sectors_per_cluster_shift;
+    fat->cluster_size = fat->cluster_sectors * SECTOR_SIZE;
+    fat->fat_num_sectors = fat->exboot.fat_length;
+    fat->num_clusters = fat->exboot.cluster_count;
+    fat->root_cluster = fat->exboot.root_cluster;
+    fat->fat_start = (uint64_t)SECTOR_SIZE * (fat->start_sector + fat->exboot.fat_offset);
+    fat->data_start = (uint64_t)SECTOR_SIZE * (fat->start_sector + fat->exboot.cluster_heap_offset);
+    fat->root_start = fat->data_start;  // The root directory is a cluster chain
+    fat->free_clusters = 0xFFFFFFFF;
+    fat->next_free = 0xFFFFFFFF;
+
+    return true;
+}
+
+/**
+ * Reads the free cluster hints out of a FAT32 FSInfo sector
+ * 
+ * The hints are left as unknown (0xFFFFFFFF) if the sector doesn't have
+ * valid signatures.
+ * 
+ * @param fat The FAT32 partition to read the FSInfo sector of
+ */
+static void Fat_ReadFsInfo(struct FatPartition * fat)
+{
+    struct FatFsInfo info;
+
+    if(fat->boot32.fsinfo_sector == 0 || fat->boot32.fsinfo_sector == 0xFFFF)
+        return;
+
+    SD_ReadCached(&info, (uint64_t)SECTOR_SIZE * (fat->start_sector + fat->boot32.fsinfo_sector), sizeof(struct FatFsInfo));
+
+    if(info.lead_sig == FAT_FSINFO_LEAD_SIG && info.struct_sig == FAT_FSINFO_STRUCT_SIG)
+    {
+        fat->free_clusters = info.free_count;
+        fat->next_free = info.next_free;
+    }
+}
+
+/**
+ * Finds every regular file in the root directory and its subdirectories with
+ * one of the given extensions and records where its entry is in the catalog
+ * 
+ * Directories are walked depth first without recursion: entering a
+ * subdirectory pushes the parent's position onto a FAT_MAX_DEPTH deep stack
+ * and one sector buffer is shared by every level. Anything deeper than that
+ * is skipped. Each directory sector is read once (plus once more when coming
+ * back up to it) and all of its entries are checked against every
+ * extension. Files aren't opened here, use Fat_OpenCatalogEntry when one is
+ * needed.
+ * 
+ * @param fat The partition to search
+ * @param catalog Where to store the location of each file found
+ * @param num_files The maximum number of files to find
+ * @param exts The extensions to look for (three characters each, e.g. "WAV")
+ * @param num_exts How many extensions are in exts
+ * 
+ * @return The number of files found
+ */
+uint16_t GetFilesByExt(struct FatPartition * fat, FatCatalogEntry * catalog, uint16_t num_files, char * exts[], uint8_t num_exts)
+{
+    struct FatDirIter dir;
+    struct FatDirPos stack[FAT_MAX_DEPTH];  // Where to carry on in each parent directory
+    struct Fat16Entry * entry;
     uint16_t num_found = 0;
+    uint8_t depth = 0;
+    uint8_t i;
+
+    Fat_OpenRoot(fat, &dir);
 
-    // Loop through every root file entry looking for matching extension
-    for(i = 0; i < fat->boot.num_root_entries && num_found < num_files; ++i)
+    while(num_found < num_files)
     {
-        SD_ReadData(&entry, fat->root_start + (uint32_t)(i * sizeof(struct Fat16Entry)), sizeof(struct Fat16Entry));
-        if(strncmp(ext, entry.ext, 3) == 0 && GetFileType((unsigned char)entry.filename[0]) == FAT_TYPE_REGULAR)
+        // Done with this directory, go back up to where we left the parent
+        if((entry = Fat_NextEntry(&dir)) == NULL)
+        {
+            if(depth == 0)
+                break;
+
+            Fat_ResumeDir(&dir, &stack[--depth]);
+            continue;
+        }
+
+        if(IsSubdirEntry(entry))
+        {
+            if(depth < FAT_MAX_DEPTH)
+            {
+                stack[depth++] = dir.pos;
+                Fat_OpenSubdir(fat, &dir, entry);
+            }
+            continue;
+        }
+
+        if(!IsRegularEntry(entry) || FAT_DIR_LOCATION(&dir) == 0)
+            continue;
+
+        for(i = 0; i < num_exts; ++i)
         {
-            Fat_open(fat, &(files[num_found]), entry.filename, entry.ext);
-            num_found++;
+            if(strncmp(exts[i], entry->ext, 3) == 0)
+            {
+                catalog[num_found] = FAT_DIR_LOCATION(&dir);
+                num_found++;
+                break;
+            }
         }
     }
 
     return num_found;
 }
 
+/**
+ * Checksums every entry of every directory GetFilesByExt looks through
+ * 
+ * The directories are walked the same way, so this reads the same sectors
+ * as a scan does, but nothing is matched or opened. Adding, removing,
+ * renaming or moving a file (or rewriting it, which changes its size, first
+ * cluster or time stamps) changes the checksum.
+ * 
+ * @param fat The partition to walk
+ * @param sum The checksum to add to
+ * 
+ * @return The new checksum
+ */
+uint32_t Fat_TreeChecksum(struct FatPartition * fat, uint32_t sum)
+{
+    struct FatDirIter dir;
+    struct FatDirPos stack[FAT_MAX_DEPTH];
+    struct Fat16Entry * entry;
+    uint8_t depth = 0;
+    uint8_t i;
+
+    Fat_OpenRoot(fat, &dir);
+
+    while(true)
+    {
+        if((entry = Fat_NextEntry(&dir)) == NULL)
+        {
+            if(depth == 0)
+                break;
+
+            Fat_ResumeDir(&dir, &stack[--depth]);
+            continue;
+        }
+
+        for(i = 0; i < sizeof(struct Fat16Entry); ++i)
+            sum = ((sum << 5) | (sum >> 27)) + ((uint8_t *)entry)[i];
+
+        if(IsSubdirEntry(entry) && depth < FAT_MAX_DEPTH)
+        {
+            stack[depth++] = dir.pos;
+            Fat_OpenSubdir(fat, &dir, entry);
+        }
+    }
+
+    return sum;
+}
+
 bool Fat_open(struct FatPartition * fat, struct FatFile * file, char * filename, char * ext)
 {
-    struct Fat16Entry entry;
-    unsigned int i = 0;
-    bool found_file = false;
+    struct FatDirIter dir;
+    struct Fat16Entry * entry;
+
+    Fat_OpenRoot(fat, &dir);
 
     // Read through and try to find the file
-    for(i = 0; i < fat->boot.num_root_entries && !found_file; ++i)
+    while((entry = Fat_NextEntry(&dir)) != NULL)
     {
-        SD_ReadData(&entry, fat->root_start + (uint32_t)(i * sizeof(struct Fat16Entry)), sizeof(struct Fat16Entry));
-
         // Check if filename and extension match and if so, grab data
-        if(strncmp(ext, entry.ext, 3) == 0 && strncmp(filename, entry.filename, 8) == 0 &&
-                GetFileType((unsigned char)entry.filename[0]) == FAT_TYPE_REGULAR)
+        if(IsRegularEntry(entry) && strncmp(ext, entry->ext, 3) == 0 && strncmp(filename, entry->filename, 8) == 0)
+        {
+            Fat_OpenEntry(fat, file, entry);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Reopens a file recorded in the catalog
+ * 
+ * On exFAT only the Stream Extension entry is read back, so the file's name
+ * is left blank.
+ * 
+ * @param fat The partition the file is in
+ * @param file The file to fill in
+ * @param location Where the file's directory entry is (from GetFilesByExt)
+ */
+void Fat_OpenCatalogEntry(struct FatPartition * fat, struct FatFile * file, FatCatalogEntry location)
+{
+    struct Fat16Entry entry;
+
+    Fat_ReadCatalogEntry(fat, location, &entry);
+    Fat_OpenEntry(fat, file, &entry);
+}
+
+/**
+ * Reads the directory entry a catalog entry points at
+ * 
+ * On exFAT it's the Stream Extension entry, translated into a FAT entry
+ * with a blank name.
+ * 
+ * @param fat The partition the file is in
+ * @param location Where the file's directory entry is (from GetFilesByExt)
+ * @param entry Where to put the entry
+ */
+void Fat_ReadCatalogEntry(struct FatPartition * fat, FatCatalogEntry location, struct Fat16Entry * entry)
+{
+    struct ExFatStreamEntry stream;
+    uint64_t address = ((uint64_t)(fat->start_sector + FAT_CATALOG_SECTOR(location)) * SECTOR_SIZE) +
+            (FAT_CATALOG_INDEX(location) * sizeof(struct Fat16Entry));
+
+    if(fat->fs_type == FAT_FS_EXFAT)
+    {
+        SD_ReadCached(&stream, address, sizeof(struct ExFatStreamEntry));
+        Fat_TranslateStream(entry, &stream);
+    }
+    else
+        SD_ReadCached(entry, address, sizeof(struct Fat16Entry));
+}
+
+/**
+ * Gets the first cluster of a directory entry
+ * 
+ * @param fat The partition the entry is in
+ * @param entry The entry
+ * 
+ * @return The first cluster (the top half only counts on FAT32 and exFAT)
+ */
+uint32_t Fat_EntryCluster(struct FatPartition * fat, struct Fat16Entry * entry)
+{
+    uint32_t cluster = entry->starting_cluster;
+
+    if(fat->fs_type != FAT_FS_FAT16)
+        cluster |= (uint32_t)entry->starting_cluster_high << 16;
+
+    return cluster;
+}
+
+/**
+ * Opens a file from its directory entry
+ * 
+ * @param fat The partition the file is in
+ * @param file The file to fill in
+ * @param entry The file's directory entry
+ */
+void Fat_OpenEntry(struct FatPartition * fat, struct FatFile * file, struct Fat16Entry * entry)
+{
+    strncpy(file->filename, entry->filename, 8);
+    strncpy(file->ext, entry->ext, 3);
+    file->filesize = entry->filesize;
+    file->starting_cluster = Fat_EntryCluster(fat, entry);
+    file->cur_cluster = file->starting_cluster;
+    file->num_clusters = 0;
+    file->cur_pos = 0;
+    file->part = fat;
+    file->type = GetFileType((unsigned char)file->filename[0]);
+    Fat_BuildExtents(file, IsContiguousEntry(fat, entry));
+}
+
+/**
+ * Starts iterating through the entries in the root directory
+ * 
+ * On FAT16 the root directory is a fixed region in front of the data
+ * section, on FAT32 and exFAT it's a cluster chain like any other directory.
+ * 
+ * @param fat The partition to read the root directory of
+ * @param dir The iterator to set up
+ */
+void Fat_OpenRoot(struct FatPartition * fat, struct FatDirIter * dir)
+{
+    if(fat->fs_type != FAT_FS_FAT16)
+    {
+        Fat_OpenDir(fat, dir, fat->root_cluster);
+        return;
+    }
+
+    dir->part = fat;
+    dir->pos.cluster = 0;
+    dir->pos.sector = SECTOR_NUM(fat->root_start);
+    dir->pos.sectors_left = (fat->boot.num_root_entries * sizeof(struct Fat16Entry) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    dir->pos.clusters_left = FAT_DIR_CHAINED;
+    dir->pos.index = FAT_ENTRIES_PER_SECTOR;    // Forces the first sector to be read
+}
+
+/**
+ * Starts iterating through the entries in a directory stored in clusters
+ * 
+ * @param fat The partition the directory is in
+ * @param dir The iterator to set up
+ * @param cluster The first cluster of the directory
+ */
+void Fat_OpenDir(struct FatPartition * fat, struct FatDirIter * dir, uint32_t cluster)
+{
+    dir->part = fat;
+    dir->pos.cluster = cluster;
+    dir->pos.sector = Fat_ClusterSector(fat, cluster);
+    dir->pos.sectors_left = fat->cluster_sectors;
+    dir->pos.clusters_left = FAT_DIR_CHAINED;
+    dir->pos.index = FAT_ENTRIES_PER_SECTOR;    // Forces the first sector to be read
+}
+
+/**
+ * Starts iterating through a subdirectory from its directory entry
+ * 
+ * @param fat The partition the directory is in
+ * @param dir The iterator to set up
+ * @param entry The subdirectory's entry (from Fat_NextEntry)
+ */
+void Fat_OpenSubdir(struct FatPartition * fat, struct FatDirIter * dir, struct Fat16Entry * entry)
+{
+    uint32_t num_clusters;
+
+    Fat_OpenDir(fat, dir, Fat_EntryCluster(fat, entry));
+
+    // exFAT directories can be contiguous too, their size says how far they go
+    if(IsContiguousEntry(fat, entry))
+    {
+        num_clusters = (entry->filesize + fat->cluster_size - 1) / fat->cluster_size;
+        dir->pos.clusters_left = (num_clusters > 0) ? num_clusters - 1 : 0;
+    }
+}
+
+/**
+ * Carries on iterating through a directory from a position saved earlier
+ * 
+ * The sector the position was in is read back in, so the iterator doesn't
+ * need to keep its own buffer for every directory level.
+ * 
+ * @param dir The iterator (part must already be set)
+ * @param pos The saved position (a copy of dir->pos)
+ */
+void Fat_ResumeDir(struct FatDirIter * dir, struct FatDirPos * pos)
+{
+    dir->pos = *pos;
+
+    if(dir->pos.index < FAT_ENTRIES_PER_SECTOR)
+        SD_ReadData(dir->buffer, (uint64_t)(dir->pos.sector - 1) * SECTOR_SIZE, SECTOR_SIZE);
+}
+
+/**
+ * Gets the next entry in a directory
+ * 
+ * Entries are read a whole sector at a time, so only every
+ * FAT_ENTRIES_PER_SECTOR'th call touches the card. On exFAT each entry set
+ * is translated into a FAT entry, so callers don't need to care which one
+ * the card is formatted with.
+ * 
+ * @param dir The directory iterator
+ * 
+ * @return A pointer to the entry (valid until the next call), or NULL once
+ *         the end of the directory is reached
+ */
+struct Fat16Entry * Fat_NextEntry(struct FatDirIter * dir)
+{
+    struct Fat16Entry * entry;
+
+    if(dir->part->fs_type == FAT_FS_EXFAT)
+        return Fat_NextExFatEntry(dir);
+
+    entry = Fat_NextSlot(dir);
+
+    // An unused entry marks the end of the directory, nothing after it is in use
+    if(entry != NULL && GetFileType((unsigned char)entry->filename[0]) == FAT_TYPE_UNUSED)
+    {
+        dir->pos.cluster = 0;
+        dir->pos.sectors_left = 0;
+        dir->pos.index = FAT_ENTRIES_PER_SECTOR;
+        return NULL;
+    }
+
+    return entry;
+}
+
+/**
+ * Gets the next raw 32 byte slot in a directory, moving on to the next
+ * sector (and cluster) when needed
+ * 
+ * @param dir The directory iterator (location is set to where the slot is)
+ * 
+ * @return A pointer to the slot in the iterator's buffer, or NULL once the
+ *         directory has no more sectors
+ */
+static struct Fat16Entry * Fat_NextSlot(struct FatDirIter * dir)
+{
+    uint32_t sector;
+
+    if(dir->pos.index >= FAT_ENTRIES_PER_SECTOR)
+    {
+        // Out of sectors in this cluster, move on to the next one in the chain
+        if(dir->pos.sectors_left == 0 && dir->pos.cluster >= 2)
+        {
+            if(dir->pos.clusters_left == FAT_DIR_CHAINED)
+                dir->pos.cluster = Fat_ReadFatEntry(dir->part, dir->pos.cluster);
+            else if(dir->pos.clusters_left > 0)
+            {
+                dir->pos.cluster++;
+                dir->pos.clusters_left--;
+            }
+            else
+                dir->pos.cluster = 0;
+
+            if(dir->pos.cluster < 2 || dir->pos.cluster >= FAT_END_OF_CHAIN)
+                dir->pos.cluster = 0;
+            else
+            {
+                dir->pos.sector = Fat_ClusterSector(dir->part, dir->pos.cluster);
+                dir->pos.sectors_left = dir->part->cluster_sectors;
+            }
+        }
+
+        if(dir->pos.sectors_left == 0)
+            return NULL;
+
+        SD_ReadData(dir->buffer, (uint64_t)dir->pos.sector * SECTOR_SIZE, SECTOR_SIZE);
+        dir->pos.sector++;
+        dir->pos.sectors_left--;
+        dir->pos.index = 0;
+    }
+
+    // Remember where the slot is, if it fits in a catalog entry
+    sector = dir->pos.sector - 1 - dir->part->start_sector;
+    dir->location = (sector <= FAT_CATALOG_MAX_SECTOR) ? FAT_CATALOG_ENTRY(sector, dir->pos.index) : 0;
+
+    return &(dir->buffer[dir->pos.index++]);
+}
+
+/**
+ * Gets the next file or directory in an exFAT directory, translated into a
+ * FAT entry
+ * 
+ * The name is folded down to an upper case 8.3 name (the first eight
+ * characters and the first three after the last dot) so extension matching
+ * works the same as on FAT. Contiguous files get FAT_ATTR_CONTIGUOUS.
+ * 
+ * @param dir The directory iterator
+ * 
+ * @return A pointer to the translated entry (valid until the next call), or
+ *         NULL once the end of the directory is reached
+ */
+static struct Fat16Entry * Fat_NextExFatEntry(struct FatDirIter * dir)
+{
+    struct Fat16Entry * slot;
+    struct ExFatNameEntry * name;
+    struct Fat16Entry * entry = &(dir->entry);
+    FatCatalogEntry location;
+    uint8_t secondary_left, attributes, name_length, i, ext_len = 0;
+    uint8_t name_pos = 0, dot = 0xFF;   // Where the last dot in the name is
+    uint16_t c;
+
+    while((slot = Fat_NextSlot(dir)) != NULL)
+    {
+        if(((struct ExFatFileEntry *)slot)->type == EXFAT_ENTRY_END)
+            break;
+
+        if(((struct ExFatFileEntry *)slot)->type != EXFAT_ENTRY_FILE)
+            continue;
+
+        secondary_left = ((struct ExFatFileEntry *)slot)->secondary_count;
+        attributes = (uint8_t)(((struct ExFatFileEntry *)slot)->attributes & 0x3F);
+
+        // The stream extension always comes straight after the file entry
+        if((slot = Fat_NextSlot(dir)) == NULL)
+            break;
+
+        if(secondary_left < 2 || ((struct ExFatStreamEntry *)slot)->type != EXFAT_ENTRY_STREAM)
+            continue;
+
+        Fat_TranslateStream(entry, (struct ExFatStreamEntry *)slot);
+        entry->attributes |= attributes;
+        name_length = ((struct ExFatStreamEntry *)slot)->name_length;
+        location = dir->location;
+
+        // Fold the name down as it goes by, it can span several sectors
+        for(--secondary_left; secondary_left > 0; --secondary_left)
         {
-            strncpy(file->filename, entry.filename, 8);
-            strncpy(file->ext, entry.ext, 3);
-            file->filesize = entry.filesize;
-            file->starting_cluster = entry.starting_cluster;
-            file->cur_cluster = file->starting_cluster;
-            file->num_clusters = 0;
-            file->cur_pos = 0;
-            file->part = fat;
-            file->type = GetFileType((unsigned char)file->filename[0]);
-            
-            found_file = true;
+            if((slot = Fat_NextSlot(dir)) == NULL)
+                return NULL;
+
+            name = (struct ExFatNameEntry *)slot;
+            if(name->type != EXFAT_ENTRY_NAME)
+                continue;
+
+            for(i = 0; i < EXFAT_NAME_CHARS && name_pos < name_length; ++i, ++name_pos)
+            {
+                c = name->name[i];
+                if(c >= 'a' && c <= 'z')
+                    c -= 'a' - 'A';
+                else if(c < 0x20 || c >= 0x7F)
+                    c = '_';
+
+                if(name_pos < 8)
+                    entry->filename[name_pos] = (char)c;
+
+                if(c == '.')
+                {
+                    dot = name_pos;
+                    ext_len = 0;
+                    memset(entry->ext, ' ', 3);
+                }
+                else if(dot != 0xFF && ext_len < 3)
+                    entry->ext[ext_len++] = (char)c;
+            }
         }
+
+        // Drop the extension from the name
+        if(dot != 0xFF && dot > 0 && dot < 8)
+            memset(entry->filename + dot, ' ', 8 - dot);
+
+        dir->location = location;
+        return entry;
     }
 
-    return found_file;
+    dir->pos.cluster = 0;
+    dir->pos.sectors_left = 0;
+    dir->pos.index = FAT_ENTRIES_PER_SECTOR;
+    return NULL;
+}
+
+/**
+ * Fills in a FAT entry from an exFAT Stream Extension entry (the name is
+ * left blank and only FAT_ATTR_CONTIGUOUS is set in the attributes)
+ * 
+ * Files bigger than 4GiB are cut short, nothing that big can be played.
+ * 
+ * @param entry The entry to fill in
+ * @param stream The stream extension to fill it from
+ */
+static void Fat_TranslateStream(struct Fat16Entry * entry, struct ExFatStreamEntry * stream)
+{
+    memset(entry, 0, sizeof(struct Fat16Entry));
+    memset(entry->filename, ' ', 8);
+    memset(entry->ext, ' ', 3);
+
+    if(stream->flags & EXFAT_FLAG_NO_FAT_CHAIN)
+        entry->attributes = FAT_ATTR_CONTIGUOUS;
+
+    entry->starting_cluster = (uint16_t)stream->first_cluster;
+    entry->starting_cluster_high = (uint16_t)(stream->first_cluster >> 16);
+    entry->filesize = (stream->valid_data_length > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)stream->valid_data_length;
 }
 
 uint32_t Fat_read(struct FatFile * file, void * buffer, uint32_t num_bytes)
 {
     uint32_t bytes_read = 0;        // How many bytes have been read in this file operation in total
     uint32_t read_num_bytes = 0;    // How many bytes to read for each individual SD_ReadData transaction
-    uint32_t file_left, cluster_left;   // Cache each loop iteration how many bytes left in file/cluster
+    uint32_t file_left, run_left;   // Cache each loop iteration how many bytes left in file/contiguous run
+    uint32_t walked;                // How much of the chain was known before walking more of it
 
     // Keep reading until we've read the number of requested bytes or hit the end of the file
     while(bytes_read < num_bytes && FILE_BYTES_LEFT(file) > 0)
     {
         file_left = FILE_BYTES_LEFT(file);
-        cluster_left = FILE_CLUSTER_LEFT(file);
+        run_left = Fat_RunLeft(file);
+
+        // The run can go on past what's been walked of the chain so far, find
+        // out how far before cutting the transaction short (a chain that ends
+        // early stops the walk getting anywhere)
+        while(run_left < num_bytes - bytes_read && run_left < file_left && !file->map_full &&
+                file->cur_extent == file->num_extents - 1)
+        {
+            walked = file->walked_clusters;
+            Fat_WalkChain(file, 0xFFFFFFFF, FAT_WALK_SECTORS);
+            if(file->walked_clusters == walked)
+                break;
+            run_left = Fat_RunLeft(file);
+        }
 
         // Determine the amount of bytes to read
         read_num_bytes = num_bytes - bytes_read;
@@ -121,24 +742,24 @@ uint32_t Fat_read(struct FatFile * file, void * buffer, uint32_t num_bytes)
         if(read_num_bytes > file_left)
             read_num_bytes = file_left;
 
-        if(read_num_bytes > cluster_left)
-            read_num_bytes = cluster_left;
+        if(read_num_bytes > run_left)
+            read_num_bytes = run_left;
 
-        // Read data into the buffer
-        SD_ReadData(buffer + bytes_read, file->part->data_start + ((file->cur_cluster - 2) * file->part->cluster_size) + file->cur_pos, read_num_bytes);
+        // Read data into the buffer (one transaction for the whole contiguous run)
+        SD_ReadData(buffer + bytes_read, file->part->data_start + ((uint64_t)(file->cur_cluster - 2) * file->part->cluster_size) + file->cur_pos, read_num_bytes);
 
         // Modify byte counters
         file_left -= read_num_bytes;
-        cluster_left -= read_num_bytes;
         bytes_read += read_num_bytes;
         file->cur_pos += read_num_bytes;
 
-        // If we've reached the end of the cluster but not the end of the file
-        if(cluster_left == 0 && file_left > 0)
+        // Walk the cursor forward over every cluster we finished, stopping on
+        // the last cluster of the file instead of stepping past it
+        while(file->cur_pos > file->part->cluster_size ||
+                (file->cur_pos == file->part->cluster_size && file_left > 0))
         {
-            // Grab the next cluster number and reset the current position within that cluster
-            SD_ReadData(&(file->cur_cluster), file->part->fat_start + (file->cur_cluster * 2), 2);
-            file->cur_pos = 0;
+            file->cur_cluster = Fat_NextCluster(file);
+            file->cur_pos -= file->part->cluster_size;
             file->num_clusters++;
         }
     }
@@ -148,26 +769,57 @@ uint32_t Fat_read(struct FatFile * file, void * buffer, uint32_t num_bytes)
 
 void Fat_seek(struct FatFile * file, uint32_t amount, enum SeekType type)
 {
-    uint16_t num_cluster_increase = 0;
-    int i = 0;
+    uint32_t target = amount;
+    uint32_t target_cluster;
 
-    switch(type)
+    if(type == FAT_SEEK_CUR)
+        target += FILE_BYTES_READ(file);
+
+    target_cluster = target / file->part->cluster_size;
+    file->cur_pos = target % file->part->cluster_size;
+
+    // Landing exactly on the end of the file leaves us at the end of the last
+    // cluster (the same place Fat_read stops) rather than past it
+    if(target_cluster > 0 && file->cur_pos == 0 && target >= file->filesize)
     {
-        case FAT_SEEK_CUR:
-            num_cluster_increase = (uint16_t)((amount + file->cur_pos) / file->part->cluster_size);
-            file->num_clusters += num_cluster_increase;
-            file->cur_pos = (amount + file->cur_pos) % file->part->cluster_size;
-            break;
-        case FAT_SEEK_SET:
-            num_cluster_increase = (uint16_t)(amount / file->part->cluster_size);
-            file->num_clusters = num_cluster_increase;
-            file->cur_pos = amount % file->part->cluster_size;
-            break;
+        target_cluster--;
+        file->cur_pos = file->part->cluster_size;
     }
 
-    // Update the current cluster number based on how many clusters we've increased by
-    for(i = 0; i < num_cluster_increase; ++i)
-        SD_ReadData(&(file->cur_cluster), file->part->fat_start + (file->cur_cluster * 2), 2);
+    Fat_SeekCluster(file, target_cluster);
+}
+
+/**
+ * Starts a stream at wherever the file is now
+ * 
+ * @param stream The stream to set up
+ * @param file The file to read from
+ * @param num_bytes How far into the file the stream goes
+ */
+void Fat_OpenStream(struct FatStream * stream, struct FatFile * file, uint32_t num_bytes)
+{
+    stream->file = file;
+    stream->bytes_left = num_bytes;
+}
+
+/**
+ * Reads from a stream, stopping at its end
+ * 
+ * @param stream The stream to read
+ * @param buffer Where to put the data
+ * @param num_bytes The most to read
+ * 
+ * @return The number of bytes read, short only at the end of the stream
+ */
+uint32_t Fat_StreamRead(struct FatStream * stream, void * buffer, uint32_t num_bytes)
+{
+    if(num_bytes > stream->bytes_left)
+        num_bytes = stream->bytes_left;
+    
+    num_bytes = Fat_read(stream->file, buffer, num_bytes);
+    stream->bytes_left = (num_bytes == 0) ? 0 : stream->bytes_left - num_bytes;
+    
+    return num_bytes;
 }
 
 /**
@@ -180,18 +832,723 @@ void ResetFile(struct FatFile * file)
     file->cur_cluster = file->starting_cluster;
     file->num_clusters = 0;
     file->cur_pos = 0;
+    file->cur_extent = 0;
 }
 
 /**
- * Determines the type of a file based off the first character in the filename
+ * Opens a file whose clusters are already known (e.g. from an index kept on
+ * the card), without touching the directory or the FAT
  * 
- * @param first The first character in the filename
+ * The name isn't known, so it's left blank.
  * 
- * @return What type the file is
+ * @param fat The partition the file is in
+ * @param file The file to fill in
+ * @param filesize The size of the file in bytes
+ * @param extents Where the file lives, must cover all of filesize
+ * @param num_extents How many extents there are (at most FAT_MAX_EXTENTS)
  */
-static enum FatFileType GetFileType(unsigned char first)
+void Fat_OpenExtents(struct FatPartition * fat, struct FatFile * file, uint32_t filesize, struct FatExtent * extents, uint8_t num_extents)
 {
-    enum FatFileType type = FAT_TYPE_UNUSED;
+    memset(file->filename, ' ', 8);
+    memset(file->ext, ' ', 3);
+    file->filesize = filesize;
+    file->starting_cluster = (num_extents > 0) ? extents[0].start_cluster : 0;
+    file->cur_cluster = file->starting_cluster;
+    file->num_clusters = 0;
+    file->cur_pos = 0;
+    file->part = fat;
+    file->type = FAT_TYPE_REGULAR;
+    file->num_extents = num_extents;
+    file->cur_extent = 0;
+    file->map_full = false;
+    file->seek_stride = 0;
+    memcpy(file->extents, extents, num_extents * sizeof(struct FatExtent));
+    memset(file->seek_index, 0, sizeof(file->seek_index));
+
+    // The map is already complete, there's nothing to walk
+    file->walked_clusters = (filesize + fat->cluster_size - 1) / fat->cluster_size;
+    file->walk_cluster = (num_extents > 0) ? extents[num_extents - 1].start_cluster + extents[num_extents - 1].num_clusters - 1 : 0;
+}
+
+/**
+ * Creates a new file in the root directory with all of its clusters in one
+ * contiguous run
+ * 
+ * The clusters are linked in every FAT copy first and the directory entry is
+ * written last, so losing power part way through at worst leaves some lost
+ * clusters behind. The contents of the file are whatever was on the card.
+ * Only FAT16 and FAT32 can be written to.
+ * 
+ * @param fat The partition to create the file in
+ * @param file The file to fill in (opened at the start of the new file)
+ * @param filename The name of the file (eight characters, space padded)
+ * @param ext The extension of the file (three characters, space padded)
+ * @param size The size of the file in bytes
+ * 
+ * @return False if there's no contiguous run of free clusters big enough, no
+ *         free root directory entry, or a write failed
+ */
+bool Fat_CreateContiguous(struct FatPartition * fat, struct FatFile * file, char * filename, char * ext, uint32_t size)
+{
+    struct FatDirIter dir;
+    struct Fat16Entry * slot;
+    uint32_t num_clusters = (size + fat->cluster_size - 1) / fat->cluster_size;
+    uint32_t first = 0;
+
+    if(fat->fs_type == FAT_FS_EXFAT)
+        return false;
+
+    // Find somewhere to put the entry before allocating anything
+    Fat_OpenRoot(fat, &dir);
+    while((slot = Fat_NextSlot(&dir)) != NULL)
+    {
+        if((unsigned char)slot->filename[0] == 0x00 || (unsigned char)slot->filename[0] == 0xE5)
+            break;
+    }
+
+    if(slot == NULL)
+        return false;
+
+    if(num_clusters > 0)
+    {
+        if((first = Fat_FindFreeRun(fat, num_clusters)) == 0)
+            return false;
+
+        // The FAT window might have been reused by the search, but the
+        // directory sector is still in the iterator's buffer
+        if(!Fat_WriteChain(fat, first, num_clusters))
+            return false;
+
+        if(fat->fs_type == FAT_FS_FAT32)
+        {
+            if(fat->free_clusters != 0xFFFFFFFF)
+                fat->free_clusters -= num_clusters;
+            fat->next_free = first + num_clusters;
+            Fat_WriteFsInfo(fat);
+        }
+    }
+
+    memset(slot, 0, sizeof(struct Fat16Entry));
+    memcpy(slot->filename, filename, 8);
+    memcpy(slot->ext, ext, 3);
+    slot->attributes = 0x20;    // Archive
+    slot->starting_cluster = (uint16_t)first;
+    if(fat->fs_type == FAT_FS_FAT32)
+        slot->starting_cluster_high = (uint16_t)(first >> 16);
+    slot->filesize = size;
+
+    if(!SD_WriteSector((uint8_t *)dir.buffer, dir.pos.sector - 1))
+        return false;
+
+    Fat_OpenEntry(fat, file, slot);
+    return true;
+}
+
+/**
+ * Deletes a file from the root directory and frees its clusters
+ * 
+ * The clusters are freed in every FAT copy before the directory entry is
+ * marked deleted, so losing power part way through at worst leaves an entry
+ * pointing at free clusters. Only FAT16 and FAT32 can be written to.
+ * 
+ * @param fat The partition the file is in
+ * @param filename The name of the file (eight characters, space padded)
+ * @param ext The extension of the file (three characters, space padded)
+ * 
+ * @return False if the file isn't there or a write failed
+ */
+bool Fat_Delete(struct FatPartition * fat, char * filename, char * ext)
+{
+    struct FatDirIter dir;
+    struct Fat16Entry * entry;
+
+    if(fat->fs_type == FAT_FS_EXFAT)
+        return false;
+
+    Fat_OpenRoot(fat, &dir);
+    while((entry = Fat_NextEntry(&dir)) != NULL)
+    {
+        if(IsRegularEntry(entry) && strncmp(ext, entry->ext, 3) == 0 && strncmp(filename, entry->filename, 8) == 0)
+            break;
+    }
+
+    if(entry == NULL || !Fat_FreeChain(fat, Fat_EntryCluster(fat, entry)))
+        return false;
+
+    // The FAT window might have been reused, but the directory sector is
+    // still in the iterator's buffer
+    entry->filename[0] = (char)0xE5;
+    return SD_WriteSector((uint8_t *)dir.buffer, dir.pos.sector - 1);
+}
+
+/**
+ * Looks through the FAT for a run of free clusters, starting from the FSInfo
+ * hint (if there is one) and wrapping around
+ * 
+ * @param fat The partition to search
+ * @param num_clusters How many clusters the run needs
+ * 
+ * @return The first cluster of the run, or zero if there isn't one
+ */
+static uint32_t Fat_FindFreeRun(struct FatPartition * fat, uint32_t num_clusters)
+{
+    uint32_t last = fat->num_clusters + 1;  // Clusters go from 2 up to this
+    uint32_t start = 2, cluster, run_start = 0, run_length = 0;
+    uint32_t checked;
+
+    if(fat->next_free >= 2 && fat->next_free <= last)
+        start = fat->next_free;
+
+    cluster = start;
+    for(checked = 0; checked <= last - 2; ++checked)
+    {
+        // A run can't wrap around the end of the FAT
+        if(cluster > last)
+        {
+            cluster = 2;
+            run_length = 0;
+        }
+
+        if(Fat_ReadFatEntry(fat, cluster) == 0)
+        {
+            if(run_length == 0)
+                run_start = cluster;
+
+            if(++run_length == num_clusters)
+                return run_start;
+        }
+        else
+            run_length = 0;
+
+        cluster++;
+    }
+
+    return 0;
+}
+
+/**
+ * Links a contiguous run of clusters into one chain in every copy of the FAT
+ * 
+ * @param fat The partition to write to
+ * @param first The first cluster of the run
+ * @param num_clusters How many clusters are in the run
+ * 
+ * @return False if any of the writes failed
+ */
+static bool Fat_WriteChain(struct FatPartition * fat, uint32_t first, uint32_t num_clusters)
+{
+    uint32_t per_sector = (fat->fs_type == FAT_FS_FAT16) ? FAT16_ENTRIES_PER_SECTOR : FAT32_ENTRIES_PER_SECTOR;
+    uint32_t last = first + num_clusters - 1;
+    uint32_t cluster = first;
+    uint32_t sector_num, index, value;
+    uint8_t * window;
+    uint8_t i;
+    bool ok = true;
+
+    while(cluster <= last)
+    {
+        // Update the whole FAT sector in the window, then write it to every copy
+        sector_num = SECTOR_NUM(fat->fat_start) + (cluster / per_sector);
+        window = Fat_WindowLookup(sector_num);
+
+        do
+        {
+            index = cluster % per_sector;
+            value = (cluster == last) ? 0x0FFFFFFF : cluster + 1;
+
+            if(fat->fs_type == FAT_FS_FAT32)
+            {
+                // The top four bits are reserved and have to be left alone
+                window[index * 4] = value & 0xFF;
+                window[(index * 4) + 1] = (value >> 8) & 0xFF;
+                window[(index * 4) + 2] = (value >> 16) & 0xFF;
+                window[(index * 4) + 3] = (window[(index * 4) + 3] & 0xF0) | ((value >> 24) & 0x0F);
+            }
+            else
+            {
+                window[index * 2] = value & 0xFF;
+                window[(index * 2) + 1] = (value >> 8) & 0xFF;
+            }
+
+            cluster++;
+        } while(cluster <= last && (cluster % per_sector) != 0);
+
+        for(i = 0; i < fat->boot.num_fats; ++i)
+            ok &= SD_WriteSector(window, sector_num + (i * fat->fat_num_sectors));
+    }
+
+    return ok;
+}
+
+/**
+ * Frees every cluster in a chain in every copy of the FAT
+ * 
+ * @param fat The partition to write to
+ * @param cluster The first cluster of the chain (zero for an empty file)
+ * 
+ * @return False if any of the writes failed
+ */
+static bool Fat_FreeChain(struct FatPartition * fat, uint32_t cluster)
+{
+    uint32_t per_sector = (fat->fs_type == FAT_FS_FAT16) ? FAT16_ENTRIES_PER_SECTOR : FAT32_ENTRIES_PER_SECTOR;
+    uint32_t freed = 0;
+    uint32_t sector_num, index, next;
+    uint8_t * window;
+    uint8_t i;
+    bool ok = true;
+
+    // A broken chain can't loop forever, it can't be longer than the FAT
+    while(cluster >= 2 && cluster <= fat->num_clusters + 1 && freed < fat->num_clusters)
+    {
+        // Changes stay in the window until the chain leaves the sector, so
+        // nothing else is looked up in between
+        sector_num = SECTOR_NUM(fat->fat_start) + (cluster / per_sector);
+        window = Fat_WindowLookup(sector_num);
+        index = cluster % per_sector;
+        next = Fat_DecodeFatEntry(fat, window, index);
+
+        if(fat->fs_type == FAT_FS_FAT32)
+        {
+            // The top four bits are reserved and have to be left alone
+            window[index * 4] = 0;
+            window[(index * 4) + 1] = 0;
+            window[(index * 4) + 2] = 0;
+            window[(index * 4) + 3] &= 0xF0;
+        }
+        else
+        {
+            window[index * 2] = 0;
+            window[(index * 2) + 1] = 0;
+        }
+
+        freed++;
+
+        // Write the sector out once the chain leaves it
+        if(next < 2 || next >= FAT_END_OF_CHAIN || next / per_sector != cluster / per_sector)
+        {
+            for(i = 0; i < fat->boot.num_fats; ++i)
+                ok &= SD_WriteSector(window, sector_num + (i * fat->fat_num_sectors));
+        }
+
+        cluster = next;
+    }
+
+    if(fat->fs_type == FAT_FS_FAT32 && fat->free_clusters != 0xFFFFFFFF)
+    {
+        fat->free_clusters += freed;
+        ok &= Fat_WriteFsInfo(fat);
+    }
+
+    return ok;
+}
+
+/**
+ * Writes the free cluster hints back to the FSInfo sector (FAT32 only)
+ * 
+ * Nothing is written if the sector doesn't have valid signatures.
+ * 
+ * @param fat The partition to update
+ * 
+ * @return False if the write failed
+ */
+static bool Fat_WriteFsInfo(struct FatPartition * fat)
+{
+    struct FatFsInfo info;
+    uint32_t sector_num = fat->start_sector + fat->boot32.fsinfo_sector;
+
+    if(fat->boot32.fsinfo_sector == 0 || fat->boot32.fsinfo_sector == 0xFFFF)
+        return true;
+
+    SD_ReadCached(&info, (uint64_t)SECTOR_SIZE * sector_num, sizeof(struct FatFsInfo));
+
+    if(info.lead_sig != FAT_FSINFO_LEAD_SIG || info.struct_sig != FAT_FSINFO_STRUCT_SIG)
+        return true;
+
+    info.free_count = fat->free_clusters;
+    info.next_free = fat->next_free;
+
+    return SD_WriteSector((uint8_t *)&info, sector_num);
+}
+
+/**
+ * Starts the extent map and seek index for a file
+ * 
+ * Only the first FAT_WALK_SECTORS FAT sectors of the chain are walked here,
+ * so opening a long fragmented file (e.g. prefetching the next track between
+ * refills) costs no more than that. The rest of the map is filled in as
+ * reads reach the end of it, and a seek past it walks as far as it needs to.
+ * Contiguous files (exFAT NoFatChain) are a single extent and the FAT is
+ * never touched.
+ * 
+ * If the file has more fragments than FAT_MAX_EXTENTS, reads past the last
+ * extent fall back to following the FAT one cluster at a time, and seeks
+ * past it start from the closest seek index entry.
+ * 
+ * @param file The file to map, starting_cluster and filesize must be set
+ * @param contiguous Whether the file's clusters are known to be in one run
+ */
+static void Fat_BuildExtents(struct FatFile * file, bool contiguous)
+{
+    uint32_t num_clusters = (file->filesize + file->part->cluster_size - 1) / file->part->cluster_size;
+
+    file->num_extents = 0;
+    file->cur_extent = 0;
+    file->map_full = false;
+    file->walked_clusters = 0;
+    file->walk_cluster = file->starting_cluster;
+    file->seek_stride = (num_clusters + FAT_SEEK_INDEX_SIZE - 1) / FAT_SEEK_INDEX_SIZE;
+    memset(file->seek_index, 0, sizeof(file->seek_index));
+
+    // Zero length files don't have any clusters
+    if(num_clusters == 0 || file->starting_cluster < 2)
+        return;
+
+    file->extents[0].start_cluster = file->starting_cluster;
+    file->extents[0].num_clusters = 1;
+    file->num_extents = 1;
+    file->walked_clusters = 1;
+    file->seek_index[0] = file->starting_cluster;
+
+    // The clusters aren't necessarily in the FAT, so there's nothing to walk
+    if(contiguous)
+    {
+        file->extents[0].num_clusters = num_clusters;
+        file->walked_clusters = num_clusters;
+        file->walk_cluster = file->starting_cluster + num_clusters - 1;
+        return;
+    }
+
+    Fat_WalkChain(file, num_clusters, FAT_WALK_SECTORS);
+}
+
+/**
+ * Walks the rest of a file's cluster chain, so the extent map is as full as
+ * it can be (e.g. before the map is saved somewhere)
+ * 
+ * @param file The file to map
+ */
+void Fat_MapFile(struct FatFile * file)
+{
+    Fat_WalkChain(file, 0xFFFFFFFF, 0xFFFFFFFF);
+}
+
+/**
+ * Carries on walking a file's cluster chain from where the last walk
+ * stopped, adding to the extent map (until it's full) and the seek index
+ * 
+ * @param file The file to walk
+ * @param until Stop once the chain is known up to this many clusters
+ * @param max_sectors Stop before looking in more FAT sectors than this
+ */
+static void Fat_WalkChain(struct FatFile * file, uint32_t until, uint32_t max_sectors)
+{
+    uint32_t num_clusters = (file->filesize + file->part->cluster_size - 1) / file->part->cluster_size;
+    uint32_t per_sector = (file->part->fs_type == FAT_FS_FAT16) ? FAT16_ENTRIES_PER_SECTOR : FAT32_ENTRIES_PER_SECTOR;
+    uint32_t n = file->walked_clusters;     // Index within the file of the next cluster to find
+    uint32_t cluster = file->walk_cluster;
+    uint32_t fat_sector = 0xFFFFFFFF;
+    uint32_t next;
+    struct FatExtent * extent;
+
+    if(file->num_extents == 0)
+        return;
+
+    extent = &(file->extents[file->num_extents - 1]);
+    if(until > num_clusters)
+        until = num_clusters;
+
+    while(n < until)
+    {
+        // Every FAT sector looked in comes out of the budget, the first one included
+        if(cluster / per_sector != fat_sector)
+        {
+            if(max_sectors-- == 0)
+                break;
+            fat_sector = cluster / per_sector;
+        }
+
+        next = Fat_ReadFatEntry(file->part, cluster);
+        if(next < 2 || next >= FAT_END_OF_CHAIN)
+        {
+            // The chain is shorter than the file, there's nothing more to find
+            n = num_clusters;
+            break;
+        }
+
+        if(file->map_full)
+        {
+            // Only walking the rest of the chain to fill in the seek index
+        }
+        else if(next == cluster + 1)
+        {
+            extent->num_clusters++;
+        }
+        else if(file->num_extents == FAT_MAX_EXTENTS)
+        {
+            // Out of room, the rest of the file gets found through the FAT
+            file->map_full = true;
+        }
+        else
+        {
+            extent = &(file->extents[file->num_extents++]);
+            extent->start_cluster = next;
+            extent->num_clusters = 1;
+        }
+
+        cluster = next;
+        if(n % file->seek_stride == 0)
+            file->seek_index[n / file->seek_stride] = cluster;
+        n++;
+    }
+
+    file->walked_clusters = n;
+    file->walk_cluster = cluster;
+}
+
+/**
+ * Moves the cursor to a cluster within the file
+ * 
+ * Clusters covered by the extent map are found directly. Anything past the
+ * map is reached by following the FAT from the closest known cluster before
+ * it: the end of the map, a seek index entry, or the current cluster.
+ * 
+ * @param file The file to move through
+ * @param target The index of the cluster within the file (0 is the first cluster)
+ */
+static void Fat_SeekCluster(struct FatFile * file, uint32_t target)
+{
+    uint32_t base = 0;      // Index of the first cluster in the current extent
+    uint32_t from = 0;      // Index of the cluster we start following the chain from
+    uint32_t k;
+    uint32_t cluster = file->starting_cluster;
+    uint8_t i;
+
+    // Get the map and seek index as far as the target first
+    if(target >= file->walked_clusters && file->num_extents > 0)
+        Fat_WalkChain(file, target + 1, 0xFFFFFFFF);
+
+    for(i = 0; i < file->num_extents; ++i)
+    {
+        if(target < base + file->extents[i].num_clusters)
+        {
+            file->cur_extent = i;
+            file->cur_cluster = file->extents[i].start_cluster + (target - base);
+            file->num_clusters = target;
+            return;
+        }
+
+        base += file->extents[i].num_clusters;
+    }
+
+    // Past the map (or an empty file), pick the closest starting point
+    if(file->num_extents > 0)
+    {
+        from = base - 1;
+        cluster = file->extents[file->num_extents - 1].start_cluster + file->extents[file->num_extents - 1].num_clusters - 1;
+    }
+
+    if(file->seek_stride > 0)
+    {
+        k = target / file->seek_stride;
+        if(k < FAT_SEEK_INDEX_SIZE && file->seek_index[k] != 0 && k * file->seek_stride > from)
+        {
+            from = k * file->seek_stride;
+            cluster = file->seek_index[k];
+        }
+    }
+
+    if(file->cur_extent >= file->num_extents && file->num_clusters > from && file->num_clusters <= target)
+    {
+        from = file->num_clusters;
+        cluster = file->cur_cluster;
+    }
+
+    for(; from < target; ++from)
+        cluster = Fat_ReadFatEntry(file->part, cluster);
+
+    file->cur_extent = file->num_extents;
+    file->cur_cluster = cluster;
+    file->num_clusters = target;
+}
+
+/**
+ * Finds the cluster after the current one, using the extent map when it
+ * covers the current cluster and the FAT when it doesn't
+ * 
+ * @param file The file to step through (cur_extent is updated)
+ * 
+ * @return The next cluster number in the file
+ */
+static uint32_t Fat_NextCluster(struct FatFile * file)
+{
+    struct FatExtent * extent;
+
+    if(file->cur_extent < file->num_extents)
+    {
+        extent = &(file->extents[file->cur_extent]);
+
+        // Reached the end of what's been walked, walk as far as another
+        // FAT_WALK_SECTORS FAT sectors go
+        if(file->cur_extent == file->num_extents - 1 && !file->map_full &&
+                file->cur_cluster + 1 == extent->start_cluster + extent->num_clusters)
+            Fat_WalkChain(file, 0xFFFFFFFF, FAT_WALK_SECTORS);
+
+        if(file->cur_cluster + 1 < extent->start_cluster + extent->num_clusters)
+            return file->cur_cluster + 1;
+
+        if(++file->cur_extent < file->num_extents)
+            return file->extents[file->cur_extent].start_cluster;
+    }
+
+    // Past the end of the map, follow the chain
+    return Fat_ReadFatEntry(file->part, file->cur_cluster);
+}
+
+/**
+ * Calculates how many bytes can be read from the current position without
+ * leaving contiguous clusters
+ * 
+ * @param file The file to check
+ * 
+ * @return The number of contiguous bytes from the current position
+ */
+static uint32_t Fat_RunLeft(struct FatFile * file)
+{
+    struct FatExtent * extent;
+    uint32_t clusters_after = 0;
+
+    if(file->cur_extent < file->num_extents)
+    {
+        extent = &(file->extents[file->cur_extent]);
+        clusters_after = extent->start_cluster + extent->num_clusters - file->cur_cluster - 1;
+    }
+
+    return (clusters_after * file->part->cluster_size) + FILE_CLUSTER_LEFT(file);
+}
+
+/**
+ * Reads the FAT entry for a cluster (the number of the cluster after it)
+ * 
+ * Lookups are served from the FAT window. When the chain gets close to the
+ * end of a FAT sector, the next one is read in too so that crossing into it
+ * doesn't cost another transaction (and it streams right after this one).
+ * 
+ * FAT16 and exFAT end of chain markers are turned into FAT32 ones so callers
+ * only have to check against FAT_END_OF_CHAIN.
+ * 
+ * @param fat The partition the cluster is in
+ * @param cluster The cluster to look up
+ * 
+ * @return The next cluster in the chain
+ */
+static uint32_t Fat_ReadFatEntry(struct FatPartition * fat, uint32_t cluster)
+{
+    uint32_t per_sector = (fat->fs_type == FAT_FS_FAT16) ? FAT16_ENTRIES_PER_SECTOR : FAT32_ENTRIES_PER_SECTOR;
+    uint32_t sector_num = SECTOR_NUM(fat->fat_start) + (cluster / per_sector);
+    uint32_t index = cluster % per_sector;
+    uint32_t next = Fat_DecodeFatEntry(fat, Fat_WindowLookup(sector_num), index);
+
+    if(index >= per_sector - FAT_PREFETCH_MARGIN &&
+            sector_num + 1 < SECTOR_NUM(fat->fat_start) + fat->fat_num_sectors)
+        Fat_WindowLookup(sector_num + 1);
+
+    return next;
+}
+
+/**
+ * Decodes one entry of a FAT sector
+ * 
+ * FAT16 and exFAT end of chain markers are turned into FAT32 ones.
+ * 
+ * @param fat The partition the sector is from
+ * @param sector The FAT sector
+ * @param index Which entry of the sector to decode
+ * 
+ * @return The cluster the entry points at
+ */
+static uint32_t Fat_DecodeFatEntry(struct FatPartition * fat, uint8_t * sector, uint32_t index)
+{
+    uint32_t next;
+
+    if(fat->fs_type == FAT_FS_FAT32)
+    {
+        sector += index * 4;
+        next = (sector[0] | (sector[1] << 8) | (sector[2] << 16) | ((uint32_t)sector[3] << 24)) & 0x0FFFFFFF;
+    }
+    else if(fat->fs_type == FAT_FS_EXFAT)
+    {
+        sector += index * 4;
+        next = sector[0] | (sector[1] << 8) | (sector[2] << 16) | ((uint32_t)sector[3] << 24);
+        if(next >= EXFAT_BAD_CLUSTER)
+            next = FAT_END_OF_CHAIN;
+    }
+    else
+    {
+        sector += index * 2;
+        next = sector[0] | (sector[1] << 8);
+        if(next >= 0xFFF8)
+            next = FAT_END_OF_CHAIN;
+    }
+
+    return next;
+}
+
+/**
+ * Calculates the first sector of a data cluster
+ * 
+ * @param fat The partition the cluster is in
+ * @param cluster The cluster number (two or above)
+ * 
+ * @return The absolute sector number of the start of the cluster
+ */
+uint32_t Fat_ClusterSector(struct FatPartition * fat, uint32_t cluster)
+{
+    return SECTOR_NUM(fat->data_start) + ((cluster - 2) * fat->cluster_sectors);
+}
+
+/**
+ * Finds a FAT sector in the window, reading it in over the least recently
+ * used slot if it isn't there
+ * 
+ * @param sector_num The FAT sector to look up
+ * 
+ * @return A pointer to the copy of the sector in the window
+ */
+static uint8_t * Fat_WindowLookup(uint32_t sector_num)
+{
+    uint8_t i, slot = 0;
+
+    ++fat_window_tick;
+
+    for(i = 0; i < FAT_WINDOW_SECTORS; ++i)
+    {
+        if(fat_window_sector[i] == sector_num)
+        {
+            fat_window_last_used[i] = fat_window_tick;
+            return fat_window[i];
+        }
+
+        if(fat_window_last_used[i] < fat_window_last_used[slot])
+            slot = i;
+    }
+
+    SD_ReadData(fat_window[slot], (uint64_t)sector_num * SECTOR_SIZE, SECTOR_SIZE);
+    fat_window_sector[slot] = sector_num;
+    fat_window_last_used[slot] = fat_window_tick;
+
+    return fat_window[slot];
+}
+
+/**
+ * Determines the type of a file based off the first character in the filename
+ * 
+ * @param first The first character in the filename
+ * 
+ * @return What type the file is
+ */
+static enum FatFileType GetFileType(unsigned char first)
+{
+    enum FatFileType type = FAT_TYPE_UNUSED;
     
     // Determine the type of the file based on the filename
     switch(first) {
@@ -203,4 +1560,49 @@ static enum FatFileType GetFileType(unsigned char first)
     }
     
     return type;
+}
+
+/**
+ * Checks if a directory entry is a regular file that's in use (not deleted,
+ * a directory, the volume label or part of a long filename)
+ * 
+ * @param entry The entry to check
+ * 
+ * @return True if the entry is a regular file
+ */
+static bool IsRegularEntry(struct Fat16Entry * entry)
+{
+    return GetFileType((unsigned char)entry->filename[0]) == FAT_TYPE_REGULAR &&
+            (entry->attributes & (FAT_ATTR_VOLUME_ID | FAT_ATTR_DIRECTORY)) == 0;
+}
+
+/**
+ * Checks if a directory entry is a subdirectory that's in use (not deleted,
+ * "." or "..", or part of a long filename)
+ * 
+ * @param entry The entry to check
+ * 
+ * @return True if the entry is a subdirectory worth looking in
+ */
+static bool IsSubdirEntry(struct Fat16Entry * entry)
+{
+    return GetFileType((unsigned char)entry->filename[0]) == FAT_TYPE_REGULAR &&
+            (entry->attributes & (FAT_ATTR_VOLUME_ID | FAT_ATTR_DIRECTORY)) == FAT_ATTR_DIRECTORY &&
+            (entry->starting_cluster != 0 || entry->starting_cluster_high != 0);
+}
+
+/**
+ * Checks if a directory entry's clusters are contiguous with no FAT chain
+ * 
+ * Only entries translated from exFAT can be, FAT_ATTR_CONTIGUOUS is a
+ * reserved bit in a real FAT entry and is ignored there.
+ * 
+ * @param fat The partition the entry came from
+ * @param entry The entry to check
+ * 
+ * @return True if the file's clusters should be worked out without the FAT
+ */
+static bool IsContiguousEntry(struct FatPartition * fat, struct Fat16Entry * entry)
+{
+    return fat->fs_type == FAT_FS_EXFAT && (entry->attributes & FAT_ATTR_CONTIGUOUS) != 0;
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "sd.h"
 
 // Maximum number of partitions a master boot record can have (assuming no extended partitions)
 #define MAX_MBR_PARTITIONS 4
@@ -50,29 +51,207 @@ struct Fat16BootSector {
     uint16_t boot_sector_sig;   // Must be 0x55AA
 } __attribute((packed));
 
+// FAT32 boot sector, identical to FAT16 up until the extended fields
+struct Fat32BootSector {
+    uint8_t jump[3];
+    char oem[8];
+    uint16_t sector_size;
+    uint8_t num_sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t num_fats;
+    uint16_t num_root_entries;  // Always zero, the root directory is a cluster chain
+    uint16_t total_sectors_short;   // Always zero (use total_num_sectors)
+    uint8_t media_descriptor;
+    uint16_t fat16_num_sectors; // Always zero (use fat_num_sectors)
+    uint16_t chs_sectors_per_track;
+    uint16_t chs_num_heads;
+    uint32_t num_hidden_sectors;
+    uint32_t total_num_sectors;
+    uint32_t fat_num_sectors;   // Num sectors used for one FAT table
+    uint16_t ext_flags;
+    uint16_t fs_version;
+    uint32_t root_cluster;      // First cluster of the root directory
+    uint16_t fsinfo_sector;     // Sector of the FSInfo structure, relative to the partition
+    uint16_t backup_boot_sector;
+    uint8_t reserved[12];
+    uint8_t drive_number;
+    uint8_t current_head;
+    uint8_t boot_sig;
+    uint32_t volume_id;
+    char volume_label[11];
+    char filesystem_type[8];
+    uint8_t boot_code[420];
+    uint16_t boot_sector_sig;   // Must be 0x55AA
+} __attribute((packed));
+
+// exFAT boot sector, shares nothing with the FAT ones past the OEM name
+struct ExFatBootSector {
+    uint8_t jump[3];
+    char oem[8];                // "EXFAT   "
+    uint8_t must_be_zero[53];
+    uint64_t partition_offset;
+    uint64_t volume_length;
+    uint32_t fat_offset;        // Sectors from the start of the partition to the FAT
+    uint32_t fat_length;        // Num sectors in one FAT
+    uint32_t cluster_heap_offset;   // Sectors from the start of the partition to cluster 2
+    uint32_t cluster_count;
+    uint32_t root_cluster;      // First cluster of the root directory
+    uint32_t volume_serial;
+    uint16_t fs_revision;
+    uint16_t volume_flags;
+    uint8_t bytes_per_sector_shift;
+    uint8_t sectors_per_cluster_shift;
+    uint8_t num_fats;
+    uint8_t drive_select;
+    uint8_t percent_in_use;
+    uint8_t reserved[7];
+    uint8_t boot_code[390];
+    uint16_t boot_sector_sig;   // Must be 0x55AA
+} __attribute((packed));
+
+// FAT32 FSInfo sector, hints about free space kept up to date by the OS
+struct FatFsInfo {
+    uint32_t lead_sig;          // Must be 0x41615252
+    uint8_t reserved1[480];
+    uint32_t struct_sig;        // Must be 0x61417272
+    uint32_t free_count;        // Number of free clusters, 0xFFFFFFFF if unknown
+    uint32_t next_free;         // Where to start looking for a free cluster, 0xFFFFFFFF if unknown
+    uint8_t reserved2[12];
+    uint32_t trail_sig;         // Must be 0xAA550000
+} __attribute((packed));
+
+#define FAT_FSINFO_LEAD_SIG 0x41615252
+#define FAT_FSINFO_STRUCT_SIG 0x61417272
+
+// Which flavor of FAT a partition is formatted with
+enum FatFsType { FAT_FS_FAT16, FAT_FS_FAT32, FAT_FS_EXFAT };
+
 // Represents a single FAT Partition (partition data and the boot sector)
 struct FatPartition {
     uint8_t partition_type;
+    enum FatFsType fs_type;
     uint32_t start_sector;
     uint32_t cluster_size;  // In bytes
-    uint32_t fat_start;     // Number of bytes from beginning of disk until the first FAT table
-    uint32_t root_start;    // Number of bytes from beginning of disk until the root entries
-    uint32_t data_start;    // Number of bytes from beginning of disk until the data section begins
-    struct Fat16BootSector boot; // Information from the boot sector
+    uint32_t cluster_sectors;   // Num sectors in one cluster
+    uint32_t fat_num_sectors;   // Num sectors in one FAT table
+    uint32_t num_clusters;  // Number of data clusters in the partition
+    uint32_t root_cluster;  // First cluster of the root directory (FAT32 only, zero for FAT16)
+    uint32_t free_clusters; // From FSInfo (FAT32 only), 0xFFFFFFFF if unknown
+    uint32_t next_free;     // From FSInfo (FAT32 only), 0xFFFFFFFF if unknown
+    uint64_t fat_start;     // Number of bytes from beginning of disk until the first FAT table
+    uint64_t root_start;    // Number of bytes from beginning of disk until the root entries (FAT16 only)
+    uint64_t data_start;    // Number of bytes from beginning of disk until the data section begins
+    union {
+        struct Fat16BootSector boot;    // Information from the boot sector
+        struct Fat32BootSector boot32;
+        struct ExFatBootSector exboot;
+    };
 };
 
-// A single file/directory entry in FAT16 raw format
+// A single file/directory entry in FAT16 raw format (FAT32 uses the same layout)
 struct Fat16Entry {
     char filename[8];
     char ext[3];
     uint8_t attributes;
-    uint8_t reserved[10];
+    uint8_t reserved[8];
+    uint16_t starting_cluster_high; // Top half of the starting cluster (FAT32 only)
     uint16_t timestamp;
     uint16_t datestamp;
     uint16_t starting_cluster;
     uint32_t filesize;  // In bytes
 } __attribute((packed));
 
+// Maximum number of contiguous cluster runs remembered for an open file
+// Files with more fragments than this follow the FAT past the last run
+#define FAT_MAX_EXTENTS 6
+
+// Number of clusters remembered in each open file's seek index
+// Seeking past the extent map costs at most file_clusters / FAT_SEEK_INDEX_SIZE FAT lookups
+#define FAT_SEEK_INDEX_SIZE 16
+
+// Number of whole FAT sectors kept in RAM for following cluster chains
+#define FAT_WINDOW_SECTORS 2
+
+// FAT sectors of a file's chain walked when it's opened, and each time reads
+// get to the end of what's been walked, so no single call walks a whole
+// (possibly very long and fragmented) chain
+#define FAT_WALK_SECTORS 1
+
+// When a chain lookup lands this close to the end of its FAT sector, the
+// next FAT sector is read into the window ahead of time
+#define FAT_PREFETCH_MARGIN 8
+
+// exFAT directory entry types (the top bit set means the entry is in use)
+#define EXFAT_ENTRY_END 0x00
+#define EXFAT_ENTRY_FILE 0x85
+#define EXFAT_ENTRY_STREAM 0xC0
+#define EXFAT_ENTRY_NAME 0xC1
+
+// Stream extension flag meaning the file's clusters are contiguous and
+// aren't recorded in the FAT
+#define EXFAT_FLAG_NO_FAT_CHAIN 0x02
+
+// Number of UTF-16 filename characters in each exFAT name entry
+#define EXFAT_NAME_CHARS 15
+
+// exFAT File directory entry, the first in each entry set
+struct ExFatFileEntry {
+    uint8_t type;
+    uint8_t secondary_count;    // Number of entries following this one in the set
+    uint16_t set_checksum;
+    uint16_t attributes;        // Same bits as the FAT attributes
+    uint8_t reserved1[2];
+    uint32_t create_timestamp;
+    uint32_t modify_timestamp;
+    uint32_t access_timestamp;
+    uint8_t create_10ms;
+    uint8_t modify_10ms;
+    uint8_t create_utc_offset;
+    uint8_t modify_utc_offset;
+    uint8_t access_utc_offset;
+    uint8_t reserved2[7];
+} __attribute((packed));
+
+// exFAT Stream Extension entry, always straight after the File entry
+struct ExFatStreamEntry {
+    uint8_t type;
+    uint8_t flags;
+    uint8_t reserved1;
+    uint8_t name_length;        // In UTF-16 characters
+    uint16_t name_hash;
+    uint8_t reserved2[2];
+    uint64_t valid_data_length; // Bytes that have actually been written
+    uint8_t reserved3[4];
+    uint32_t first_cluster;
+    uint64_t data_length;       // Bytes allocated
+} __attribute((packed));
+
+// exFAT File Name entry, EXFAT_NAME_CHARS characters of the name each
+struct ExFatNameEntry {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t name[EXFAT_NAME_CHARS];
+} __attribute((packed));
+
+// Cluster numbers at or above this mark the end of a chain (FAT16 end markers
+// are translated to the FAT32 ones when the FAT is read)
+#define FAT_END_OF_CHAIN 0x0FFFFFF8
+
+// A run of contiguous clusters belonging to a file
+struct FatExtent {
+    uint32_t start_cluster;
+    uint32_t num_clusters;
+};
+
+// Directory entry attribute bits
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_LFN 0x0F   // Long filename entries set all of the low four bits
+#define FAT_ATTR_CONTIGUOUS 0x80    // Set on entries translated from exFAT whose clusters have no FAT chain (reserved on FAT)
+
+// Number of directory entries that fit in one sector
+#define FAT_ENTRIES_PER_SECTOR (SECTOR_SIZE / sizeof(struct Fat16Entry))
+
 // The type a file represents
 enum FatFileType { FAT_TYPE_UNUSED, FAT_TYPE_DELETED, FAT_TYPE_E5, FAT_TYPE_REGULAR, FAT_TYPE_FOLDER };
 
@@ -80,18 +259,69 @@ enum FatFileType { FAT_TYPE_UNUSED, FAT_TYPE_DELETED, FAT_TYPE_E5, FAT_TYPE_REGU
 struct FatFile {
     char filename[8];
     char ext[3];
-    uint16_t starting_cluster;
-    uint16_t cur_cluster;   // The cluster number of the cluster we're currently reading from
-    uint16_t num_clusters;   // How many clusters we've read through so far
+    uint32_t starting_cluster;
+    uint32_t cur_cluster;   // The cluster number of the cluster we're currently reading from
+    uint32_t num_clusters;   // How many clusters we've read through so far
     uint32_t cur_pos;   // Position within the current cluster in bytes
     uint32_t filesize;  // In bytes
     enum FatFileType type; // What type of file entry is this
     struct FatPartition * part; // Pointer to the partition this file is in
+    struct FatExtent extents[FAT_MAX_EXTENTS];  // Where the file lives, built when it's opened
+    uint8_t num_extents;
+    uint8_t cur_extent;     // The extent cur_cluster is in (num_extents once we're past the map)
+    uint32_t seek_index[FAT_SEEK_INDEX_SIZE];   // Cluster number of every seek_stride'th cluster
+    uint32_t seek_stride;
+    uint32_t walked_clusters;   // How much of the chain has been walked into the map and index
+    uint32_t walk_cluster;      // The last cluster walked
+    bool map_full;              // Whether the walk has gone past the last extent the map has room for
     // TODO: Add file type (unused, deleted, starts_e5, directory, regular)
 };
 
 enum SeekType {FAT_SEEK_CUR, FAT_SEEK_SET};
 
+// Part of a file read through to a set end (e.g. the data chunk of a WAV)
+struct FatStream {
+    struct FatFile * file;
+    uint32_t bytes_left;
+};
+
+// Remembers where a file's directory entry is so the file can be reopened later
+// The sector of the entry (counted from the start of the partition) is in the
+// top 28 bits and the entry within the sector is in the bottom 4. On exFAT
+// it's the Stream Extension entry that gets recorded.
+typedef uint32_t FatCatalogEntry;
+
+// Directory entries further than this into the partition can't be recorded
+#define FAT_CATALOG_MAX_SECTOR 0x0FFFFFFF
+
+#define FAT_CATALOG_ENTRY(sector, index) (((uint32_t)(sector) << 4) | ((index) & 0xF))
+#define FAT_CATALOG_SECTOR(entry) ((entry) >> 4)
+#define FAT_CATALOG_INDEX(entry) ((entry) & 0xF)
+
+// How deep into subdirectories GetFilesByExt will look (the root is depth zero)
+#define FAT_MAX_DEPTH 8
+
+// clusters_left value for directories whose clusters are found through the FAT
+#define FAT_DIR_CHAINED 0xFFFFFFFF
+
+// Where a directory iterator is, small enough to keep one per directory level
+struct FatDirPos {
+    uint32_t cluster;       // The cluster being read (zero for the fixed FAT16 root directory)
+    uint32_t sector;        // The next sector to read
+    uint32_t sectors_left;  // How many sectors of the cluster (or FAT16 root) haven't been read yet
+    uint32_t clusters_left; // Clusters after this one in a contiguous exFAT directory (or FAT_DIR_CHAINED)
+    uint8_t index;          // The next entry to return from buffer
+};
+
+// Walks through the entries of a directory one sector at a time
+struct FatDirIter {
+    struct FatPartition * part;
+    struct FatDirPos pos;
+    FatCatalogEntry location;   // Where the last returned entry is, zero if it can't be recorded
+    struct Fat16Entry buffer[SECTOR_SIZE / sizeof(struct Fat16Entry)];
+    struct Fat16Entry entry;    // exFAT entry sets translated to a FAT entry
+};
+
 // Takes in a pointer to a FatFile and returns how many bytes have currently been read/are left
 #define FILE_BYTES_READ(file) ((file->num_clusters * file->part->cluster_size) + file->cur_pos)
 #define FILE_BYTES_LEFT(file) (file->filesize - FILE_BYTES_READ(file))
@@ -99,13 +329,33 @@ enum SeekType {FAT_SEEK_CUR, FAT_SEEK_SET};
 // Takes in a pointer to a file and returns how many bytes are left in the current cluster
 #define FILE_CLUSTER_LEFT(file) (file->part->cluster_size - file->cur_pos)
 
+// Takes in a pointer to a FatDirIter and returns the catalog entry for the last entry it returned
+#define FAT_DIR_LOCATION(dir) ((dir)->location)
+
 // Function prototypes
 bool OpenFirstFatPartition(struct FatPartition * fat);
-uint16_t GetFilesByExt(struct FatPartition * fat, struct FatFile * files, uint16_t num_files, char * ext);
+uint16_t GetFilesByExt(struct FatPartition * fat, FatCatalogEntry * catalog, uint16_t num_files, char * exts[], uint8_t num_exts);
 bool Fat_open(struct FatPartition * fat, struct FatFile * file, char * filename, char * ext);
+uint32_t Fat_TreeChecksum(struct FatPartition * fat, uint32_t sum);
+void Fat_OpenCatalogEntry(struct FatPartition * fat, struct FatFile * file, FatCatalogEntry location);
+void Fat_ReadCatalogEntry(struct FatPartition * fat, FatCatalogEntry location, struct Fat16Entry * entry);
+uint32_t Fat_EntryCluster(struct FatPartition * fat, struct Fat16Entry * entry);
+void Fat_OpenEntry(struct FatPartition * fat, struct FatFile * file, struct Fat16Entry * entry);
+void Fat_OpenRoot(struct FatPartition * fat, struct FatDirIter * dir);
+void Fat_OpenDir(struct FatPartition * fat, struct FatDirIter * dir, uint32_t cluster);
+void Fat_OpenSubdir(struct FatPartition * fat, struct FatDirIter * dir, struct Fat16Entry * entry);
+void Fat_ResumeDir(struct FatDirIter * dir, struct FatDirPos * pos);
+struct Fat16Entry * Fat_NextEntry(struct FatDirIter * dir);
 uint32_t Fat_read(struct FatFile * file, void * buffer, uint32_t num_bytes);
 void Fat_seek(struct FatFile * file, uint32_t amount, enum SeekType type);
+void Fat_OpenStream(struct FatStream * stream, struct FatFile * file, uint32_t num_bytes);
+uint32_t Fat_StreamRead(struct FatStream * stream, void * buffer, uint32_t num_bytes);
 void ResetFile(struct FatFile * file);
+void Fat_OpenExtents(struct FatPartition * fat, struct FatFile * file, uint32_t filesize, struct FatExtent * extents, uint8_t num_extents);
+void Fat_MapFile(struct FatFile * file);
+bool Fat_CreateContiguous(struct FatPartition * fat, struct FatFile * file, char * filename, char * ext, uint32_t size);
+bool Fat_Delete(struct FatPartition * fat, char * filename, char * ext);
+uint32_t Fat_ClusterSector(struct FatPartition * fat, uint32_t cluster);
 
 #endif	/* FAT_H */
 
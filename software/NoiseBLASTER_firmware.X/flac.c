@@ -0,0 +1,822 @@
+/*
+ * File:   flac.c
+ *
+ * Created on October 17, 2026
+ *
+ * FLAC decoder, integer only and without a heap. The whole of the first
+ * channel of a block has to be decoded before any of it can be played (the
+ * second channel of a stereo frame comes after all of it), which is what
+ * most of the RAM goes on.
+ *
+ * The first channel is decoded into samples[] as 32 bit ints. The second
+ * is decoded FLAC_CHUNK_SIZE samples at a time into chunk[], behind the
+ * last FLAC_MAX_ORDER samples its predictor needs, and each chunk is joined
+ * with the first channel and packed down to 16 bit stereo over the top of
+ * it. A 16 bit stereo frame is the same size as one 32 bit sample, so the
+ * block ends up in samples[] ready to be sent.
+ *
+ * Decoding goes a chunk at a time as frames are asked for, and each chunk
+ * of the second channel can be sent as soon as it's joined. So only the
+ * first channel is decoded in one go (half a block, 46ms of audio at most
+ * at 44.1KHz), and the ring is topped up through the rest of the block
+ * rather than all at the end of it.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "flac.h"
+#include "wav.h"
+#include "fat.h"
+
+typedef int16_t __attribute__((may_alias)) flac_s16;
+
+#define FLAC_STREAMINFO_SIZE 34
+
+// Subframe types, as kept in FlacSubframe
+#define FLAC_SUBFRAME_CONSTANT 0
+#define FLAC_SUBFRAME_VERBATIM 1
+#define FLAC_SUBFRAME_FIXED 2
+#define FLAC_SUBFRAME_LPC 3
+
+// Channel assignments for stereo that's been decorrelated (0-7 are independent channels)
+#define FLAC_LEFT_SIDE 8
+#define FLAC_RIGHT_SIDE 9
+#define FLAC_MID_SIDE 10
+
+// Sample size codes in the frame header, 0 means the STREAMINFO one and 0xFF isn't allowed
+static const uint8_t flac_sample_sizes[8] = { 0, 8, 12, 0xFF, 16, 20, 24, 0xFF };
+
+#define FLAC_BE16(p) (((uint16_t)(p)[0] << 8) | (p)[1])
+#define FLAC_BE24(p) (((uint32_t)(p)[0] << 16) | ((uint32_t)(p)[1] << 8) | (p)[2])
+
+// Takes a sample of up to 24 bits, moved up to the top of an int32 first, down to 16 bits
+#define FLAC_TO_S16(x, up) ((int16_t)((int32_t)((uint32_t)(x) << (up)) >> 16))
+
+/**
+ * Tops the cache up to at least 25 bits, short only at the end of the stream
+ */
+static void Flac_Refill(struct FlacBitReader * br)
+{
+    while(br->cache_bits <= 24)
+    {
+        if(br->pos == br->len)
+        {
+            br->len = Fat_StreamRead(br->stream, br->buffer, SECTOR_SIZE);
+            br->pos = 0;
+
+            if(br->len == 0)
+                return;
+        }
+
+        br->cache |= (uint32_t)br->buffer[br->pos++] << (24 - br->cache_bits);
+        br->cache_bits += 8;
+    }
+}
+
+/**
+ * Reads up to 24 bits
+ *
+ * Past the end of the stream it reads zeros and sets overrun.
+ */
+static inline uint32_t Flac_ReadBits(struct FlacBitReader * br, uint8_t num_bits)
+{
+    uint32_t value;
+
+    if(num_bits == 0)
+        return 0;
+
+    if(br->cache_bits < num_bits)
+    {
+        Flac_Refill(br);
+
+        if(br->cache_bits < num_bits)
+        {
+            br->overrun = true;
+            br->cache_bits = num_bits;
+        }
+    }
+
+    value = br->cache >> (32 - num_bits);
+    br->cache <<= num_bits;
+    br->cache_bits -= num_bits;
+
+    return value;
+}
+
+/**
+ * Reads a two's complement number of up to 32 bits
+ */
+static int32_t Flac_ReadSigned(struct FlacBitReader * br, uint8_t num_bits)
+{
+    uint32_t value;
+
+    if(num_bits == 0)
+        return 0;
+
+    if(num_bits > 24)
+        value = (Flac_ReadBits(br, num_bits - 16) << 16) | Flac_ReadBits(br, 16);
+    else
+        value = Flac_ReadBits(br, num_bits);
+
+    return (int32_t)(value << (32 - num_bits)) >> (32 - num_bits);
+}
+
+/**
+ * Reads a Rice coded residual
+ *
+ * The quotient is unary (a run of zeros ended by a one), which the cache
+ * counts in one go. Bits below cache_bits are always zero, so a cache of
+ * zero means none of it has the one in.
+ */
+static inline int32_t Flac_ReadRice(struct FlacBitReader * br, uint8_t param)
+{
+    uint32_t quotient = 0, value;
+    uint8_t zeros;
+
+    while(br->cache == 0)
+    {
+        quotient += br->cache_bits;
+        br->cache_bits = 0;
+        Flac_Refill(br);
+
+        if(br->cache_bits == 0)
+        {
+            br->overrun = true;
+            return 0;
+        }
+    }
+
+    zeros = __builtin_clz(br->cache);
+    br->cache = (br->cache << zeros) << 1;
+    br->cache_bits -= zeros + 1;
+
+    if(param > 24)
+        value = ((quotient + zeros) << param) | (Flac_ReadBits(br, param - 16) << 16) | Flac_ReadBits(br, 16);
+    else
+        value = ((quotient + zeros) << param) | Flac_ReadBits(br, param);
+
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/**
+ * Finds the next frame and reads its header
+ *
+ * The header's CRC-8 is checked so that a run of audio that happens to look
+ * like a sync code isn't taken for a frame.
+ *
+ * @param dec The decoder, block_frames and bits_per_sample are set from the header
+ * @param assignment Set to the channel assignment
+ *
+ * @return False if there isn't a good frame header next
+ */
+static bool Flac_ReadFrameHeader(struct FlacDecoder * dec, uint8_t * assignment)
+{
+    struct FlacBitReader * br = &dec->reader;
+    uint8_t header[16];
+    uint8_t len = 2, extra, code, crc, i;
+
+    // Frames start on a byte
+    br->cache <<= br->cache_bits & 7;
+    br->cache_bits &= ~7;
+
+    header[1] = Flac_ReadBits(br, 8);
+    do
+    {
+        header[0] = header[1];
+        header[1] = Flac_ReadBits(br, 8);
+
+        if(br->overrun)
+            return false;
+    } while(header[0] != 0xFF || (header[1] & 0xFE) != 0xF8);
+
+    header[len++] = Flac_ReadBits(br, 8);
+    header[len++] = Flac_ReadBits(br, 8);
+
+    // The frame (or sample) number, UTF-8 style, isn't needed but has to be read past
+    header[len] = Flac_ReadBits(br, 8);
+    for(extra = 0; extra < 8 && (header[len] & (0x80 >> extra)); extra++) { }
+    if(extra == 1 || extra == 8)
+        return false;
+    for(len++, extra = (extra == 0) ? 0 : extra - 1; extra > 0; extra--)
+        header[len++] = Flac_ReadBits(br, 8);
+
+    // Block size
+    code = header[2] >> 4;
+    if(code == 0)
+        return false;
+    else if(code == 1)
+        dec->block_frames = 192;
+    else if(code <= 5)
+        dec->block_frames = 576 << (code - 2);
+    else if(code == 6)
+    {
+        header[len] = Flac_ReadBits(br, 8);
+        dec->block_frames = header[len++] + 1;
+    }
+    else if(code == 7)
+    {
+        header[len] = Flac_ReadBits(br, 8);
+        header[len + 1] = Flac_ReadBits(br, 8);
+        dec->block_frames = FLAC_BE16(&header[len]) + 1;
+        len += 2;
+    }
+    else
+        dec->block_frames = 256 << (code - 8);
+
+    // Sample rate, which comes from STREAMINFO, but it may have more bytes
+    code = header[2] & 0xF;
+    if(code == 15)
+        return false;
+    for(extra = (code == 12) ? 1 : ((code >= 13) ? 2 : 0); extra > 0; extra--)
+        header[len++] = Flac_ReadBits(br, 8);
+
+    crc = 0;
+    for(i = 0; i < len; i++)
+    {
+        crc ^= header[i];
+        for(extra = 0; extra < 8; extra++)
+            crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+    }
+    if(crc != Flac_ReadBits(br, 8) || br->overrun)
+        return false;
+
+    *assignment = header[3] >> 4;
+    if(*assignment > FLAC_MID_SIDE || (*assignment < FLAC_LEFT_SIDE && *assignment + 1 != dec->channels) ||
+            (*assignment >= FLAC_LEFT_SIDE && dec->channels != 2))
+        return false;
+
+    code = flac_sample_sizes[(header[3] >> 1) & 7];
+    if(code == 0xFF)
+        return false;
+    if(code != 0)
+        dec->bits_per_sample = code;
+
+    return dec->block_frames <= FLAC_MAX_BLOCK_SIZE;
+}
+
+/**
+ * Reads a subframe's header, up to the first of its residuals
+ *
+ * @param dec The decoder, with the frame header read
+ * @param sf Where to keep the subframe's details
+ * @param bits Bits in each of its samples (one more for a side channel)
+ * @param warmup Where its first samples go (as many as the predictor's order)
+ *
+ * @return False if the subframe can't be decoded
+ */
+static bool Flac_ReadSubframeHeader(struct FlacDecoder * dec, struct FlacSubframe * sf, uint8_t bits, int32_t * warmup)
+{
+    struct FlacBitReader * br = &dec->reader;
+    uint8_t type = Flac_ReadBits(br, 8);
+    uint8_t precision, i;
+
+    if(type & 0x80)
+        return false;
+
+    // Low bits that are zero in every sample, given as a unary count
+    sf->wasted_bits = 0;
+    if(type & 1)
+    {
+        for(sf->wasted_bits = 1; Flac_ReadBits(br, 1) == 0; sf->wasted_bits++)
+        {
+            if(br->overrun || sf->wasted_bits >= bits)
+                return false;
+        }
+    }
+
+    sf->bits = bits - sf->wasted_bits;
+    sf->order = 0;
+    type >>= 1;
+
+    if(type == 0)
+    {
+        sf->type = FLAC_SUBFRAME_CONSTANT;
+        sf->value = Flac_ReadSigned(br, sf->bits);
+        return !br->overrun;
+    }
+    else if(type == 1)
+    {
+        sf->type = FLAC_SUBFRAME_VERBATIM;
+        return !br->overrun;
+    }
+    else if((type & 0x38) == 0x08 && (type & 7) <= 4)
+    {
+        sf->type = FLAC_SUBFRAME_FIXED;
+        sf->order = type & 7;
+    }
+    else if(type & 0x20)
+    {
+        sf->type = FLAC_SUBFRAME_LPC;
+        sf->order = (type & 0x1F) + 1;
+    }
+    else
+        return false;
+
+    if(sf->order > dec->block_frames)
+        return false;
+
+    for(i = 0; i < sf->order; i++)
+        warmup[i] = Flac_ReadSigned(br, sf->bits);
+
+    if(sf->type == FLAC_SUBFRAME_LPC)
+    {
+        precision = Flac_ReadBits(br, 4) + 1;
+        sf->shift = Flac_ReadSigned(br, 5);
+        if(precision > 15 || sf->shift < 0)
+            return false;
+
+        for(i = 0; i < sf->order; i++)
+            sf->coefs[i] = Flac_ReadSigned(br, precision);
+    }
+
+    // Rice parameters are 4 bits, or 5 for streams that need big ones
+    switch(Flac_ReadBits(br, 2))
+    {
+        case 0:
+            sf->param_bits = 4;
+            break;
+        case 1:
+            sf->param_bits = 5;
+            break;
+        default:
+            return false;
+    }
+
+    // The block is split into 2^order partitions, the first less the warm up samples
+    sf->partition_order = Flac_ReadBits(br, 4);
+    sf->partitions_done = 0;
+    sf->partition_left = 0;
+    if((dec->block_frames & ((1 << sf->partition_order) - 1)) != 0 ||
+            (dec->block_frames >> sf->partition_order) < sf->order)
+        return false;
+
+    return !br->overrun;
+}
+
+/**
+ * Reads residuals, carrying on from wherever the last call got to
+ */
+static bool Flac_ReadResidual(struct FlacDecoder * dec, struct FlacSubframe * sf, int32_t * out, uint16_t count)
+{
+    struct FlacBitReader * br = &dec->reader;
+    uint16_t n;
+
+    while(count > 0)
+    {
+        if(sf->partition_left == 0)
+        {
+            if(sf->partitions_done == (1 << sf->partition_order))
+                return false;
+
+            // The biggest parameter means the partition is raw numbers of the width that follows
+            sf->rice_param = Flac_ReadBits(br, sf->param_bits);
+            sf->escape_bits = 0xFF;
+            if(sf->rice_param == (1 << sf->param_bits) - 1)
+                sf->escape_bits = Flac_ReadBits(br, 5);
+
+            sf->partition_left = (dec->block_frames >> sf->partition_order) - ((sf->partitions_done == 0) ? sf->order : 0);
+            sf->partitions_done++;
+            continue;
+        }
+
+        n = (count < sf->partition_left) ? count : sf->partition_left;
+        count -= n;
+        sf->partition_left -= n;
+
+        if(sf->escape_bits == 0xFF)
+        {
+            while(n-- > 0)
+                *out++ = Flac_ReadRice(br, sf->rice_param);
+        }
+        else
+        {
+            while(n-- > 0)
+                *out++ = Flac_ReadSigned(br, sf->escape_bits);
+        }
+    }
+
+    return !br->overrun;
+}
+
+/**
+ * Turns residuals into samples
+ *
+ * The LPC sum is kept in 64 bits so it can't overflow whatever the bit
+ * depth and precision, which costs nothing extra on the M4K as MADD
+ * accumulates into 64 bits anyway.
+ *
+ * @param sf The subframe
+ * @param out The residuals, replaced with the samples. The samples before
+ * the first one (as many as the order) have to be just before it.
+ * @param count How many there are
+ */
+static void Flac_Predict(const struct FlacSubframe * sf, int32_t * out, uint16_t count)
+{
+    const int32_t * history;
+    int64_t sum;
+    uint16_t i;
+    uint8_t k;
+
+    if(sf->type == FLAC_SUBFRAME_LPC)
+    {
+        for(i = 0; i < count; i++)
+        {
+            history = out + i;
+            sum = 0;
+
+            for(k = 0; k < sf->order; k++)
+                sum += (int64_t)sf->coefs[k] * history[-1 - k];
+
+            out[i] += (int32_t)(sum >> sf->shift);
+        }
+
+        return;
+    }
+
+    // The fixed predictors are polynomials through the last few samples
+    switch(sf->order)
+    {
+        case 1:
+            for(i = 0; i < count; i++)
+                out[i] += out[i - 1];
+            break;
+        case 2:
+            for(i = 0; i < count; i++)
+                out[i] += (2 * out[i - 1]) - out[i - 2];
+            break;
+        case 3:
+            for(i = 0; i < count; i++)
+                out[i] += (3 * (out[i - 1] - out[i - 2])) + out[i - 3];
+            break;
+        case 4:
+            for(i = 0; i < count; i++)
+                out[i] += (4 * (out[i - 1] + out[i - 3])) - (6 * out[i - 2]) - out[i - 4];
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Decodes the next samples of a subframe, after its warm up samples
+ *
+ * @param dec The decoder
+ * @param sf The subframe, with its header read
+ * @param out Where the samples go, just after the ones before them
+ * @param count How many to decode
+ */
+static bool Flac_DecodeSamples(struct FlacDecoder * dec, struct FlacSubframe * sf, int32_t * out, uint16_t count)
+{
+    struct FlacBitReader * br = &dec->reader;
+
+    switch(sf->type)
+    {
+        case FLAC_SUBFRAME_CONSTANT:
+            while(count-- > 0)
+                *out++ = sf->value;
+            break;
+        case FLAC_SUBFRAME_VERBATIM:
+            while(count-- > 0)
+                *out++ = Flac_ReadSigned(br, sf->bits);
+            break;
+        default:
+            if(!Flac_ReadResidual(dec, sf, out, count))
+                return false;
+            Flac_Predict(sf, out, count);
+            break;
+    }
+
+    return !br->overrun;
+}
+
+/**
+ * Joins a chunk of the second channel with the first and packs them into 16 bit stereo
+ *
+ * @param dec The decoder, with the chunk decoded
+ * @param assignment How the channels were decorrelated
+ * @param pos Frame of the block the chunk starts at
+ * @param count Frames in the chunk
+ */
+static void Flac_JoinChunk(struct FlacDecoder * dec, uint8_t assignment, uint16_t pos, uint16_t count)
+{
+    const int32_t * first = dec->samples + pos;
+    const int32_t * second = dec->chunk + FLAC_MAX_ORDER;
+    flac_s16 * out = (flac_s16 *)(dec->samples + pos);
+    const uint8_t wasted0 = dec->subframes[0].wasted_bits;
+    const uint8_t wasted1 = dec->subframes[1].wasted_bits;
+    const uint8_t up = 32 - dec->bits_per_sample;
+    int32_t a, b, mid;
+    uint16_t i;
+
+    // Each frame is read before it's written over, so it can all be done in place
+    switch(assignment)
+    {
+        case FLAC_LEFT_SIDE:
+            for(i = 0; i < count; i++)
+            {
+                a = first[i] << wasted0;
+                b = second[i] << wasted1;
+                out[2 * i] = FLAC_TO_S16(a, up);
+                out[(2 * i) + 1] = FLAC_TO_S16(a - b, up);
+            }
+            break;
+        case FLAC_RIGHT_SIDE:
+            for(i = 0; i < count; i++)
+            {
+                a = first[i] << wasted0;
+                b = second[i] << wasted1;
+                out[2 * i] = FLAC_TO_S16(a + b, up);
+                out[(2 * i) + 1] = FLAC_TO_S16(b, up);
+            }
+            break;
+        case FLAC_MID_SIDE:
+            for(i = 0; i < count; i++)
+            {
+                b = second[i] << wasted1;
+                mid = ((first[i] << wasted0) << 1) | (b & 1);
+                out[2 * i] = FLAC_TO_S16((mid + b) >> 1, up);
+                out[(2 * i) + 1] = FLAC_TO_S16((mid - b) >> 1, up);
+            }
+            break;
+        default:
+            for(i = 0; i < count; i++)
+            {
+                a = first[i] << wasted0;
+                b = second[i] << wasted1;
+                out[2 * i] = FLAC_TO_S16(a, up);
+                out[(2 * i) + 1] = FLAC_TO_S16(b, up);
+            }
+            break;
+    }
+}
+
+/**
+ * Reads the next frame's header and its first subframe's, ready to decode
+ *
+ * @return False if the frame is bad (or there isn't one)
+ */
+static bool Flac_StartFrame(struct FlacDecoder * dec)
+{
+    struct FlacSubframe * sf = &dec->subframes[0];
+
+    if(!Flac_ReadFrameHeader(dec, &dec->assignment))
+        return false;
+
+    // The side channel has an extra bit
+    if(!Flac_ReadSubframeHeader(dec, sf, dec->bits_per_sample + (dec->assignment == FLAC_RIGHT_SIDE), dec->samples))
+        return false;
+
+    dec->decoded = sf->order;
+    dec->stage = FLAC_STAGE_FIRST;
+
+    return true;
+}
+
+/**
+ * Decodes the next FLAC_CHUNK_SIZE samples of the block, or as many as are left
+ *
+ * Stereo frames come out joined a chunk at a time once the whole of the
+ * first channel is in, so they can be sent while the rest of the second
+ * channel is still to decode.
+ *
+ * @return False if the frame is bad
+ */
+static bool Flac_DecodeChunk(struct FlacDecoder * dec)
+{
+    struct FlacSubframe * sf;
+    int32_t * history = dec->chunk + FLAC_MAX_ORDER;
+    flac_s16 * out = (flac_s16 *)dec->samples;
+    uint16_t n, i;
+    uint8_t up;
+
+    n = dec->block_frames - dec->decoded;
+    if(n > FLAC_CHUNK_SIZE)
+        n = FLAC_CHUNK_SIZE;
+
+    if(dec->stage == FLAC_STAGE_FIRST)
+    {
+        sf = &dec->subframes[0];
+        if(!Flac_DecodeSamples(dec, sf, dec->samples + dec->decoded, n))
+            return false;
+
+        dec->decoded += n;
+        if(dec->decoded < dec->block_frames)
+            return true;
+
+        if(dec->channels == 1)
+        {
+            up = 32 - dec->bits_per_sample + sf->wasted_bits;
+            for(i = 0; i < dec->block_frames; i++)
+                out[2 * i] = out[(2 * i) + 1] = FLAC_TO_S16(dec->samples[i], up);
+        }
+        else
+        {
+            sf = &dec->subframes[1];
+            if(!Flac_ReadSubframeHeader(dec, sf, dec->bits_per_sample + (dec->assignment == FLAC_LEFT_SIDE || dec->assignment == FLAC_MID_SIDE), history))
+                return false;
+
+            dec->decoded = 0;
+            dec->stage = FLAC_STAGE_SECOND;
+            return true;
+        }
+    }
+    else
+    {
+        sf = &dec->subframes[1];
+
+        // The first chunk starts with the warm up samples
+        i = (dec->decoded == 0) ? sf->order : 0;
+        if(!Flac_DecodeSamples(dec, sf, history + i, n - i))
+            return false;
+
+        Flac_JoinChunk(dec, dec->assignment, dec->decoded, n);
+
+        // Keep what the predictor needs of this chunk for the next one
+        if(n >= sf->order)
+            memcpy(history - sf->order, history + n - sf->order, sf->order * sizeof(int32_t));
+
+        dec->decoded += n;
+        if(dec->decoded < dec->block_frames)
+            return true;
+    }
+
+    // Then there's padding to a byte and a CRC-16 of the frame, which isn't checked
+    Flac_ReadBits(&dec->reader, dec->reader.cache_bits & 7);
+    Flac_ReadBits(&dec->reader, 16);
+
+    dec->decoded = dec->block_frames;
+    dec->stage = FLAC_STAGE_DONE;
+
+    return !dec->reader.overrun;
+}
+
+/**
+ * Reads a FLAC file's metadata
+ *
+ * Leaves the file at the first frame.
+ *
+ * @param file The file, from anywhere in it
+ * @param info Set to the stream's format, with the frames as the data
+ *
+ * @return False if it isn't FLAC that can be played
+ */
+bool Flac_ReadInfo(struct FatFile * file, struct WavInfo * info)
+{
+    uint8_t block[FLAC_STREAMINFO_SIZE];
+    uint32_t pos = 4, size;
+    uint16_t max_block_size = 0;
+    bool last = false;
+
+    memset(info, 0, sizeof(struct WavInfo));
+
+    ResetFile(file);
+    if(Fat_read(file, block, 10) != 10)
+        return false;
+
+    // Tagging tools sometimes put an ID3v2 tag in front (the size is 7 bits a byte)
+    if(memcmp(block, "ID3", 3) == 0)
+    {
+        pos = 10 + (((uint32_t)block[6] << 21) | ((uint32_t)block[7] << 14) | (block[8] << 7) | block[9]);
+        if(block[5] & 0x10)
+            pos += 10;
+
+        if(pos + 4 > file->filesize)
+            return false;
+
+        Fat_seek(file, pos, FAT_SEEK_SET);
+        Fat_read(file, block, 4);
+        pos += 4;
+    }
+    else
+        Fat_seek(file, pos, FAT_SEEK_SET);
+
+    if(memcmp(block, "fLaC", 4) != 0)
+        return false;
+
+    // Metadata blocks, only STREAMINFO (always first) is needed
+    while(!last)
+    {
+        if(pos + 4 > file->filesize || Fat_read(file, block, 4) != 4)
+            return false;
+
+        last = (block[0] & 0x80) != 0;
+        size = FLAC_BE24(block + 1);
+        pos += 4;
+
+        if(size > file->filesize - pos)
+            return false;
+
+        if((block[0] & 0x7F) == 0 && size >= FLAC_STREAMINFO_SIZE)
+        {
+            if(Fat_read(file, block, FLAC_STREAMINFO_SIZE) != FLAC_STREAMINFO_SIZE)
+                return false;
+
+            max_block_size = FLAC_BE16(block + 2);
+            info->sample_rate = ((uint32_t)block[10] << 12) | ((uint32_t)block[11] << 4) | (block[12] >> 4);
+            info->channels = ((block[12] >> 1) & 7) + 1;
+            info->bits_per_sample = (((block[12] & 1) << 4) | (block[13] >> 4)) + 1;
+
+            // The total is 36 bits, anything past 32 is left as unknown
+            if((block[13] & 0xF) == 0)
+                info->frames = ((uint32_t)block[14] << 24) | FLAC_BE24(block + 15);
+
+            size -= FLAC_STREAMINFO_SIZE;
+            pos += FLAC_STREAMINFO_SIZE;
+        }
+
+        if(size > 0)
+            Fat_seek(file, size, FAT_SEEK_CUR);
+        pos += size;
+    }
+
+    if(info->sample_rate == 0 || info->channels > 2 || info->bits_per_sample < 4 ||
+            info->bits_per_sample > FLAC_MAX_BITS_PER_SAMPLE || max_block_size > FLAC_MAX_BLOCK_SIZE)
+        return false;
+
+    info->format = WAV_FORMAT_FLAC;
+    info->valid_bits = info->bits_per_sample;
+    info->data_offset = pos;
+    info->data_size = file->filesize - pos;
+
+    return true;
+}
+
+/**
+ * Sets a decoder up for a track
+ *
+ * @param dec The decoder
+ * @param info The track's format, from Flac_ReadInfo
+ */
+void Flac_Init(struct FlacDecoder * dec, const struct WavInfo * info)
+{
+    dec->channels = info->channels;
+    dec->bits_per_sample = info->bits_per_sample;
+    dec->block_frames = 0;
+    dec->frame = 0;
+    dec->decoded = 0;
+    dec->stage = FLAC_STAGE_HEADER;
+
+    memset(&dec->reader, 0, sizeof(dec->reader) - sizeof(dec->reader.buffer));
+}
+
+/**
+ * Decodes frames from a track into 16 bit stereo, decoding blocks as needed
+ *
+ * A frame that's damaged is skipped over.
+ *
+ * @param dec The track's decoder
+ * @param stream The track's frames
+ * @param out Where to put the frames
+ * @param num_frames The most frames to decode
+ *
+ * @return How many frames were decoded, short only at the end of the track
+ */
+uint32_t Flac_Read(struct FlacDecoder * dec, struct FatStream * stream, int16_t * out, uint32_t num_frames)
+{
+    uint32_t made = 0, count;
+    uint16_t ready;
+    bool good;
+
+    dec->reader.stream = stream;
+
+    while(made < num_frames)
+    {
+        // Frames can be sent as soon as they're joined, the first channel has to be decoded ahead
+        ready = (dec->stage >= FLAC_STAGE_SECOND) ? dec->decoded : 0;
+
+        if(dec->frame == ready)
+        {
+            if(dec->stage == FLAC_STAGE_DONE)
+            {
+                dec->stage = FLAC_STAGE_HEADER;
+                dec->frame = 0;
+            }
+
+            good = (dec->stage == FLAC_STAGE_HEADER) ? Flac_StartFrame(dec) : Flac_DecodeChunk(dec);
+            if(!good)
+            {
+                // What's left of the frame is lost, decoding starts again from the next one
+                dec->stage = FLAC_STAGE_HEADER;
+                dec->frame = 0;
+
+                if(dec->reader.overrun)
+                    return made;
+            }
+
+            continue;
+        }
+
+        count = ready - dec->frame;
+        if(count > num_frames - made)
+            count = num_frames - made;
+
+        memcpy(out, dec->samples + dec->frame, count * sizeof(int32_t));
+
+        dec->frame += count;
+        out += count * 2;
+        made += count;
+    }
+
+    return made;
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+/*
+ * File:   flac.h
+ *
+ * Created on October 17, 2026
+ */
+
+#ifndef FLAC_H
+#define	FLAC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "wav.h"
+#include "fat.h"
+#include "sd.h"
+
+// Biggest block that can be played, the most the streamable subset allows
+// up to 48KHz (and what encoders use)
+#define FLAC_MAX_BLOCK_SIZE 4608
+
+#define FLAC_MAX_ORDER 32
+#define FLAC_MAX_BITS_PER_SAMPLE 24
+
+// Each channel is decoded this many samples at a time, so no call takes
+// much longer than a block of the ring
+#define FLAC_CHUNK_SIZE 128
+
+// How far through its block a decoder is
+#define FLAC_STAGE_HEADER 0     // Needs the next frame's header
+#define FLAC_STAGE_FIRST 1      // Decoding the first channel
+#define FLAC_STAGE_SECOND 2     // Decoding the second, what's joined of it can be sent
+#define FLAC_STAGE_DONE 3       // All decoded, waiting to be sent
+
+// Feeds a frame's bits from the stream, a sector at a time
+struct FlacBitReader {
+    struct FatStream * stream;
+    uint32_t cache;             // Next bits, from the top bit down
+    uint8_t cache_bits;
+    bool overrun;               // Read past the end of the stream
+    uint16_t pos;               // Next byte of buffer to go in the cache
+    uint16_t len;
+    uint8_t buffer[SECTOR_SIZE];
+};
+
+// A channel of the frame being decoded
+struct FlacSubframe {
+    uint8_t type;
+    uint8_t bits;               // Bits in each sample, after wasted bits are taken off
+    uint8_t wasted_bits;
+    uint8_t order;              // Warm up samples before the predictor runs
+    int8_t shift;               // Of the LPC sum
+    int32_t value;              // Of a constant subframe
+    int16_t coefs[FLAC_MAX_ORDER];
+
+    // Where the residual is up to
+    uint8_t param_bits;         // 4 or 5
+    uint8_t partition_order;
+    uint16_t partitions_done;
+    uint16_t partition_left;    // Residuals left in this partition
+    uint8_t rice_param;
+    uint8_t escape_bits;        // Width of raw residuals (escaped partition), 0xFF if Rice coded
+};
+
+// Decodes FLAC a frame at a time
+struct FlacDecoder {
+    uint8_t channels;
+    uint8_t bits_per_sample;
+    uint16_t block_frames;      // Frames in the block that's decoded
+    uint16_t frame;             // Next frame of it to send
+    uint16_t decoded;           // Samples of the channel being decoded that are done
+    uint8_t stage;
+    uint8_t assignment;         // How the block's channels were decorrelated
+
+    struct FlacBitReader reader;
+    struct FlacSubframe subframes[2];
+
+    // The first channel of a block as it's decoded, then the whole block as
+    // 16 bit stereo in the same place
+    int32_t samples[FLAC_MAX_BLOCK_SIZE];
+
+    // The second channel, the last FLAC_MAX_ORDER samples and then the chunk being decoded
+    int32_t chunk[FLAC_MAX_ORDER + FLAC_CHUNK_SIZE];
+};
+
+bool Flac_ReadInfo(struct FatFile * file, struct WavInfo * info);
+void Flac_Init(struct FlacDecoder * dec, const struct WavInfo * info);
+uint32_t Flac_Read(struct FlacDecoder * dec, struct FatStream * stream, int16_t * out, uint32_t num_frames);
+
+#endif	/* FLAC_H */
+
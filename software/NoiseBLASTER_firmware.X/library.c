@@ -0,0 +1,265 @@
+/*
+ * File:   library.c
+ *
+ * Created on October 17, 2026
+ *
+ * Keeps the result of scanning the card in NBINDEX.BIN in the root
+ * directory, so a boot can load it instead of scanning again. The file is
+ * one contiguous run of clusters, read and written a sector at a time:
+ *
+ *   - a header sector (struct LibraryHeader), with the stamp of the card's
+ *     directories it was written against
+ *   - the catalog, one FatCatalogEntry a track, exactly as GetFilesByExt
+ *     left it
+ *   - a 64 byte struct LibraryRecord a track, LIBRARY_RECORDS_PER_SECTOR to
+ *     a sector, holding its size and first LIBRARY_MAX_EXTENTS extents so
+ *     it opens without walking the FAT
+ *
+ * The index is only trusted while the stamp still matches, see
+ * Library_Stamp.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "library.h"
+#include "fat.h"
+#include "sd.h"
+
+// Function prototypes
+static uint32_t Library_Stamp(struct FatPartition * fat);
+
+/**
+ * Finds the index file in the root directory, creating it if it isn't there
+ * 
+ * The index file is always one contiguous run of clusters so it can be read
+ * and written with plain sector arithmetic. One that isn't (the wrong size,
+ * or copied onto the card in pieces) is deleted and made again, otherwise
+ * every boot would rescan without ever fixing it. exFAT cards don't get an
+ * index.
+ * 
+ * @param library The index to set up
+ * @param fat The partition the index is on
+ * @param max_files How many tracks the index needs room for
+ * 
+ * @return False if there's no usable index file (every boot will rescan)
+ */
+bool Library_Open(struct LibraryIndex * library, struct FatPartition * fat, uint16_t max_files)
+{
+    struct FatFile file;
+    uint32_t sector[SECTOR_SIZE / sizeof(uint32_t)];
+    uint32_t size = LIBRARY_SIZE(max_files);
+
+    library->part = fat;
+    library->start_sector = 0;
+    library->max_files = max_files;
+    library->records_valid = false;
+
+    if(fat->fs_type == FAT_FS_EXFAT)
+        return false;
+
+    if(Fat_open(fat, &file, LIBRARY_FILENAME, LIBRARY_EXT))
+    {
+        // Made for a different MAX_FILES, or it was copied onto the card in pieces
+        Fat_MapFile(&file);
+        if(file.filesize == size && file.num_extents == 1 &&
+                file.extents[0].num_clusters * fat->cluster_size >= size)
+        {
+            library->start_sector = Fat_ClusterSector(fat, file.starting_cluster);
+            return true;
+        }
+
+        if(!Fat_Delete(fat, LIBRARY_FILENAME, LIBRARY_EXT))
+            return false;
+    }
+
+    if(!Fat_CreateContiguous(fat, &file, LIBRARY_FILENAME, LIBRARY_EXT, size))
+        return false;
+
+    // The new clusters hold whatever was there before, make sure the
+    // header can't pass for a valid one
+    memset(sector, 0, SECTOR_SIZE);
+    SD_WriteSector((uint8_t *)sector, Fat_ClusterSector(fat, file.starting_cluster));
+
+    library->start_sector = Fat_ClusterSector(fat, file.starting_cluster);
+    return true;
+}
+
+/**
+ * Loads the catalog from the index file if it still matches the card
+ * 
+ * The header is checked first, then the card's stamp is worked out and
+ * compared with the one the index was written with. If they match, the
+ * catalog comes straight off the card in one multi-block read.
+ * 
+ * @param library The index (from Library_Open)
+ * @param catalog Where to put the catalog
+ * @param num_files Set to the number of tracks in the catalog
+ * 
+ * @return False if the card has to be scanned again
+ */
+bool Library_Load(struct LibraryIndex * library, FatCatalogEntry * catalog, uint16_t * num_files)
+{
+    struct LibraryHeader header;
+
+    if(library->start_sector == 0)
+        return false;
+
+    SD_ReadData(&header, (uint64_t)library->start_sector * SECTOR_SIZE, sizeof(struct LibraryHeader));
+
+    if(header.magic != LIBRARY_MAGIC || header.version != LIBRARY_VERSION ||
+            header.record_size != LIBRARY_RECORD_SIZE || header.max_files != library->max_files ||
+            header.num_files > library->max_files)
+        return false;
+
+    if(header.stamp != Library_Stamp(library->part))
+        return false;
+
+    SD_ReadData(catalog, (uint64_t)(library->start_sector + 1) * SECTOR_SIZE, header.num_files * sizeof(FatCatalogEntry));
+    *num_files = header.num_files;
+    library->records_valid = true;
+
+    return true;
+}
+
+/**
+ * Writes the catalog and a record for every track to the index file
+ * 
+ * The header is cleared first and written last, so an index that was only
+ * partly written is never trusted. Every track is opened once here to find
+ * its extents, which is what saves walking the FAT on later boots.
+ * 
+ * @param library The index (from Library_Open), nothing is written if there isn't one
+ * @param catalog The catalog from GetFilesByExt
+ * @param num_files How many tracks are in the catalog
+ */
+void Library_Save(struct LibraryIndex * library, FatCatalogEntry * catalog, uint16_t num_files)
+{
+    struct FatFile file;
+    uint32_t sector[SECTOR_SIZE / sizeof(uint32_t)];
+    struct LibraryRecord * records = (struct LibraryRecord *)sector;
+    struct LibraryHeader * header = (struct LibraryHeader *)sector;
+    uint32_t catalog_start = library->start_sector + 1;
+    uint32_t records_start = catalog_start + LIBRARY_CATALOG_SECTORS(library->max_files);
+    uint32_t full_sectors = (num_files * sizeof(FatCatalogEntry)) / SECTOR_SIZE;
+    uint32_t tail = (num_files * sizeof(FatCatalogEntry)) % SECTOR_SIZE;
+    uint32_t stamp, covered;
+    uint16_t i;
+    uint8_t k, e;
+
+    library->records_valid = false;
+
+    if(library->start_sector == 0 || num_files > library->max_files)
+        return;
+
+    stamp = Library_Stamp(library->part);
+
+    memset(sector, 0, SECTOR_SIZE);
+    if(!SD_WriteSector((uint8_t *)sector, library->start_sector))
+        return;
+
+    // Whole sectors of the catalog go straight from the array, the last one is padded
+    if(full_sectors > 0)
+        SD_WriteMultiSectors((const uint8_t (*)[SECTOR_SIZE])catalog, catalog_start, full_sectors);
+
+    if(tail > 0)
+    {
+        memset(sector, 0, SECTOR_SIZE);
+        memcpy(sector, (uint8_t *)catalog + (full_sectors * SECTOR_SIZE), tail);
+        SD_WriteSector((uint8_t *)sector, catalog_start + full_sectors);
+    }
+
+    for(i = 0; i < num_files; ++i)
+    {
+        k = i % LIBRARY_RECORDS_PER_SECTOR;
+        if(k == 0)
+            memset(sector, 0, SECTOR_SIZE);
+
+        Fat_OpenCatalogEntry(library->part, &file, catalog[i]);
+        Fat_MapFile(&file);
+
+        records[k].filesize = file.filesize;
+        records[k].num_extents = file.num_extents;
+
+        // Only worth using if the extent map has the whole file in it
+        covered = 0;
+        for(e = 0; e < file.num_extents && e < LIBRARY_MAX_EXTENTS; ++e)
+        {
+            records[k].extents[e] = file.extents[e];
+            covered += file.extents[e].num_clusters;
+        }
+        records[k].complete = (file.num_extents <= LIBRARY_MAX_EXTENTS &&
+                (uint64_t)covered * library->part->cluster_size >= file.filesize);
+
+        if(k == LIBRARY_RECORDS_PER_SECTOR - 1 || i == num_files - 1)
+            SD_WriteSector((uint8_t *)sector, records_start + (i / LIBRARY_RECORDS_PER_SECTOR));
+    }
+
+    memset(sector, 0, SECTOR_SIZE);
+    header->magic = LIBRARY_MAGIC;
+    header->version = LIBRARY_VERSION;
+    header->record_size = LIBRARY_RECORD_SIZE;
+    header->max_files = library->max_files;
+    header->num_files = num_files;
+    header->stamp = stamp;
+
+    library->records_valid = SD_WriteSector((uint8_t *)sector, library->start_sector);
+}
+
+/**
+ * Opens a track from the catalog, using its record in the index when there
+ * is one so the FAT doesn't have to be walked
+ * 
+ * @param library The index
+ * @param file The file to fill in
+ * @param catalog The catalog
+ * @param track Which track in the catalog to open
+ */
+void Library_OpenTrack(struct LibraryIndex * library, struct FatFile * file, FatCatalogEntry * catalog, uint16_t track)
+{
+    struct LibraryRecord record;
+    struct Fat16Entry entry;
+    uint32_t records_start = library->start_sector + 1 + LIBRARY_CATALOG_SECTORS(library->max_files);
+    uint32_t first_cluster;
+
+    Fat_ReadCatalogEntry(library->part, catalog[track], &entry);
+
+    if(library->records_valid && track < library->max_files)
+    {
+        SD_ReadCached(&record, ((uint64_t)records_start * SECTOR_SIZE) + (track * LIBRARY_RECORD_SIZE), sizeof(struct LibraryRecord));
+        first_cluster = (record.num_extents > 0) ? record.extents[0].start_cluster : 0;
+
+        // The record is only used if the directory entry still agrees with
+        // it, so a file changed since the stamp was checked is walked afresh
+        if(record.complete && record.num_extents <= FAT_MAX_EXTENTS &&
+                record.filesize == entry.filesize && first_cluster == Fat_EntryCluster(library->part, &entry))
+        {
+            Fat_OpenExtents(library->part, file, record.filesize, record.extents, record.num_extents);
+            return;
+        }
+    }
+
+    Fat_OpenEntry(library->part, file, &entry);
+}
+
+/**
+ * Works out a stamp that changes whenever anything in a directory the
+ * catalog could come from changes
+ * 
+ * Every entry of every directory GetFilesByExt would look through goes into
+ * it, so renaming, moving, adding, removing or rewriting a file anywhere in
+ * the tree is caught. It costs the same directory reads as a scan but
+ * nothing is matched or opened, and the FAT isn't read.
+ * 
+ * @param fat The partition
+ * 
+ * @return The stamp
+ */
+static uint32_t Library_Stamp(struct FatPartition * fat)
+{
+    uint32_t sum = fat->fs_type;
+
+    sum = (sum * 31) + ((fat->fs_type == FAT_FS_FAT32) ? fat->boot32.volume_id : fat->boot.volume_id);
+
+    return Fat_TreeChecksum(fat, sum);
+}
@@ -0,0 +1,75 @@
+/* 
+ * File:   library.h
+ *
+ * Created on October 17, 2026
+ */
+
+#ifndef LIBRARY_H
+#define	LIBRARY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fat.h"
+#include "sd.h"
+
+// How many tracks the index has room for (the player and the card prep tool
+// both size the index file from this, so it has to be the same for both)
+#define LIBRARY_MAX_FILES 4096
+
+// Name of the index file kept in the root directory (8.3, space padded)
+#define LIBRARY_FILENAME "NBINDEX "
+#define LIBRARY_EXT "BIN"
+
+#define LIBRARY_MAGIC 0x5849424E    // "NBIX"
+#define LIBRARY_VERSION 2
+
+// Extents remembered per track, a record is exactly LIBRARY_RECORD_SIZE bytes
+#define LIBRARY_MAX_EXTENTS 7
+#define LIBRARY_RECORD_SIZE 64
+#define LIBRARY_RECORDS_PER_SECTOR (SECTOR_SIZE / LIBRARY_RECORD_SIZE)
+
+// Layout of the index file: a header sector, the catalog, then one record per track
+#define LIBRARY_CATALOG_SECTORS(max_files) (((max_files) * sizeof(FatCatalogEntry) + SECTOR_SIZE - 1) / SECTOR_SIZE)
+#define LIBRARY_RECORD_SECTORS(max_files) (((max_files) + LIBRARY_RECORDS_PER_SECTOR - 1) / LIBRARY_RECORDS_PER_SECTOR)
+#define LIBRARY_SIZE(max_files) ((1 + LIBRARY_CATALOG_SECTORS(max_files) + LIBRARY_RECORD_SECTORS(max_files)) * SECTOR_SIZE)
+
+// First sector of the index file
+struct LibraryHeader {
+    uint32_t magic;         // LIBRARY_MAGIC, zero while the index is being written
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t max_files;     // How many tracks the file has room for
+    uint32_t num_files;     // How many tracks are in the catalog
+    uint32_t stamp;         // Library_Stamp() of the card when the index was written
+} __attribute((packed));
+
+// Where one track lives, so it can be opened without walking the FAT
+struct LibraryRecord {
+    uint32_t filesize;
+    uint8_t num_extents;
+    uint8_t complete;       // Zero if the extents don't cover the whole file
+    uint8_t reserved[2];
+    struct FatExtent extents[LIBRARY_MAX_EXTENTS];
+};
+
+// The index file on an open partition
+struct LibraryIndex {
+    struct FatPartition * part;
+    uint32_t start_sector;  // First sector of the index file, zero if there isn't a usable one
+    uint16_t max_files;
+    bool records_valid;     // Whether the records match the card (after a load or a save)
+};
+
+// Checking an index still matches the card (see Library_Stamp) reads every
+// directory sector a scan would, so Library_Load costs about what
+// GetFilesByExt does. The index pays off when tracks are opened, from their
+// records instead of the FAT.
+
+// Function prototypes
+bool Library_Open(struct LibraryIndex * library, struct FatPartition * fat, uint16_t max_files);
+bool Library_Load(struct LibraryIndex * library, FatCatalogEntry * catalog, uint16_t * num_files);
+void Library_Save(struct LibraryIndex * library, FatCatalogEntry * catalog, uint16_t num_files);
+void Library_OpenTrack(struct LibraryIndex * library, struct FatFile * file, FatCatalogEntry * catalog, uint16_t track);
+
+#endif	/* LIBRARY_H */
+
@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "debug.h"
 #include "sysclk.h"
 #include "sd.h"
@@ -28,23 +29,21 @@
 #include "timer.h"
 #include "wav.h"
 #include "fat.h"
+#include "library.h"
+#include "pcm.h"
+#include "resample.h"
+#include "adpcm.h"
+#include "flac.h"
+#include "qoa.h"
+#include "crossfade.h"
+#include "audio.h"
 
 #define NUM_SECTORS 60
 
-extern WAV_HEADER wavHeader;
-
-enum buffer_type { FRONT, BACK };
-
-// Flags to tell main to update data
-volatile bool frontbuffer_done_sending = 0;
-volatile bool backbuffer_done_sending = 0;
-volatile enum buffer_type cur_buffer = FRONT;
-
 volatile bool playing = true;
 
-// Buffers to store audio data
-int8_t frontbuffer[SECTOR_SIZE];
-int8_t backbuffer[SECTOR_SIZE];
+// Decoded audio waiting for the DMA
+struct AudioRing audio_ring;
 
 //Button Timer Flags
 volatile bool vol_minus_pressed = false;
@@ -55,16 +54,80 @@ volatile bool play_held = false;
 volatile bool vol_plus_held = false;
 
 // Variables needed for FAT
-#define MAX_FILES 100
+// Only the location of each track is kept (4 bytes a track), and the ones
+// that are playing and up next are opened into tracks
+#define MAX_FILES LIBRARY_MAX_FILES
 struct FatPartition fat;
-struct FatFile files[MAX_FILES];
+FatCatalogEntry catalog[MAX_FILES];
+struct LibraryIndex library;    // Index kept on the card so boots don't have to rescan
+char * file_exts[] = { "WAV", "FLA", "QOA" };
 uint16_t num_files = 0;
-uint16_t current_song = 0;
-uint32_t bytes_read = 0;
+
+// Where a song's samples are and how to decode them
+enum SongCodec { CODEC_NONE, CODEC_PCM, CODEC_ADPCM, CODEC_FLAC, CODEC_QOA };
+struct Track {
+    uint16_t song;              // Catalog entry
+    struct FatFile file;
+    struct WavInfo info;
+    struct FatStream stream;
+    enum SongCodec codec;       // CODEC_NONE once it's run out
+    uint32_t frames_left;       // Counted down from info.frames, if that's known
+    struct PcmConverter pcm;
+};
+
+// The song after the current one is opened (and its header read) ahead of
+// time, so when the current one runs out the next one's samples carry on in
+// the same buffer
+struct Track tracks[2];
+struct Track * current_track = &tracks[0];
+struct Track * next_track = &tracks[1];
+bool next_track_ready = false;
+uint16_t next_song = 0;         // Catalog entry to try opening as the next track
+uint16_t next_song_tries = 0;   // Entries tried since the current track started
+
+// Each track has its own decoder so both can play during a crossfade,
+// except FLAC's which is too big to have twice
+struct AdpcmDecoder adpcm[2];
+struct FlacDecoder flac;
+struct QoaDecoder qoa[2];
+
+// Overlap between one track and the next, 0 to play them back to back
+// The next track has to be ready in time and play out at the same rate,
+// otherwise it follows on without a fade.
+#ifndef CROSSFADE_MS
+#define CROSSFADE_MS 0
+#endif
+struct Crossfade crossfade;
+bool fading = false;            // Whether the next track is being mixed in
+int16_t fade_buffer[PCM_BUFFER_FRAMES * 2] __attribute__((aligned(4)));
+
+// Songs at a rate the DAC can't be clocked for are resampled to the closest one it can
+#define RESAMPLE_QUALITY RESAMPLE_QUALITY_MEDIUM
+struct Resampler resampler;
+bool resampling = false;
+uint32_t output_rate = 0;       // Rate the DAC is running at
+int16_t resample_buffer[PCM_BUFFER_FRAMES * 2] __attribute__((aligned(4)));
+uint32_t resample_frames = 0;   // Frames in resample_buffer
+uint32_t resample_pos = 0;      // How many of them the resampler has taken
 
 // Init functions
 void InitPins(void);
 
+// Song data
+bool OpenTrack(struct Track * track, uint16_t song);
+void PrefetchTrack();
+void AdvanceTrack();
+bool SameOutput(struct Track * track);
+void StartTrack(struct Track * track);
+uint32_t CrossfadeFrames(struct Track * track);
+bool CanCrossfade();
+uint32_t MixFrames(int16_t * buffer, uint32_t num_frames);
+void StartSong();
+bool FillRing();
+uint32_t ReadSong(AudioFrame * block);
+uint32_t ReadFrames(int16_t * buffer);
+uint32_t DecodeFrames(struct Track * track, int16_t * buffer, uint32_t num_frames);
+
 //Music Controls
 void play();
 void pause();
@@ -80,6 +143,8 @@ int main(int argc, char** argv)
     int i = 0;
     for(i = 0; i < 1000000; i++);
     
+    bool song_ended;
+    
     // Enable multi vectored interrupts
     INTEnableSystemMultiVectoredInt(); //Do not call after setting up interrupts
     
@@ -93,7 +158,11 @@ int main(int argc, char** argv)
     
     // Start up FAT stuff and open a file
     OpenFirstFatPartition(&fat);
-    num_files = GetFilesByExt(&fat, files, MAX_FILES, "WAV");
+    if(!Library_Open(&library, &fat, MAX_FILES) || !Library_Load(&library, catalog, &num_files))
+    {
+        num_files = GetFilesByExt(&fat, catalog, MAX_FILES, file_exts, sizeof(file_exts) / sizeof(file_exts[0]));
+        Library_Save(&library, catalog, num_files);
+    }
     
     if(num_files == 0)
     {
@@ -101,14 +170,12 @@ int main(int argc, char** argv)
         while(1) { }
     }
     
-    Fat_read(&(files[current_song]), (void*)frontbuffer, SECTOR_SIZE);
-    readWavHeader(frontbuffer);
-    
-    Fat_read(&(files[current_song]), (void*)frontbuffer, SECTOR_SIZE);
-    Fat_read(&(files[current_song]), (void*)backbuffer, SECTOR_SIZE);
+    OpenTrack(current_track, 0);
+    next_song = 1 % num_files;
+    StartSong();
     
     // Enable global interrupts
-    asm volatile("ei");
+    INTEnableInterrupts();
     
     //TestWavHeader();
     
@@ -116,32 +183,20 @@ int main(int argc, char** argv)
     DCH0ECONSET = 0x90;
     
     while(1){
+        // Top the ring up with interrupts on, so the DMA carries on from it however long the card takes
+        song_ended = playing && !FillRing();
+        
+        // Let the end of the song play out before the DAC is reclocked for the next one
+        if(song_ended){
+            while(AUDIO_RING_FILLED() > 0) { }
+        }
+        
         // Disable interrupts to avoid read/write problems when reading variables accessed by interrupts
         // Disable interrupts to avoid crashes during I2C read when an interrupt fires during transmission
         // Enable interrupts at the end of the loop
-        asm volatile("di");
-        if(playing){
-            if (frontbuffer_done_sending){
-                frontbuffer_done_sending = false;
-
-                bytes_read = Fat_read(&(files[current_song]), (void*)frontbuffer, SECTOR_SIZE);
-
-                if(bytes_read < SECTOR_SIZE)
-                {
-                    nextSong();
-                }
-            }
-
-            if (backbuffer_done_sending){
-                backbuffer_done_sending = false;
-
-                bytes_read = Fat_read(&(files[current_song]), (void*)backbuffer, SECTOR_SIZE);
-
-                if(bytes_read < SECTOR_SIZE)
-                {
-                    nextSong();
-                }
-            }
+        INTDisableInterrupts();
+        if(song_ended){
+            nextSong();
         }
         
         if (vol_plus_pressed == true){
@@ -178,7 +233,12 @@ int main(int argc, char** argv)
             prevSong(); 
             vol_minus_held = false;
         }
-        asm volatile("ei");
+        INTEnableInterrupts();
+        
+        // The ring is full, so there's time to open the next song
+        if(playing){
+            PrefetchTrack();
+        }
     }
     
     return (EXIT_SUCCESS);
@@ -198,42 +258,406 @@ void pause(){
 
 void nextSong(){
     DAC_DigitalControl(true);
-    if(current_song == num_files-1){
-        current_song = 0;
-    }else{
-        current_song = (current_song + 1) % num_files;
+    
+    // A track that was fading in has been read into, so it's opened again from the start
+    if(fading){
+        fading = false;
+        next_track_ready = false;
     }
     
-    ResetFile(&(files[current_song]));
-    Fat_read(&(files[current_song]), (void*)frontbuffer, SECTOR_SIZE);
-    readWavHeader(frontbuffer);
-
-    Fat_read(&(files[current_song]), (void*)frontbuffer, SECTOR_SIZE);
-    Fat_read(&(files[current_song]), (void*)backbuffer, SECTOR_SIZE);
-    backbuffer_done_sending = false;
-    frontbuffer_done_sending = false;
+    AdvanceTrack();
+    StartSong();
     DAC_DigitalControl(false);
 }
 
 void prevSong(){
     DAC_DigitalControl(true);
-    if(current_song == 0){
-        current_song = num_files-1;
+    if(current_track->song == 0){
+        OpenTrack(current_track, num_files - 1);
     }else{
-        current_song = (current_song - 1) % num_files;
+        OpenTrack(current_track, current_track->song - 1);
     }
     
-    ResetFile(&(files[current_song]));
-    Fat_read(&(files[current_song]), (void*)frontbuffer, SECTOR_SIZE);
-    readWavHeader(frontbuffer);
-
-    Fat_read(&(files[current_song]), (void*)frontbuffer, SECTOR_SIZE);
-    Fat_read(&(files[current_song]), (void*)backbuffer, SECTOR_SIZE);
-    backbuffer_done_sending = false;
-    frontbuffer_done_sending = false;
+    fading = false;
+    next_track_ready = false;
+    next_song = (current_track->song + 1) % num_files;
+    next_song_tries = 0;
+    
+    StartSong();
     DAC_DigitalControl(false);
 }
 
+/**
+ * Opens a song and reads its header, leaving it ready to decode from its first sample
+ * 
+ * Anything that isn't a FLAC or QOA file, or a WAV file in a format there's
+ * a decoder for, is given no samples.
+ * 
+ * @param track Where to open it
+ * @param song The catalog entry
+ * 
+ * @return False if it can't be played
+ */
+bool OpenTrack(struct Track * track, uint16_t song){
+    track->song = song;
+    track->codec = CODEC_NONE;
+    
+    Library_OpenTrack(&library, &track->file, catalog, song);
+    
+    if(Wav_ReadInfo(&track->file, &track->info) && track->info.sample_rate > 0){
+        if(Pcm_SelectConverter(&track->pcm, &track->info)){
+            track->codec = CODEC_PCM;
+        }else if(Adpcm_Supported(&track->info)){
+            track->codec = CODEC_ADPCM;
+            track->info.frames = Adpcm_CountFrames(&track->info);
+        }
+    }else if(Flac_ReadInfo(&track->file, &track->info)){
+        track->codec = CODEC_FLAC;
+    }else if(Qoa_ReadInfo(&track->file, &track->info)){
+        track->codec = CODEC_QOA;
+    }
+    
+    if(track->codec != CODEC_NONE){
+        Fat_OpenStream(&track->stream, &track->file, track->info.data_size);
+    }
+    track->frames_left = track->info.frames;
+    
+    return track->codec != CODEC_NONE;
+}
+
+/**
+ * Opens the song after the current one, if it isn't already, so it's ready
+ * to carry on from the current one
+ * 
+ * One catalog entry is tried each call, skipping anything that can't be
+ * played, so it never holds the main loop up for long.
+ */
+void PrefetchTrack(){
+    if(next_track_ready || next_song_tries >= num_files){
+        return;
+    }
+    
+    next_song_tries++;
+    next_track_ready = OpenTrack(next_track, next_song);
+    
+    if(!next_track_ready){
+        next_song = (next_song + 1) % num_files;
+    }
+}
+
+/**
+ * Makes the next track the current one, opening it first if that hasn't been done yet
+ */
+void AdvanceTrack(){
+    struct Track * track;
+    
+    while(!next_track_ready && next_song_tries < num_files){
+        PrefetchTrack();
+    }
+    
+    // If nothing can be played this gives no samples, and the next refill moves on again
+    if(!next_track_ready){
+        OpenTrack(next_track, next_song);
+    }
+    
+    track = current_track;
+    current_track = next_track;
+    next_track = track;
+    
+    next_track_ready = false;
+    next_song = (current_track->song + 1) % num_files;
+    next_song_tries = 0;
+}
+
+/**
+ * Checks whether a track plays out at the same rate, through the same
+ * resampler settings, as the one playing
+ * 
+ * If it does it can follow on with nothing at all reconfigured.
+ */
+bool SameOutput(struct Track * track){
+    uint32_t rate = track->info.sample_rate;
+    uint32_t out_rate = DAC_ClosestSampleRate(rate);
+    
+    if(out_rate != output_rate){
+        return false;
+    }
+    
+    if(out_rate == rate){
+        return !resampling;
+    }
+    
+    return resampling && resampler.in_rate == rate;
+}
+
+/**
+ * Sets the decoder up for a track, and the DAC and resampler for its rate if they need changing
+ * 
+ * The DAC is clocked for the track's sample rate, or for the closest rate it
+ * can do if the track has to be resampled.
+ */
+void StartTrack(struct Track * track){
+    uint32_t rate = track->info.sample_rate;
+    uint32_t out_rate = DAC_ClosestSampleRate(rate);
+    
+    switch(track->codec){
+        case CODEC_ADPCM:
+            Adpcm_Init(&adpcm[track - tracks], &track->info);
+            break;
+        case CODEC_FLAC:
+            Flac_Init(&flac, &track->info);
+            break;
+        case CODEC_QOA:
+            Qoa_Init(&qoa[track - tracks], &track->info);
+            break;
+        default:
+            break;
+    }
+    
+    if(track->codec == CODEC_NONE || SameOutput(track)){
+        return;
+    }
+    
+    resampling = (out_rate != rate);
+    if(resampling){
+        Resample_Configure(&resampler, rate, out_rate, RESAMPLE_QUALITY);
+    }
+    
+    DAC_SetSampleRate(out_rate);
+    output_rate = out_rate;
+}
+
+/**
+ * Starts the current track from its first sample
+ */
+void StartSong(){
+    StartTrack(current_track);
+    
+    // Nothing of the last track is carried over
+    if(resampling){
+        Resample_Reset(&resampler);
+    }
+    resample_frames = resample_pos = 0;
+    
+    // Anything queued of the last track is dropped, the main loop refills the ring
+    audio_ring.head = audio_ring.tail + (audio_ring.sending ? 1 : 0);
+}
+
+/**
+ * Decodes into every free block of the ring
+ * 
+ * This runs with interrupts on. Only this moves the ring's head on and only
+ * the DMA interrupt moves its tail, so neither needs a lock.
+ * 
+ * @return False if the song ran out (its last block is padded with silence)
+ */
+bool FillRing(){
+    uint32_t frames;
+    
+    while(AUDIO_RING_FILLED() < AUDIO_RING_BLOCKS){
+        frames = ReadSong(audio_ring.blocks[audio_ring.head & AUDIO_RING_MASK]);
+        audio_ring.head++;
+        
+        if(frames < AUDIO_BLOCK_FRAMES){
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * Fills a block with the next frames of the song, resampled if it needs to be
+ * 
+ * @param block Where to put the frames, padded with silence past the end
+ * 
+ * @return The number of frames (short of a full block at the end of the song)
+ */
+uint32_t ReadSong(AudioFrame * block){
+    uint32_t made = 0, used;
+    
+    if(!resampling){
+        return ReadFrames((int16_t*)block) / PCM_OUT_FRAME_SIZE;
+    }
+    
+    // The resampler takes a varying number of frames for each block it makes,
+    // so it's fed from a block of its own
+    while(made < PCM_BUFFER_FRAMES){
+        if(resample_pos == resample_frames){
+            resample_frames = ReadFrames(resample_buffer) / PCM_OUT_FRAME_SIZE;
+            resample_pos = 0;
+            
+            if(resample_frames == 0){
+                break;
+            }
+        }
+        
+        made += Resample_Process(&resampler, (int16_t*)(block + made), PCM_BUFFER_FRAMES - made,
+                resample_buffer + (resample_pos * 2), resample_frames - resample_pos, &used);
+        resample_pos += used;
+    }
+    
+    if(made < PCM_BUFFER_FRAMES){
+        memset(block + made, 0, (PCM_BUFFER_FRAMES - made) * PCM_OUT_FRAME_SIZE);
+    }
+    
+    return made;
+}
+
+/**
+ * Works out how many frames of a track the crossfade takes up
+ */
+uint32_t CrossfadeFrames(struct Track * track){
+    return (CROSSFADE_MS * track->info.sample_rate) / 1000;
+}
+
+/**
+ * Checks whether the current track is far enough through to start fading
+ * into the next one, and the next one can be
+ * 
+ * The next track has to be open already, play out the same way, be longer
+ * than the fade and not need the decoder the current one is using.
+ */
+bool CanCrossfade(){
+    struct Track * track = current_track;
+    
+    if(CROSSFADE_MS == 0 || track->codec == CODEC_NONE || track->frames_left == 0 ||
+            track->frames_left > CrossfadeFrames(track)){
+        return false;
+    }
+    
+    return next_track_ready && SameOutput(next_track) && next_track->frames_left > track->frames_left &&
+            !(track->codec == CODEC_FLAC && next_track->codec == CODEC_FLAC);
+}
+
+/**
+ * Decodes the next frames of both tracks and mixes them together, making
+ * the next track the current one once the fade is over
+ * 
+ * Either track running out early just leaves silence in its place.
+ * 
+ * @param buffer Where to put the frames
+ * @param num_frames The most to mix
+ * 
+ * @return How many frames were mixed, short at the end of the fade
+ */
+uint32_t MixFrames(int16_t * buffer, uint32_t num_frames){
+    uint32_t made;
+    
+    if(num_frames > crossfade.length - crossfade.done){
+        num_frames = crossfade.length - crossfade.done;
+    }
+    
+    // Each track reads a block's worth at most, the same as it would on its own
+    made = DecodeFrames(current_track, buffer, num_frames);
+    memset(buffer + (made * 2), 0, (num_frames - made) * PCM_OUT_FRAME_SIZE);
+    made = DecodeFrames(next_track, fade_buffer, num_frames);
+    memset(fade_buffer + (made * 2), 0, (num_frames - made) * PCM_OUT_FRAME_SIZE);
+    
+    Crossfade_Mix(&crossfade, buffer, fade_buffer, num_frames);
+    
+    if(crossfade.done == crossfade.length){
+        fading = false;
+        AdvanceTrack();
+    }
+    
+    return num_frames;
+}
+
+/**
+ * Decodes the next block of 16 bit stereo, going straight on into the next
+ * track if the current one runs out partway
+ * 
+ * The next track only follows on in the same block if it's already been
+ * opened and plays out the same way. Otherwise the block is cut short and
+ * the caller moves on to the next track. With CROSSFADE_MS set the next
+ * track starts that long before the end of the current one, mixed in.
+ * 
+ * @param buffer Where to put the frames, padded with silence past the end
+ * 
+ * @return The number of bytes of decoded frames
+ */
+uint32_t ReadFrames(int16_t * buffer){
+    uint32_t num_frames = 0, count, made, fade_frames;
+    
+    while(num_frames < PCM_BUFFER_FRAMES){
+        count = PCM_BUFFER_FRAMES - num_frames;
+        
+        if(!fading && CanCrossfade()){
+            StartTrack(next_track);
+            Crossfade_Start(&crossfade, current_track->frames_left);
+            fading = true;
+        }
+        
+        if(fading){
+            num_frames += MixFrames(buffer + (num_frames * 2), count);
+            continue;
+        }
+        
+        // Stop where the fade would start, so it can if the next track is ready by then
+        fade_frames = CrossfadeFrames(current_track);
+        if(current_track->frames_left > fade_frames && count > current_track->frames_left - fade_frames){
+            count = current_track->frames_left - fade_frames;
+        }
+        
+        made = DecodeFrames(current_track, buffer + (num_frames * 2), count);
+        num_frames += made;
+        
+        if(made < count){
+            if(!next_track_ready || !SameOutput(next_track)){
+                break;
+            }
+            
+            AdvanceTrack();
+            StartTrack(current_track);
+        }
+    }
+    
+    if(num_frames < PCM_BUFFER_FRAMES){
+        memset(buffer + (num_frames * 2), 0, (PCM_BUFFER_FRAMES - num_frames) * PCM_OUT_FRAME_SIZE);
+    }
+    
+    return num_frames * PCM_OUT_FRAME_SIZE;
+}
+
+/**
+ * Decodes frames of a track into 16 bit stereo, stopping at the end of its
+ * data rather than the end of the file
+ * 
+ * @param track The track
+ * @param buffer Where to put the frames
+ * @param num_frames The most to decode
+ * 
+ * @return How many frames were decoded, short only once the track has run out
+ */
+uint32_t DecodeFrames(struct Track * track, int16_t * buffer, uint32_t num_frames){
+    uint32_t made = 0;
+    
+    switch(track->codec){
+        case CODEC_PCM:
+            made = Pcm_Read(&track->pcm, &track->stream, buffer, num_frames);
+            break;
+        case CODEC_ADPCM:
+            made = Adpcm_Read(&adpcm[track - tracks], &track->stream, buffer, num_frames);
+            break;
+        case CODEC_FLAC:
+            made = Flac_Read(&flac, &track->stream, buffer, num_frames);
+            break;
+        case CODEC_QOA:
+            made = Qoa_Read(&qoa[track - tracks], &track->stream, buffer, num_frames);
+            break;
+        default:
+            break;
+    }
+    
+    if(made < num_frames){
+        track->codec = CODEC_NONE;
+    }
+    track->frames_left = (made < track->frames_left) ? track->frames_left - made : 0;
+    
+    return made;
+}
+
 void InitPins(void)
 {
     // Set all pins to be digital (no analog 4 u)
@@ -314,8 +738,8 @@ static unsigned int _excep_addr;
 // this function overrides the normal _weak_ generic handler
 void _general_exception_handler(void)
 {
-    asm volatile("mfc0 %0,$13" : "=r" (_excep_code));
-    asm volatile("mfc0 %0,$14" : "=r" (_excep_addr));
+    _excep_code = _CP0_GET_CAUSE();
+    _excep_addr = _CP0_GET_EPC();
     _excep_code = (_excep_code & 0x0000007C) >> 2;    
     while (1) {
         DEBUG_LED_ON();
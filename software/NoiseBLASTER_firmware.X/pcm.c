@@ -0,0 +1,231 @@
+/*
+ * File:   pcm.c
+ *
+ * Created on October 17, 2026
+ *
+ * Turns whatever sample format a track is in into the 16 bit stereo the DAC
+ * is sent. Each format has its own kernel, picked once when the track is
+ * opened, so there's no per sample format checking.
+ *
+ * The kernels can run in place. When the input frame is smaller than the
+ * output frame the input is read into the end of the buffer and converted
+ * forwards; the output never catches up with input that hasn't been read
+ * yet. Same sized input sits at the start of the buffer. Only input frames
+ * bigger than the output (24/32 bit stereo) need a separate scratch buffer.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "pcm.h"
+#include "wav.h"
+#include "fat.h"
+
+// The kernels read and write the same buffer through different types
+typedef int16_t __attribute__((may_alias)) pcm_s16;
+typedef uint32_t __attribute__((may_alias)) pcm_u32;
+
+// Puts one frame out as a single 32 bit store (left in the low half)
+#define PCM_FRAME(left, right) (((uint32_t)(uint16_t)(left)) | ((uint32_t)(uint16_t)(right) << 16))
+
+// Runs a kernel's step (which converts one frame) four frames at a time
+#define PCM_UNROLL(step) \
+    while(num_frames >= 4) { step; step; step; step; num_frames -= 4; } \
+    while(num_frames > 0) { step; num_frames--; }
+
+// Where input that's bigger than its output gets read to
+static uint8_t pcm_scratch[PCM_BUFFER_FRAMES * PCM_MAX_IN_FRAME_SIZE] __attribute__((aligned(4)));
+
+/**
+ * Converts a 32 bit float to 16 bits using only integer operations (the
+ * PIC32MX has no FPU)
+ *
+ * Scales by 32768 and rounds towards zero, anything at or past full scale
+ * (including infinities and NaNs) is clipped.
+ *
+ * @param bits The float's bit pattern
+ *
+ * @return The sample as 16 bit signed PCM
+ */
+static inline int16_t Pcm_FloatToS16(uint32_t bits)
+{
+    int32_t exponent = (bits >> 23) & 0xFF;
+    int32_t value;
+
+    if(exponent >= 127)
+        return (bits & 0x80000000) ? -32768 : 32767;
+
+    // Anything under 2^-15 is less than one step
+    if(exponent < 112)
+        return 0;
+
+    value = ((bits & 0x7FFFFF) | 0x800000) >> (135 - exponent);
+    return (bits & 0x80000000) ? -value : value;
+}
+
+static void Pcm_U8Mono(int16_t * out, const uint8_t * in, uint32_t num_frames)
+{
+    pcm_u32 * dst = (pcm_u32 *)out;
+    int16_t s;
+
+    PCM_UNROLL(s = (int16_t)((in[0] - 128) << 8); *dst++ = PCM_FRAME(s, s); in += 1)
+}
+
+static void Pcm_U8Stereo(int16_t * out, const uint8_t * in, uint32_t num_frames)
+{
+    pcm_u32 * dst = (pcm_u32 *)out;
+
+    PCM_UNROLL(*dst++ = PCM_FRAME((in[0] - 128) << 8, (in[1] - 128) << 8); in += 2)
+}
+
+static void Pcm_S16Mono(int16_t * out, const uint8_t * in, uint32_t num_frames)
+{
+    pcm_u32 * dst = (pcm_u32 *)out;
+    const pcm_s16 * src = (const pcm_s16 *)in;
+    int16_t s;
+
+    PCM_UNROLL(s = *src++; *dst++ = PCM_FRAME(s, s))
+}
+
+static void Pcm_S16Stereo(int16_t * out, const uint8_t * in, uint32_t num_frames)
+{
+    // Already what the DAC wants, only moves if it wasn't read in place
+    if((const uint8_t *)out != in)
+        memmove(out, in, num_frames * PCM_OUT_FRAME_SIZE);
+}
+
+// 24 bit samples are only byte aligned, so they're put together a byte at a time
+static void Pcm_S24Mono(int16_t * out, const uint8_t * in, uint32_t num_frames)
+{
+    pcm_u32 * dst = (pcm_u32 *)out;
+    int16_t s;
+
+    PCM_UNROLL(s = (int16_t)(in[1] | (in[2] << 8)); *dst++ = PCM_FRAME(s, s); in += 3)
+}
+
+static void Pcm_S24Stereo(int16_t * out, const uint8_t * in, uint32_t num_frames)
+{
+    pcm_u32 * dst = (pcm_u32 *)out;
+
+    PCM_UNROLL(*dst++ = PCM_FRAME(in[1] | (in[2] << 8), in[4] | (in[5] << 8)); in += 6)
+}
+
+// The top half of a 32 bit sample is the 16 bit one
+static void Pcm_S32Mono(int16_t * out, const uint8_t * in, uint32_t num_frames)
+{
+    pcm_u32 * dst = (pcm_u32 *)out;
+    const pcm_s16 * src = (const pcm_s16 *)in;
+    int16_t s;
+
+    PCM_UNROLL(s = src[1]; *dst++ = PCM_FRAME(s, s); src += 2)
+}
+
+static void Pcm_S32Stereo(int16_t * out, const uint8_t * in, uint32_t num_frames)
+{
+    pcm_u32 * dst = (pcm_u32 *)out;
+    const pcm_s16 * src = (const pcm_s16 *)in;
+
+    PCM_UNROLL(*dst++ = PCM_FRAME(src[1], src[3]); src += 4)
+}
+
+static void Pcm_FloatMono(int16_t * out, const uint8_t * in, uint32_t num_frames)
+{
+    pcm_u32 * dst = (pcm_u32 *)out;
+    const pcm_u32 * src = (const pcm_u32 *)in;
+    int16_t s;
+
+    PCM_UNROLL(s = Pcm_FloatToS16(*src++); *dst++ = PCM_FRAME(s, s))
+}
+
+static void Pcm_FloatStereo(int16_t * out, const uint8_t * in, uint32_t num_frames)
+{
+    pcm_u32 * dst = (pcm_u32 *)out;
+    const pcm_u32 * src = (const pcm_u32 *)in;
+
+    PCM_UNROLL(*dst++ = PCM_FRAME(Pcm_FloatToS16(src[0]), Pcm_FloatToS16(src[1])); src += 2)
+}
+
+enum PcmKernelFormat { PCM_U8, PCM_S16, PCM_S24, PCM_S32, PCM_FLOAT };
+
+// Kernels by sample format (in PcmKernelFormat order), mono then stereo
+static const PcmConvertFunc pcm_kernels[][2] = {
+    { Pcm_U8Mono, Pcm_U8Stereo },
+    { Pcm_S16Mono, Pcm_S16Stereo },
+    { Pcm_S24Mono, Pcm_S24Stereo },
+    { Pcm_S32Mono, Pcm_S32Stereo },
+    { Pcm_FloatMono, Pcm_FloatStereo },
+};
+
+/**
+ * Picks the kernel for a track
+ *
+ * @param pcm The converter to set up
+ * @param info The track's format
+ *
+ * @return False if there's no kernel for the format (the track can't be played)
+ */
+bool Pcm_SelectConverter(struct PcmConverter * pcm, const struct WavInfo * info)
+{
+    enum PcmKernelFormat format;
+
+    pcm->convert = NULL;
+    pcm->in_frame_size = 0;
+
+    if(info->channels < 1 || info->channels > 2 || info->block_align != info->channels * (info->bits_per_sample / 8))
+        return false;
+
+    if(info->format == WAV_FORMAT_PCM)
+    {
+        switch(info->bits_per_sample)
+        {
+            case 8: format = PCM_U8; break;
+            case 16: format = PCM_S16; break;
+            case 24: format = PCM_S24; break;
+            case 32: format = PCM_S32; break;
+            default: return false;
+        }
+    }
+    else if(info->format == WAV_FORMAT_IEEE_FLOAT && info->bits_per_sample == 32)
+        format = PCM_FLOAT;
+    else
+        return false;
+
+    pcm->convert = pcm_kernels[format][info->channels - 1];
+    pcm->in_frame_size = info->block_align;
+    return true;
+}
+
+/**
+ * Reads frames from a track and converts them to 16 bit stereo
+ *
+ * The input is read to wherever it can be converted in place (see the top
+ * of the file), so out must have room for num_frames.
+ *
+ * @param pcm The track's converter
+ * @param stream The track's samples
+ * @param out Where to put the converted frames
+ * @param num_frames The most frames to read
+ *
+ * @return How many frames were read, short only at the end of the track
+ */
+uint32_t Pcm_Read(const struct PcmConverter * pcm, struct FatStream * stream, int16_t * out, uint32_t num_frames)
+{
+    uint8_t * in = (uint8_t *)out;
+
+    if(num_frames > stream->bytes_left / pcm->in_frame_size)
+        num_frames = stream->bytes_left / pcm->in_frame_size;
+
+    if(pcm->in_frame_size > PCM_OUT_FRAME_SIZE)
+    {
+        if(num_frames > PCM_BUFFER_FRAMES)
+            num_frames = PCM_BUFFER_FRAMES;
+        in = pcm_scratch;
+    }
+    else if(pcm->in_frame_size < PCM_OUT_FRAME_SIZE)
+        in += num_frames * (PCM_OUT_FRAME_SIZE - pcm->in_frame_size);
+
+    num_frames = Fat_StreamRead(stream, in, num_frames * pcm->in_frame_size) / pcm->in_frame_size;
+    pcm->convert(out, in, num_frames);
+
+    return num_frames;
+}
@@ -0,0 +1,37 @@
+/*
+ * File:   pcm.h
+ *
+ * Created on October 17, 2026
+ */
+
+#ifndef PCM_H
+#define	PCM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "wav.h"
+#include "fat.h"
+#include "sd.h"
+#include "audio.h"
+
+// What the DAC is sent: 16 bit stereo, left then right, a block at a time
+#define PCM_OUT_FRAME_SIZE sizeof(AudioFrame)
+#define PCM_BUFFER_FRAMES AUDIO_BLOCK_FRAMES
+
+// Biggest input frame there's a kernel for (32 bit stereo)
+#define PCM_MAX_IN_FRAME_SIZE 8
+
+// Converts num_frames frames of input into 16 bit stereo
+typedef void (*PcmConvertFunc)(int16_t * out, const uint8_t * in, uint32_t num_frames);
+
+// How the current track gets turned into what the DAC wants, picked once per track
+struct PcmConverter {
+    PcmConvertFunc convert;
+    uint8_t in_frame_size;      // Bytes of input for one frame out
+};
+
+bool Pcm_SelectConverter(struct PcmConverter * pcm, const struct WavInfo * info);
+uint32_t Pcm_Read(const struct PcmConverter * pcm, struct FatStream * stream, int16_t * out, uint32_t num_frames);
+
+#endif	/* PCM_H */
+
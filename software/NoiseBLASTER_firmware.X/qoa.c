@@ -0,0 +1,239 @@
+/*
+ * File:   qoa.c
+ *
+ * Created on October 17, 2026
+ *
+ * QOA ("Quite OK Audio"), a lossy format at 3.2 bits a sample that takes
+ * next to no work to decode: a 4 tap sign-sign LMS predictor plus a 3 bit
+ * residual scaled by one of 16 step sizes. Every 20 samples of a channel
+ * are packed into 8 bytes, so slices are read straight from the stream and
+ * nothing bigger than one slice per channel is kept.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "qoa.h"
+#include "wav.h"
+#include "fat.h"
+
+// Each scalefactor ((s + 1)^2.75) times 0.75, 2.5, 4.5 and 7 of either sign,
+// rounded away from zero, indexed by the 3 bit residual
+static const int16_t qoa_dequant[16][8] = {
+    { 1, -1, 3, -3, 5, -5, 7, -7 },
+    { 5, -5, 18, -18, 32, -32, 49, -49 },
+    { 16, -16, 53, -53, 95, -95, 147, -147 },
+    { 34, -34, 113, -113, 203, -203, 315, -315 },
+    { 63, -63, 210, -210, 378, -378, 588, -588 },
+    { 104, -104, 345, -345, 621, -621, 966, -966 },
+    { 158, -158, 528, -528, 950, -950, 1477, -1477 },
+    { 228, -228, 760, -760, 1368, -1368, 2128, -2128 },
+    { 316, -316, 1053, -1053, 1895, -1895, 2947, -2947 },
+    { 422, -422, 1405, -1405, 2529, -2529, 3934, -3934 },
+    { 548, -548, 1828, -1828, 3290, -3290, 5117, -5117 },
+    { 696, -696, 2320, -2320, 4176, -4176, 6496, -6496 },
+    { 868, -868, 2893, -2893, 5207, -5207, 8099, -8099 },
+    { 1064, -1064, 3548, -3548, 6386, -6386, 9933, -9933 },
+    { 1286, -1286, 4288, -4288, 7718, -7718, 12005, -12005 },
+    { 1536, -1536, 5120, -5120, 9216, -9216, 14336, -14336 }
+};
+
+#define QOA_BE16(p) ((int16_t)(((uint16_t)(p)[0] << 8) | (p)[1]))
+#define QOA_BE32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (p)[3])
+
+/**
+ * Checks a file is QOA and reads its format
+ *
+ * Leaves the file at the first frame.
+ *
+ * @param file The file, from anywhere in it
+ * @param info Set to the stream's format, with the frames as the data
+ *
+ * @return False if it isn't QOA that can be played
+ */
+bool Qoa_ReadInfo(struct FatFile * file, struct WavInfo * info)
+{
+    uint8_t header[QOA_FILE_HEADER_SIZE + QOA_FRAME_HEADER_SIZE];
+
+    memset(info, 0, sizeof(struct WavInfo));
+
+    ResetFile(file);
+    if(Fat_read(file, header, sizeof(header)) != sizeof(header) || memcmp(header, "qoaf", 4) != 0)
+        return false;
+
+    // Every frame gives the format again, the first one's is what's played
+    info->channels = header[QOA_FILE_HEADER_SIZE];
+    info->sample_rate = QOA_BE32(header + QOA_FILE_HEADER_SIZE) & 0xFFFFFF;
+    if(info->channels < 1 || info->channels > 2 || info->sample_rate == 0)
+        return false;
+
+    info->bits_per_sample = 16;
+    info->valid_bits = 16;
+    info->data_offset = QOA_FILE_HEADER_SIZE;
+    info->data_size = file->filesize - QOA_FILE_HEADER_SIZE;
+    info->frames = QOA_BE32(header + 4);
+
+    Fat_seek(file, QOA_FILE_HEADER_SIZE, FAT_SEEK_SET);
+
+    return true;
+}
+
+/**
+ * Sets a decoder up for a track
+ *
+ * @param dec The decoder
+ * @param info The track's format, from Qoa_ReadInfo
+ */
+void Qoa_Init(struct QoaDecoder * dec, const struct WavInfo * info)
+{
+    dec->channels = info->channels;
+    dec->frame_left = 0;
+    dec->slice_frames = 0;
+    dec->slice_pos = 0;
+}
+
+/**
+ * Reads a frame's header and each channel's predictor
+ *
+ * @return False at the end of the track, or if the channels change
+ */
+static bool Qoa_LoadFrame(struct QoaDecoder * dec, struct FatStream * stream)
+{
+    uint8_t bytes[QOA_FRAME_HEADER_SIZE + (2 * QOA_LMS_SIZE)];
+    const uint8_t * lms = bytes + QOA_FRAME_HEADER_SIZE;
+    uint16_t size = QOA_FRAME_HEADER_SIZE + (dec->channels * QOA_LMS_SIZE);
+    uint8_t c, i;
+
+    if(Fat_StreamRead(stream, bytes, size) != size || bytes[0] != dec->channels)
+        return false;
+
+    dec->frame_left = (uint16_t)QOA_BE16(bytes + 4);
+
+    // The history (oldest first) then the weights
+    for(c = 0; c < dec->channels; c++, lms += QOA_LMS_SIZE)
+    {
+        for(i = 0; i < QOA_LMS_LEN; i++)
+        {
+            dec->history[c][i] = QOA_BE16(lms + (2 * i));
+            dec->weights[c][i] = QOA_BE16(lms + 8 + (2 * i));
+        }
+    }
+
+    return dec->frame_left > 0;
+}
+
+/**
+ * Reads the next slice of every channel and dequantises them
+ *
+ * @return False at the end of the track
+ */
+static bool Qoa_LoadSlices(struct QoaDecoder * dec, struct FatStream * stream)
+{
+    uint8_t bytes[2 * QOA_SLICE_SIZE];
+    uint16_t size = dec->channels * QOA_SLICE_SIZE;
+    const int16_t * dequant;
+    uint64_t slice;
+    uint8_t c, i;
+
+    if(Fat_StreamRead(stream, bytes, size) != size)
+        return false;
+
+    // The scalefactor is the top 4 bits, then the residuals from the top down
+    for(c = 0; c < dec->channels; c++)
+    {
+        slice = ((uint64_t)QOA_BE32(bytes + (c * QOA_SLICE_SIZE)) << 32) | QOA_BE32(bytes + (c * QOA_SLICE_SIZE) + 4);
+        dequant = qoa_dequant[slice >> 60];
+
+        for(i = 0; i < QOA_SLICE_LEN; i++)
+            dec->residuals[c][i] = dequant[(slice >> (57 - (3 * i))) & 7];
+    }
+
+    // The frame's last slice can be short
+    dec->slice_frames = (dec->frame_left < QOA_SLICE_LEN) ? dec->frame_left : QOA_SLICE_LEN;
+    dec->slice_pos = 0;
+    dec->frame_left -= dec->slice_frames;
+
+    return true;
+}
+
+/**
+ * Predicts a channel's next sample, adds the residual and updates the predictor
+ *
+ * @return The new sample
+ */
+static inline int16_t Qoa_DecodeSample(struct QoaDecoder * dec, uint8_t c, int32_t residual)
+{
+    int32_t * history = dec->history[c];
+    int32_t * weights = dec->weights[c];
+    int32_t sample, delta;
+
+    sample = ((weights[0] * history[0]) + (weights[1] * history[1]) +
+            (weights[2] * history[2]) + (weights[3] * history[3])) >> 13;
+    sample += residual;
+    sample = (sample > 32767) ? 32767 : ((sample < -32768) ? -32768 : sample);
+
+    // Each weight moves towards whatever would have made the prediction better
+    delta = residual >> 4;
+    weights[0] += (history[0] < 0) ? -delta : delta;
+    weights[1] += (history[1] < 0) ? -delta : delta;
+    weights[2] += (history[2] < 0) ? -delta : delta;
+    weights[3] += (history[3] < 0) ? -delta : delta;
+
+    history[0] = history[1];
+    history[1] = history[2];
+    history[2] = history[3];
+    history[3] = sample;
+
+    return sample;
+}
+
+/**
+ * Decodes frames from a track into 16 bit stereo, reading slices as needed
+ *
+ * @param dec The track's decoder
+ * @param stream The track's frames
+ * @param out Where to put the frames
+ * @param num_frames The most frames to decode
+ *
+ * @return How many frames were decoded, short only at the end of the track
+ */
+uint32_t Qoa_Read(struct QoaDecoder * dec, struct FatStream * stream, int16_t * out, uint32_t num_frames)
+{
+    uint32_t made = 0, count;
+
+    while(made < num_frames)
+    {
+        if(dec->slice_pos == dec->slice_frames)
+        {
+            if(dec->frame_left == 0 && !Qoa_LoadFrame(dec, stream))
+                break;
+            if(!Qoa_LoadSlices(dec, stream))
+                break;
+        }
+
+        count = dec->slice_frames - dec->slice_pos;
+        if(count > num_frames - made)
+            count = num_frames - made;
+        made += count;
+
+        if(dec->channels == 1)
+        {
+            while(count-- > 0)
+            {
+                out[0] = out[1] = Qoa_DecodeSample(dec, 0, dec->residuals[0][dec->slice_pos++]);
+                out += 2;
+            }
+        }
+        else
+        {
+            while(count-- > 0)
+            {
+                out[0] = Qoa_DecodeSample(dec, 0, dec->residuals[0][dec->slice_pos]);
+                out[1] = Qoa_DecodeSample(dec, 1, dec->residuals[1][dec->slice_pos++]);
+                out += 2;
+            }
+        }
+    }
+
+    return made;
+}
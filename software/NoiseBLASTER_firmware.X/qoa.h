@@ -0,0 +1,42 @@
+/*
+ * File:   qoa.h
+ *
+ * Created on October 17, 2026
+ */
+
+#ifndef QOA_H
+#define	QOA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "wav.h"
+#include "fat.h"
+
+#define QOA_FILE_HEADER_SIZE 8
+#define QOA_FRAME_HEADER_SIZE 8
+#define QOA_LMS_SIZE 16             // Bytes of LMS state for each channel at the start of a frame
+#define QOA_SLICE_SIZE 8            // Bytes of each slice, a scalefactor and 20 residuals
+#define QOA_SLICE_LEN 20
+#define QOA_LMS_LEN 4
+
+// Decodes QOA a slice (20 frames) at a time
+struct QoaDecoder {
+    uint8_t channels;
+    uint16_t frame_left;        // Frames left in the QOA frame being decoded
+    uint8_t slice_frames;       // Frames in the slices that are loaded
+    uint8_t slice_pos;          // Next frame of them to decode
+
+    // Each channel's predictor
+    int32_t history[2][QOA_LMS_LEN];
+    int32_t weights[2][QOA_LMS_LEN];
+
+    // Each channel's slice, already dequantised
+    int16_t residuals[2][QOA_SLICE_LEN];
+};
+
+bool Qoa_ReadInfo(struct FatFile * file, struct WavInfo * info);
+void Qoa_Init(struct QoaDecoder * dec, const struct WavInfo * info);
+uint32_t Qoa_Read(struct QoaDecoder * dec, struct FatStream * stream, int16_t * out, uint32_t num_frames);
+
+#endif	/* QOA_H */
+
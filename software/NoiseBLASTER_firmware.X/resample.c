@@ -0,0 +1,232 @@
+/*
+ * File:   resample.c
+ *
+ * Created on October 17, 2026
+ *
+ * Polyphase resampler for tracks at a rate the DAC can't be clocked for.
+ *
+ * The filter (a Kaiser windowed sinc) is worked out in floating point once,
+ * when a track at a new rate is opened, and stored in Q15 at
+ * RESAMPLE_PHASES fractional delays. Each output frame interpolates the
+ * filter between the two phases either side of it and runs it over the
+ * history with integer multiply-accumulates only.
+ *
+ * The position steps by exactly in_rate / out_rate per output frame (the
+ * remainder is carried Bresenham style), so there's no drift however long
+ * the track is.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "resample.h"
+
+#define RESAMPLE_PI 3.14159265f
+
+// Filter length, passband edge (as a fraction of the lower Nyquist rate) and Kaiser beta of each preset
+static const struct {
+    uint8_t taps;
+    float passband;
+    float beta;
+} resample_presets[] = {
+    { 8, 0.80f, 5.0f },     // RESAMPLE_QUALITY_LOW
+    { 16, 0.88f, 7.0f },    // RESAMPLE_QUALITY_MEDIUM
+    { 32, 0.93f, 9.0f },    // RESAMPLE_QUALITY_HIGH
+};
+
+/**
+ * Zeroth order modified Bessel function of the first kind, for the Kaiser window
+ */
+static float Resample_BesselI0(float x)
+{
+    float sum = 1.0f, term = 1.0f;
+    int k;
+
+    for(k = 1; k < 25; k++)
+    {
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+/**
+ * Works out the filter for every phase
+ *
+ * @param rs The resampler, with its rates and preset already set
+ */
+static void Resample_BuildFilter(struct Resampler * rs)
+{
+    float row[RESAMPLE_MAX_TAPS];
+    float half = rs->taps / 2;
+    float cutoff = 0.5f * resample_presets[rs->quality].passband;   // In cycles per input frame
+    float beta = resample_presets[rs->quality].beta;
+    float i0_beta = Resample_BesselI0(beta);
+    float t, x, sum;
+    int phase, k;
+
+    // Going down in rate, the filter has to cut off below the new Nyquist rate
+    if(rs->out_rate < rs->in_rate)
+        cutoff = cutoff * rs->out_rate / rs->in_rate;
+
+    for(phase = 0; phase <= RESAMPLE_PHASES; phase++)
+    {
+        sum = 0.0f;
+
+        for(k = 0; k < rs->taps; k++)
+        {
+            // How far this tap is from the output frame, in input frames
+            t = k - (half - 1.0f) - ((float)phase / RESAMPLE_PHASES);
+            x = t / half;
+
+            if(x <= -1.0f || x >= 1.0f)
+                row[k] = 0.0f;
+            else if(t == 0.0f)
+                row[k] = 2.0f * cutoff;
+            else
+                row[k] = sinf(2.0f * RESAMPLE_PI * cutoff * t) / (RESAMPLE_PI * t);
+
+            if(row[k] != 0.0f)
+                row[k] *= Resample_BesselI0(beta * sqrtf(1.0f - (x * x))) / i0_beta;
+
+            sum += row[k];
+        }
+
+        // Every phase passes DC at exactly unity
+        for(k = 0; k < rs->taps; k++)
+            rs->coefs[(phase * rs->taps) + k] = (int16_t)floorf((row[k] / sum * 32768.0f) + 0.5f);
+    }
+}
+
+/**
+ * Sets a resampler up for a pair of rates
+ *
+ * The filter is only rebuilt if the rates or the preset changed, but the
+ * history is always cleared.
+ *
+ * @param rs The resampler
+ * @param in_rate The rate of the frames going in
+ * @param out_rate The rate wanted out
+ * @param quality Which preset to use
+ */
+void Resample_Configure(struct Resampler * rs, uint32_t in_rate, uint32_t out_rate, enum ResampleQuality quality)
+{
+    uint64_t step = ((uint64_t)in_rate << RESAMPLE_POS_BITS);
+
+    if(rs->in_rate != in_rate || rs->out_rate != out_rate || rs->quality != quality || rs->taps == 0)
+    {
+        rs->in_rate = in_rate;
+        rs->out_rate = out_rate;
+        rs->quality = quality;
+        rs->taps = resample_presets[quality].taps;
+        Resample_BuildFilter(rs);
+    }
+
+    rs->step = step / out_rate;
+    rs->step_error = step % out_rate;
+
+    Resample_Reset(rs);
+}
+
+/**
+ * Forgets the history, ready to start a new track at the same rates
+ *
+ * @param rs The resampler
+ */
+void Resample_Reset(struct Resampler * rs)
+{
+    memset(rs->history, 0, sizeof(rs->history));
+    rs->history_pos = 0;
+    rs->pos = 0;
+    rs->pos_error = 0;
+
+    // Fill up to the middle of the window so the first output is the first input frame
+    rs->frames_needed = (rs->taps / 2) + 1;
+}
+
+/**
+ * Resamples as many frames as it can, up to a whole output block
+ *
+ * Stops early when it runs out of input. Whatever it has taken of the input
+ * so far is kept, so the next call just carries on with more.
+ *
+ * @param rs The resampler
+ * @param out Where to put the output frames (16 bit stereo)
+ * @param out_frames How many frames there's room for
+ * @param in The input frames (16 bit stereo)
+ * @param in_frames How many input frames there are
+ * @param in_used Set to how many of the input frames were taken
+ *
+ * @return How many output frames were made
+ */
+uint32_t Resample_Process(struct Resampler * rs, int16_t * out, uint32_t out_frames, const int16_t * in, uint32_t in_frames, uint32_t * in_used)
+{
+    const uint8_t taps = rs->taps;
+    const int16_t * window;
+    const int16_t * h0;
+    const int16_t * h1;
+    uint32_t made = 0, used = 0;
+    int32_t left, right, frac, c;
+    uint8_t k;
+
+    while(made < out_frames)
+    {
+        // Take in everything the next output frame needs
+        while(rs->frames_needed > 0)
+        {
+            if(used == in_frames)
+            {
+                *in_used = used;
+                return made;
+            }
+
+            rs->history[rs->history_pos * 2] = rs->history[(rs->history_pos + taps) * 2] = in[0];
+            rs->history[(rs->history_pos * 2) + 1] = rs->history[((rs->history_pos + taps) * 2) + 1] = in[1];
+            if(++rs->history_pos == taps)
+                rs->history_pos = 0;
+
+            in += 2;
+            used++;
+            rs->frames_needed--;
+        }
+
+        // Blend the phases either side of the position into the filter as it's run
+        h0 = &rs->coefs[(rs->pos >> (RESAMPLE_POS_BITS - RESAMPLE_PHASE_BITS)) * taps];
+        h1 = h0 + taps;
+        frac = rs->pos & ((1UL << (RESAMPLE_POS_BITS - RESAMPLE_PHASE_BITS)) - 1);
+        window = &rs->history[rs->history_pos * 2];
+        left = right = 0;
+
+        for(k = 0; k < taps; k++)
+        {
+            c = h0[k] + (((h1[k] - h0[k]) * frac) >> (RESAMPLE_POS_BITS - RESAMPLE_PHASE_BITS));
+            left += window[0] * c;
+            right += window[1] * c;
+            window += 2;
+        }
+
+        left = (left + (1 << 14)) >> 15;
+        right = (right + (1 << 14)) >> 15;
+        out[0] = (left > 32767) ? 32767 : ((left < -32768) ? -32768 : left);
+        out[1] = (right > 32767) ? 32767 : ((right < -32768) ? -32768 : right);
+        out += 2;
+        made++;
+
+        // Step on, taking another input frame for every whole frame passed
+        rs->pos += rs->step;
+        rs->pos_error += rs->step_error;
+        if(rs->pos_error >= rs->out_rate)
+        {
+            rs->pos_error -= rs->out_rate;
+            rs->pos++;
+        }
+
+        rs->frames_needed = rs->pos >> RESAMPLE_POS_BITS;
+        rs->pos &= RESAMPLE_POS_ONE - 1;
+    }
+
+    *in_used = used;
+    return made;
+}
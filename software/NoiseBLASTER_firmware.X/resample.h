@@ -0,0 +1,61 @@
+/*
+ * File:   resample.h
+ *
+ * Created on October 17, 2026
+ */
+
+#ifndef RESAMPLE_H
+#define	RESAMPLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The filter is stored at this many fractional delays, the ones in between
+// are interpolated
+#define RESAMPLE_PHASES 32
+#define RESAMPLE_PHASE_BITS 5
+
+// Position between two input frames, as a Q20 fraction
+#define RESAMPLE_POS_BITS 20
+#define RESAMPLE_POS_ONE (1UL << RESAMPLE_POS_BITS)
+
+#define RESAMPLE_MAX_TAPS 32
+
+// Quality presets, trading filter length (CPU per output frame) for a
+// flatter passband and less aliasing
+enum ResampleQuality {
+    RESAMPLE_QUALITY_LOW,       // 8 taps
+    RESAMPLE_QUALITY_MEDIUM,    // 16 taps
+    RESAMPLE_QUALITY_HIGH       // 32 taps
+};
+
+// Converts 16 bit stereo from one sample rate to another, keeping its
+// place (and the filter's history) from one block to the next
+struct Resampler {
+    uint32_t in_rate;
+    uint32_t out_rate;
+    enum ResampleQuality quality;
+    uint8_t taps;
+
+    // Where the next output frame is, counted on from the oldest frame of history
+    uint32_t pos;               // Q20 fraction of an input frame
+    uint32_t pos_error;         // Remainder of pos, in 1/out_rate of a Q20 step
+    uint32_t step;              // How far pos moves for each output frame
+    uint32_t step_error;
+    uint8_t frames_needed;      // Input frames to take before the next output
+
+    // The last taps input frames (left, right), stored twice over so a whole
+    // window can always be read without wrapping
+    int16_t history[RESAMPLE_MAX_TAPS * 2 * 2];
+    uint8_t history_pos;
+
+    // Q15 filter for each phase (plus one more so there's always a next phase)
+    int16_t coefs[(RESAMPLE_PHASES + 1) * RESAMPLE_MAX_TAPS];
+};
+
+void Resample_Configure(struct Resampler * rs, uint32_t in_rate, uint32_t out_rate, enum ResampleQuality quality);
+void Resample_Reset(struct Resampler * rs);
+uint32_t Resample_Process(struct Resampler * rs, int16_t * out, uint32_t out_frames, const int16_t * in, uint32_t in_frames, uint32_t * in_used);
+
+#endif	/* RESAMPLE_H */
+
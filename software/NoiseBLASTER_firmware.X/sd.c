@@ -1,4 +1,58 @@
+#define _SUPPRESS_PLIB_WARNING
+#include <xc.h>
+#include <plib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/kmem.h>
 #include "sd.h"
+#include "uart.h"
+
+// Clear/Set the SS 
+#define CLEAR_SS() (mPORTBClearBits(BIT_10))
+#define SET_SS() (mPORTBSetBits(BIT_10))
+
+// SD Card helper macros
+#define SD_Read()   (SPI_Write(0xFF))
+#define SD_Clock()   (SPI_Write(0xFF))
+#define SD_Disable() SET_SS(); SD_Clock()
+#define SD_Enable()  (CLEAR_SS())
+
+// DMA channels used to move sector data off of SPI2
+#define SD_DMA_TX_CHN 1
+#define SD_DMA_RX_CHN 2
+
+// Source for the 0xFF bytes clocked out while receiving a sector (lives in flash)
+static const uint8_t sd_dummy_tx[SECTOR_SIZE] = { [0 ... SECTOR_SIZE - 1] = 0xFF };
+
+// Set by the DMA ISR when a sector has finished landing in memory
+static volatile bool sd_dma_done = false;
+
+// State of the open-ended multi-block read session (see SD_StreamRead)
+static bool sd_stream_open = false;
+static uint32_t sd_stream_next_sector = 0;
+
+// Holds partial sectors for SD_ReadData requests that aren't sector aligned
+static uint8_t sd_bounce[1][SECTOR_SIZE];
+static uint32_t sd_bounce_sector;
+static bool sd_bounce_valid = false;
+
+// LRU cache of recently used metadata sectors (FAT, directories, boot sector)
+static uint8_t sd_cache[SD_CACHE_SECTORS][SECTOR_SIZE];
+static uint32_t sd_cache_sector[SD_CACHE_SECTORS];
+static uint32_t sd_cache_last_used[SD_CACHE_SECTORS];   // Zero means the slot is empty
+static uint32_t sd_cache_tick = 0;
+
+uint32_t sd_cache_hits = 0;
+uint32_t sd_cache_misses = 0;
+
+static void SD_ReadBounce(void * buffer, uint32_t sector_num, uint32_t offset, uint32_t size);
+static uint8_t * SD_CacheLookup(uint32_t sector_num);
+static void SD_StartRead(uint8_t cmd, uint32_t sector_num);
+static void SD_ReadBlock(uint8_t * buffer);
+static void SD_StopTransmission(void);
+static void SD_DmaReadBlock(uint8_t * buffer);
+static bool SD_WriteBlock(uint8_t token, const uint8_t * buffer);
+static void SD_CacheWrite(uint32_t sector_num, const uint8_t * buffer);
 
 /**
  * Initialize SPI2 (used to interface with the SD Card)
@@ -14,10 +68,49 @@ static void InitSPI2(void)
     SPI2STATbits.SPIROV = 0;    // Clear the receive overflow bit
     SPI2CON = 0x260;    // Master, CKE=0; CKP=1, sample end (dude on internet says this works)
     SPI2BRG = 128;  // Divide by 512. SCK = Fpb/(2 * (BRG + 1)), aka, 156.25KHz
+    SPI2CONbits.SRXISEL = 1;    // Receive event whenever a byte arrives (starts the sector DMA)
     
     SPI2CONbits.ON = 1; // enable
 }
 
+/**
+ * Initialize the two DMA channels used to receive sectors from the SD card
+ *
+ * Both channels are started by the SPI2 receive event so they run in lock
+ * step: every received byte is read out by the RX channel and triggers the TX
+ * channel to clock out the next 0xFF. This means only one byte is ever in
+ * flight and the receive buffer can never overflow.
+ */
+static void InitSDDMA(void)
+{
+    DMACONSET = 0x8000;     // Enable the DMA controller
+
+    DmaChnIntDisable(SD_DMA_RX_CHN);
+    DmaChnClrIntFlag(SD_DMA_RX_CHN);
+    mDmaChnSetIntPriority(SD_DMA_RX_CHN, 5, 0);
+
+    // TX channel: dummy 0xFF bytes from flash into SPI2BUF
+    DCH1CON = 0x2;          // Channel off, pri 2
+    DCH1ECON = (_SPI2_RX_IRQ << 8) | 0x10;  // Start on SPI2 receive, SIRQEN
+    DCH1SSA = KVA_TO_PA(sd_dummy_tx);
+    DCH1DSA = KVA_TO_PA(&SPI2BUF);
+    DCH1SSIZ = SECTOR_SIZE;
+    DCH1DSIZ = 1;
+    DCH1CSIZ = 1;
+    DCH1INTCLR = 0xFF00FF;  // No interrupts, clear all flags
+
+    // RX channel: SPI2BUF into the destination buffer (set per transfer)
+    DCH2CON = 0x3;          // Channel off, pri 3 (must beat the TX channel)
+    DCH2ECON = (_SPI2_RX_IRQ << 8) | 0x10;  // Start on SPI2 receive, SIRQEN
+    DCH2SSA = KVA_TO_PA(&SPI2BUF);
+    DCH2SSIZ = 1;
+    DCH2DSIZ = SECTOR_SIZE;
+    DCH2CSIZ = 1;
+    DCH2INTCLR = 0xFF00FF;  // Clear all flags and interrupt enables
+    DCH2INTSET = 0x80000;   // Enable block transfer complete interrupt
+    DmaChnIntEnable(SD_DMA_RX_CHN);
+}
+
 /**
  * Initialize the SPI connected to the SD Card, and the SD Card itself
  */
@@ -79,6 +172,8 @@ void InitSD(void)
     SPI2BRG = 0;  // SCK = Fpb/(2 * (BRG + 1))
     SPI2CONbits.ON = 1; // enable
     
+    InitSDDMA();
+    
     UART_SendString("Card is initialized\n\r");
 }
 
@@ -156,37 +251,147 @@ uint8_t SD_SendCmd(uint8_t cmd, uint32_t addr, uint8_t crc)
  * Read a variable amount of bytes off of the SD card starting at a specific
  * byte address.
  * 
+ * Requests can be any length and alignment. The whole sectors in the middle
+ * of the request are read straight into the caller's buffer with a single
+ * multi-block read, and only the partial sectors at either end go through the
+ * bounce buffer. Sectors are read through the streaming session, so
+ * sequential calls (like the audio refills) don't pay for a new read command
+ * every time.
+ * 
+ * @param buffer        The buffer to put data into
+ * @param start_byte    The byte address to start reading from
+ * @param size          How many bytes to read
+ */
+void SD_ReadData(void * buffer, uint64_t start_byte, size_t size)
+{
+    uint32_t sector_num = SECTOR_NUM(start_byte);
+    uint32_t offset = start_byte % SECTOR_SIZE;
+    uint32_t num_bytes, num_sectors;
+    
+    // Ragged head: the request starts partway into a sector or ends before it does
+    if(size > 0 && (offset != 0 || size < SECTOR_SIZE))
+    {
+        num_bytes = SECTOR_SIZE - offset;
+        if(num_bytes > size)
+            num_bytes = size;
+        
+        SD_ReadBounce(buffer, sector_num, offset, num_bytes);
+        
+        buffer = (uint8_t *)buffer + num_bytes;
+        size -= num_bytes;
+        sector_num++;
+    }
+    
+    // Aligned middle: every whole sector lands directly in the caller's buffer
+    num_sectors = size / SECTOR_SIZE;
+    if(num_sectors > 0)
+    {
+        SD_StreamRead((uint8_t (*)[SECTOR_SIZE])buffer, sector_num, num_sectors);
+        
+        buffer = (uint8_t *)buffer + (num_sectors * SECTOR_SIZE);
+        size -= num_sectors * SECTOR_SIZE;
+        sector_num += num_sectors;
+    }
+    
+    // Ragged tail: whatever is left over from the last sector
+    if(size > 0)
+        SD_ReadBounce(buffer, sector_num, 0, size);
+}
+
+/**
+ * Copy part of a sector out of the bounce buffer, reading the sector into it
+ * first if it isn't the one already there
+ * 
+ * Keeping the last sector around means a read that ends partway through a
+ * sector followed by one that picks up where it left off only touches the
+ * card once (and doesn't break the streaming session).
+ * 
+ * @param buffer        The buffer to put data into
+ * @param sector_num    The sector to copy out of
+ * @param offset        The byte offset within the sector to start from
+ * @param size          How many bytes to copy (must stay within the sector)
+ */
+static void SD_ReadBounce(void * buffer, uint32_t sector_num, uint32_t offset, uint32_t size)
+{
+    if(!sd_bounce_valid || sd_bounce_sector != sector_num)
+    {
+        SD_StreamRead(sd_bounce, sector_num, 1);
+        sd_bounce_sector = sector_num;
+        sd_bounce_valid = true;
+    }
+    
+    memcpy(buffer, sd_bounce[0] + offset, size);
+}
+
+/**
+ * Read a variable amount of bytes through the metadata sector cache
+ * 
+ * Meant for small, repeated reads like FAT lookups, directory entries and
+ * the boot sector. Bulk data should go through SD_ReadData instead so it
+ * doesn't push the metadata out of the cache.
+ * 
  * @param buffer        The buffer to put data into
  * @param start_byte    The byte address to start reading from
  * @param size          How many bytes to read
+ */
+void SD_ReadCached(void * buffer, uint64_t start_byte, size_t size)
+{
+    uint8_t * sector;
+    uint32_t offset, num_bytes;
+    
+    while(size > 0)
+    {
+        sector = SD_CacheLookup(SECTOR_NUM(start_byte));
+        
+        // Copy out as much as this sector holds
+        offset = start_byte % SECTOR_SIZE;
+        num_bytes = SECTOR_SIZE - offset;
+        if(num_bytes > size)
+            num_bytes = size;
+        
+        memcpy(buffer, sector + offset, num_bytes);
+        
+        buffer = (uint8_t *)buffer + num_bytes;
+        start_byte += num_bytes;
+        size -= num_bytes;
+    }
+}
+
+/**
+ * Find a sector in the metadata cache, reading it in over the least recently
+ * used slot if it isn't there
+ * 
+ * @param sector_num The sector to look up
  * 
- * NOTE: With this implementation, only SECTOR_SIZE number of bytes can be
- * safely read. Modifications need to be made to read more than SECTOR_SIZE
- * number of bytes safely and efficiently.
+ * @return A pointer to the cached copy of the sector
  */
-void SD_ReadData(void * buffer, uint32_t start_byte, size_t size)
+static uint8_t * SD_CacheLookup(uint32_t sector_num)
 {
-    // Buffers to hold data across sector boundaries
-    uint8_t intermediate[MAX_SD_BUFFERS][SECTOR_SIZE];
-    int i = 0, j = 0;
+    uint8_t i, slot = 0;
     
-    // How many bytes it takes up adding the bytes from the start of the sector
-    int size_from_start = size + (start_byte % SECTOR_SIZE);
+    ++sd_cache_tick;
     
-    // Check if size is outside the boundaries and force to upper limit if so
-    if(size > ((MAX_SD_BUFFERS - 1) * SECTOR_SIZE))
-        size = (MAX_SD_BUFFERS - 1) * SECTOR_SIZE;
+    for(i = 0; i < SD_CACHE_SECTORS; ++i)
+    {
+        if(sd_cache_last_used[i] != 0 && sd_cache_sector[i] == sector_num)
+        {
+            sd_cache_last_used[i] = sd_cache_tick;
+            sd_cache_hits++;
+            return sd_cache[i];
+        }
+        
+        // Remember the oldest slot in case this is a miss (empty slots are oldest)
+        if(sd_cache_last_used[i] < sd_cache_last_used[slot])
+            slot = i;
+    }
     
-    // Operation fits within a single sector read
-    if(size_from_start <= SECTOR_SIZE)
-        SD_ReadSector((uint8_t *)intermediate, SECTOR_NUM(start_byte));
-    else
-        // Operation will cross sector boundaries, do a multi-sector read
-        SD_ReadMultiSectors(intermediate, SECTOR_NUM(start_byte), MAX_SD_BUFFERS);
+    sd_cache_misses++;
     
-    // Move from the intermediate buffer into the requested buffer
-    for(i = start_byte % SECTOR_SIZE; j < size; ++i, ++j)
-        *((uint8_t *)buffer + j) = intermediate[SECTOR_NUM(i)][i % SECTOR_SIZE];
+    SD_StreamRead(&sd_cache[slot], sector_num, 1);
+    sd_cache_sector[slot] = sector_num;
+    sd_cache_last_used[slot] = sd_cache_tick;
+    
+    return sd_cache[slot];
 }
 
 /**
@@ -197,54 +402,220 @@ void SD_ReadData(void * buffer, uint32_t start_byte, size_t size)
  */
 void SD_ReadSector(uint8_t * buffer, uint32_t sector_num)
 {
-    uint16_t i = 0;
-    //uint32_t addr = sector_num * SECTOR_SIZE;
-    uint32_t addr = sector_num; // SDHC uses sector addressing, not byte
+    // The card can't take a new command while it's in the middle of a stream
+    SD_StreamStop();
     
     SD_Enable(); // enable SD card
+    SD_StartRead(17, sector_num);
+    SD_ReadBlock(buffer);
+    SD_Disable();
+}
 
-    SPI_Write(17 | 0x40); // send command packet (6 bytes)
-    SPI_Write((addr>>24) & 0xFF); // msb of the address/argument
-    SPI_Write((addr>>16) & 0xFF);
-    SPI_Write((addr>>8) & 0xFF);
-    SPI_Write((addr) & 0xFF); // lsb
-    SPI_Write(0); // Not used unless CRC mode is turned back on for SPI access.
-
-    // Wait for zero confirming the command was received correctly
-    for(i = 0; i < 10 && SD_Read() != 0x00; ++i);
-    
-    if(i >= 10)
-        UART_SendString("ERROR: Data command not sent successfully\r\n");
+/**
+ * Read multiple sectors from the SD Card in one transaction
+ * 
+ * @param buffer The buffer to store each of the sectors to read
+ * @param start_sector_num The number of the starting sector to read
+ * @param num_sectors The number of sectors to read
+ */
+void SD_ReadMultiSectors(uint8_t buffer[][SECTOR_SIZE], uint32_t start_sector_num, uint32_t num_sectors)
+{
+    uint32_t i;
     
-    // Wait for the start of the data (aka, the 0xFE data token for CMD17)
-    while(SD_Read() != 0xFE);
+    SD_StreamStop();
     
-    // Actually read the data
-    for(i = 0; i < SECTOR_SIZE; ++i)
-        buffer[i] = SD_Read();
+    SD_Enable(); // enable SD card
+    SD_StartRead(18, start_sector_num);
     
-    // Skip the 2 bytes of checksum
-    SD_Read();
-    SD_Read();
+    // Read in the sectors
+    for(i = 0; i < num_sectors; ++i)
+        SD_ReadBlock(buffer[i]);
     
+    SD_StopTransmission();
     SD_Disable();
 }
 
 /**
- * Read multiple sectors from the SD Card in one transaction
+ * Read sectors through the open-ended multi-block read session
+ * 
+ * The card is left in multi-block read mode (CMD18) after each call. If the
+ * next call continues where this one left off, the sectors are clocked
+ * straight out of the card without sending any commands. Reading from any
+ * other sector stops the old session (CMD12) and starts a new one.
  * 
  * @param buffer The buffer to store each of the sectors to read
  * @param start_sector_num The number of the starting sector to read
  * @param num_sectors The number of sectors to read
  */
-void SD_ReadMultiSectors(uint8_t buffer[][SECTOR_SIZE], uint32_t start_sector_num, uint32_t num_sectors)
+void SD_StreamRead(uint8_t buffer[][SECTOR_SIZE], uint32_t start_sector_num, uint32_t num_sectors)
+{
+    uint32_t i;
+    
+    // Discontinuity (cluster jump, seek, new file), restart the session
+    if(!sd_stream_open || start_sector_num != sd_stream_next_sector)
+    {
+        SD_StreamStop();
+        
+        SD_Enable(); // enable SD card
+        SD_StartRead(18, start_sector_num);
+        sd_stream_open = true;
+    }
+    
+    for(i = 0; i < num_sectors; ++i)
+        SD_ReadBlock(buffer[i]);
+    
+    sd_stream_next_sector = start_sector_num + num_sectors;
+}
+
+/**
+ * Stop the multi-block read session (if there is one) and release the card
+ */
+void SD_StreamStop(void)
 {
-    uint16_t i, j;
-    uint32_t addr = start_sector_num; // SDHC uses sector addressing, not byte
+    if(!sd_stream_open)
+        return;
+    
+    SD_StopTransmission();
+    SD_Disable();
+    sd_stream_open = false;
+}
+
+/**
+ * Writes a single sector to the SD Card
+ * 
+ * Any copy of the sector in the metadata cache or the bounce buffer is
+ * updated to match.
+ * 
+ * @param buffer The 512 bytes to write
+ * @param sector_num Which sector to write
+ * 
+ * @return True if the card accepted the data
+ */
+bool SD_WriteSector(const uint8_t * buffer, uint32_t sector_num)
+{
+    bool accepted = false;
+    
+    SD_StreamStop();
+    
+    SD_Enable(); // enable SD card
+    if(SD_SendCmd(24, sector_num, 0) == 0x00)
+    {
+        SD_Clock();     // The card wants at least one byte before the data token
+        accepted = SD_WriteBlock(0xFE, buffer);
+    }
+    else
+        UART_SendString("ERROR: Write command not sent successfully\r\n");
+    SD_Disable();
+    
+    SD_CacheWrite(sector_num, buffer);
+    
+    return accepted;
+}
+
+/**
+ * Writes multiple sectors to the SD Card in one transaction
+ * 
+ * @param buffer The sectors to write
+ * @param start_sector_num The number of the first sector to write
+ * @param num_sectors The number of sectors to write
+ * 
+ * @return True if the card accepted all of the data
+ */
+bool SD_WriteMultiSectors(const uint8_t buffer[][SECTOR_SIZE], uint32_t start_sector_num, uint32_t num_sectors)
+{
+    bool accepted = false;
+    uint32_t i;
+    
+    SD_StreamStop();
     
     SD_Enable(); // enable SD card
+    if(SD_SendCmd(25, start_sector_num, 0) == 0x00)
+    {
+        SD_Clock();
+        
+        accepted = true;
+        for(i = 0; i < num_sectors && accepted; ++i)
+            accepted = SD_WriteBlock(0xFC, buffer[i]);
+        
+        // Stop tran token, then wait for the card to finish programming
+        SPI_Write(0xFD);
+        SD_Read();
+        while(SD_Read() != 0xFF);
+    }
+    else
+        UART_SendString("ERROR: Write command not sent successfully\r\n");
+    SD_Disable();
+    
+    for(i = 0; i < num_sectors; ++i)
+        SD_CacheWrite(start_sector_num + i, buffer[i]);
+    
+    return accepted;
+}
+
+/**
+ * Send one data block of a write (CMD24/CMD25) and wait for the card to
+ * program it
+ * 
+ * @param token The start block token (0xFE single, 0xFC multi-block)
+ * @param buffer The 512 bytes to send
+ * 
+ * @return True if the card accepted the data
+ */
+static bool SD_WriteBlock(uint8_t token, const uint8_t * buffer)
+{
+    uint16_t i;
+    uint8_t response;
+    
+    SPI_Write(token);
+    for(i = 0; i < SECTOR_SIZE; ++i)
+        SPI_Write(buffer[i]);
+    
+    // Dummy checksum, CRC is off in SPI mode
+    SPI_Write(0xFF);
+    SPI_Write(0xFF);
+    
+    // Data response is xxx0sss1, where sss = 010 means the data was accepted
+    response = SD_Read() & 0x1F;
+    
+    // The card holds the line low while it's busy programming
+    while(SD_Read() != 0xFF);
+    
+    return response == 0x05;
+}
+
+/**
+ * Keeps the metadata cache and the bounce buffer in step with a sector that
+ * was just written
+ * 
+ * @param sector_num The sector that was written
+ * @param buffer What was written to it
+ */
+static void SD_CacheWrite(uint32_t sector_num, const uint8_t * buffer)
+{
+    uint8_t i;
+    
+    for(i = 0; i < SD_CACHE_SECTORS; ++i)
+    {
+        if(sd_cache_last_used[i] != 0 && sd_cache_sector[i] == sector_num)
+            memcpy(sd_cache[i], buffer, SECTOR_SIZE);
+    }
+    
+    if(sd_bounce_valid && sd_bounce_sector == sector_num)
+        memcpy(sd_bounce[0], buffer, SECTOR_SIZE);
+}
 
-    SPI_Write(18 | 0x40); // send command packet (6 bytes)
+/**
+ * Send a read command (CMD17/CMD18) and wait for the card to accept it
+ * 
+ * @param cmd The read command to send
+ * @param sector_num The sector to start reading from
+ */
+static void SD_StartRead(uint8_t cmd, uint32_t sector_num)
+{
+    uint16_t i = 0;
+    uint32_t addr = sector_num; // SDHC uses sector addressing, not byte
+    
+    SPI_Write(cmd | 0x40); // send command packet (6 bytes)
     SPI_Write((addr>>24) & 0xFF); // msb of the address/argument
     SPI_Write((addr>>16) & 0xFF);
     SPI_Write((addr>>8) & 0xFF);
@@ -256,21 +627,32 @@ void SD_ReadMultiSectors(uint8_t buffer[][SECTOR_SIZE], uint32_t start_sector_nu
     
     if(i >= 10)
         UART_SendString("ERROR: Data command not sent successfully\r\n");
-    
-    // Read in the sectors
-    for(i = 0; i < num_sectors; ++i)
-    {
-        // Wait for the start of the data (aka, the 0xFE data token for CMD18)
-        while(SD_Read() != 0xFE);
+}
 
-        // Actually read the data
-        for(j = 0; j < SECTOR_SIZE; ++j)
-            buffer[i][j] = SD_Read();
+/**
+ * Read one data block after a CMD17/CMD18 has been accepted
+ * 
+ * @param buffer A 512 byte buffer to store the sector in
+ */
+static void SD_ReadBlock(uint8_t * buffer)
+{
+    // Wait for the start of the data (aka, the 0xFE data token)
+    while(SD_Read() != 0xFE);
 
-        // Skip the 2 bytes of checksum
-        SD_Read();
-        SD_Read();
-    }
+    // Actually read the data
+    SD_DmaReadBlock(buffer);
+
+    // Skip the 2 bytes of checksum
+    SD_Read();
+    SD_Read();
+}
+
+/**
+ * Send CMD12 to stop a multi-block read and wait for the card to finish
+ */
+static void SD_StopTransmission(void)
+{
+    uint16_t i;
     
     // Send CMD12 to tell the SD card to stop transmitting
     SPI_Write(12 | 0x40); // send command packet (6 bytes)
@@ -288,6 +670,55 @@ void SD_ReadMultiSectors(uint8_t buffer[][SECTOR_SIZE], uint32_t start_sector_nu
     
     // Wait for busy signal to de-assert
     while(SD_Read() != 0xFF);
+}
+
+/**
+ * Receive one sector worth of data off of SPI2 using DMA
+ * 
+ * The data token must already have been read. Returns once the whole sector
+ * has been written into the buffer.
+ * 
+ * @param buffer A 512 byte buffer to store the data in
+ */
+static void SD_DmaReadBlock(uint8_t * buffer)
+{
+    sd_dma_done = false;
     
-    SD_Disable();
+    SPI2BUF;                    // Make sure the receive buffer starts out empty
+    SPI2STATbits.SPIROV = 0;
+    
+    DCH2DSA = KVA_TO_PA(buffer);
+    DCH2INTCLR = 0xFF;          // Clear any stale flags
+    DmaChnEnable(SD_DMA_RX_CHN);
+    DmaChnEnable(SD_DMA_TX_CHN);
+    
+    // Kick off the first byte, every byte after that is triggered by the previous receive
+    DCH1ECONSET = 0x80;         // CFORCE
+    
+    // DmaCh2Int normally sees the block finish, but nextSong and prevSong
+    // read with interrupts off, so watch the flag here too for when the ISR
+    // can't run. With interrupts on the two race to clear it, which is harmless
+    // as both only ever set sd_dma_done.
+    while(!sd_dma_done)
+    {
+        if(DCH2INTbits.CHBCIF)
+        {
+            DCH2INTCLR = 0x8;
+            DmaChnClrIntFlag(SD_DMA_RX_CHN);
+            sd_dma_done = true;
+        }
+    }
+}
+
+/*
+ * Finished receiving one complete sector
+ * 
+ * DMA channel 2 block complete interrupt service routine
+ */
+void __ISR(_DMA_2_VECTOR, ipl5) DmaCh2Int(void)
+{
+    DCH2INTCLR = 0x8;   // Clear block transfer complete interrupt
+    DmaChnClrIntFlag(SD_DMA_RX_CHN);
+    
+    sd_dma_done = true;
 }
\ No newline at end of file
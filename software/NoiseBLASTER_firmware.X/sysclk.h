@@ -9,6 +9,7 @@
 #define	SYSCLK_H
 
 #define SYS_FREQ (44452800L)
+#define POSC_FREQ (16934400L)     // 384 * 44.1KHz crystal, SYS_FREQ is it * 21 / 4 / 2
 
 #endif	/* SYSCLK_H */
 
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include "wav.h"
 
 /**
@@ -19,7 +20,7 @@
  * @param count The number of bytes to copy from source to destination
  */
 void extractData (uint8_t * sourcePtr, uint8_t * destinationPtr, unsigned int address, unsigned int count){
-    int i;
+    unsigned int i;
     
     for (i = 0; i<count; i++){
         destinationPtr[i] = sourcePtr [address+i];
@@ -34,7 +35,7 @@ void extractData (uint8_t * sourcePtr, uint8_t * destinationPtr, unsigned int ad
  */
 unsigned int mergeUnsignedInt (uint8_t * ptr, unsigned int size){
     unsigned int output = 0;
-    int i;
+    unsigned int i;
     
     for (i = 0; i<size; i++) {
         output = output | (ptr[i] << (i * 8));
@@ -42,24 +43,95 @@ unsigned int mergeUnsignedInt (uint8_t * ptr, unsigned int size){
     return output;
 }
 
-
 /**
- * Attempts to read the entire WAV header from the data provided
+ * Walks the RIFF chunks of a WAV file to find its format and its samples
+ * 
+ * Only the 8 byte chunk headers and the start of the fmt chunk are read,
+ * anything else (LIST, fact, bext, ...) is seeked over without buffering it.
+ * On success the file is left at the first sample.
+ * 
+ * A data chunk claiming to be bigger than the file (or zero, as left by some
+ * recorders that never went back to fill it in) is cut down to what's
+ * actually there.
  * 
- * @param sourcePtr A pointer to the byte array to read from
+ * @param file The file to read, starting from the beginning
+ * @param info Filled in with the format and where the samples are
+ * 
+ * @return False if the file isn't a WAV or has no fmt chunk before its data
  */
-void readWavHeader (uint8_t * sourcePtr){
-    extractData(sourcePtr, wavHeader.riffChunk,0,4);
-    extractData(sourcePtr, wavHeader.fileSize,4,4);
-    extractData(sourcePtr, wavHeader.format,8,4);
-    extractData(sourcePtr, wavHeader.formatChunk,12,4);
-    extractData(sourcePtr, wavHeader.formatChunkSize,16,4);
-    extractData(sourcePtr, wavHeader.audioFormat,20,2);
-    extractData(sourcePtr, wavHeader.channelCount,22,2);
-    extractData(sourcePtr, wavHeader.sampleRate,24,4);
-    extractData(sourcePtr, wavHeader.bytesPerSecond,28,4);
-    extractData(sourcePtr, wavHeader.blockAlign,32,2);
-    extractData(sourcePtr, wavHeader.bitsPerSample,34,2);
-    extractData(sourcePtr, wavHeader.dataChunk,36,4);
-    extractData(sourcePtr, wavHeader.dataChunkSize,40,4);
-}
\ No newline at end of file
+bool Wav_ReadInfo (struct FatFile * file, struct WavInfo * info){
+    uint8_t chunk[WAV_FMT_MAX_SIZE];
+    uint32_t pos = 12;      // Byte after the chunk header just read
+    uint32_t chunk_size;
+    uint32_t read_size;
+    bool have_fmt = false;
+    
+    memset(info, 0, sizeof(struct WavInfo));
+    
+    ResetFile(file);
+    if (Fat_read(file, chunk, 12) != 12 || memcmp(chunk, "RIFF", 4) != 0 || memcmp(chunk + 8, "WAVE", 4) != 0){
+        return false;
+    }
+    
+    while (pos + 8 <= file->filesize && Fat_read(file, chunk, 8) == 8){
+        chunk_size = mergeUnsignedInt(chunk + 4, 4);
+        pos += 8;
+        
+        if (memcmp(chunk, "data", 4) == 0){
+            if (!have_fmt){
+                return false;
+            }
+            
+            if (chunk_size == 0 || chunk_size > file->filesize - pos){
+                chunk_size = file->filesize - pos;
+            }
+            
+            info->data_offset = pos;
+            info->data_size = chunk_size - (chunk_size % info->block_align);
+            
+            // For compressed formats a block isn't a frame, their decoders count them
+            if (info->format == WAV_FORMAT_PCM || info->format == WAV_FORMAT_IEEE_FLOAT){
+                info->frames = info->data_size / info->block_align;
+            }
+            return true;
+        }
+        
+        // Chunks are padded out to an even number of bytes
+        if (chunk_size > file->filesize - pos){
+            return false;
+        }
+        chunk_size += chunk_size & 1;
+        
+        if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16){
+            read_size = (chunk_size < WAV_FMT_MAX_SIZE) ? chunk_size : WAV_FMT_MAX_SIZE;
+            if (Fat_read(file, chunk, read_size) != read_size){
+                return false;
+            }
+            
+            info->format = mergeUnsignedInt(chunk, 2);
+            info->channels = mergeUnsignedInt(chunk + 2, 2);
+            info->sample_rate = mergeUnsignedInt(chunk + 4, 4);
+            info->block_align = mergeUnsignedInt(chunk + 12, 2);
+            info->bits_per_sample = mergeUnsignedInt(chunk + 14, 2);
+            info->valid_bits = info->bits_per_sample;
+            
+            // The real format is the first two bytes of the sub-format GUID
+            if (info->format == WAV_FORMAT_EXTENSIBLE && read_size >= WAV_FMT_MAX_SIZE){
+                info->valid_bits = mergeUnsignedInt(chunk + 18, 2);
+                info->channel_mask = mergeUnsignedInt(chunk + 20, 4);
+                info->format = mergeUnsignedInt(chunk + 24, 2);
+            }
+            
+            have_fmt = (info->channels != 0 && info->block_align != 0);
+            chunk_size -= read_size;
+            pos += read_size;
+        }
+        
+        if (chunk_size > 0){
+            Fat_seek(file, chunk_size, FAT_SEEK_CUR);
+        }
+        pos += chunk_size;
+    }
+    
+    return false;
+}
@@ -8,27 +8,38 @@
 #ifndef WAV_H
 #define	WAV_H
 
-typedef struct {
-    uint8_t riffChunk[5]; //Expected RIFF
-    uint8_t fileSize[4]; // 32 bit unsigned int
-    uint8_t format[5]; //Expected WAVE
-    uint8_t formatChunk[4]; //Expected fmt
-    uint8_t formatChunkSize[4]; // 32 bit unsigned int
-    uint8_t audioFormat[2]; // 16 bit unsigned int
-    uint8_t channelCount[2]; // 16 bit unsigned int
-    uint8_t sampleRate[4]; // 32 bit unsigned int
-    uint8_t bytesPerSecond[4]; // 32 bit unsigned int
-    uint8_t blockAlign[2]; // 16 bit unsigned int
-    uint8_t bitsPerSample[2]; // 16 bit unsigned int
-    uint8_t dataChunk[5]; //Expected DATA
-    uint8_t dataChunkSize[4]; // 32 bit unsigned int
-} WAV_HEADER;
-
-WAV_HEADER wavHeader;
+#include <stdint.h>
+#include <stdbool.h>
+#include "fat.h"
+
+// Format tags from the fmt chunk
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_ADPCM 0x0002
+#define WAV_FORMAT_IEEE_FLOAT 0x0003
+#define WAV_FORMAT_IMA_ADPCM 0x0011
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+#define WAV_FORMAT_FLAC 0xF1AC       // Also what a native FLAC file is described as
+
+// Biggest fmt chunk that gets looked at (WAVE_FORMAT_EXTENSIBLE), anything past it is skipped
+#define WAV_FMT_MAX_SIZE 40
+
+// Everything needed to play a WAV file, found by walking its RIFF chunks
+struct WavInfo {
+    uint16_t format;            // For WAVE_FORMAT_EXTENSIBLE this is the sub-format's tag
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint16_t block_align;       // Bytes in one frame (a sample for every channel)
+    uint16_t bits_per_sample;   // Container size, valid_bits may be fewer
+    uint16_t valid_bits;
+    uint32_t channel_mask;      // Zero unless the file is WAVE_FORMAT_EXTENSIBLE
+    uint32_t data_offset;       // Byte in the file where the first sample is
+    uint32_t data_size;         // Bytes of samples, a whole number of frames
+    uint32_t frames;            // Frames in the track, zero if it isn't known
+};
 
 void extractData (uint8_t * sourcePtr, uint8_t * destinationPtr, unsigned int address, unsigned int count);
 unsigned int mergeUnsignedInt (uint8_t * ptr, unsigned int size);
-void readWavHeader (uint8_t * sourcePtr);
+bool Wav_ReadInfo (struct FatFile * file, struct WavInfo * info);
 
 #endif	/* WAV_H */
 
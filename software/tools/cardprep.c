@@ -0,0 +1,623 @@
+/*
+ * File:   cardprep.c
+ *
+ * Created on October 17, 2026
+ *
+ * Builds a FAT32 card image for the player out of a directory of WAV files.
+ *
+ *   cardprep [-s size_MiB] [-k cluster_KiB] [-m manifest] image audio_dir
+ *
+ * Every track is converted to the player's native format (16 bit stereo PCM
+ * behind a plain 44 byte header) and stored in one contiguous, cluster
+ * aligned run, so it streams without a single FAT lookup or read restart.
+ * The library index the player loads at boot (library.c) is written too,
+ * using the firmware's own code, so the player opens each track straight
+ * from its extent instead of scanning the card. The manifest lists where
+ * every track ended up and how close each refill gets to its deadline.
+ *
+ * The image can be a block device (e.g. /dev/sdX), in which case the whole
+ * device is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include "sd_file.h"
+#include "fat.h"
+#include "library.h"
+#include "wav.h"
+#include "sysclk.h"
+
+// Where the partition starts, 1MiB in like the SD association formatter
+#define PART_START_SECTOR 2048
+
+#define FAT32_MIN_CLUSTERS 65525
+#define FAT32_RESERVED_SECTORS 32
+
+// How many sectors are written to the card at a time
+#define WRITE_SECTORS 64
+
+// How the player reads the card: SPI2 at Fpb / 2 (SPI2BRG = 0), one sector per refill
+#define PLAYER_SPI_HZ (SYS_FREQ / 2)
+#define PLAYER_REFILL_BYTES SECTOR_SIZE
+
+// Card timing assumed for the latency report (typical class 10 card)
+#define CARD_BLOCK_GAP_US 20.0      // Between blocks of a multi-block read
+#define CARD_ACCESS_US 1000.0       // CMD12, then CMD18 until the first block arrives
+
+// Input formats that can be converted
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+// A track waiting to be written to the card
+struct Track {
+    char path[PATH_MAX];
+    char source[NAME_MAX + 1];
+    uint16_t format;
+    uint16_t channels;
+    uint16_t bits;
+    uint16_t block_align;
+    uint32_t rate;
+    long data_offset;       // Where the samples start in the source file
+    uint32_t frames;
+    uint32_t out_size;      // Size of the converted file in bytes
+    uint32_t start_sector;  // Where it ended up on the card
+    uint8_t extents;
+};
+
+static struct Track * tracks = NULL;
+static uint32_t num_tracks = 0;
+
+static struct FatPartition fat;
+static struct LibraryIndex library;
+static FatCatalogEntry catalog[LIBRARY_MAX_FILES];
+
+// Function prototypes
+static bool FindTracks(const char * dir_path);
+static bool ParseWav(struct Track * track);
+static bool FormatFat32(uint32_t cluster_sectors);
+static bool WriteTrack(struct Track * track, uint16_t index);
+static void WriteManifest(FILE * out);
+static void Put16(uint8_t * p, uint16_t value);
+static void Put32(uint8_t * p, uint32_t value);
+
+static void Usage(void)
+{
+    fprintf(stderr, "usage: cardprep [-s size_MiB] [-k cluster_KiB] [-m manifest] image audio_dir\n");
+    exit(2);
+}
+
+int main(int argc, char ** argv)
+{
+    uint64_t size_mib = 0, needed = 0;
+    uint32_t cluster_kib = 0, cluster_sectors, i;
+    const char * manifest_path = NULL;
+    FILE * manifest;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:k:m:")) != -1)
+    {
+        switch(opt)
+        {
+            case 's': size_mib = strtoull(optarg, NULL, 10); break;
+            case 'k': cluster_kib = strtoul(optarg, NULL, 10); break;
+            case 'm': manifest_path = optarg; break;
+            default: Usage();
+        }
+    }
+
+    if(argc - optind != 2)
+        Usage();
+
+    if(!FindTracks(argv[optind + 1]))
+        return 1;
+
+    // Default to just enough room for the tracks and the index, with some to spare
+    for(i = 0; i < num_tracks; ++i)
+        needed += tracks[i].out_size + (64 * 1024);
+    needed += LIBRARY_SIZE(LIBRARY_MAX_FILES);
+    if(size_mib == 0)
+        size_mib = (needed + (needed / 16)) / (1024 * 1024) + 8;
+    if(size_mib < 64)
+        size_mib = 64;
+
+    if(!SD_OpenImage(argv[optind], size_mib * 1024 * 1024))
+        return 1;
+
+    // Biggest cluster that still leaves enough clusters for FAT32, unless one was asked for
+    if(cluster_kib != 0)
+        cluster_sectors = cluster_kib * 2;
+    else
+    {
+        for(cluster_sectors = 64; cluster_sectors > 1; cluster_sectors /= 2)
+        {
+            if((SD_ImageSectors() - PART_START_SECTOR) / cluster_sectors > FAT32_MIN_CLUSTERS + 1024)
+                break;
+        }
+    }
+
+    if(!FormatFat32(cluster_sectors))
+        return 1;
+
+    if(!OpenFirstFatPartition(&fat) || fat.fs_type != FAT_FS_FAT32)
+    {
+        fprintf(stderr, "cardprep: couldn't read back the new partition\n");
+        return 1;
+    }
+
+    for(i = 0; i < num_tracks; ++i)
+    {
+        if(!WriteTrack(&tracks[i], i))
+            return 1;
+    }
+
+    // Same steps the player takes on its first boot, so it finds a valid index
+    if(!Library_Open(&library, &fat, LIBRARY_MAX_FILES))
+    {
+        fprintf(stderr, "cardprep: couldn't create the library index\n");
+        return 1;
+    }
+
+    {
+        char * exts[] = { "WAV" };
+        uint16_t num_files = GetFilesByExt(&fat, catalog, LIBRARY_MAX_FILES, exts, 1);
+        Library_Save(&library, catalog, num_files);
+    }
+
+    manifest = stdout;
+    if(manifest_path != NULL && (manifest = fopen(manifest_path, "w")) == NULL)
+    {
+        perror(manifest_path);
+        return 1;
+    }
+
+    WriteManifest(manifest);
+
+    if(manifest != stdout)
+        fclose(manifest);
+
+    SD_CloseImage();
+    return 0;
+}
+
+static int CompareTracks(const void * a, const void * b)
+{
+    return strcmp(((const struct Track *)a)->source, ((const struct Track *)b)->source);
+}
+
+/**
+ * Collects every WAV file in a directory that can be converted, sorted by name
+ *
+ * @param dir_path The directory to look in
+ *
+ * @return False if the directory couldn't be read or had nothing to play
+ */
+static bool FindTracks(const char * dir_path)
+{
+    DIR * dir = opendir(dir_path);
+    struct dirent * entry;
+    struct Track track;
+    size_t len;
+
+    if(dir == NULL)
+    {
+        perror(dir_path);
+        return false;
+    }
+
+    while((entry = readdir(dir)) != NULL)
+    {
+        len = strlen(entry->d_name);
+        if(len < 5 || strcasecmp(entry->d_name + len - 4, ".wav") != 0)
+            continue;
+
+        memset(&track, 0, sizeof(track));
+        snprintf(track.path, sizeof(track.path), "%s/%s", dir_path, entry->d_name);
+        snprintf(track.source, sizeof(track.source), "%s", entry->d_name);
+
+        if(!ParseWav(&track))
+            continue;
+
+        if(num_tracks == LIBRARY_MAX_FILES)
+        {
+            fprintf(stderr, "cardprep: more than %d tracks, skipping %s\n", LIBRARY_MAX_FILES, track.source);
+            continue;
+        }
+
+        tracks = realloc(tracks, (num_tracks + 1) * sizeof(struct Track));
+        tracks[num_tracks++] = track;
+    }
+
+    closedir(dir);
+
+    if(num_tracks == 0)
+    {
+        fprintf(stderr, "cardprep: no usable WAV files in %s\n", dir_path);
+        return false;
+    }
+
+    qsort(tracks, num_tracks, sizeof(struct Track), CompareTracks);
+    return true;
+}
+
+/**
+ * Walks the RIFF chunks of a WAV file to find its format and samples
+ *
+ * @param track The track to fill in (path must be set)
+ *
+ * @return False if it isn't a WAV file that can be converted
+ */
+static bool ParseWav(struct Track * track)
+{
+    FILE * in = fopen(track->path, "rb");
+    uint8_t header[12], chunk[8], fmt[40];
+    uint32_t chunk_size, data_size = 0;
+    long file_size, chunk_start;
+    bool have_fmt = false, have_data = false;
+
+    if(in == NULL)
+    {
+        perror(track->path);
+        return false;
+    }
+
+    fseek(in, 0, SEEK_END);
+    file_size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    if(fread(header, 1, 12, in) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+    {
+        fprintf(stderr, "cardprep: %s isn't a WAV file, skipping\n", track->source);
+        fclose(in);
+        return false;
+    }
+
+    while(!have_data && fread(chunk, 1, 8, in) == 8)
+    {
+        chunk_size = mergeUnsignedInt(chunk + 4, 4);
+        chunk_start = ftell(in);
+
+        if(memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16)
+        {
+            memset(fmt, 0, sizeof(fmt));
+            if(fread(fmt, 1, chunk_size < sizeof(fmt) ? chunk_size : sizeof(fmt), in) < 16)
+                break;
+
+            track->format = mergeUnsignedInt(fmt, 2);
+            track->channels = mergeUnsignedInt(fmt + 2, 2);
+            track->rate = mergeUnsignedInt(fmt + 4, 4);
+            track->block_align = mergeUnsignedInt(fmt + 12, 2);
+            track->bits = mergeUnsignedInt(fmt + 14, 2);
+
+            // The real format is the first two bytes of the sub-format GUID
+            if(track->format == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 26)
+                track->format = mergeUnsignedInt(fmt + 24, 2);
+
+            have_fmt = true;
+        }
+        else if(memcmp(chunk, "data", 4) == 0)
+        {
+            track->data_offset = ftell(in);
+            data_size = chunk_size;
+            have_data = true;
+        }
+
+        // Chunks are padded to an even size
+        if(!have_data)
+            fseek(in, chunk_start + (long)chunk_size + (chunk_size & 1), SEEK_SET);
+    }
+
+    fclose(in);
+
+    if(!have_fmt || !have_data || track->channels == 0 || track->block_align == 0 ||
+            !((track->format == WAVE_FORMAT_PCM && (track->bits == 8 || track->bits == 16 || track->bits == 24 || track->bits == 32)) ||
+              (track->format == WAVE_FORMAT_IEEE_FLOAT && track->bits == 32)) ||
+            track->block_align < track->channels * (track->bits / 8))
+    {
+        fprintf(stderr, "cardprep: %s isn't PCM this tool can convert, skipping\n", track->source);
+        return false;
+    }
+
+    // Files cut short by a bad copy still get whatever samples they have
+    if(track->data_offset + (long)data_size > file_size)
+        data_size = file_size - track->data_offset;
+
+    track->frames = data_size / track->block_align;
+    track->out_size = 44 + (track->frames * 4);
+    return true;
+}
+
+/**
+ * Converts one sample to 16 bits
+ *
+ * @param p The sample
+ * @param track The track it's from
+ *
+ * @return The sample as 16 bit signed PCM
+ */
+static int16_t ConvertSample(const uint8_t * p, const struct Track * track)
+{
+    float f;
+
+    if(track->format == WAVE_FORMAT_IEEE_FLOAT)
+    {
+        memcpy(&f, p, sizeof(f));
+        if(f >= 1.0f)
+            return 32767;
+        if(f <= -1.0f)
+            return -32768;
+        return (int16_t)(f * 32767.0f);
+    }
+
+    switch(track->bits)
+    {
+        case 8: return (int16_t)((p[0] - 128) << 8);
+        case 16: return (int16_t)(p[0] | (p[1] << 8));
+        case 24: return (int16_t)(p[1] | (p[2] << 8));
+        default: return (int16_t)(p[2] | (p[3] << 8));
+    }
+}
+
+/**
+ * Creates a track's file on the card and fills it with the converted samples
+ *
+ * @param track The track to write
+ * @param index Its position, used for the 8.3 name (TRK00000.WAV and up)
+ *
+ * @return False if the card is full or a write failed
+ */
+static bool WriteTrack(struct Track * track, uint16_t index)
+{
+    static uint8_t out[WRITE_SECTORS][SECTOR_SIZE];
+    static uint8_t in[WRITE_SECTORS * SECTOR_SIZE * 4];
+    uint8_t * pos = out[0];
+    uint8_t * end = out[0] + sizeof(out);
+    uint32_t sample_bytes = track->bits / 8;
+    uint32_t frames_left = track->frames, frames, f, sector;
+    int16_t left, right;
+    struct FatFile file;
+    char name[9];
+    FILE * src;
+
+    snprintf(name, sizeof(name), "TRK%05u", (unsigned)index);
+    if(!Fat_CreateContiguous(&fat, &file, name, "WAV", track->out_size))
+    {
+        fprintf(stderr, "cardprep: no room on the card for %s\n", track->source);
+        return false;
+    }
+
+    Fat_MapFile(&file);
+    track->start_sector = Fat_ClusterSector(&fat, file.starting_cluster);
+    track->extents = file.num_extents;
+    sector = track->start_sector;
+
+    if((src = fopen(track->path, "rb")) == NULL || fseek(src, track->data_offset, SEEK_SET) != 0)
+    {
+        perror(track->path);
+        return false;
+    }
+
+    // Canonical header, the samples start right after it
+    memcpy(pos, "RIFF", 4);
+    Put32(pos + 4, track->out_size - 8);
+    memcpy(pos + 8, "WAVEfmt ", 8);
+    Put32(pos + 16, 16);
+    Put16(pos + 20, WAVE_FORMAT_PCM);
+    Put16(pos + 22, 2);
+    Put32(pos + 24, track->rate);
+    Put32(pos + 28, track->rate * 4);
+    Put16(pos + 32, 4);
+    Put16(pos + 34, 16);
+    memcpy(pos + 36, "data", 4);
+    Put32(pos + 40, track->frames * 4);
+    pos += 44;
+
+    while(frames_left > 0 || pos != out[0])
+    {
+        frames = sizeof(in) / track->block_align;
+        if(frames > frames_left)
+            frames = frames_left;
+        if(frames > 0 && fread(in, track->block_align, frames, src) != frames)
+            memset(in, 0, sizeof(in));  // Shouldn't happen, the size was checked
+        frames_left -= frames;
+
+        for(f = 0; f < frames; ++f)
+        {
+            left = ConvertSample(in + (f * track->block_align), track);
+            right = (track->channels > 1) ? ConvertSample(in + (f * track->block_align) + sample_bytes, track) : left;
+
+            Put16(pos, (uint16_t)left);
+            Put16(pos + 2, (uint16_t)right);
+            pos += 4;
+
+            if(pos == end)
+            {
+                if(!SD_WriteMultiSectors((const uint8_t (*)[SECTOR_SIZE])out, sector, WRITE_SECTORS))
+                    return false;
+                sector += WRITE_SECTORS;
+                pos = out[0];
+            }
+        }
+
+        // Whatever's left over goes out padded to a whole sector
+        if(frames_left == 0 && pos != out[0])
+        {
+            uint32_t used = (pos - out[0] + SECTOR_SIZE - 1) / SECTOR_SIZE;
+            memset(pos, 0, (used * SECTOR_SIZE) - (pos - out[0]));
+            if(!SD_WriteMultiSectors((const uint8_t (*)[SECTOR_SIZE])out, sector, used))
+                return false;
+            pos = out[0];
+        }
+    }
+
+    fclose(src);
+    return true;
+}
+
+/**
+ * Writes a fresh MBR and FAT32 partition over the whole image
+ *
+ * @param cluster_sectors Sectors per cluster (a power of two, at most 128)
+ *
+ * @return False if the image is too small for FAT32 with that cluster size
+ */
+static bool FormatFat32(uint32_t cluster_sectors)
+{
+    static uint8_t zero[WRITE_SECTORS][SECTOR_SIZE];
+    uint8_t sector[SECTOR_SIZE];
+    struct PartitionTable * partition = (struct PartitionTable *)(sector + 0x1BE);
+    struct Fat32BootSector * boot = (struct Fat32BootSector *)sector;
+    struct FatFsInfo * info = (struct FatFsInfo *)sector;
+    uint64_t image_sectors = SD_ImageSectors();
+    uint32_t part_sectors, reserved = FAT32_RESERVED_SECTORS, fat_sectors = 1, needed;
+    uint32_t data_start, num_clusters, i, n;
+
+    if(cluster_sectors == 0 || cluster_sectors > 128 || (cluster_sectors & (cluster_sectors - 1)) != 0 ||
+            image_sectors <= PART_START_SECTOR)
+    {
+        fprintf(stderr, "cardprep: bad cluster size or image size\n");
+        return false;
+    }
+
+    part_sectors = (image_sectors - PART_START_SECTOR > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)(image_sectors - PART_START_SECTOR);
+
+    // Size the FATs, keeping the data section lined up with the clusters on the card
+    while(true)
+    {
+        data_start = reserved + (2 * fat_sectors);
+        if((PART_START_SECTOR + data_start) % cluster_sectors != 0)
+        {
+            reserved += cluster_sectors - ((PART_START_SECTOR + data_start) % cluster_sectors);
+            continue;
+        }
+
+        num_clusters = (part_sectors - data_start) / cluster_sectors;
+        needed = ((num_clusters + 2) * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        if(needed <= fat_sectors)
+            break;
+        fat_sectors = needed;
+    }
+
+    if(num_clusters < FAT32_MIN_CLUSTERS)
+    {
+        fprintf(stderr, "cardprep: image too small for FAT32 with %u byte clusters\n", cluster_sectors * SECTOR_SIZE);
+        return false;
+    }
+
+    // Clear the reserved sectors, both FATs and the root directory cluster
+    for(i = 0; i < data_start + cluster_sectors; i += n)
+    {
+        n = data_start + cluster_sectors - i;
+        if(n > WRITE_SECTORS)
+            n = WRITE_SECTORS;
+        SD_WriteMultiSectors((const uint8_t (*)[SECTOR_SIZE])zero, PART_START_SECTOR + i, n);
+    }
+
+    memset(sector, 0, SECTOR_SIZE);
+    partition->partition_type = 0x0C;  // FAT32 LBA
+    partition->start_sector = PART_START_SECTOR;
+    partition->length_sectors = part_sectors;
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+    SD_WriteSector(sector, 0);
+
+    memset(sector, 0, SECTOR_SIZE);
+    memcpy(boot->jump, "\xEB\x58\x90", 3);
+    memcpy(boot->oem, "MSWIN4.1", 8);
+    boot->sector_size = SECTOR_SIZE;
+    boot->num_sectors_per_cluster = cluster_sectors;
+    boot->reserved_sectors = reserved;
+    boot->num_fats = 2;
+    boot->media_descriptor = 0xF8;
+    boot->chs_sectors_per_track = 63;
+    boot->chs_num_heads = 255;
+    boot->num_hidden_sectors = PART_START_SECTOR;
+    boot->total_num_sectors = part_sectors;
+    boot->fat_num_sectors = fat_sectors;
+    boot->root_cluster = 2;
+    boot->fsinfo_sector = 1;
+    boot->backup_boot_sector = 6;
+    boot->drive_number = 0x80;
+    boot->boot_sig = 0x29;
+    boot->volume_id = (uint32_t)time(NULL);
+    memcpy(boot->volume_label, "NOISEBLASTR", 11);
+    memcpy(boot->filesystem_type, "FAT32   ", 8);
+    boot->boot_sector_sig = 0xAA55;
+    SD_WriteSector(sector, PART_START_SECTOR);
+    SD_WriteSector(sector, PART_START_SECTOR + 6);
+
+    memset(sector, 0, SECTOR_SIZE);
+    info->lead_sig = FAT_FSINFO_LEAD_SIG;
+    info->struct_sig = FAT_FSINFO_STRUCT_SIG;
+    info->free_count = num_clusters - 1;   // The root directory has one
+    info->next_free = 3;
+    info->trail_sig = 0xAA550000;
+    SD_WriteSector(sector, PART_START_SECTOR + 1);
+    SD_WriteSector(sector, PART_START_SECTOR + 7);
+
+    // Media descriptor, reserved entry, and the root directory's cluster
+    memset(sector, 0, SECTOR_SIZE);
+    Put32(sector, 0x0FFFFFF8);
+    Put32(sector + 4, 0x0FFFFFFF);
+    Put32(sector + 8, 0x0FFFFFFF);
+    SD_WriteSector(sector, PART_START_SECTOR + reserved);
+    SD_WriteSector(sector, PART_START_SECTOR + reserved + fat_sectors);
+
+    return true;
+}
+
+/**
+ * Lists where each track is on the card and how its refills are expected to
+ * go, as seen by the player
+ *
+ * A refill is one sector. While a track stays in one extent, the card just
+ * keeps clocking out blocks of the open multi-block read. Each jump to
+ * another extent costs a CMD12 and a new CMD18.
+ *
+ * @param out Where to write the manifest
+ */
+static void WriteManifest(FILE * out)
+{
+    double byte_us = 8.0 * 1000000.0 / PLAYER_SPI_HZ;
+    double sector_us = CARD_BLOCK_GAP_US + ((SECTOR_SIZE + 3) * byte_us);  // Token and CRC
+    double restart_us = CARD_ACCESS_US + (16 * byte_us);                     // Two commands
+    double worst_us, deadline_us;
+    uint32_t i;
+
+    fprintf(out, "# cardprep manifest: %u tracks, %u byte clusters, assuming %.0f us card access and %.0f us block gaps\n",
+            num_tracks, fat.cluster_size, CARD_ACCESS_US, CARD_BLOCK_GAP_US);
+    fprintf(out, "# name\tstart_sector\tsectors\tbytes\trate\textents\tworst_refill_us\tdeadline_us\tsource\n");
+
+    for(i = 0; i < num_tracks; ++i)
+    {
+        worst_us = sector_us + ((tracks[i].extents > 1) ? restart_us : 0);
+        deadline_us = PLAYER_REFILL_BYTES * 1000000.0 / (tracks[i].rate * 4.0);
+
+        fprintf(out, "TRK%05u.WAV\t%u\t%u\t%u\t%u\t%u\t%.0f\t%.0f\t%s%s\n",
+                i, tracks[i].start_sector, (tracks[i].out_size + SECTOR_SIZE - 1) / SECTOR_SIZE,
+                tracks[i].out_size, tracks[i].rate, tracks[i].extents, worst_us, deadline_us, tracks[i].source,
+                (worst_us > deadline_us) ? "\t# WILL UNDERRUN" : "");
+    }
+}
+
+static void Put16(uint8_t * p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void Put32(uint8_t * p, uint32_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
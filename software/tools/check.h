@@ -0,0 +1,99 @@
+/*
+ * File:   check.h
+ *
+ * Created on October 17, 2026
+ *
+ * What the host checks (make check) report with. A check that fails prints
+ * where and why and carries on, and the program exits non-zero at the end
+ * if any of them did.
+ */
+
+#ifndef CHECK_H
+#define	CHECK_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static int check_count = 0;
+static int check_failures = 0;
+
+#define CHECK(cond, ...) do { \
+        check_count++; \
+        if(!(cond)) \
+        { \
+            check_failures++; \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+        } \
+    } while(0)
+
+/**
+ * Runs checks in a process of their own, so the firmware's statics (caches,
+ * the FAT window, the library) start out the way they are at boot
+ *
+ * A check that crashes counts as a failure instead of taking the rest down.
+ *
+ * @param name What's being checked, for the crash report
+ * @param checks The checks to run
+ */
+static inline void Check_Boot(const char * name, void (*checks)(void))
+{
+    int fds[2], counts[2], status = 0;
+    pid_t pid;
+
+    fflush(stdout);
+    fflush(stderr);
+    if(pipe(fds) != 0 || (pid = fork()) < 0)
+    {
+        CHECK(false, "Couldn't start %s", name);
+        return;
+    }
+
+    if(pid == 0)
+    {
+        close(fds[0]);
+        check_count = check_failures = 0;
+        checks();
+
+        counts[0] = check_count;
+        counts[1] = check_failures;
+        fflush(stdout);
+        fflush(stderr);
+        _exit(write(fds[1], counts, sizeof(counts)) == sizeof(counts) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    if(read(fds[0], counts, sizeof(counts)) == sizeof(counts))
+    {
+        check_count += counts[0];
+        check_failures += counts[1];
+    }
+    close(fds[0]);
+
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0, "%s crashed", name);
+}
+
+/**
+ * Prints how the checks went
+ *
+ * @param name The check program
+ *
+ * @return What main should return
+ */
+static inline int Check_Result(const char * name)
+{
+    if(check_failures > 0)
+    {
+        printf("%s: %d of %d checks FAILED\n", name, check_failures, check_count);
+        return 1;
+    }
+
+    printf("%s: %d checks passed\n", name, check_count);
+    return 0;
+}
+
+#endif	/* CHECK_H */
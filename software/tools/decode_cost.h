@@ -0,0 +1,91 @@
+/*
+ * File:   decode_cost.h
+ *
+ * Created on October 17, 2026
+ *
+ * Charges the simulated clock for decoding and mixing, which on the host
+ * take no simulated time at all. A check includes this just ahead of
+ * main.c, so main.c's calls come through here while the decoders' own
+ * headers (already in) are left alone.
+ *
+ * The counts are estimates of the PIC32MX's cycles for each frame of 16
+ * bit stereo out, not measurements. FLAC's first channel is charged all at
+ * once when a block starts, the way flac.c decodes it.
+ */
+
+#ifndef DECODE_COST_H
+#define	DECODE_COST_H
+
+#include <stdint.h>
+#include "pic32_sim.h"
+#include "sysclk.h"
+#include "pcm.h"
+#include "adpcm.h"
+#include "flac.h"
+#include "qoa.h"
+#include "crossfade.h"
+
+#define PCM_FRAME_CYCLES 16
+#define ADPCM_FRAME_CYCLES 80
+#define QOA_FRAME_CYCLES 140
+#define FLAC_SAMPLE_CYCLES 60           // For each sample of each channel, predicted from its residual
+#define FLAC_JOIN_CYCLES 20             // Undoing the stereo decorrelation and packing a frame
+#define CROSSFADE_FRAME_CYCLES 40
+
+// Everything decoded and mixed, in simulated seconds
+static double decode_seconds;
+
+static inline void DecodeCost_Spend(uint32_t cycles)
+{
+    decode_seconds += (double)cycles / SYS_FREQ;
+    Pic32_Spend((double)cycles / SYS_FREQ);
+}
+
+static inline uint32_t DecodeCost_PcmRead(const struct PcmConverter * pcm, struct FatStream * stream, int16_t * out, uint32_t num_frames)
+{
+    uint32_t made = Pcm_Read(pcm, stream, out, num_frames);
+
+    DecodeCost_Spend(made * PCM_FRAME_CYCLES);
+    return made;
+}
+
+static inline uint32_t DecodeCost_AdpcmRead(struct AdpcmDecoder * dec, struct FatStream * stream, int16_t * out, uint32_t num_frames)
+{
+    uint32_t made = Adpcm_Read(dec, stream, out, num_frames);
+
+    DecodeCost_Spend(made * ADPCM_FRAME_CYCLES);
+    return made;
+}
+
+static inline uint32_t DecodeCost_FlacRead(struct FlacDecoder * dec, struct FatStream * stream, int16_t * out, uint32_t num_frames)
+{
+    uint32_t made = Flac_Read(dec, stream, out, num_frames);
+
+    // The block now being sent was started by this read
+    if(made > 0 && dec->frame <= made)
+        DecodeCost_Spend(dec->block_frames * FLAC_SAMPLE_CYCLES);
+    DecodeCost_Spend(made * ((dec->channels - 1) * FLAC_SAMPLE_CYCLES + FLAC_JOIN_CYCLES));
+    return made;
+}
+
+static inline uint32_t DecodeCost_QoaRead(struct QoaDecoder * dec, struct FatStream * stream, int16_t * out, uint32_t num_frames)
+{
+    uint32_t made = Qoa_Read(dec, stream, out, num_frames);
+
+    DecodeCost_Spend(made * QOA_FRAME_CYCLES);
+    return made;
+}
+
+static inline void DecodeCost_CrossfadeMix(struct Crossfade * fade, int16_t * out, const int16_t * in, uint32_t num_frames)
+{
+    Crossfade_Mix(fade, out, in, num_frames);
+    DecodeCost_Spend(num_frames * CROSSFADE_FRAME_CYCLES);
+}
+
+#define Pcm_Read DecodeCost_PcmRead
+#define Adpcm_Read DecodeCost_AdpcmRead
+#define Flac_Read DecodeCost_FlacRead
+#define Qoa_Read DecodeCost_QoaRead
+#define Crossfade_Mix DecodeCost_CrossfadeMix
+
+#endif	/* DECODE_COST_H */
@@ -0,0 +1,25 @@
+/*
+ * File:   md5.h
+ *
+ * Created on October 17, 2026
+ *
+ * MD5 (RFC 1321), for checking decodes against the hashes reference
+ * decoders and encoders give.
+ */
+
+#ifndef MD5_H
+#define	MD5_H
+
+#include <stdint.h>
+
+struct Md5 {
+    uint32_t state[4];
+    uint64_t length;
+    uint8_t block[64];
+};
+
+void Md5_Init(struct Md5 * md5);
+void Md5_Update(struct Md5 * md5, const void * data, uint32_t size);
+void Md5_Final(struct Md5 * md5, uint8_t digest[16]);
+
+#endif	/* MD5_H */
@@ -0,0 +1,132 @@
+/*
+ * File:   plib.h
+ *
+ * Created on October 17, 2026
+ *
+ * Host stand-in for the PIC32 peripheral library, just the calls the
+ * firmware makes. Anything the simulation doesn't need to see does nothing.
+ */
+
+#ifndef PLIB_H
+#define	PLIB_H
+
+#include <xc.h>
+#include <sys/attribs.h>
+
+#define FALSE false
+#define TRUE true
+
+// System and interrupts, only whether interrupts are on matters
+#define SYS_CFG_WAIT_STATES 0
+#define SYS_CFG_PCACHE 0
+#define INT_T1 0
+#define INT_ENABLED 1
+#define INT_PRIORITY_LEVEL_2 2
+#define INT_SUB_PRIORITY_LEVEL_0 0
+#define INT_TIMER_1_VECTOR 4
+
+#define SYSTEMConfig(clock, flags) ((void)(clock))
+#define INTEnableSystemMultiVectoredInt() ((void)0)
+#define INTEnableInterrupts() Pic32_Interrupts(true)
+#define INTDisableInterrupts() Pic32_Interrupts(false)
+#define INTEnable(source, enable) ((void)(source))
+#define INTSetVectorPriority(vector, priority) ((void)(vector))
+#define INTSetVectorSubPriority(vector, sub_priority) ((void)(vector))
+#define INTClearFlag(source) ((void)(source))
+
+// Timer 1, the buttons' 25Hz tick, which the simulation never runs
+#define T1_ON 0
+#define T1_SOURCE_INT 0
+#define T1_PS_1_256 0
+
+#define OpenTimer1(config, period) ((void)(period))
+#define WriteTimer1(value) ((void)(value))
+
+// Ports
+#define BIT_0 (1 << 0)
+#define BIT_1 (1 << 1)
+#define BIT_2 (1 << 2)
+#define BIT_3 (1 << 3)
+#define BIT_4 (1 << 4)
+#define BIT_5 (1 << 5)
+#define BIT_7 (1 << 7)
+#define BIT_8 (1 << 8)
+#define BIT_9 (1 << 9)
+#define BIT_10 (1 << 10)
+#define BIT_11 (1 << 11)
+#define BIT_13 (1 << 13)
+#define BIT_14 (1 << 14)
+#define BIT_15 (1 << 15)
+
+#define mPORTASetBits(bits) Pic32_PortWrite('A', (bits), true)
+#define mPORTAClearBits(bits) Pic32_PortWrite('A', (bits), false)
+#define mPORTAToggleBits(bits) ((void)(bits))
+#define mPORTASetPinsDigitalOut(bits) ((void)(bits))
+#define mPORTBSetBits(bits) Pic32_PortWrite('B', (bits), true)
+#define mPORTBClearBits(bits) Pic32_PortWrite('B', (bits), false)
+#define mPORTBToggleBits(bits) ((void)(bits))
+#define mPORTBSetPinsDigitalOut(bits) ((void)(bits))
+#define mPORTBSetPinsDigitalIn(bits) ((void)(bits))
+
+// Peripheral pin select
+#define PPSUnLock ((void)0)
+#define PPSLock ((void)0)
+#define PPSInput(group, function, pin) ((void)(group))
+#define PPSOutput(group, pin, function) ((void)(group))
+
+// DMA
+#define DmaChnEnable(chn) Pic32_DmaEnable(chn)
+#define DmaChnIntEnable(chn) ((void)(chn))
+#define DmaChnIntDisable(chn) ((void)(chn))
+#define DmaChnClrIntFlag(chn) ((void)(chn))
+#define mDmaChnSetIntPriority(chn, pri, sub_pri) ((void)(chn))
+
+// I2C, a start, the bytes and a stop make one write to the DAC
+#define I2C1 1
+#define I2C_SUCCESS 0
+#define I2C_MASTER_BUS_COLLISION 1
+#define I2C_START (1 << 3)
+#define I2C_STOP (1 << 4)
+#define I2C_ENABLE_SLAVE_CLOCK_STRETCHING 0
+#define I2C_ENABLE_HIGH_SPEED 0
+
+#define I2CEnable(module, enable) ((void)(module))
+#define I2CConfigure(module, flags) ((void)(module))
+#define I2CSetFrequency(module, clock, rate) (rate)
+#define I2CBusIsIdle(module) true
+#define I2CStart(module) Pic32_I2cCondition(I2C_START)
+#define I2CRepeatStart(module) Pic32_I2cCondition(I2C_START)
+#define I2CStop(module) Pic32_I2cCondition(I2C_STOP)
+#define I2CGetStatus(module) Pic32_I2cStatus()
+#define I2CTransmitterIsReady(module) true
+#define I2CSendByte(module, data) Pic32_I2cSend(data)
+#define I2CTransmissionHasCompleted(module) true
+#define I2CByteWasAcknowledged(module) Pic32_I2cAcked()
+#define I2CAcknowledgeByte(module, ack) ((void)(ack))
+#define I2CAcknowledgeHasCompleted(module) true
+#define I2CReceiverEnable(module, enable) ((void)(enable))
+#define I2CReceivedDataIsAvailable(module) true
+#define I2CGetByte(module) 0xFF
+
+// UART, everything sent goes to pic32_uart_log
+#define UART1 1
+#define UART_ENABLE_PINS_TX_RX_ONLY 0
+#define UART_INTERRUPT_ON_TX_NOT_FULL 0
+#define UART_INTERRUPT_ON_RX_NOT_EMPTY 0
+#define UART_DATA_SIZE_8_BITS 0
+#define UART_PARITY_NONE 0
+#define UART_STOP_BITS_1 0
+#define UART_PERIPHERAL 0
+#define UART_RX 0
+#define UART_TX 0
+#define UART_ENABLE_FLAGS(flags) (flags)
+
+#define UARTConfigure(module, config) ((void)(module))
+#define UARTSetFifoMode(module, mode) ((void)(module))
+#define UARTSetLineControl(module, control) ((void)(module))
+#define UARTSetDataRate(module, clock, rate) ((void)(clock))
+#define UARTEnable(module, flags) ((void)(module))
+#define UARTTransmitterIsReady(module) true
+#define UARTSendDataByte(module, data) Pic32_UartSend(data)
+
+#endif	/* PLIB_H */
@@ -0,0 +1,15 @@
+/*
+ * File:   attribs.h
+ *
+ * Created on October 17, 2026
+ *
+ * Host stand-in for XC32's sys/attribs.h. Interrupt handlers are plain
+ * functions, the simulation calls them.
+ */
+
+#ifndef ATTRIBS_H
+#define	ATTRIBS_H
+
+#define __ISR(vector, ...)
+
+#endif	/* ATTRIBS_H */
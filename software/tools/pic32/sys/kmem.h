@@ -0,0 +1,17 @@
+/*
+ * File:   kmem.h
+ *
+ * Created on October 17, 2026
+ *
+ * Host stand-in for XC32's sys/kmem.h. The simulated DMA is given host
+ * addresses as they are.
+ */
+
+#ifndef KMEM_H
+#define	KMEM_H
+
+#include <stdint.h>
+
+#define KVA_TO_PA(v) ((uintptr_t)(v))
+
+#endif	/* KMEM_H */
@@ -0,0 +1,90 @@
+/*
+ * File:   xc.h
+ *
+ * Created on October 17, 2026
+ *
+ * Host stand-in for XC32's xc.h with just the registers the firmware uses.
+ * Most are plain variables (in pic32_sim.c). The ones the simulated SD card
+ * has to see being used, SPI2's buffer and status and the flag that says a
+ * sector has been received, are calls into the simulation.
+ */
+
+#ifndef XC_H
+#define	XC_H
+
+#include <stdint.h>
+#include "pic32_sim.h"
+
+// Interrupt request and vector numbers, only used to tell them apart
+#define _SPI2_RX_IRQ 38
+#define _DMA_2_VECTOR 38
+#define _TIMER_1_VECTOR 4
+
+// Coprocessor 0, only read by the exception handler
+#define _CP0_GET_CAUSE() 0
+#define _CP0_GET_EPC() 0
+
+// Ports, the buttons on RB3, RB7 and RB11 are pulled up
+extern volatile uint32_t ANSELA;
+extern volatile uint32_t ANSELB;
+extern volatile struct Pic32PortB PORTBbits;
+
+// Oscillator
+extern volatile struct Pic32OscCon OSCCONbits;
+
+// Reference clock output, the DAC's MCLK
+#define REFOCONbits (*Pic32_RefoCon())
+extern volatile struct Pic32RefoTrim REFOTRIMbits;
+
+// SPI1, I2S out to the DAC
+extern volatile uint32_t SPI1CON2;
+extern volatile uint32_t SPI1BRG;
+extern volatile uint32_t SPI1BUF;
+extern volatile struct Pic32SpiCon SPI1CONbits;
+extern volatile struct Pic32SpiCon2 SPI1CON2bits;
+extern volatile struct Pic32SpiStat SPI1STATbits;
+
+// SPI2, the SD card
+extern volatile uint32_t SPI2CON;
+extern volatile uint32_t SPI2BRG;
+extern volatile struct Pic32SpiCon SPI2CONbits;
+#define SPI2BUF (*Pic32_Spi2Buf())
+#define SPI2STATbits (*Pic32_Spi2Stat())
+
+// DMA, the addresses are big enough for a host pointer
+extern volatile uint32_t DMACONSET;
+
+extern volatile uint32_t DCH0CON;
+extern volatile uint32_t DCH0CONSET;
+extern volatile uint32_t DCH0ECON;
+extern volatile uint32_t DCH0ECONSET;
+extern volatile uintptr_t DCH0SSA;
+extern volatile uintptr_t DCH0DSA;
+extern volatile uint32_t DCH0SSIZ;
+extern volatile uint32_t DCH0DSIZ;
+extern volatile uint32_t DCH0CSIZ;
+extern volatile uint32_t DCH0INTCLR;
+extern volatile uint32_t DCH0INTSET;
+
+extern volatile uint32_t DCH1CON;
+extern volatile uint32_t DCH1ECON;
+extern volatile uint32_t DCH1ECONSET;
+extern volatile uintptr_t DCH1SSA;
+extern volatile uintptr_t DCH1DSA;
+extern volatile uint32_t DCH1SSIZ;
+extern volatile uint32_t DCH1DSIZ;
+extern volatile uint32_t DCH1CSIZ;
+extern volatile uint32_t DCH1INTCLR;
+
+extern volatile uint32_t DCH2CON;
+extern volatile uint32_t DCH2ECON;
+extern volatile uintptr_t DCH2SSA;
+extern volatile uintptr_t DCH2DSA;
+extern volatile uint32_t DCH2SSIZ;
+extern volatile uint32_t DCH2DSIZ;
+extern volatile uint32_t DCH2CSIZ;
+extern volatile uint32_t DCH2INTCLR;
+extern volatile uint32_t DCH2INTSET;
+#define DCH2INTbits (*Pic32_Dch2Int())
+
+#endif	/* XC_H */
@@ -0,0 +1,774 @@
+/*
+ * File:   pic32_sim.c
+ *
+ * Created on October 17, 2026
+ *
+ * The card follows the SPI mode protocol closely enough that anything sd.c
+ * gets wrong shows up: commands are only taken while it's selected, reads
+ * stream until CMD12, the DMA only runs when both channels are set up the
+ * way sd.c needs them to be, and every byte costs bus time at whatever rate
+ * SPI2BRG gives. The DAC only takes whole three byte writes to its address,
+ * and REFCLKO only picks up a new divisor when it's told to switch to it.
+ * Channel 0 is only started again by its interrupt, and an interrupt can't
+ * be taken while they're off, so the firmware holding them off too long
+ * shows up as silence sent to the DAC.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <plib.h>
+#include "pic32_sim.h"
+#include "sysclk.h"
+
+#define CARD_SECTOR_SIZE 512
+
+// Bytes of 0xFF before each data token, and the busy time after a write or CMD12
+#define CARD_ACCESS_BYTES 3
+#define CARD_BUSY_BYTES 2
+
+// ACMD41s it takes the card to leave the idle state
+#define CARD_INIT_POLLS 2
+
+// R1 bits
+#define R1_IDLE 0x01
+#define R1_ILLEGAL_COMMAND 0x04
+#define R1_ADDRESS_ERROR 0x20
+
+// Registers that are only ever written or read back as they are
+volatile uint32_t SPI2CON, SPI2BRG;
+volatile struct Pic32SpiCon SPI2CONbits;
+volatile struct Pic32OscCon OSCCONbits;
+volatile uint32_t DMACONSET;
+volatile uint32_t DCH1CON, DCH1ECON, DCH1ECONSET, DCH1SSIZ, DCH1DSIZ, DCH1CSIZ, DCH1INTCLR;
+volatile uint32_t DCH2CON, DCH2ECON, DCH2SSIZ, DCH2DSIZ, DCH2CSIZ, DCH2INTCLR, DCH2INTSET;
+volatile uintptr_t DCH1SSA, DCH1DSA, DCH2SSA, DCH2DSA;
+volatile uint32_t SPI1CON2, SPI1BRG, SPI1BUF;
+volatile struct Pic32SpiCon SPI1CONbits;
+volatile struct Pic32SpiCon2 SPI1CON2bits;
+volatile struct Pic32SpiStat SPI1STATbits;
+volatile struct Pic32RefoTrim REFOTRIMbits;
+volatile uint32_t ANSELA, ANSELB;
+volatile struct Pic32PortB PORTBbits = { 1, 1, 1 };
+volatile uint32_t DCH0CON, DCH0CONSET, DCH0ECON, DCH0ECONSET, DCH0SSIZ, DCH0DSIZ, DCH0CSIZ, DCH0INTCLR, DCH0INTSET;
+volatile uintptr_t DCH0SSA, DCH0DSA;
+
+struct Pic32SdStats pic32_sd;
+struct Pic32Dac pic32_dac;
+struct Pic32I2s pic32_i2s;
+double pic32_seconds;
+char pic32_uart_log[4096];
+
+// SPI2's receive buffer, with the bit above the byte set once it's been exchanged
+// (the firmware only ever writes a byte to it, so anything below 0x100 is still to send)
+#define SPI_RECEIVED 0x100
+static volatile uint32_t spi2_buf = SPI_RECEIVED | 0xFF;
+static volatile struct Pic32SpiStat spi2_stat;
+static volatile struct Pic32DmaInt dch2_int;
+static bool dma_enabled[8];
+
+// REFCLKO, with the source, divisor and trim it's actually running from
+static volatile struct Pic32RefoCon refo_con;
+static unsigned refo_source, refo_div, refo_trim;
+
+// The I2C transfer going on, and what the last condition and byte got
+#define DAC_I2C_ADDRESS 0x34
+static uint8_t i2c_bytes[4];
+static uint8_t i2c_len;
+static int i2c_status;
+static bool i2c_acked;
+
+// DMA channel 0 sending to SPI1, and its interrupt
+static struct {
+    void (*handler)(void);
+    bool interrupts;            // Whether the CPU takes interrupts
+    bool sending;
+    double block_end;           // When the block being sent is done
+    bool pending;               // A block finished and its interrupt hasn't been taken
+    double pending_since;
+} audio_dma;
+
+// Sectors whose reads are counted in watched_reads
+static uint64_t watch_first, watch_count;
+
+// The card
+static struct {
+    uint8_t * image;
+    uint64_t num_sectors;
+    bool selected;
+    bool idle;
+    bool app_command;           // The last command was CMD55
+    uint8_t init_polls;
+
+    uint8_t command[6];
+    uint8_t command_len;
+
+    uint8_t response[8];        // Queued to go out ahead of anything else
+    uint8_t response_len;
+    uint8_t response_pos;
+
+    // Reading: -CARD_ACCESS_BYTES (and any stall) up to the token at 0, the data, then the CRC
+    bool reading;
+    bool multi_block;
+    uint32_t sector;
+    int32_t pos;
+    double stall_seconds;       // Held up for before the next sector's token
+
+    // Writing: waiting for a token, then the data and CRC
+    bool writing;
+    bool multi_write;
+    int16_t write_pos;          // -1 until the token's been seen
+    uint8_t write_data[CARD_SECTOR_SIZE];
+} card;
+
+/**
+ * Queues the bytes the card answers a command with
+ */
+static void Card_Respond(const uint8_t * bytes, uint8_t len)
+{
+    memcpy(card.response, bytes, len);
+    card.response_len = len;
+    card.response_pos = 0;
+}
+
+/**
+ * Starts on a sector of a read, as late as any stall holds it up
+ */
+static void Card_StartSector(void)
+{
+    card.pos = -CARD_ACCESS_BYTES;
+    if(card.stall_seconds > 0)
+    {
+        card.pos -= (int32_t)(card.stall_seconds * SYS_FREQ / (8.0 * 2 * (SPI2BRG + 1)));
+        card.stall_seconds = 0;
+        pic32_sd.stalls++;
+    }
+}
+
+/**
+ * Carries out a command once all six bytes are in
+ */
+static void Card_Command(void)
+{
+    uint8_t index = card.command[0] & 0x3F;
+    uint32_t arg = ((uint32_t)card.command[1] << 24) | ((uint32_t)card.command[2] << 16) |
+            ((uint32_t)card.command[3] << 8) | card.command[4];
+    uint8_t r1 = card.idle ? R1_IDLE : 0;
+    uint8_t reply[8] = { 0xFF, r1 };
+    bool app_command = card.app_command;
+
+    pic32_sd.commands[index]++;
+    card.app_command = false;
+
+    switch(index)
+    {
+        case 0:
+            card.idle = true;
+            card.init_polls = 0;
+            card.reading = card.writing = false;
+            reply[1] = R1_IDLE;
+            Card_Respond(reply, 2);
+            return;
+        case 8:
+            // Echoes the voltage range and check pattern
+            reply[2] = reply[3] = 0;
+            reply[4] = (arg >> 8) & 0xF;
+            reply[5] = arg & 0xFF;
+            Card_Respond(reply, 6);
+            return;
+        case 55:
+            card.app_command = true;
+            Card_Respond(reply, 2);
+            return;
+        case 41:
+            if(app_command && ++card.init_polls >= CARD_INIT_POLLS)
+                card.idle = false;
+            reply[1] = card.idle ? R1_IDLE : 0;
+            Card_Respond(reply, 2);
+            return;
+        case 12:
+            // The byte after CMD12 is junk, then R1 and busy until it's stopped
+            if(!card.reading)
+                pic32_sd.errors++;
+            card.reading = false;
+            reply[1] = 0xFF;
+            reply[2] = 0;
+            reply[3] = reply[4] = 0;
+            Card_Respond(reply, 2 + CARD_BUSY_BYTES + 1);
+            return;
+        default:
+            break;
+    }
+
+    if(card.idle || card.reading || card.writing)
+    {
+        pic32_sd.errors++;
+        reply[1] = r1 | R1_ILLEGAL_COMMAND;
+        Card_Respond(reply, 2);
+        return;
+    }
+
+    switch(index)
+    {
+        case 17:
+        case 18:
+        case 24:
+        case 25:
+            if(arg >= card.num_sectors)
+            {
+                pic32_sd.errors++;
+                reply[1] = R1_ADDRESS_ERROR;
+                break;
+            }
+
+            card.sector = arg;
+            if(index <= 18)
+            {
+                card.reading = true;
+                card.multi_block = (index == 18);
+                Card_StartSector();
+            }
+            else
+            {
+                card.writing = true;
+                card.multi_write = (index == 25);
+                card.write_pos = -1;
+            }
+            break;
+        default:
+            pic32_sd.errors++;
+            reply[1] = R1_ILLEGAL_COMMAND;
+            break;
+    }
+
+    Card_Respond(reply, 2);
+}
+
+/**
+ * The next byte of a read, moving on to the next sector of a multi-block read
+ */
+static uint8_t Card_ReadByte(void)
+{
+    int32_t pos = card.pos++;
+
+    if(pos < 0)
+        return 0xFF;
+    if(pos == 0)
+    {
+        if(card.sector >= card.num_sectors)
+            pic32_sd.errors++;
+        return 0xFE;
+    }
+    if(pos <= CARD_SECTOR_SIZE)
+    {
+        if(card.sector >= card.num_sectors)
+            return 0;
+        if(pos == CARD_SECTOR_SIZE)
+        {
+            pic32_sd.sectors_read++;
+            if(card.sector - watch_first < watch_count)
+                pic32_sd.watched_reads++;
+        }
+        return card.image[((uint64_t)card.sector * CARD_SECTOR_SIZE) + pos - 1];
+    }
+
+    // Two bytes of CRC, which the firmware doesn't check
+    if(pos == CARD_SECTOR_SIZE + 2)
+    {
+        card.sector++;
+        Card_StartSector();
+
+        if(!card.multi_block)
+            card.reading = false;
+    }
+    return 0x00;
+}
+
+/**
+ * Takes a byte of a write's data, returning the data response once a block is in
+ */
+static uint8_t Card_WriteByte(uint8_t in)
+{
+    uint8_t reply[8] = { 0x05, 0, 0, 0xFF };
+
+    if(card.write_pos < 0)
+    {
+        if(in == 0xFE || in == 0xFC)
+            card.write_pos = 0;
+        else if(in == 0xFD && card.multi_write)
+        {
+            // Stop tran, then busy while it finishes
+            card.writing = false;
+            reply[0] = 0xFF;
+            Card_Respond(reply, 1 + CARD_BUSY_BYTES);
+        }
+        return 0xFF;
+    }
+
+    if(card.write_pos < CARD_SECTOR_SIZE)
+        card.write_data[card.write_pos] = in;
+
+    // The last CRC byte
+    if(++card.write_pos == CARD_SECTOR_SIZE + 2)
+    {
+        if(card.sector < card.num_sectors)
+        {
+            memcpy(card.image + ((uint64_t)card.sector * CARD_SECTOR_SIZE), card.write_data, CARD_SECTOR_SIZE);
+            pic32_sd.sectors_written++;
+        }
+        else
+        {
+            pic32_sd.errors++;
+            reply[0] = 0x0D;
+        }
+
+        card.sector++;
+        card.write_pos = -1;
+        if(!card.multi_write)
+            card.writing = false;
+
+        Card_Respond(reply, 1 + CARD_BUSY_BYTES + 1);
+    }
+
+    return 0xFF;
+}
+
+/**
+ * Clocks one byte each way between SPI2 and the card
+ */
+static uint8_t Card_Exchange(uint8_t in)
+{
+    uint8_t out = 0xFF;
+
+    if(!SPI2CONbits.ON)
+        pic32_sd.errors++;
+    pic32_sd.bus_seconds += 8.0 * 2 * (SPI2BRG + 1) / SYS_FREQ;
+    Pic32_Spend(8.0 * 2 * (SPI2BRG + 1) / SYS_FREQ);
+
+    if(!card.selected || card.image == NULL)
+        return 0xFF;
+
+    // Commands can come in at any time (CMD12 while a read is still streaming)
+    if(card.command_len > 0 || (!card.writing && (in & 0xC0) == 0x40))
+    {
+        if(card.reading)
+            out = Card_ReadByte();
+
+        card.command[card.command_len++] = in;
+        if(card.command_len == sizeof(card.command))
+        {
+            card.command_len = 0;
+            Card_Command();
+        }
+        return out;
+    }
+
+    if(card.response_pos < card.response_len)
+        return card.response[card.response_pos++];
+
+    if(card.writing)
+        return Card_WriteByte(in);
+
+    if(card.reading)
+        return Card_ReadByte();
+
+    return 0xFF;
+}
+
+/**
+ * SPI2BUF, exchanging whatever the firmware wrote to it since last time
+ */
+volatile uint32_t * Pic32_Spi2Buf(void)
+{
+    if(spi2_buf < SPI_RECEIVED)
+    {
+        spi2_buf = SPI_RECEIVED | Card_Exchange(spi2_buf);
+        pic32_sd.cpu_bytes++;
+        spi2_stat.SPIRBF = 1;
+    }
+    else
+        spi2_stat.SPIRBF = 0;
+
+    return &spi2_buf;
+}
+
+/**
+ * SPI2STATbits, with a byte that's been written finished by the time it's looked at
+ */
+volatile struct Pic32SpiStat * Pic32_Spi2Stat(void)
+{
+    if(spi2_buf < SPI_RECEIVED)
+    {
+        spi2_buf = SPI_RECEIVED | Card_Exchange(spi2_buf);
+        pic32_sd.cpu_bytes++;
+        spi2_stat.SPIRBF = 1;
+    }
+
+    return &spi2_stat;
+}
+
+/**
+ * Checks a channel is set up to move a byte to or from SPI2BUF on each SPI2 receive
+ */
+static bool Dma_OnSpi2Receive(uint32_t econ, uintptr_t spi_side)
+{
+    return (econ & 0x10) && ((econ >> 8) & 0xFF) == _SPI2_RX_IRQ && spi_side == (uintptr_t)&spi2_buf;
+}
+
+/**
+ * DCH2INTbits, running the sector transfer if the firmware has kicked it off
+ *
+ * Channel 1 sends 0xFF from its source for every byte channel 2 takes out of
+ * SPI2BUF, one cell each, started by forcing the first one.
+ */
+volatile struct Pic32DmaInt * Pic32_Dch2Int(void)
+{
+    const uint8_t * src = (const uint8_t *)DCH1SSA;
+    uint8_t * dest = (uint8_t *)DCH2DSA;
+    uint32_t i;
+
+    if(DCH2INTCLR & 0x8)
+        dch2_int.CHBCIF = 0;
+    DCH2INTCLR = 0;
+
+    if(!(DCH1ECONSET & 0x80))
+        return &dch2_int;
+    DCH1ECONSET = 0;
+
+    if(!dma_enabled[1] || !dma_enabled[2] || !(DMACONSET & 0x8000) ||
+            !Dma_OnSpi2Receive(DCH1ECON, DCH1DSA) || !Dma_OnSpi2Receive(DCH2ECON, DCH2SSA) ||
+            DCH1CSIZ != 1 || DCH2CSIZ != 1 || DCH1SSIZ < DCH2DSIZ || DCH2DSIZ == 0)
+    {
+        pic32_sd.errors++;
+        return &dch2_int;
+    }
+
+    for(i = 0; i < DCH2DSIZ; i++)
+        dest[i] = Card_Exchange(src[i]);
+
+    pic32_sd.dma_bytes += DCH2DSIZ;
+    pic32_sd.dma_transfers++;
+    pic32_sd.dma_dest = DCH2DSA;
+
+    // Both channels turn themselves off at the end of the block
+    dma_enabled[1] = dma_enabled[2] = false;
+    dch2_int.CHBCIF = 1;
+
+    return &dch2_int;
+}
+
+void Pic32_DmaEnable(int channel)
+{
+    dma_enabled[channel] = true;
+}
+
+/**
+ * Port writes, RB10 is the card's chip select
+ */
+void Pic32_PortWrite(char port, uint32_t bits, bool set)
+{
+    if(port == 'B' && (bits & (1 << 10)))
+        card.selected = !set;
+}
+
+void Pic32_UartSend(uint8_t data)
+{
+    size_t len = strlen(pic32_uart_log);
+
+    if(len + 1 < sizeof(pic32_uart_log))
+        pic32_uart_log[len] = data;
+}
+
+/**
+ * REFOCONbits, with ACTIVE following ON and a divisor switch done by the
+ * next time it's looked at
+ *
+ * The source can only change while the output is off and has stopped.
+ */
+volatile struct Pic32RefoCon * Pic32_RefoCon(void)
+{
+    if(refo_con.ROSEL != refo_source)
+    {
+        if(refo_con.ACTIVE)
+            pic32_dac.errors++;
+        refo_source = refo_con.ROSEL;
+    }
+
+    if(refo_con.DIVSWEN)
+    {
+        refo_div = refo_con.RODIV;
+        refo_trim = REFOTRIMbits.ROTRIM;
+        refo_con.DIVSWEN = 0;
+    }
+
+    refo_con.ACTIVE = refo_con.ON;
+
+    return &refo_con;
+}
+
+/**
+ * A start or a stop, the stop ending the write the DAC was being sent
+ */
+int Pic32_I2cCondition(int condition)
+{
+    struct Pic32DacWrite * write;
+
+    if(condition == I2C_STOP && i2c_len > 0)
+    {
+        if(i2c_len != 3 || i2c_bytes[0] != DAC_I2C_ADDRESS)
+            pic32_dac.errors++;
+        else
+        {
+            pic32_dac.regs[(i2c_bytes[1] >> 1) & 0xF] = ((i2c_bytes[1] & 1) << 8) | i2c_bytes[2];
+            if(pic32_dac.num_writes < sizeof(pic32_dac.log) / sizeof(pic32_dac.log[0]))
+            {
+                write = &pic32_dac.log[pic32_dac.num_writes];
+                write->reg = i2c_bytes[1] >> 1;
+                write->value = ((i2c_bytes[1] & 1) << 8) | i2c_bytes[2];
+                write->lrclk_hz = Pic32_LrclkHz();
+            }
+            pic32_dac.num_writes++;
+        }
+    }
+
+    i2c_len = 0;
+    i2c_status = condition;
+
+    return I2C_SUCCESS;
+}
+
+int Pic32_I2cStatus(void)
+{
+    return i2c_status;
+}
+
+/**
+ * A byte sent on I2C1, which the DAC acknowledges if it's being talked to
+ */
+int Pic32_I2cSend(uint8_t data)
+{
+    if(i2c_len < sizeof(i2c_bytes))
+        i2c_bytes[i2c_len] = data;
+    i2c_len++;
+    i2c_acked = i2c_bytes[0] == DAC_I2C_ADDRESS && i2c_len <= 3;
+
+    return I2C_SUCCESS;
+}
+
+bool Pic32_I2cAcked(void)
+{
+    return i2c_acked;
+}
+
+/**
+ * What REFCLKO is putting out, 0 when it's off
+ */
+double Pic32_RefClockHz(void)
+{
+    double source;
+
+    Pic32_RefoCon();
+    if(!refo_con.ON || !refo_con.OE)
+        return 0;
+
+    switch(refo_source)
+    {
+        case 0: source = SYS_FREQ; break;
+        case 1: source = (double)SYS_FREQ / (1 << OSCCONbits.PBDIV); break;
+        case 2: source = POSC_FREQ; break;
+        default: return 0;
+    }
+
+    if(refo_div == 0)
+        return source;
+
+    return source / (2.0 * (refo_div + refo_trim / 512.0));
+}
+
+/**
+ * The frame rate SPI1 sends 16 bit stereo I2S at, 0 when it's stopped
+ */
+double Pic32_LrclkHz(void)
+{
+    if(!SPI1CONbits.ON || !SPI1CONbits.MSTEN || !SPI1CONbits.MCLKSEL || !SPI1CON2bits.AUDEN)
+        return 0;
+
+    return Pic32_RefClockHz() / (2.0 * (SPI1BRG + 1)) / 32;
+}
+
+/**
+ * Takes channel 0's interrupt if it's due, and starts its next block if it's been enabled again
+ *
+ * A block is sent from wherever DCH0SSA points when it starts, taking as
+ * long as LRCLK says. Nothing is sent while it's stopped or SPI1 isn't.
+ */
+static void AudioDma_Run(void)
+{
+    const int16_t * source;
+    double lrclk, start;
+    uint32_t frames, i;
+
+    while(true)
+    {
+        if(audio_dma.sending)
+        {
+            if(pic32_seconds < audio_dma.block_end)
+                return;
+
+            // The channel turns itself off at the end of the block
+            audio_dma.sending = false;
+            dma_enabled[0] = false;
+            audio_dma.pending = true;
+            audio_dma.pending_since = audio_dma.block_end;
+        }
+
+        // A block that's done is followed straight on from when its interrupt is taken
+        start = pic32_seconds;
+        if(audio_dma.pending)
+        {
+            if(!audio_dma.interrupts || audio_dma.handler == NULL)
+                return;
+
+            start = audio_dma.pending_since;
+            audio_dma.pending = false;
+            audio_dma.handler();
+        }
+
+        if(DCH0CONSET & 0x80)
+        {
+            dma_enabled[0] = true;
+            DCH0CONSET = 0;
+        }
+        DCH0ECON |= DCH0ECONSET & ~0x80u;
+        DCH0ECONSET = 0;
+
+        lrclk = Pic32_LrclkHz();
+        if(!dma_enabled[0] || !(DMACONSET & 0x8000) || !(DCH0ECON & 0x10) || lrclk <= 0 || DCH0SSIZ < 4)
+            return;
+
+        // SPI1 sent silence while the interrupt waited to be taken
+        if(audio_dma.block_end > 0 && start > audio_dma.block_end)
+        {
+            frames = (uint32_t)(((start - audio_dma.block_end) * lrclk) + 0.5);
+            pic32_i2s.late_frames += frames;
+            for(i = 0; i < frames; i++, pic32_i2s.num_frames++)
+            {
+                if(pic32_i2s.num_frames < pic32_i2s.max_frames)
+                    pic32_i2s.frames[pic32_i2s.num_frames * 2] = pic32_i2s.frames[(pic32_i2s.num_frames * 2) + 1] = 0;
+            }
+        }
+
+        source = (const int16_t *)DCH0SSA;
+        frames = DCH0SSIZ / 4;
+        for(i = 0; i < frames; i++, pic32_i2s.num_frames++)
+        {
+            if(pic32_i2s.num_frames < pic32_i2s.max_frames)
+                memcpy(&pic32_i2s.frames[pic32_i2s.num_frames * 2], &source[i * 2], 4);
+        }
+        pic32_i2s.blocks++;
+
+        audio_dma.sending = true;
+        audio_dma.block_end = start + (frames / lrclk);
+    }
+}
+
+/**
+ * Turns interrupts on or off, taking any that came in while they were off
+ */
+void Pic32_Interrupts(bool on)
+{
+    AudioDma_Run();
+    if(on && !audio_dma.interrupts && audio_dma.pending && audio_dma.pending_since < pic32_seconds)
+        audio_dma.pending_since = pic32_seconds;
+    audio_dma.interrupts = on;
+    AudioDma_Run();
+}
+
+/**
+ * Gives channel 0's interrupt handler (DmaCh0Int), which the simulation calls as the firmware's vector would
+ */
+void Pic32_AttachDmaInterrupt(void (*handler)(void))
+{
+    audio_dma.handler = handler;
+}
+
+/**
+ * Keeps what SPI1 sends from now on
+ */
+void Pic32_CaptureI2s(int16_t * frames, uint32_t max_frames)
+{
+    memset(&pic32_i2s, 0, sizeof(pic32_i2s));
+    pic32_i2s.frames = frames;
+    pic32_i2s.max_frames = max_frames;
+}
+
+/**
+ * Moves the clock on by time the CPU or a peripheral took, with the DMA
+ * carrying on and interrupting over it
+ */
+void Pic32_Spend(double seconds)
+{
+    pic32_seconds += seconds;
+
+    if(audio_dma.sending && pic32_seconds < audio_dma.block_end)
+        return;
+    AudioDma_Run();
+}
+
+/**
+ * Sits idle until the block being sent is done and its interrupt taken
+ *
+ * @return False if no interrupt is coming
+ */
+bool Pic32_WaitForInterrupt(void)
+{
+    AudioDma_Run();
+    if(!audio_dma.sending || !audio_dma.interrupts)
+        return false;
+
+    Pic32_Spend(audio_dma.block_end - pic32_seconds);
+    return true;
+}
+
+/**
+ * Puts a card in the slot, powered up and waiting for CMD0
+ *
+ * @param image The card's contents, which writes go straight into
+ * @param size Its size in bytes
+ */
+void Pic32_InsertCard(uint8_t * image, uint64_t size)
+{
+    memset(&card, 0, sizeof(card));
+    card.image = image;
+    card.num_sectors = size / CARD_SECTOR_SIZE;
+    card.idle = true;
+
+    Pic32_ResetStats();
+    pic32_uart_log[0] = '\0';
+}
+
+/**
+ * Holds up the next sector the card starts to read, the way a card busy
+ * with its own housekeeping does, by sending 0xFF that much longer before
+ * the data token
+ *
+ * @param seconds How long for
+ */
+void Pic32_StallCard(double seconds)
+{
+    card.stall_seconds = seconds;
+}
+
+void Pic32_ResetStats(void)
+{
+    memset(&pic32_sd, 0, sizeof(pic32_sd));
+}
+
+/**
+ * Counts reads of a range of sectors (e.g. the FAT) in pic32_sd.watched_reads
+ */
+void Pic32_WatchSectors(uint64_t first, uint64_t count)
+{
+    watch_first = first;
+    watch_count = count;
+}
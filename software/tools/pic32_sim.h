@@ -0,0 +1,155 @@
+/*
+ * File:   pic32_sim.h
+ *
+ * Created on October 17, 2026
+ *
+ * Simulated PIC32 peripherals, so the firmware's hardware code (sd.c, uart.c,
+ * dac.c, i2c.c) can run on a PC against the register stand-ins in pic32/.
+ * SPI2 has an SD card on it that answers in SPI mode from a disk image in
+ * RAM, held up before a read whenever a check wants it to be, and the two DMA channels sd.c receives sectors with are run whenever
+ * the firmware waits for them to finish. I2C1 has the DAC on it, which keeps
+ * its registers, and REFCLKO and SPI1 give the clocks it's sent. DMA channel
+ * 0 feeds SPI1 a block at a time at the LRCLK they make, interrupting at
+ * the end of each, against a clock that SPI2's bytes and the CPU move on.
+ */
+
+#ifndef PIC32_SIM_H
+#define	PIC32_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bits of the control registers the firmware sets
+struct Pic32SpiCon {
+    unsigned SRXISEL:2;
+    unsigned STXISEL:2;
+    unsigned MSTEN:1;
+    unsigned CKP:1;
+    unsigned MODE16:1;
+    unsigned MODE32:1;
+    unsigned ENHBUF:1;
+    unsigned MCLKSEL:1;         // BCLK from REFCLKO instead of PBCLK
+    unsigned ON:1;
+};
+
+struct Pic32SpiCon2 {
+    unsigned AUDMOD:2;
+    unsigned AUDMONO:1;
+    unsigned AUDEN:1;
+};
+
+// REFCLKO's divisor and trim only take effect on a DIVSWEN
+struct Pic32RefoCon {
+    unsigned RODIV:15;
+    unsigned ON:1;
+    unsigned ACTIVE:1;
+    unsigned DIVSWEN:1;
+    unsigned OE:1;
+    unsigned ROSEL:4;
+};
+
+struct Pic32RefoTrim {
+    unsigned ROTRIM:9;
+};
+
+struct Pic32OscCon {
+    unsigned PBDIV:2;
+};
+
+// The buttons' port, high while they're up
+struct Pic32PortB {
+    unsigned RB3:1;
+    unsigned RB7:1;
+    unsigned RB11:1;
+};
+
+// SPI status bits the firmware reads and writes
+struct Pic32SpiStat {
+    unsigned SPIRBF:1;          // Receive buffer full
+    unsigned SPIROV:1;          // Receive overflow
+};
+
+// DMA channel interrupt flags the firmware polls
+struct Pic32DmaInt {
+    unsigned CHBCIF:1;          // Block transfer complete
+};
+
+// What the card and SPI2 saw, for working out what the firmware cost
+struct Pic32SdStats {
+    uint32_t commands[64];      // Of each command (ACMD41 is counted as 41)
+    uint64_t cpu_bytes;         // Moved by the CPU through SPI2BUF
+    uint64_t dma_bytes;         // Moved by the DMA
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+    uint32_t dma_transfers;
+    uintptr_t dma_dest;         // Where the last DMA transfer went
+    double bus_seconds;         // Time SPI2 spent clocking bytes
+    uint32_t errors;            // Things a real card or the DMA wouldn't have put up with
+    uint64_t watched_reads;     // Sectors read in the range given to Pic32_WatchSectors
+    uint32_t stalls;            // Reads held up by Pic32_StallCard
+};
+
+extern struct Pic32SdStats pic32_sd;
+
+// A register write the DAC took, and what the clocks were when it did
+struct Pic32DacWrite {
+    uint8_t reg;
+    uint16_t value;
+    double lrclk_hz;            // What SPI1 was sending at (0 if it was stopped)
+};
+
+// The DAC on I2C1
+struct Pic32Dac {
+    uint16_t regs[16];
+    struct Pic32DacWrite log[256];
+    uint32_t num_writes;        // Also counts ones past the end of the log
+    uint32_t errors;            // Bad I2C transfers, or REFCLKO's source changed while running
+};
+
+extern struct Pic32Dac pic32_dac;
+
+// What SPI1 sent the DAC, as DMA channel 0 moved it
+struct Pic32I2s {
+    int16_t * frames;           // 16 bit stereo, from Pic32_CaptureI2s
+    uint32_t max_frames;
+    uint32_t num_frames;        // Sent, counting any past max_frames
+    uint32_t blocks;            // DMA blocks sent
+    uint32_t late_frames;       // Sent as silence while the DMA waited for its interrupt to be taken
+};
+
+extern struct Pic32I2s pic32_i2s;
+
+// Simulated time in seconds, moved on by SPI2's bytes and by Pic32_Spend
+extern double pic32_seconds;
+
+// Everything the firmware sent out of UART1
+extern char pic32_uart_log[4096];
+
+volatile uint32_t * Pic32_Spi2Buf(void);
+volatile struct Pic32SpiStat * Pic32_Spi2Stat(void);
+volatile struct Pic32DmaInt * Pic32_Dch2Int(void);
+void Pic32_DmaEnable(int channel);
+void Pic32_PortWrite(char port, uint32_t bits, bool set);
+void Pic32_UartSend(uint8_t data);
+volatile struct Pic32RefoCon * Pic32_RefoCon(void);
+int Pic32_I2cCondition(int condition);
+int Pic32_I2cStatus(void);
+int Pic32_I2cSend(uint8_t data);
+bool Pic32_I2cAcked(void);
+
+double Pic32_RefClockHz(void);
+double Pic32_LrclkHz(void);
+
+void Pic32_Interrupts(bool on);
+void Pic32_AttachDmaInterrupt(void (*handler)(void));
+void Pic32_CaptureI2s(int16_t * frames, uint32_t max_frames);
+void Pic32_Spend(double seconds);
+bool Pic32_WaitForInterrupt(void);
+
+void Pic32_InsertCard(uint8_t * image, uint64_t size);
+void Pic32_ResetStats(void);
+void Pic32_WatchSectors(uint64_t first, uint64_t count);
+void Pic32_StallCard(double seconds);
+
+#endif	/* PIC32_SIM_H */
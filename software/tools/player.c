@@ -0,0 +1,160 @@
+/*
+ * File:   player.c
+ *
+ * Created on October 17, 2026
+ *
+ * The steps are main()'s, in its order, with its busy waits turned into
+ * waits for the simulated DMA's next interrupt. The buttons are never
+ * pressed.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <plib.h>
+#include "player.h"
+#include "pic32_sim.h"
+#include "audio.h"
+#include "dac.h"
+#include "dma.h"
+#include "fat.h"
+#include "library.h"
+#include "sd.h"
+
+// What the player in main.c has
+struct Track;
+extern volatile bool playing;
+extern struct FatPartition fat;
+extern FatCatalogEntry catalog[];
+extern struct LibraryIndex library;
+extern char * file_exts[3];
+extern uint16_t num_files;
+extern struct Track * current_track;
+extern uint16_t next_song;
+
+bool OpenTrack(struct Track * track, uint16_t song);
+void PrefetchTrack();
+void StartSong();
+bool FillRing();
+void nextSong();
+void DmaCh0Int(void);
+
+struct PlayerStats player_stats;
+
+// The song just changed, so the ring is filling up from empty
+static bool song_changed;
+
+// Time spent waiting in this pass
+static double waited;
+
+/**
+ * Puts a card in and starts the player on its first song, as main() does
+ *
+ * @param image The card
+ * @param size Its size in bytes
+ * @param capture Where to keep what SPI1 sends
+ * @param max_frames How much of it to keep
+ */
+void Player_Boot(uint8_t * image, uint64_t size, int16_t * capture, uint32_t max_frames)
+{
+    memset(&player_stats, 0, sizeof(player_stats));
+    song_changed = false;
+    Pic32_InsertCard(image, size);
+    Pic32_AttachDmaInterrupt(DmaCh0Int);
+    Pic32_CaptureI2s(capture, max_frames);
+
+    InitDAC();
+    InitSD();
+    InitDMA();
+
+    OpenFirstFatPartition(&fat);
+    if(!Library_Open(&library, &fat, LIBRARY_MAX_FILES) || !Library_Load(&library, catalog, &num_files))
+    {
+        num_files = GetFilesByExt(&fat, catalog, LIBRARY_MAX_FILES, file_exts, sizeof(file_exts) / sizeof(file_exts[0]));
+        Library_Save(&library, catalog, num_files);
+    }
+
+    OpenTrack(current_track, 0);
+    next_song = 1 % num_files;
+    StartSong();
+
+    INTEnableInterrupts();
+    DCH0ECONSET = 0x90;
+}
+
+/**
+ * Waits for the DMA's next interrupt, keeping count of the time
+ *
+ * @return False if nothing is coming
+ */
+static bool Player_Wait(void)
+{
+    double start = pic32_seconds;
+    bool interrupted = Pic32_WaitForInterrupt();
+
+    waited += pic32_seconds - start;
+    return interrupted;
+}
+
+/**
+ * Goes round main()'s loop once
+ *
+ * With the ring full, main() would spin refilling nothing until the DMA
+ * takes a block, so this waits for that.
+ */
+void Player_Pass(void)
+{
+    uint32_t dac_writes = pic32_dac.num_writes, underruns = audio_ring.underruns;
+    double start = pic32_seconds, took;
+    bool song_ended;
+
+    waited = 0;
+    song_ended = playing && !FillRing();
+
+    took = pic32_seconds - start;
+    player_stats.fill_seconds += took;
+    if(took > player_stats.worst_fill)
+        player_stats.worst_fill = took;
+
+    if(!song_changed)
+        player_stats.stray_underruns += audio_ring.underruns - underruns;
+    song_changed = song_ended;
+
+    // Draining the ring ends on silence, once its last block has gone out
+    if(song_ended)
+    {
+        while(AUDIO_RING_FILLED() > 0 && Player_Wait()) { }
+    }
+    player_stats.stray_dac_writes += pic32_dac.num_writes - dac_writes;
+
+    // The interrupts held off while the song changes come in on an empty ring
+    INTDisableInterrupts();
+    if(song_ended)
+    {
+        nextSong();
+        player_stats.songs_ended++;
+    }
+    INTEnableInterrupts();
+
+    dac_writes = pic32_dac.num_writes;
+    underruns = audio_ring.underruns;
+    if(playing)
+        PrefetchTrack();
+
+    if(AUDIO_RING_FILLED() == AUDIO_RING_BLOCKS)
+        Player_Wait();
+    player_stats.stray_dac_writes += pic32_dac.num_writes - dac_writes;
+    if(!song_changed)
+        player_stats.stray_underruns += audio_ring.underruns - underruns;
+    player_stats.busy_seconds += (pic32_seconds - start) - waited;
+    player_stats.passes++;
+}
+
+/**
+ * Goes round main()'s loop until SPI1 has sent at least so many frames
+ */
+void Player_Run(uint32_t frames)
+{
+    while(pic32_i2s.num_frames < frames)
+        Player_Pass();
+}
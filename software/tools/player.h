@@ -0,0 +1,36 @@
+/*
+ * File:   player.h
+ *
+ * Created on October 17, 2026
+ *
+ * Runs the player in main.c on the simulated PIC32: boots it the way
+ * main() does and then goes round main()'s loop, with the DMA sending the
+ * ring to SPI1 in simulated time and the card's reads taking theirs. What
+ * comes out is in pic32_i2s. A check includes main.c with its main()
+ * renamed, and drives it through these.
+ */
+
+#ifndef PLAYER_H
+#define	PLAYER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// What going round the loop cost
+struct PlayerStats {
+    uint32_t passes;            // Times round the loop
+    uint32_t songs_ended;       // Times it drained the ring and called nextSong
+    uint32_t stray_dac_writes;  // Made by anything but nextSong
+    uint32_t stray_underruns;   // Other than as the ring drains for nextSong and fills again after
+    double worst_fill;          // Longest FillRing, in simulated seconds
+    double fill_seconds;        // All the time spent in FillRing
+    double busy_seconds;        // All the time not spent waiting for the DMA
+};
+
+extern struct PlayerStats player_stats;
+
+void Player_Boot(uint8_t * image, uint64_t size, int16_t * capture, uint32_t max_frames);
+void Player_Pass(void);
+void Player_Run(uint32_t frames);
+
+#endif	/* PLAYER_H */
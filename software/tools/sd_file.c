@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sd_file.h"
+
+// The image everything is read from and written to
+static int sd_fd = -1;
+static uint64_t sd_num_sectors = 0;
+
+// Where the firmware's multi-block read session would be
+static bool sd_stream_open = false;
+static uint32_t sd_stream_next_sector = 0;
+
+uint32_t sd_cache_hits = 0;
+uint32_t sd_cache_misses = 0;
+
+uint32_t sd_file_commands = 0;
+uint64_t sd_file_sectors_read = 0;
+uint64_t sd_file_sectors_written = 0;
+
+/**
+ * Opens a disk image or block device in place of the SD card
+ *
+ * @param path The image file or block device
+ * @param size The size to make an image file in bytes (zero keeps the size
+ *             it already is, block devices are always used as they are)
+ *
+ * @return False if it couldn't be opened
+ */
+bool SD_OpenImage(const char * path, uint64_t size)
+{
+    struct stat info;
+    off_t end;
+
+    sd_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(sd_fd < 0)
+    {
+        perror(path);
+        return false;
+    }
+
+    if(fstat(sd_fd, &info) == 0 && S_ISREG(info.st_mode) && size > 0)
+    {
+        if(ftruncate(sd_fd, 0) != 0 || ftruncate(sd_fd, (off_t)size) != 0)
+        {
+            perror(path);
+            return false;
+        }
+    }
+
+    end = lseek(sd_fd, 0, SEEK_END);
+    if(end < 0)
+    {
+        perror(path);
+        return false;
+    }
+
+    sd_num_sectors = (uint64_t)end / SECTOR_SIZE;
+    return true;
+}
+
+/**
+ * @return The size of the open image in sectors
+ */
+uint64_t SD_ImageSectors(void)
+{
+    return sd_num_sectors;
+}
+
+/**
+ * Flushes and closes the image
+ */
+void SD_CloseImage(void)
+{
+    if(sd_fd < 0)
+        return;
+
+    fsync(sd_fd);
+    close(sd_fd);
+    sd_fd = -1;
+}
+
+void SD_ReadData(void * buffer, uint64_t start_byte, size_t size)
+{
+    if(pread(sd_fd, buffer, size, (off_t)start_byte) != (ssize_t)size)
+        memset(buffer, 0, size);
+
+    sd_file_sectors_read += (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+void SD_ReadCached(void * buffer, uint64_t start_byte, size_t size)
+{
+    SD_ReadData(buffer, start_byte, size);
+}
+
+void SD_ReadSector(uint8_t * buffer, uint32_t sector_num)
+{
+    SD_StreamStop();
+    sd_file_commands++;
+    SD_ReadData(buffer, (uint64_t)sector_num * SECTOR_SIZE, SECTOR_SIZE);
+}
+
+void SD_ReadMultiSectors(uint8_t buffer[][SECTOR_SIZE], uint32_t start_sector_num, uint32_t num_sectors)
+{
+    SD_StreamStop();
+    sd_file_commands++;
+    SD_ReadData(buffer, (uint64_t)start_sector_num * SECTOR_SIZE, (size_t)num_sectors * SECTOR_SIZE);
+}
+
+void SD_StreamRead(uint8_t buffer[][SECTOR_SIZE], uint32_t start_sector_num, uint32_t num_sectors)
+{
+    if(!sd_stream_open || start_sector_num != sd_stream_next_sector)
+    {
+        sd_file_commands++;
+        sd_stream_open = true;
+    }
+
+    SD_ReadData(buffer, (uint64_t)start_sector_num * SECTOR_SIZE, (size_t)num_sectors * SECTOR_SIZE);
+    sd_stream_next_sector = start_sector_num + num_sectors;
+}
+
+void SD_StreamStop(void)
+{
+    sd_stream_open = false;
+}
+
+bool SD_WriteSector(const uint8_t * buffer, uint32_t sector_num)
+{
+    return SD_WriteMultiSectors((const uint8_t (*)[SECTOR_SIZE])buffer, sector_num, 1);
+}
+
+bool SD_WriteMultiSectors(const uint8_t buffer[][SECTOR_SIZE], uint32_t start_sector_num, uint32_t num_sectors)
+{
+    size_t size = (size_t)num_sectors * SECTOR_SIZE;
+
+    SD_StreamStop();
+    sd_file_commands++;
+    sd_file_sectors_written += num_sectors;
+
+    return pwrite(sd_fd, buffer, size, (off_t)start_sector_num * SECTOR_SIZE) == (ssize_t)size;
+}
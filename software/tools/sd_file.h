@@ -0,0 +1,27 @@
+/*
+ * File:   sd_file.h
+ *
+ * Created on October 17, 2026
+ *
+ * Stands in for the firmware's sd.c on a PC, reading and writing a disk
+ * image (or a block device) instead of the SD card.
+ */
+
+#ifndef SD_FILE_H
+#define	SD_FILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sd.h"
+
+// Counters for working out how the firmware would have used the card
+extern uint32_t sd_file_commands;    // Read/write commands (a new one whenever a read doesn't follow on)
+extern uint64_t sd_file_sectors_read;
+extern uint64_t sd_file_sectors_written;
+
+bool SD_OpenImage(const char * path, uint64_t size);
+uint64_t SD_ImageSectors(void);
+void SD_CloseImage(void);
+
+#endif	/* SD_FILE_H */
+
@@ -0,0 +1,519 @@
+/*
+ * File:   test_adpcm.c
+ *
+ * Created on October 17, 2026
+ *
+ * Checks the firmware's IMA and Microsoft ADPCM decoder (adpcm.c) bit for
+ * bit. IMA is checked against golden blocks decoded by CPython's audioop,
+ * then both formats have tracks encoded here streamed off the simulated card
+ * through Adpcm_Read, in reads of every size, against a plain reference
+ * decoder written from the format descriptions. Also reports what each
+ * layout costs in card bandwidth and host time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "testcard.h"
+#include "adpcm.h"
+#include "fat.h"
+#include "sd.h"
+#include "wav.h"
+
+#define TRACK_FRAMES 20000
+#define SAMPLE_RATE 44100
+
+// Most frames asked for in one Adpcm_Read
+#define MAX_READ 300
+
+// A mono IMA block decoded by audioop.adpcm2lin (which takes the codes high nibble first)
+struct ImaGolden {
+    int16_t sample;
+    uint8_t step_index;
+    uint8_t codes[32];
+    uint8_t num_codes;
+    int16_t out[32];
+};
+
+static const struct ImaGolden ima_golden[] = {
+    // Clipping both ways from near full scale, with every code
+    { 32000, 60, { 7, 7, 7, 7, 0, 1, 2, 3, 4, 5, 6, 8, 9, 10, 11, 12, 13, 14, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3, 12, 0, 0 }, 32,
+            { 32767, 32767, 32767, 32767, 32767, 32767, 32767, 32767, 32767, 32767, 32767, 28672, 17500, 572, -20971, -32768,
+            -32768, -32768, -32768, -32768, -32768, -32768, -32768, -32768, -32768, -32768, -32768, -32768, -4099, -32768, -28673, -24949 } },
+    // The smallest step, where the shifts lose everything
+    { -100, 0, { 0, 8, 0, 8, 7, 15, 7, 15, 1, 9, 4, 12, 6, 14, 2, 10 }, 16,
+            { -100, -100, -100, -100, -89, -119, -56, -192, -134, -186, -40, -216, 92, -455, -82, -422 } },
+    // The biggest step, full scale swings
+    { -30000, 88, { 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 7, 7, 7, 7 }, 16,
+            { -32768, -32768, -32768, -32768, -32768, -32768, -32768, -32768, -32768, -32768, -32768, -32768, 28668, 32767, 32767, 32767 } },
+};
+
+// A track's layout
+struct Layout {
+    uint16_t format;
+    uint8_t channels;
+    uint16_t block_align;
+    bool truncated;             // The last block is cut short, the way some encoders leave it
+};
+
+static const struct Layout layouts[] = {
+    { WAV_FORMAT_IMA_ADPCM, 1, 256, false },
+    { WAV_FORMAT_IMA_ADPCM, 2, 2048, false },
+    { WAV_FORMAT_IMA_ADPCM, 2, 36, false },
+    { WAV_FORMAT_IMA_ADPCM, 2, 1024, true },
+    { WAV_FORMAT_ADPCM, 1, 256, false },
+    { WAV_FORMAT_ADPCM, 2, 2048, false },
+    { WAV_FORMAT_ADPCM, 2, 1025, false },
+    { WAV_FORMAT_ADPCM, 1, 512, true },
+};
+#define NUM_LAYOUTS (sizeof(layouts) / sizeof(layouts[0]))
+
+// The standard tables, as the format descriptions give them
+static const int ima_steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+static const int ima_index_steps[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+static const int ms_coef1[7] = { 256, 512, 0, 192, 240, 460, 392 };
+static const int ms_coef2[7] = { 0, -256, 0, 64, 0, -208, -232 };
+static const int ms_adaptation[16] = { 230, 230, 230, 230, 307, 409, 512, 614, 768, 614, 512, 409, 307, 230, 230, 230 };
+
+static struct TestCard card;
+static struct FatPartition fat;
+
+static int Clamp16(int x)
+{
+    return (x > 32767) ? 32767 : ((x < -32768) ? -32768 : x);
+}
+
+/**
+ * One IMA code, the way the IMA recommendation's decoder does it
+ */
+static int ImaDecode(int * sample, int * index, int code)
+{
+    int step = ima_steps[*index], diff = step >> 3;
+
+    if(code & 4)
+        diff += step;
+    if(code & 2)
+        diff += step >> 1;
+    if(code & 1)
+        diff += step >> 2;
+
+    *sample = Clamp16((code & 8) ? *sample - diff : *sample + diff);
+    *index += ima_index_steps[code & 7];
+    *index = (*index < 0) ? 0 : ((*index > 88) ? 88 : *index);
+
+    return *sample;
+}
+
+/**
+ * One MS code, with the division by 256 rounding towards zero as the
+ * Microsoft decoder does, and the step size held where libavcodec's decoder
+ * holds it so it can't overflow
+ */
+static int MsDecode(int * s1, int * s2, int * delta, int coef, int code)
+{
+    int prediction = ((*s1 * ms_coef1[coef]) + (*s2 * ms_coef2[coef])) / 256;
+    int sample = Clamp16(prediction + (((code & 8) ? code - 16 : code) * *delta));
+
+    *s2 = *s1;
+    *s1 = sample;
+    *delta = (ms_adaptation[code] * *delta) >> 8;
+    if(*delta < 16)
+        *delta = 16;
+    else if(*delta > 0x7FFFFFFF / 768)
+        *delta = 0x7FFFFFFF / 768;
+
+    return sample;
+}
+
+static int FramesPerBlock(const struct Layout * layout, uint32_t size)
+{
+    if(layout->format == WAV_FORMAT_IMA_ADPCM)
+        return 1 + (((size - (4 * layout->channels)) / (4 * layout->channels)) * 8);
+
+    return 2 + (((size - (7 * layout->channels)) * 2) / layout->channels);
+}
+
+/**
+ * Decodes a whole track into 16 bit stereo, a block at a time
+ *
+ * @return The frames decoded
+ */
+static uint32_t ReferenceDecode(const struct Layout * layout, const uint8_t * data, uint32_t size, int16_t * out)
+{
+    const int ch = layout->channels;
+    int sample[2], index[2], s2[2], delta[2], coef[2];
+    int frames, f, c, code, value;
+    uint32_t block_size, made = 0;
+    const uint8_t * p;
+
+    for(; size >= (uint32_t)((layout->format == WAV_FORMAT_IMA_ADPCM) ? 4 : 7) * ch; data += block_size, size -= block_size)
+    {
+        block_size = (size < layout->block_align) ? size : layout->block_align;
+        frames = FramesPerBlock(layout, block_size);
+
+        for(f = 0; f < frames; f++)
+        {
+            for(c = 0; c < 2; c++)
+            {
+                if(c == ch)
+                {
+                    out[((made + f) * 2) + 1] = out[(made + f) * 2];
+                    break;
+                }
+
+                if(layout->format == WAV_FORMAT_IMA_ADPCM)
+                {
+                    if(f == 0)
+                    {
+                        sample[c] = (int16_t)(data[4 * c] | (data[(4 * c) + 1] << 8));
+                        index[c] = (data[(4 * c) + 2] > 88) ? 88 : data[(4 * c) + 2];
+                        value = sample[c];
+                    }
+                    else
+                    {
+                        // Groups of 4 bytes of each channel in turn, low nibble first
+                        p = data + (4 * ch) + (((f - 1) / 8) * 4 * ch) + (4 * c) + (((f - 1) % 8) / 2);
+                        code = ((f - 1) % 2) ? (*p >> 4) : (*p & 0xF);
+                        value = ImaDecode(&sample[c], &index[c], code);
+                    }
+                }
+                else
+                {
+                    if(f == 0)
+                    {
+                        coef[c] = (data[c] < 7) ? data[c] : 0;
+                        delta[c] = (int16_t)(data[ch + (2 * c)] | (data[ch + (2 * c) + 1] << 8));
+                        sample[c] = (int16_t)(data[(3 * ch) + (2 * c)] | (data[(3 * ch) + (2 * c) + 1] << 8));
+                        s2[c] = (int16_t)(data[(5 * ch) + (2 * c)] | (data[(5 * ch) + (2 * c) + 1] << 8));
+                        value = s2[c];
+                    }
+                    else if(f == 1)
+                        value = sample[c];
+                    else
+                    {
+                        // A code for each channel in turn, high nibble first
+                        code = (((f - 2) * ch) + c);
+                        p = data + (7 * ch) + (code / 2);
+                        value = MsDecode(&sample[c], &s2[c], &delta[c], coef[c], (code % 2) ? (*p & 0xF) : (*p >> 4));
+                    }
+                }
+
+                out[((made + f) * 2) + c] = value;
+            }
+        }
+
+        made += frames;
+    }
+
+    return made;
+}
+
+/**
+ * Something like music for each channel, with a burst of full scale square
+ * wave now and then to slam the step sizes about
+ */
+static void MakeSignal(int16_t * signal, uint32_t frames, int channels)
+{
+    uint32_t i;
+    int c;
+    double v;
+
+    for(i = 0; i < frames; i++)
+    {
+        for(c = 0; c < channels; c++)
+        {
+            v = (12000 * sin(2 * M_PI * (440 + (c * 110)) * i / SAMPLE_RATE)) +
+                    (6000 * sin((2 * M_PI * 3100 * i / SAMPLE_RATE) + c)) + ((rand() % 5001) - 2500);
+            if(i % 9000 < 30)
+                v = ((i / 3) % 2) ? 32767 : -32768;
+            signal[(i * channels) + c] = Clamp16((int)lrint(v));
+        }
+    }
+}
+
+/**
+ * Encodes a signal, each code the nearest to the next sample from where the
+ * decoder will be
+ *
+ * @return Bytes of data, whole blocks unless the layout is truncated
+ */
+static uint32_t Encode(const struct Layout * layout, const int16_t * signal, uint32_t frames, uint8_t * data)
+{
+    const int ch = layout->channels;
+    const int per_block = FramesPerBlock(layout, layout->block_align);
+    int sample[2] = { 0, 0 }, index[2] = { 0, 0 }, s2[2], delta[2] = { 16, 16 }, coef[2];
+    int f, c, code, best, diff, x, step, trial, trial_index, trial_s1, trial_s2, trial_delta;
+    uint32_t block, num_blocks = (frames + per_block - 1) / per_block, size;
+    uint8_t * b;
+
+    memset(data, 0, num_blocks * layout->block_align);
+
+    for(block = 0; block < num_blocks; block++)
+    {
+        b = data + (block * layout->block_align);
+
+        for(f = 0; f < per_block; f++)
+        {
+            for(c = 0; c < ch; c++)
+            {
+                x = signal[(((block * per_block) + f < frames) ? (block * per_block) + f : frames - 1) * ch + c];
+
+                if(layout->format == WAV_FORMAT_IMA_ADPCM)
+                {
+                    if(f == 0)
+                    {
+                        sample[c] = x;
+                        b[4 * c] = x & 0xFF;
+                        b[(4 * c) + 1] = (x >> 8) & 0xFF;
+                        b[(4 * c) + 2] = index[c];
+                        continue;
+                    }
+
+                    // The IMA encoder's successive approximation
+                    diff = x - sample[c];
+                    code = (diff < 0) ? 8 : 0;
+                    diff = abs(diff);
+                    step = ima_steps[index[c]];
+                    if(diff >= step) { code |= 4; diff -= step; }
+                    step >>= 1;
+                    if(diff >= step) { code |= 2; diff -= step; }
+                    step >>= 1;
+                    if(diff >= step) code |= 1;
+                    ImaDecode(&sample[c], &index[c], code);
+
+                    b[(4 * ch) + (((f - 1) / 8) * 4 * ch) + (4 * c) + (((f - 1) % 8) / 2)] |= ((f - 1) % 2) ? (code << 4) : code;
+                }
+                else
+                {
+                    if(f == 0)
+                    {
+                        // Every predictor gets used, and the step size carries on from the last block
+                        coef[c] = (block + c) % 7;
+                        s2[c] = x;
+                        b[c] = coef[c];
+                        b[ch + (2 * c)] = delta[c] & 0xFF;
+                        b[ch + (2 * c) + 1] = (delta[c] >> 8) & 0xFF;
+                        b[(5 * ch) + (2 * c)] = x & 0xFF;
+                        b[(5 * ch) + (2 * c) + 1] = (x >> 8) & 0xFF;
+                        continue;
+                    }
+                    if(f == 1)
+                    {
+                        sample[c] = x;
+                        b[(3 * ch) + (2 * c)] = x & 0xFF;
+                        b[(3 * ch) + (2 * c) + 1] = (x >> 8) & 0xFF;
+                        continue;
+                    }
+
+                    // Try every code, keep the closest
+                    best = 0;
+                    for(code = 0, diff = 1 << 30; code < 16; code++)
+                    {
+                        trial_s1 = sample[c];
+                        trial_s2 = s2[c];
+                        trial_delta = delta[c];
+                        trial = MsDecode(&trial_s1, &trial_s2, &trial_delta, coef[c], code);
+                        if(abs(trial - x) < diff)
+                        {
+                            diff = abs(trial - x);
+                            best = code;
+                        }
+                    }
+                    MsDecode(&sample[c], &s2[c], &delta[c], coef[c], best);
+
+                    trial_index = ((f - 2) * ch) + c;
+                    b[(7 * ch) + (trial_index / 2)] |= (trial_index % 2) ? best : (best << 4);
+                }
+            }
+        }
+
+        if(delta[0] > 0x7FFF || delta[1] > 0x7FFF)
+            delta[0] = delta[1] = 0x7FFF;
+    }
+
+    size = num_blocks * layout->block_align;
+    if(layout->truncated)
+        size -= layout->block_align - (((layout->format == WAV_FORMAT_IMA_ADPCM) ? 4 : 7) * ch) - 37;
+
+    return size;
+}
+
+static void SetInfo(struct WavInfo * info, const struct Layout * layout, uint32_t data_size)
+{
+    memset(info, 0, sizeof(struct WavInfo));
+    info->format = layout->format;
+    info->channels = layout->channels;
+    info->sample_rate = SAMPLE_RATE;
+    info->block_align = layout->block_align;
+    info->bits_per_sample = 4;
+    info->data_size = data_size;
+}
+
+static const char * LayoutName(const struct Layout * layout)
+{
+    static char name[48];
+
+    snprintf(name, sizeof(name), "%s %s %u%s", (layout->format == WAV_FORMAT_IMA_ADPCM) ? "IMA" : "MS",
+            (layout->channels == 1) ? "mono" : "stereo", layout->block_align, layout->truncated ? " truncated" : "");
+    return name;
+}
+
+/**
+ * The audioop blocks decode the same, and so does the reference decoder
+ */
+static void CheckGolden(void)
+{
+    static uint8_t blocks[3][4 + 16];
+    static int16_t out[33 * 2], reference[33 * 2];
+    const struct ImaGolden * g;
+    struct Layout layout = { WAV_FORMAT_IMA_ADPCM, 1, 0, false };
+    struct AdpcmDecoder dec;
+    struct FatStream stream;
+    struct WavInfo info;
+    struct FatFile file;
+    uint32_t i, k, n, size;
+    char name[16];
+    bool matches;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 32768, 4);
+    for(i = 0; i < sizeof(ima_golden) / sizeof(ima_golden[0]); ++i)
+    {
+        g = &ima_golden[i];
+        blocks[i][0] = g->sample & 0xFF;
+        blocks[i][1] = (g->sample >> 8) & 0xFF;
+        blocks[i][2] = g->step_index;
+        for(k = 0; k < g->num_codes; k += 2)
+            blocks[i][4 + (k / 2)] = g->codes[k] | (g->codes[k + 1] << 4);
+
+        snprintf(name, sizeof(name), "GOLD%u.RAW", i);
+        TestCard_AddFile(&card, TESTCARD_ROOT, name, blocks[i], 4 + (g->num_codes / 2), 0);
+    }
+
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat), "The card didn't open");
+
+    for(i = 0; i < sizeof(ima_golden) / sizeof(ima_golden[0]); ++i)
+    {
+        g = &ima_golden[i];
+        size = 4 + (g->num_codes / 2);
+        layout.block_align = size;
+        SetInfo(&info, &layout, size);
+        snprintf(name, sizeof(name), "GOLD%u   ", i);
+        CHECK(Adpcm_Supported(&info) && Fat_open(&fat, &file, name, "RAW"), "Couldn't open golden block %u", i);
+
+        Adpcm_Init(&dec, &info);
+        Fat_OpenStream(&stream, &file, size);
+        n = Adpcm_Read(&dec, &stream, out, 33);
+        CHECK(n == g->num_codes + 1u && n == Adpcm_CountFrames(&info), "Golden block %u decoded to %u frames", i, n);
+
+        matches = (out[0] == g->sample);
+        for(k = 0; matches && k < g->num_codes; ++k)
+            matches = (out[(k + 1) * 2] == g->out[k] && out[((k + 1) * 2) + 1] == g->out[k]);
+        CHECK(matches, "Golden block %u differs from audioop at frame %u", i, k);
+
+        ReferenceDecode(&layout, blocks[i], size, reference);
+        CHECK(memcmp(reference, out, n * 4) == 0, "The reference decoder differs from audioop on golden block %u", i);
+    }
+}
+
+/**
+ * Every layout streams off the card in reads of every size and matches the
+ * reference decoder exactly
+ */
+static void CheckTracks(void)
+{
+    static int16_t signal[TRACK_FRAMES * 2];
+    static uint8_t data[NUM_LAYOUTS][TRACK_FRAMES * 2];
+    static uint32_t sizes[NUM_LAYOUTS];
+    static int16_t reference[(TRACK_FRAMES + 4096) * 2], out[(TRACK_FRAMES + 4096) * 2];
+    const struct Layout * layout;
+    struct AdpcmDecoder dec;
+    struct FatStream stream;
+    struct WavInfo info;
+    struct FatFile file;
+    uint32_t l, expected, got, n, first, pcm_bytes;
+    double audio_seconds, bus_seconds, ns;
+    struct timespec start, end;
+    char name[16];
+
+    TestCard_Format(&card, FAT_FS_FAT16, 200000, 8);
+    card.frag_percent = 20;
+    for(l = 0; l < NUM_LAYOUTS; ++l)
+    {
+        MakeSignal(signal, TRACK_FRAMES, layouts[l].channels);
+        sizes[l] = Encode(&layouts[l], signal, TRACK_FRAMES, data[l]);
+        snprintf(name, sizeof(name), "ADPCM%u.RAW", l);
+        TestCard_AddFile(&card, TESTCARD_ROOT, name, data[l], sizes[l], 0);
+    }
+
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat), "The card didn't open");
+
+    for(l = 0; l < NUM_LAYOUTS; ++l)
+    {
+        layout = &layouts[l];
+        SetInfo(&info, layout, sizes[l]);
+        snprintf(name, sizeof(name), "ADPCM%u  ", l);
+        if(!Adpcm_Supported(&info) || !Fat_open(&fat, &file, name, "RAW"))
+        {
+            CHECK(false, "Couldn't start %s", LayoutName(layout));
+            continue;
+        }
+
+        expected = ReferenceDecode(layout, data[l], sizes[l], reference);
+        CHECK(layout->truncated || Adpcm_CountFrames(&info) == expected, "%s counts %u frames, there are %u",
+                LayoutName(layout), Adpcm_CountFrames(&info), expected);
+
+        Adpcm_Init(&dec, &info);
+        Fat_OpenStream(&stream, &file, sizes[l]);
+        Pic32_ResetStats();
+        got = 0;
+        while((n = Adpcm_Read(&dec, &stream, &out[got * 2], 1 + (rand() % MAX_READ))) > 0)
+            got += n;
+
+        for(first = 0; first < got && first < expected && memcmp(&out[first * 2], &reference[first * 2], 4) == 0; ++first);
+        CHECK(got == expected && first == expected, "%s decoded %u frames of %u, differing from the reference at frame %u",
+                LayoutName(layout), got, expected, first);
+
+        // What it takes to stream, against 16 bit PCM of the same track
+        audio_seconds = (double)got / SAMPLE_RATE;
+        pcm_bytes = got * 2 * layout->channels;
+        bus_seconds = pic32_sd.bus_seconds;
+
+        Adpcm_Init(&dec, &info);
+        Fat_seek(&file, 0, FAT_SEEK_SET);
+        Fat_OpenStream(&stream, &file, sizes[l]);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while(Adpcm_Read(&dec, &stream, out, 128) > 0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+        printf("%-26s %6.0f bytes/s off the card (16 bit PCM %6.0f), %4.1fms of SPI a second, %5.1fns a frame on the host\n",
+                LayoutName(layout), sizes[l] / audio_seconds, pcm_bytes / audio_seconds,
+                bus_seconds / audio_seconds * 1e3, ns / got);
+    }
+}
+
+int main(void)
+{
+    srand(7);
+    Check_Boot("Golden", CheckGolden);
+    Check_Boot("Tracks", CheckTracks);
+    return Check_Result("test_adpcm");
+}
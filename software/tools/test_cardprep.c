@@ -0,0 +1,346 @@
+/*
+ * File:   test_cardprep.c
+ *
+ * Created on October 17, 2026
+ *
+ * Runs cardprep on a directory of WAV files in every format it converts,
+ * then boots the firmware's fat.c and library.c on the image it made and
+ * checks every track is where the manifest says, in one run, and holds the
+ * samples it should.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "fat.h"
+#include "library.h"
+#include "sd.h"
+
+#define MAX_TRACKS 8
+
+// A source file and what the player should find on the card for it
+struct Source {
+    const char * name;
+    uint16_t format;
+    uint16_t channels;
+    uint16_t bits;
+    uint32_t rate;
+    uint32_t frames;
+    bool extra_chunk;       // An odd sized chunk between fmt and data
+};
+
+static const struct Source sources[] = {
+    { "a_cd.wav", 1, 2, 16, 44100, 30000, false },
+    { "b_mono8.wav", 1, 1, 8, 22050, 10001, true },
+    { "c_studio.wav", 1, 2, 24, 48000, 20000, true },
+    { "d_float.wav", 3, 1, 32, 44100, 5000, false },
+    { "e_32bit.WAV", 1, 2, 32, 32000, 7777, false },
+};
+#define NUM_SOURCES (sizeof(sources) / sizeof(sources[0]))
+
+// One line of the manifest
+struct ManifestLine {
+    char name[16];
+    uint32_t start_sector, sectors, bytes, rate, extents;
+    double worst_us, deadline_us;
+};
+
+static char dir_path[64];
+
+static void Put16(uint8_t * p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void Put32(uint8_t * p, uint32_t value)
+{
+    Put16(p, value & 0xFFFF);
+    Put16(p + 2, value >> 16);
+}
+
+/**
+ * The test signal, full scale, different in each channel and track
+ */
+static double Signal(const struct Source * source, uint32_t frame, uint16_t channel)
+{
+    uint32_t x = (frame * 2654435761u) ^ ((channel + 1) * 40503u) ^ (uint32_t)source->rate;
+
+    x ^= x >> 15;
+    x *= 0x2C1B3C6D;
+    x ^= x >> 12;
+    return ((double)(x & 0xFFFF) - 32768.0) / 32768.0;
+}
+
+/**
+ * Writes one source sample and returns what the player should get for it
+ */
+static int16_t PutSample(uint8_t * p, const struct Source * source, uint32_t frame, uint16_t channel)
+{
+    double s = Signal(source, frame, channel);
+    int32_t v = (int32_t)(s * 2147483647.0);
+    float f = (float)(s * 1.25);    // Some of it out of range, to be clipped
+
+    if(source->format == 3)
+    {
+        memcpy(p, &f, sizeof(f));
+        if(f >= 1.0f)
+            return 32767;
+        if(f <= -1.0f)
+            return -32768;
+        return (int16_t)(f * 32767.0f);
+    }
+
+    switch(source->bits)
+    {
+        case 8: p[0] = (uint8_t)((v >> 24) + 128); break;
+        case 16: Put16(p, (uint16_t)(v >> 16)); break;
+        case 24: Put16(p, (uint16_t)(v >> 8)); p[2] = (uint8_t)(v >> 24); break;
+        default: Put32(p, (uint32_t)v); break;
+    }
+
+    return (int16_t)(v >> 16) & ((source->bits == 8) ? 0xFF00 : 0xFFFF);
+}
+
+/**
+ * Writes a source file, and the file the player should find for it
+ */
+static bool WriteSource(const struct Source * source, uint8_t ** expected, uint32_t * expected_size)
+{
+    uint32_t bytes = source->bits / 8, data_size = source->frames * source->channels * bytes;
+    uint8_t * data = malloc(data_size + 1);
+    uint8_t header[44], chunk[8 + 3];
+    int16_t left, right;
+    char path[128];
+    uint32_t f;
+    FILE * out;
+
+    *expected_size = 44 + (source->frames * 4);
+    *expected = malloc(*expected_size);
+
+    for(f = 0; f < source->frames; ++f)
+    {
+        left = PutSample(data + (f * source->channels * bytes), source, f, 0);
+        right = (source->channels > 1) ? PutSample(data + (f * source->channels * bytes) + bytes, source, f, 1) : left;
+        Put16(*expected + 44 + (f * 4), (uint16_t)left);
+        Put16(*expected + 46 + (f * 4), (uint16_t)right);
+    }
+
+    // The canonical header cardprep writes
+    memcpy(*expected, "RIFF", 4);
+    Put32(*expected + 4, *expected_size - 8);
+    memcpy(*expected + 8, "WAVEfmt ", 8);
+    Put32(*expected + 16, 16);
+    Put16(*expected + 20, 1);
+    Put16(*expected + 22, 2);
+    Put32(*expected + 24, source->rate);
+    Put32(*expected + 28, source->rate * 4);
+    Put16(*expected + 32, 4);
+    Put16(*expected + 34, 16);
+    memcpy(*expected + 36, "data", 4);
+    Put32(*expected + 40, source->frames * 4);
+
+    snprintf(path, sizeof(path), "%s/%s", dir_path, source->name);
+    if((out = fopen(path, "wb")) == NULL)
+    {
+        free(data);
+        return false;
+    }
+
+    memcpy(header, "RIFF", 4);
+    Put32(header + 4, 36 + data_size + (source->extra_chunk ? sizeof(chunk) + 1 : 0));
+    memcpy(header + 8, "WAVEfmt ", 8);
+    Put32(header + 16, 16);
+    Put16(header + 20, source->format);
+    Put16(header + 22, source->channels);
+    Put32(header + 24, source->rate);
+    Put32(header + 28, source->rate * source->channels * bytes);
+    Put16(header + 32, source->channels * bytes);
+    Put16(header + 34, source->bits);
+    fwrite(header, 1, 36, out);
+
+    if(source->extra_chunk)
+    {
+        memcpy(chunk, "LIST\x03\0\0\0abc", sizeof(chunk));
+        fwrite(chunk, 1, sizeof(chunk), out);
+        fputc(0, out);
+    }
+
+    memcpy(header + 36, "data", 4);
+    Put32(header + 40, data_size);
+    fwrite(header + 36, 1, 8, out);
+    fwrite(data, 1, data_size, out);
+
+    free(data);
+    return fclose(out) == 0;
+}
+
+/**
+ * Reads the manifest's track lines
+ */
+static uint32_t ReadManifest(const char * path, struct ManifestLine * lines, uint32_t max_lines)
+{
+    char text[512];
+    uint32_t num_lines = 0;
+    FILE * in = fopen(path, "r");
+
+    if(in == NULL)
+        return 0;
+
+    while(num_lines < max_lines && fgets(text, sizeof(text), in) != NULL)
+    {
+        if(text[0] == '#')
+            continue;
+
+        if(sscanf(text, "%15s %u %u %u %u %u %lf %lf", lines[num_lines].name, &lines[num_lines].start_sector,
+                &lines[num_lines].sectors, &lines[num_lines].bytes, &lines[num_lines].rate,
+                &lines[num_lines].extents, &lines[num_lines].worst_us, &lines[num_lines].deadline_us) == 8)
+            num_lines++;
+    }
+
+    fclose(in);
+    return num_lines;
+}
+
+/**
+ * Reads a whole track through the player's path and compares it
+ */
+static bool TrackMatches(struct FatFile * file, const uint8_t * expected, uint32_t size)
+{
+    static uint8_t buffer[4096];
+    uint32_t offset = 0, n;
+
+    while((n = Fat_read(file, buffer, sizeof(buffer))) > 0)
+    {
+        if(offset + n > size || memcmp(buffer, expected + offset, n) != 0)
+            return false;
+        offset += n;
+    }
+
+    return offset == size;
+}
+
+/**
+ * Makes an image with cardprep and plays it back
+ */
+static void CheckRoundTrip(void)
+{
+    static uint8_t * expected[NUM_SOURCES];
+    static uint32_t expected_size[NUM_SOURCES];
+    static FatCatalogEntry catalog[LIBRARY_MAX_FILES];
+    struct ManifestLine lines[MAX_TRACKS];
+    struct FatPartition fat;
+    struct LibraryIndex library;
+    struct FatFile file;
+    struct Fat16Entry entry;
+    struct stat info;
+    char command[512], image_path[128], manifest_path[128], path[128];
+    uint32_t num_lines, i;
+    uint16_t num_files = 0;
+    uint8_t * image;
+    FILE * junk;
+    int fd;
+
+    for(i = 0; i < NUM_SOURCES; ++i)
+        CHECK(WriteSource(&sources[i], &expected[i], &expected_size[i]), "Couldn't write %s", sources[i].name);
+
+    // Neither of these can be converted
+    snprintf(path, sizeof(path), "%s/f_junk.wav", dir_path);
+    if((junk = fopen(path, "wb")) != NULL)
+    {
+        fputs("not a RIFF file at all", junk);
+        fclose(junk);
+    }
+    snprintf(path, sizeof(path), "%s/notes.txt", dir_path);
+    if((junk = fopen(path, "wb")) != NULL)
+        fclose(junk);
+
+    snprintf(image_path, sizeof(image_path), "%s.img", dir_path);
+    snprintf(manifest_path, sizeof(manifest_path), "%s.txt", dir_path);
+    snprintf(command, sizeof(command), "./cardprep -m %s %s %s 2>/dev/null", manifest_path, image_path, dir_path);
+    CHECK(system(command) == 0, "cardprep failed");
+
+    num_lines = ReadManifest(manifest_path, lines, MAX_TRACKS);
+    CHECK(num_lines == NUM_SOURCES, "The manifest lists %u tracks, not %u", num_lines, (unsigned)NUM_SOURCES);
+
+    fd = open(image_path, O_RDWR);
+    if(fd < 0 || fstat(fd, &info) != 0)
+    {
+        CHECK(false, "No image");
+        return;
+    }
+    image = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(image == MAP_FAILED)
+    {
+        CHECK(false, "Couldn't map the image");
+        return;
+    }
+
+    // Boot the way the player does
+    Pic32_InsertCard(image, info.st_size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat) && fat.fs_type == FAT_FS_FAT32, "The image didn't open as FAT32");
+    CHECK(Library_Open(&library, &fat, LIBRARY_MAX_FILES) && Library_Load(&library, catalog, &num_files),
+            "The player would have to scan the card");
+    CHECK(num_files == NUM_SOURCES, "The index has %u tracks, not %u", num_files, (unsigned)NUM_SOURCES);
+
+    for(i = 0; i < num_files && i < num_lines; ++i)
+    {
+        Fat_ReadCatalogEntry(&fat, catalog[i], &entry);
+        CHECK(memcmp(entry.filename, lines[i].name, 8) == 0, "Track %u is %.8s on the card, %s in the manifest", i, entry.filename, lines[i].name);
+        Library_OpenTrack(&library, &file, catalog, i);
+        CHECK(file.num_extents == 1 && Fat_ClusterSector(&fat, file.starting_cluster) == lines[i].start_sector,
+                "%s isn't in one run at sector %u", lines[i].name, lines[i].start_sector);
+        CHECK(file.filesize == lines[i].bytes && lines[i].sectors == (lines[i].bytes + SECTOR_SIZE - 1) / SECTOR_SIZE,
+                "%s is %u bytes, the manifest says %u in %u sectors", lines[i].name, file.filesize, lines[i].bytes, lines[i].sectors);
+        CHECK(lines[i].start_sector % fat.boot32.num_sectors_per_cluster == 0, "%s doesn't start on a cluster boundary", lines[i].name);
+        CHECK(lines[i].worst_us < lines[i].deadline_us, "%s will underrun", lines[i].name);
+
+        Pic32_WatchSectors(fat.fat_start / SECTOR_SIZE, fat.data_start / SECTOR_SIZE - fat.fat_start / SECTOR_SIZE);
+        Pic32_ResetStats();
+        CHECK(TrackMatches(&file, expected[i], expected_size[i]), "%s (from %s) doesn't hold what it should", lines[i].name, sources[i].name);
+        // At most one multi-block read, none if the last track ended where this one starts
+        CHECK(pic32_sd.watched_reads == 0 && pic32_sd.commands[18] <= 1,
+                "Playing %s read %llu FAT sectors with %u CMD18s", lines[i].name, (unsigned long long)pic32_sd.watched_reads, pic32_sd.commands[18]);
+    }
+
+    munmap(image, info.st_size);
+    unlink(image_path);
+    unlink(manifest_path);
+}
+
+int main(void)
+{
+    char path[128];
+    uint32_t i;
+
+    snprintf(dir_path, sizeof(dir_path), "/tmp/test_cardprep.XXXXXX");
+    if(mkdtemp(dir_path) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    Check_Boot("Round trip", CheckRoundTrip);
+
+    for(i = 0; i < NUM_SOURCES; ++i)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir_path, sources[i].name);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/f_junk.wav", dir_path);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/notes.txt", dir_path);
+    unlink(path);
+    rmdir(dir_path);
+
+    return Check_Result("test_cardprep");
+}
@@ -0,0 +1,491 @@
+/*
+ * File:   test_crossfade.c
+ *
+ * Created on October 17, 2026
+ *
+ * Checks the crossfade. The curve (crossfade.c) has to hold its power level
+ * to within a rounding error of a true sin/cos fade, however the fade is
+ * split into reads. Then main.c, built with CROSSFADE_MS set, plays a card
+ * on the simulated PIC32 through fades between every codec, two ADPCM
+ * tracks (IMA into MS) reading the card and the shared code buffer in
+ * turns among them. What SPI1 sends has to be each track as it decodes on
+ * its own, mixed over exactly the fade and nowhere else, without the ring
+ * running dry. Decoding is charged to the clock (decode_cost.h), and the
+ * longest refill and the CPU load are reported for the fades against
+ * playing a track on its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "testcard.h"
+#include "player.h"
+#include "decode_cost.h"
+
+// The player, with a fade, its main() out of the way, and its pause() out of unistd.h's
+#define CROSSFADE_MS 100
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#define main Firmware_Main
+#define pause Firmware_Pause
+#include "main.c"
+#undef main
+#undef pause
+#pragma GCC diagnostic pop
+
+#define SAMPLE_RATE 44100
+#define FADE_FRAMES ((CROSSFADE_MS * SAMPLE_RATE) / 1000)
+#define MAX_TRACK_FRAMES 16384
+#define MAX_FILE_SIZE (64 * 1024)
+#define CAPTURE_FRAMES (256 * 1024)
+
+// Frames of the first track checked when it comes round again
+#define WRAP_FRAMES 2000
+
+// A track on the card, in catalog order
+struct PlaylistTrack {
+    const char * name;          // 8.3, as it's put on the card
+    const char * fixture;       // Where it comes from, or NULL to make a 16 bit WAV
+    bool fades;                 // Into the next one, rather than joining it
+};
+
+static const struct PlaylistTrack playlist[] = {
+    { "A.WAV", "adpcm/ima.wav", true },
+    { "B.WAV", "adpcm/ms.wav", true },
+    { "C.QOA", "qoa/qs44.qoa", true },
+    { "D.FLA", "flac/lf5s44.fla", false },    // FLAC into FLAC has only the one decoder
+    { "E.FLA", "flac/ffmid.fla", true },
+    { "F.WAV", NULL, true },
+};
+#define NUM_TRACKS (sizeof(playlist) / sizeof(playlist[0]))
+#define NUM_FADES 5
+
+static struct TestCard card;
+static uint8_t files[NUM_TRACKS][MAX_FILE_SIZE];
+static uint32_t file_sizes[NUM_TRACKS];
+static int16_t alone[NUM_TRACKS][MAX_TRACK_FRAMES * 2];
+static uint32_t alone_frames[NUM_TRACKS];
+static int16_t expected[(NUM_TRACKS * MAX_TRACK_FRAMES + WRAP_FRAMES) * 2];
+static int16_t capture[CAPTURE_FRAMES * 2];
+
+// Where each part of what's expected starts, to say where it went wrong
+static uint32_t part_starts[NUM_TRACKS * 2 + 1];
+static char part_names[NUM_TRACKS * 2 + 1][24];
+static uint32_t num_parts;
+
+static void Put16(uint8_t * p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void Put32(uint8_t * p, uint32_t v)
+{
+    Put16(p, v & 0xFFFF);
+    Put16(p + 2, v >> 16);
+}
+
+/**
+ * Makes a 16 bit stereo WAV of two tones
+ *
+ * @return Its size
+ */
+static uint32_t MakeWav(uint8_t * wav, uint32_t frames)
+{
+    uint32_t data_size = frames * 4, i;
+
+    memcpy(wav, "RIFF", 4);
+    Put32(wav + 4, 36 + data_size);
+    memcpy(wav + 8, "WAVEfmt ", 8);
+    Put32(wav + 16, 16);
+    Put16(wav + 20, WAV_FORMAT_PCM);
+    Put16(wav + 22, 2);
+    Put32(wav + 24, SAMPLE_RATE);
+    Put32(wav + 28, SAMPLE_RATE * 4);
+    Put16(wav + 32, 4);
+    Put16(wav + 34, 16);
+    memcpy(wav + 36, "data", 4);
+    Put32(wav + 40, data_size);
+
+    for(i = 0; i < frames; i++)
+    {
+        Put16(wav + 44 + (i * 4), (int16_t)(12000 * sin(i * 0.0627)));
+        Put16(wav + 46 + (i * 4), (int16_t)(9000 * sin(i * 0.0412)));
+    }
+
+    return 44 + data_size;
+}
+
+static bool LoadFixture(const char * path, uint8_t * data, uint32_t * size)
+{
+    FILE * in = fopen(path, "rb");
+
+    if(in == NULL)
+        return false;
+    *size = fread(data, 1, MAX_FILE_SIZE, in);
+    fclose(in);
+
+    return *size > 0 && *size < MAX_FILE_SIZE;
+}
+
+/**
+ * Decodes a track on its own, straight through its decoder
+ *
+ * @param frames Set to how many frames its header gives
+ *
+ * @return Its frames, 0 if it can't be played
+ */
+static uint32_t DecodeAlone(const char * name, int16_t * out, uint32_t * frames)
+{
+    static struct FlacDecoder flac_dec;
+    struct AdpcmDecoder adpcm_dec;
+    struct QoaDecoder qoa_dec;
+    struct PcmConverter pcm_conv;
+    struct FatStream stream;
+    struct WavInfo info;
+    struct FatFile file;
+    char padded[9], ext[4];
+    const char * dot = strchr(name, '.');
+    uint32_t got = 0, n = 1;
+
+    snprintf(padded, sizeof(padded), "%-8.*s", (int)(dot - name), name);
+    snprintf(ext, sizeof(ext), "%s", dot + 1);
+    *frames = 0;
+    if(!Fat_open(&fat, &file, padded, ext))
+        return 0;
+
+    if(Wav_ReadInfo(&file, &info) && Pcm_SelectConverter(&pcm_conv, &info))
+    {
+        Fat_OpenStream(&stream, &file, info.data_size);
+        while(got < MAX_TRACK_FRAMES && (n = Pcm_Read(&pcm_conv, &stream, &out[got * 2], 100)) > 0)
+            got += n;
+    }
+    else if(Adpcm_Supported(&info))
+    {
+        info.frames = Adpcm_CountFrames(&info);
+        Adpcm_Init(&adpcm_dec, &info);
+        Fat_OpenStream(&stream, &file, info.data_size);
+        while(got < MAX_TRACK_FRAMES && (n = Adpcm_Read(&adpcm_dec, &stream, &out[got * 2], 100)) > 0)
+            got += n;
+    }
+    else if(Flac_ReadInfo(&file, &info))
+    {
+        Flac_Init(&flac_dec, &info);
+        Fat_OpenStream(&stream, &file, info.data_size);
+        while(got < MAX_TRACK_FRAMES && (n = Flac_Read(&flac_dec, &stream, &out[got * 2], 100)) > 0)
+            got += n;
+    }
+    else if(Qoa_ReadInfo(&file, &info))
+    {
+        Qoa_Init(&qoa_dec, &info);
+        Fat_OpenStream(&stream, &file, info.data_size);
+        while(got < MAX_TRACK_FRAMES && (n = Qoa_Read(&qoa_dec, &stream, &out[got * 2], 100)) > 0)
+            got += n;
+    }
+
+    *frames = info.frames;
+    return got;
+}
+
+static uint32_t AddPart(uint32_t pos, const char * what, const char * name)
+{
+    part_starts[num_parts] = pos;
+    snprintf(part_names[num_parts], sizeof(part_names[0]), "%s%s", what, name);
+    num_parts++;
+
+    return pos;
+}
+
+/**
+ * Lays out what should come out: each track, with the fade over the end
+ * of it mixed the same way from the two tracks decoded on their own, and
+ * then the start of the first track again
+ *
+ * @return How many frames
+ */
+static uint32_t Expect(void)
+{
+    struct Crossfade fade;
+    uint32_t t, next, from, to, pos = 0;
+
+    for(t = 0; t < NUM_TRACKS; t++)
+    {
+        from = (t > 0 && playlist[t - 1].fades) ? FADE_FRAMES : 0;
+        to = alone_frames[t] - (playlist[t].fades ? FADE_FRAMES : 0);
+        AddPart(pos, "", playlist[t].name);
+        memcpy(&expected[pos * 2], &alone[t][from * 2], (to - from) * 4);
+        pos += to - from;
+
+        if(playlist[t].fades)
+        {
+            next = (t + 1) % NUM_TRACKS;
+            AddPart(pos, "fade out of ", playlist[t].name);
+            memcpy(&expected[pos * 2], &alone[t][to * 2], FADE_FRAMES * 4);
+            Crossfade_Start(&fade, FADE_FRAMES);
+            Crossfade_Mix(&fade, &expected[pos * 2], alone[next], FADE_FRAMES);
+            pos += FADE_FRAMES;
+        }
+    }
+
+    AddPart(pos, "again ", playlist[0].name);
+    memcpy(&expected[pos * 2], &alone[0][FADE_FRAMES * 2], WRAP_FRAMES * 4);
+    pos += WRAP_FRAMES;
+    AddPart(pos, "", "");
+
+    return pos;
+}
+
+/**
+ * Reads a fade's gains back out of Crossfade_Mix, a full scale negative
+ * sample times each gain being exactly minus the gain
+ */
+static void Gains(uint32_t length, int32_t * gain_out, int32_t * gain_in, bool split)
+{
+    static int16_t out[8192 * 2], in[8192 * 2];
+    struct Crossfade fade;
+    uint32_t i, n, done;
+    int pass;
+
+    for(pass = 0; pass < 2; pass++)
+    {
+        for(i = 0; i < length * 2; i++)
+        {
+            out[i] = (pass == 0) ? -32768 : 0;
+            in[i] = (pass == 0) ? 0 : -32768;
+        }
+
+        Crossfade_Start(&fade, length);
+        for(done = 0; done < length; done += n)
+        {
+            n = split ? 1 + ((uint32_t)rand() % 300) : length;
+            n = (n > length - done) ? length - done : n;
+            Crossfade_Mix(&fade, &out[done * 2], &in[done * 2], n);
+        }
+
+        for(i = 0; i < length; i++)
+        {
+            if(pass == 0)
+                gain_out[i] = -out[i * 2];
+            else
+                gain_in[i] = -out[i * 2];
+        }
+    }
+}
+
+/**
+ * The gains follow sin and cos of a quarter turn, keep the power level,
+ * only ever go one way, and don't care how the fade is split up
+ */
+static void CheckCurve(void)
+{
+    static const uint32_t lengths[] = { 1, 2, 7, 64, 441, FADE_FRAMES, 8192 };
+    static int32_t gain_out[8192], gain_in[8192], split_out[8192], split_in[8192];
+    static int16_t loud[64 * 2], also_loud[64 * 2];
+    struct Crossfade fade;
+    double angle, error, worst_error = 0, power, low_power = 2, high_power = 0;
+    uint32_t l, i, length, wrong, backwards;
+
+    for(l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+    {
+        length = lengths[l];
+        Gains(length, gain_out, gain_in, false);
+        Gains(length, split_out, split_in, true);
+
+        CHECK(gain_out[0] == 32767 && gain_in[0] == 0, "A %u frame fade starts at %d out and %d in", length, gain_out[0], gain_in[0]);
+
+        for(i = 0, wrong = 0, backwards = 0; i < length; i++)
+        {
+            angle = M_PI / 2 * i / length;
+            error = fmax(fabs(gain_in[i] - 32767 * sin(angle)), fabs(gain_out[i] - 32767 * cos(angle)));
+            worst_error = fmax(worst_error, error);
+            wrong += (error > 4);
+
+            power = ((double)gain_in[i] * gain_in[i] + (double)gain_out[i] * gain_out[i]) / (32767.0 * 32767.0);
+            low_power = fmin(low_power, power);
+            high_power = fmax(high_power, power);
+
+            if(i > 0)
+                backwards += (gain_in[i] < gain_in[i - 1]) || (gain_out[i] > gain_out[i - 1]);
+        }
+        CHECK(wrong == 0, "%u gains of a %u frame fade are more than 4 off sin and cos", wrong, length);
+        CHECK(backwards == 0, "%u gains of a %u frame fade go backwards", backwards, length);
+        CHECK(memcmp(gain_out, split_out, length * sizeof(gain_out[0])) == 0 && memcmp(gain_in, split_in, length * sizeof(gain_in[0])) == 0,
+                "A %u frame fade comes out differently mixed in pieces", length);
+
+        // And it ends where the curve does, with nothing more mixed past it
+        Crossfade_Start(&fade, length);
+        for(i = 0; i <= length; i += 64)
+            Crossfade_Mix(&fade, loud, also_loud, 64);
+        CHECK(fade.done == length && fade.pos == CROSSFADE_POS_END, "A %u frame fade ended %u frames and %u steps in",
+                length, fade.done, fade.pos);
+    }
+    CHECK(low_power > 0.999 && high_power < 1.001, "The power goes from %.5f to %.5f of full", low_power, high_power);
+
+    // Two full scale tracks in step add up to 1.41 in the middle, and clip rather than wrap
+    for(i = 0; i < 64 * 2; i++)
+        loud[i] = also_loud[i] = (i & 2) ? 32767 : -32768;
+    Crossfade_Start(&fade, 128);
+    Crossfade_Mix(&fade, loud, also_loud, 32);
+    Crossfade_Mix(&fade, loud, also_loud, 64);
+    for(i = 0, wrong = 0; i < 64 * 2; i++)
+        wrong += (i & 2) ? (loud[i] != 32767) : (loud[i] != -32768);
+    CHECK(wrong == 0, "%u samples of full scale tracks in step didn't clip", wrong);
+
+    printf("Gains within %.2f of sin and cos, power from %.5f to %.5f of full\n", worst_error, low_power, high_power);
+}
+
+/**
+ * Where to look for the first track, from the start of what was sent
+ */
+static uint32_t FindStart(void)
+{
+    uint32_t i;
+
+    for(i = 0; i + 64 <= pic32_i2s.num_frames && i + 64 <= CAPTURE_FRAMES; i++)
+    {
+        if(memcmp(&capture[i * 2], expected, 64 * 4) == 0)
+            return i;
+    }
+
+    return UINT32_MAX;
+}
+
+// What the loop cost while it was fading, and while it wasn't
+struct Window {
+    uint32_t passes;
+    uint32_t blocks;            // Filled
+    double busy_seconds;
+    double bus_seconds;         // Of it, on SPI2 to the card
+    double decode_seconds;      // Of it, decoding and mixing
+    double worst_fill;
+    uint8_t lowest_ring;        // Blocks left in the ring as a block went out
+};
+
+static struct Window windows[2];
+
+// dma.c's, which the simulated DMA calls
+void DmaCh0Int(void);
+
+/**
+ * The DMA interrupt, watching how low the ring gets as each block goes out
+ */
+static void WatchRing(void)
+{
+    struct Window * window = &windows[fading];
+
+    DmaCh0Int();
+    if(AUDIO_RING_FILLED() < window->lowest_ring && player_stats.passes > 1)
+        window->lowest_ring = AUDIO_RING_FILLED();
+}
+
+static void PrintWindow(const char * what, const struct Window * window)
+{
+    double audio_seconds = (double)window->blocks * AUDIO_BLOCK_FRAMES / SAMPLE_RATE;
+
+    printf("%-24s longest refill %5.2fms (a block is %.2fms), ring down to %u of %u blocks, "
+            "CPU %4.1f%% busy (%4.1f%% SD, %4.1f%% decoding and mixing)\n", what, window->worst_fill * 1e3,
+            AUDIO_BLOCK_FRAMES * 1e3 / SAMPLE_RATE, window->lowest_ring, AUDIO_RING_BLOCKS,
+            window->busy_seconds / audio_seconds * 100, window->bus_seconds / audio_seconds * 100,
+            window->decode_seconds / audio_seconds * 100);
+}
+
+/**
+ * Every track fades into the next exactly over its last CROSSFADE_MS, other
+ * than FLAC into FLAC, which joins, and the ring never runs dry doing it
+ */
+static void CheckFades(void)
+{
+    struct Window * window;
+    uint32_t t, header_frames, faded, frames, start, i, part, fades = 0;
+    uint8_t head;
+    double busy, bus, decoded;
+    bool was_fading;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 65536, 4);
+    card.frag_percent = 20;
+    for(t = 0; t < NUM_TRACKS; t++)
+    {
+        if(playlist[t].fixture != NULL)
+            CHECK(LoadFixture(playlist[t].fixture, files[t], &file_sizes[t]), "Couldn't load %s", playlist[t].fixture);
+        else
+            file_sizes[t] = MakeWav(files[t], 10001);
+        TestCard_AddFile(&card, TESTCARD_ROOT, playlist[t].name, files[t], file_sizes[t], 0);
+    }
+
+    // What each track is on its own, which has to be what its header says for the fade to land right
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat), "The card didn't open");
+    for(t = 0; t < NUM_TRACKS; t++)
+    {
+        alone_frames[t] = DecodeAlone(playlist[t].name, alone[t], &header_frames);
+        faded = FADE_FRAMES * (playlist[(t + NUM_TRACKS - 1) % NUM_TRACKS].fades + playlist[t].fades);
+        CHECK(alone_frames[t] > faded && alone_frames[t] == header_frames, "%s decodes to %u frames on its own, %u by its header",
+                playlist[t].name, alone_frames[t], header_frames);
+        if(alone_frames[t] <= faded)
+            return;
+    }
+    frames = Expect();
+
+    // Played through, a pass at a time so the fades can be told apart
+    Player_Boot(card.image, card.size, capture, CAPTURE_FRAMES);
+    Pic32_AttachDmaInterrupt(WatchRing);
+    windows[0].lowest_ring = windows[1].lowest_ring = AUDIO_RING_BLOCKS;
+    while(pic32_i2s.num_frames < frames + 2048)
+    {
+        was_fading = fading;
+        head = audio_ring.head;
+        busy = player_stats.busy_seconds;
+        bus = pic32_sd.bus_seconds;
+        decoded = decode_seconds;
+        player_stats.worst_fill = 0;
+
+        Player_Pass();
+
+        // Fades started within what's checked, which the decoder is up to a ring ahead of
+        fades += !was_fading && fading && pic32_i2s.num_frames + (AUDIO_RING_BLOCKS * AUDIO_BLOCK_FRAMES) < frames;
+        window = &windows[was_fading || fading];
+        window->passes++;
+        window->blocks += (uint8_t)(audio_ring.head - head);
+        window->busy_seconds += player_stats.busy_seconds - busy;
+        window->bus_seconds += pic32_sd.bus_seconds - bus;
+        window->decode_seconds += decode_seconds - decoded;
+        window->worst_fill = fmax(window->worst_fill, player_stats.worst_fill);
+    }
+
+    start = FindStart();
+    CHECK(start != UINT32_MAX, "%s never started", playlist[0].name);
+    if(start == UINT32_MAX)
+        return;
+
+    for(i = 0; i < frames && start + i < CAPTURE_FRAMES; i++)
+    {
+        if(capture[(start + i) * 2] != expected[i * 2] || capture[(start + i) * 2 + 1] != expected[i * 2 + 1])
+            break;
+    }
+    for(part = 0; part + 1 < num_parts && part_starts[part + 1] <= i; part++) { }
+    CHECK(i == frames, "What was sent goes wrong %u frames into %s", i - part_starts[part], part_names[part]);
+
+    CHECK(fades == NUM_FADES, "%u fades, not %u", fades, NUM_FADES);
+    CHECK(player_stats.songs_ended == 0 && player_stats.stray_dac_writes == 0, "The ring was drained %u times and the DAC written %u times",
+            player_stats.songs_ended, player_stats.stray_dac_writes);
+    CHECK(audio_ring.underruns == 0 && pic32_i2s.late_frames == 0, "%u underruns and %u late frames", audio_ring.underruns, pic32_i2s.late_frames);
+
+    printf("%u frames from frame %u, %u fades of %u frames\n", frames, start, fades, FADE_FRAMES);
+    PrintWindow("Fading:", &windows[1]);
+    PrintWindow("Playing one track:", &windows[0]);
+}
+
+int main(void)
+{
+    srand(24);
+    Check_Boot("Curve", CheckCurve);
+    Check_Boot("Fades", CheckFades);
+    return Check_Result("test_crossfade");
+}
@@ -0,0 +1,218 @@
+/*
+ * File:   test_dac.c
+ *
+ * Created on October 17, 2026
+ *
+ * Runs the firmware's dac.c and i2c.c against the simulated REFCLKO, SPI1
+ * and DAC, and checks every clock plan from the registers they end up in:
+ * what LRCLK SPI1 sends at, how far that is off the rate it's meant to be,
+ * and that the DAC's own sample rate setting agrees with it. Also checks a
+ * rate change only mutes the DAC around the reprogramming.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <xc.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "dac.h"
+#include "i2c.h"
+
+// How far off a rate LRCLK is allowed to be
+#define MAX_PPM 150.0
+
+// Rates tracks come in, supported or not
+static const uint32_t rates[] = {
+    8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100,
+    48000, 64000, 88200, 96000, 176400, 192000,
+};
+
+/**
+ * The DAC's sample rate in normal mode, from its MCLK and its sample rate
+ * control register (the TLV320AIC23B datasheet's table, just the settings
+ * where the ADC and DAC run at the same rate)
+ *
+ * @return The rate in Hz, 0 for a setting that isn't in the table
+ */
+static double DacSampleRate(double mclk, uint16_t rate_bits)
+{
+    double divisor;
+
+    if(rate_bits & 0x40)        // CLKIN, MCLK halved
+        mclk /= 2;
+
+    switch((rate_bits >> 2) & 0xF)
+    {
+        case 0x0: divisor = 256; break;
+        case 0x3: divisor = 1536; break;
+        case 0x6: divisor = 384; break;
+        case 0x7: divisor = 128; break;
+        case 0x8: divisor = 256; break;
+        case 0xB: divisor = 1408; break;
+        case 0xF: divisor = 128; break;
+        default: return 0;
+    }
+
+    if(rate_bits & 0x2)         // BOSR, the 384fs clocks
+        divisor *= 1.5;
+
+    return mclk / divisor;
+}
+
+/**
+ * The de-emphasis the DAC should have on at a rate
+ */
+static unsigned Deemphasis(uint32_t sample_rate)
+{
+    switch(sample_rate)
+    {
+        case 32000: return DAC_DEEMPHASIS_32K;
+        case 44100: return DAC_DEEMPHASIS_44K1;
+        case 48000: return DAC_DEEMPHASIS_48K;
+        default: return DAC_DEEMPHASIS_NONE;
+    }
+}
+
+/**
+ * InitDAC starts SPI1 as an I2S master at 44.1KHz with the DAC set up to
+ * match
+ */
+static void CheckInit(void)
+{
+    InitDAC();
+
+    CHECK(fabs(Pic32_LrclkHz() - DAC_DEFAULT_SAMPLE_RATE) < 1e-6, "LRCLK is %.3fHz after InitDAC", Pic32_LrclkHz());
+    CHECK(SPI1CONbits.ON && SPI1CONbits.MSTEN && SPI1CONbits.CKP && SPI1CON2bits.AUDEN && SPI1CON2bits.AUDMOD == 0,
+            "SPI1 isn't an I2S master after InitDAC");
+    CHECK(pic32_dac.regs[Sample_Rate_Control] == DAC_FindClockPlan(DAC_DEFAULT_SAMPLE_RATE)->rate_bits,
+            "The DAC's sample rate control is 0x%03x", pic32_dac.regs[Sample_Rate_Control]);
+    CHECK(pic32_dac.regs[Digital_Interface_Format] == 0x02, "The DAC isn't a 16 bit I2S slave");
+    CHECK(pic32_dac.regs[Digital_Interface_Activation] == 1, "The DAC's digital interface is off");
+    CHECK(!(pic32_dac.regs[Digital_Path_Control] & (1 << 3)), "The DAC is muted after InitDAC");
+    CHECK(pic32_dac.errors == 0, "%u bad DAC transfers or REFCLKO switches", pic32_dac.errors);
+}
+
+/**
+ * Every plan's LRCLK is within MAX_PPM of its rate (exact for the 44.1KHz
+ * family) and the DAC is set for the same rate from the same MCLK. Rates
+ * without a plan change nothing.
+ */
+static void CheckClockPlans(void)
+{
+    const struct DacClockPlan * plan;
+    uint32_t writes;
+    double lrclk, dac_rate, ppm, before;
+    unsigned i, num_plans = 0;
+
+    InitDAC();
+
+    printf("  fs      REFCLKO        LRCLK          error     DAC fs\n");
+    for(i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    {
+        plan = DAC_FindClockPlan(rates[i]);
+        if(plan == NULL)
+        {
+            writes = pic32_dac.num_writes;
+            before = Pic32_LrclkHz();
+            CHECK(!DAC_SetSampleRate(rates[i]), "Switched to %u, which has no plan", rates[i]);
+            CHECK(pic32_dac.num_writes == writes && Pic32_LrclkHz() == before, "Trying %u changed the clocks", rates[i]);
+            printf("%6u  no plan\n", rates[i]);
+            continue;
+        }
+
+        num_plans++;
+        CHECK(plan->sample_rate == rates[i], "Looking up %u found the plan for %u", rates[i], plan->sample_rate);
+        CHECK(DAC_SetSampleRate(rates[i]), "Couldn't switch to %u", rates[i]);
+
+        lrclk = Pic32_LrclkHz();
+        dac_rate = DacSampleRate(Pic32_RefClockHz(), pic32_dac.regs[Sample_Rate_Control]);
+        ppm = (lrclk / rates[i] - 1) * 1e6;
+        printf("%6u  %9.0fHz  %12.3fHz  %+7.1fppm  %12.3fHz\n", rates[i], Pic32_RefClockHz(), lrclk, ppm, dac_rate);
+
+        CHECK(fabs(ppm) < MAX_PPM, "LRCLK for %u is %+.1fppm off", rates[i], ppm);
+        CHECK(plan->refo_source != DAC_REFO_POSC || fabs(ppm) < 0.01, "LRCLK for %u is %+.3fppm off the crystal", rates[i], ppm);
+        CHECK(fabs(dac_rate / lrclk - 1) < 1e-9, "The DAC runs at %.3fHz for %u, LRCLK is %.3fHz", dac_rate, rates[i], lrclk);
+        CHECK(((pic32_dac.regs[Digital_Path_Control] >> 1) & 3) == Deemphasis(rates[i]),
+                "De-emphasis is %u at %u", (pic32_dac.regs[Digital_Path_Control] >> 1) & 3, rates[i]);
+    }
+
+    CHECK(num_plans == 9, "There are plans for %u of the rates", num_plans);
+    CHECK(pic32_dac.errors == 0, "%u bad DAC transfers or REFCLKO switches", pic32_dac.errors);
+}
+
+/**
+ * Switching rates mutes the DAC and stops its interface before the clocks
+ * change, and puts both back after, muted or not as they were. Switching to
+ * the rate it's already at writes nothing.
+ */
+static void CheckSwitch(void)
+{
+    const struct Pic32DacWrite * log = pic32_dac.log;
+    uint32_t i, num_writes;
+    double bus_seconds;
+
+    InitDAC();
+    pic32_dac.num_writes = 0;
+    DAC_SetSampleRate(48000);
+    num_writes = pic32_dac.num_writes;
+
+    CHECK(num_writes >= 5, "A rate change took %u DAC writes", num_writes);
+    if(num_writes < 5)
+        return;
+    CHECK(log[0].reg == Digital_Path_Control && (log[0].value & (1 << 3)) && log[0].lrclk_hz == 44100,
+            "The DAC wasn't muted first");
+    CHECK(log[1].reg == Digital_Interface_Activation && log[1].value == 0 && log[1].lrclk_hz == 44100,
+            "The DAC's interface wasn't stopped before the clocks changed");
+    for(i = 2; i < num_writes; i++)
+        CHECK(fabs(log[i].lrclk_hz / 48000 - 1) < MAX_PPM * 1e-6, "DAC write %u was made with LRCLK at %.1fHz", i, log[i].lrclk_hz);
+    CHECK(log[num_writes - 2].reg == Digital_Interface_Activation && log[num_writes - 2].value == 1,
+            "The DAC's interface wasn't started again");
+    CHECK(log[num_writes - 1].reg == Digital_Path_Control && !(log[num_writes - 1].value & (1 << 3)),
+            "The DAC was left muted");
+
+    // Address, register and data bytes, each with an ack, and a start and stop, at 400KHz
+    bus_seconds = num_writes * (3 * 9 + 2) / (double)I2C_Clock;
+    printf("A rate change is %u DAC writes, %.0fus of I2C\n", num_writes, bus_seconds * 1e6);
+
+    pic32_dac.num_writes = 0;
+    CHECK(DAC_SetSampleRate(48000) && pic32_dac.num_writes == 0, "Staying at 48KHz took %u DAC writes", pic32_dac.num_writes);
+
+    DAC_DigitalControl(true);
+    DAC_SetSampleRate(22050);
+    CHECK(pic32_dac.regs[Digital_Path_Control] & (1 << 3), "A rate change unmuted the DAC");
+    CHECK(pic32_dac.errors == 0, "%u bad DAC transfers or REFCLKO switches", pic32_dac.errors);
+}
+
+/**
+ * Tracks without a plan are resampled up to the next rate there is, or
+ * down to the highest
+ */
+static void CheckClosestRate(void)
+{
+    static const uint32_t cases[][2] = {
+        { 1, 8000 }, { 8000, 8000 }, { 11025, 16000 }, { 12000, 16000 },
+        { 44100, 44100 }, { 44101, 48000 }, { 64000, 88200 }, { 96000, 96000 },
+        { 176400, 96000 }, { 192000, 96000 },
+    };
+    unsigned i;
+
+    for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        CHECK(DAC_ClosestSampleRate(cases[i][0]) == cases[i][1], "The closest rate to %u is %u, not %u",
+                cases[i][0], DAC_ClosestSampleRate(cases[i][0]), cases[i][1]);
+        CHECK(DAC_FindClockPlan(DAC_ClosestSampleRate(cases[i][0])) != NULL, "There's no plan for the closest rate to %u", cases[i][0]);
+    }
+}
+
+int main(void)
+{
+    Check_Boot("InitDAC", CheckInit);
+    Check_Boot("Clock plans", CheckClockPlans);
+    Check_Boot("Rate switch", CheckSwitch);
+    Check_Boot("Closest rate", CheckClosestRate);
+    return Check_Result("test_dac");
+}
@@ -0,0 +1,811 @@
+/*
+ * File:   test_fat.c
+ *
+ * Created on October 17, 2026
+ *
+ * Runs the firmware's fat.c and sd.c against cards built by testcard.c on
+ * the simulated SD card, and checks what they read and what it costs. Each
+ * card gets a boot of its own (see Check_Boot).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "testcard.h"
+#include "fat.h"
+#include "library.h"
+#include "sd.h"
+
+// Most of a file read at a time, like the player's refills
+#define READ_SIZE 4096
+
+static struct TestCard card;
+static struct FatPartition fat;
+
+// fat.c's reads of file data, counted on their way to sd.c (test_fat is
+// linked with --wrap=SD_ReadData)
+static uint32_t read_data_calls;
+
+void __real_SD_ReadData(void * buffer, uint64_t start_byte, size_t size);
+
+void __wrap_SD_ReadData(void * buffer, uint64_t start_byte, size_t size)
+{
+    if(start_byte >= (uint64_t)card.data_sector * SECTOR_SIZE)
+        read_data_calls++;
+    __real_SD_ReadData(buffer, start_byte, size);
+}
+
+/**
+ * Puts the card in, starts it up and opens the partition like main does at boot
+ */
+static bool Mount(void)
+{
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+
+    CHECK(OpenFirstFatPartition(&fat), "The partition didn't open");
+    CHECK(fat.fs_type == card.fs_type, "A type %d card opened as type %d", card.fs_type, fat.fs_type);
+    return fat.fs_type == card.fs_type;
+}
+
+/**
+ * Reads a whole file and checks it matches what was put on the card
+ */
+static bool ReadMatches(struct FatFile * file, const uint8_t * expected, uint32_t size)
+{
+    static uint8_t buffer[READ_SIZE];
+    uint32_t offset = 0, n;
+
+    while((n = Fat_read(file, buffer, READ_SIZE)) > 0)
+    {
+        if(offset + n > size || memcmp(buffer, expected + offset, n) != 0)
+            return false;
+        offset += n;
+    }
+
+    return offset == size;
+}
+
+/**
+ * Splits a chain on the card into runs of contiguous clusters
+ *
+ * @param cluster The first cluster of the chain
+ * @param runs Where to put the first max_runs runs
+ * @param max_runs How many runs there's room for
+ *
+ * @return How many runs there are in all
+ */
+static uint32_t CountRuns(uint32_t cluster, struct FatExtent * runs, uint32_t max_runs)
+{
+    uint32_t end_of_chain = (card.fs_type == FAT_FS_FAT16) ? 0xFFF8 : FAT_END_OF_CHAIN;
+    uint32_t num_runs = 0, prev = 0;
+
+    while(cluster >= 2 && cluster < end_of_chain)
+    {
+        if(num_runs == 0 || cluster != prev + 1)
+        {
+            if(num_runs < max_runs)
+            {
+                runs[num_runs].start_cluster = cluster;
+                runs[num_runs].num_clusters = 0;
+            }
+            num_runs++;
+        }
+        if(num_runs <= max_runs)
+            runs[num_runs - 1].num_clusters++;
+
+        prev = cluster;
+        cluster = TestCard_FatEntry(&card, cluster);
+    }
+
+    return num_runs;
+}
+
+/**
+ * Opening a file maps its clusters into extents, and reading it goes a
+ * whole run at a time without looking at the FAT again
+ */
+static void CheckExtentMap(void)
+{
+    static uint8_t contig[200 * 1024], frag[60 * 1024], shredded[120 * 1024];
+    struct FatExtent runs[FAT_MAX_EXTENTS];
+    struct FatFile file;
+    uint32_t num_runs, i;
+    bool map_matches;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 32768, 4);
+    TestCard_Fill(contig, sizeof(contig), 1);
+    TestCard_Fill(frag, sizeof(frag), 2);
+    TestCard_Fill(shredded, sizeof(shredded), 3);
+    TestCard_AddFile(&card, TESTCARD_ROOT, "CONTIG.WAV", contig, sizeof(contig), 0);
+    card.frag_percent = 10;
+    TestCard_AddFile(&card, TESTCARD_ROOT, "FRAG.WAV", frag, sizeof(frag), 0);
+    card.frag_percent = 50;
+    TestCard_AddFile(&card, TESTCARD_ROOT, "SHREDDED.WAV", shredded, sizeof(shredded), 0);
+
+    if(!Mount())
+        return;
+    Pic32_WatchSectors(card.fat_sector, card.fat_sectors * card.num_fats);
+
+    // One run, one CMD18 and no FAT
+    CHECK(Fat_open(&fat, &file, "CONTIG  ", "WAV"), "CONTIG.WAV didn't open");
+    CHECK(file.num_extents == 1 && file.extents[0].num_clusters == 100,
+            "CONTIG.WAV mapped to %u extents, the first %u clusters long", file.num_extents, file.extents[0].num_clusters);
+    Pic32_ResetStats();
+    CHECK(ReadMatches(&file, contig, sizeof(contig)), "CONTIG.WAV read back wrong");
+    CHECK(pic32_sd.watched_reads == 0, "Reading CONTIG.WAV read %llu FAT sectors", (unsigned long long)pic32_sd.watched_reads);
+    CHECK(pic32_sd.commands[18] == 1, "Reading CONTIG.WAV took %u CMD18s", pic32_sd.commands[18]);
+
+    // A few runs, each its own CMD18, and still no FAT
+    CHECK(Fat_open(&fat, &file, "FRAG    ", "WAV"), "FRAG.WAV didn't open");
+    num_runs = CountRuns(file.starting_cluster, runs, FAT_MAX_EXTENTS);
+    map_matches = (file.num_extents == num_runs);
+    for(i = 0; map_matches && i < num_runs; ++i)
+        map_matches = (file.extents[i].start_cluster == runs[i].start_cluster && file.extents[i].num_clusters == runs[i].num_clusters);
+    CHECK(num_runs > 1 && num_runs <= FAT_MAX_EXTENTS, "FRAG.WAV is in %u runs, the check needs 2 to %u", num_runs, FAT_MAX_EXTENTS);
+    CHECK(map_matches, "FRAG.WAV's %u runs mapped to %u extents", num_runs, file.num_extents);
+    Pic32_ResetStats();
+    CHECK(ReadMatches(&file, frag, sizeof(frag)), "FRAG.WAV read back wrong");
+    CHECK(pic32_sd.watched_reads == 0, "Reading FRAG.WAV read %llu FAT sectors", (unsigned long long)pic32_sd.watched_reads);
+    CHECK(pic32_sd.commands[18] == num_runs, "Reading FRAG.WAV's %u runs took %u CMD18s", num_runs, pic32_sd.commands[18]);
+    printf("Extent map: FRAG.WAV's %u runs read with %u CMD18s and %llu FAT reads\n",
+            num_runs, pic32_sd.commands[18], (unsigned long long)pic32_sd.watched_reads);
+
+    // More runs than the map has room for, the rest are found through the FAT
+    CHECK(Fat_open(&fat, &file, "SHREDDED", "WAV"), "SHREDDED.WAV didn't open");
+    num_runs = CountRuns(file.starting_cluster, runs, FAT_MAX_EXTENTS);
+    map_matches = (file.num_extents == FAT_MAX_EXTENTS);
+    for(i = 0; map_matches && i < FAT_MAX_EXTENTS; ++i)
+        map_matches = (file.extents[i].start_cluster == runs[i].start_cluster && file.extents[i].num_clusters == runs[i].num_clusters);
+    CHECK(num_runs > FAT_MAX_EXTENTS, "SHREDDED.WAV is in %u runs, the check needs more than %u", num_runs, FAT_MAX_EXTENTS);
+    CHECK(map_matches, "SHREDDED.WAV's first %u runs weren't mapped", FAT_MAX_EXTENTS);
+    CHECK(ReadMatches(&file, shredded, sizeof(shredded)), "SHREDDED.WAV read back wrong");
+    CHECK(pic32_sd.errors == 0, "%u card errors", pic32_sd.errors);
+}
+
+/**
+ * Seeks land in the right place, both ways, and once the chain has been
+ * walked a seek past the map costs at most a stride of FAT hops
+ */
+static void CheckSeek(void)
+{
+    static uint8_t data[2 * 1024 * 1024];
+    uint8_t buffer[600];
+    struct FatFile file;
+    uint32_t state = 7, offset, size, bad = 0, max_fat_reads = 0, i;
+    uint32_t stride, max_sectors;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 65536, 4);
+    TestCard_Fill(data, sizeof(data), 4);
+    card.frag_percent = 50;
+    TestCard_AddFile(&card, TESTCARD_ROOT, "BIG.WAV", data, sizeof(data), 0);
+
+    if(!Mount())
+        return;
+    Pic32_WatchSectors(card.fat_sector, card.fat_sectors * card.num_fats);
+    CHECK(Fat_open(&fat, &file, "BIG     ", "WAV"), "BIG.WAV didn't open");
+
+    // The first seek to the end walks the chain (filling in the seek index)
+    Fat_seek(&file, sizeof(data) - 1, FAT_SEEK_SET);
+    CHECK(Fat_read(&file, buffer, 10) == 1 && buffer[0] == data[sizeof(data) - 1], "The last byte read back wrong");
+
+    for(i = 0; i < 500; ++i)
+    {
+        state = (state * 1103515245) + 12345;
+        offset = (state >> 4) % sizeof(data);
+        size = (sizeof(data) - offset < sizeof(buffer)) ? sizeof(data) - offset : sizeof(buffer);
+
+        Pic32_ResetStats();
+        if(i % 2 == 0)
+            Fat_seek(&file, offset, FAT_SEEK_SET);
+        else
+        {
+            // Forward from wherever the last read left off, backwards is always a SEEK_SET
+            Fat_seek(&file, 0, FAT_SEEK_SET);
+            Fat_seek(&file, offset, FAT_SEEK_CUR);
+        }
+        if(Fat_read(&file, buffer, sizeof(buffer)) != size || memcmp(buffer, data + offset, size) != 0)
+            bad++;
+
+        if(pic32_sd.watched_reads > max_fat_reads)
+            max_fat_reads = (uint32_t)pic32_sd.watched_reads;
+    }
+
+    // testcard leaves at most 3 clusters between two of a file's, so a stride
+    // of hops covers at most 4 times as many FAT entries (plus the prefetch)
+    stride = file.seek_stride;
+    max_sectors = ((stride * 4) / (SECTOR_SIZE / 2)) + 2;
+
+    CHECK(bad == 0, "%u of 500 seeks read back wrong", bad);
+    CHECK(max_fat_reads <= max_sectors, "A seek read %u FAT sectors, a stride of %u hops spans at most %u",
+            max_fat_reads, stride, max_sectors);
+    CHECK(pic32_sd.errors == 0, "%u card errors", pic32_sd.errors);
+
+    printf("Seek: %u extents, a stride of %u clusters, at most %u FAT sector reads a seek\n",
+            file.num_extents, stride, max_fat_reads);
+}
+
+/**
+ * One pass over the root directory finds every file with any of the
+ * extensions, reading each directory sector once, and skips everything
+ * that isn't a regular file
+ */
+static void CheckScan(void)
+{
+    static char * exts[] = { "WAV", "QOA" };
+    static const char * kinds[] = { "WAV", "QOA", "TXT" };
+    uint8_t data[100];
+    char name[16];
+    FatCatalogEntry catalog[200];
+    struct Fat16Entry * slot;
+    struct FatFile file;
+    uint32_t num_entries, root_sectors, i;
+    uint16_t num_found;
+    bool names_match = true;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 32768, 4);
+    TestCard_Fill(data, sizeof(data), 5);
+
+    // A volume label, a long filename entry and a deleted WAV, none of which are files
+    slot = (struct Fat16Entry *)TestCard_DirSlot(&card, TESTCARD_ROOT);
+    memcpy(slot->filename, "NOISEBLAST WAV", 11);
+    slot->attributes = FAT_ATTR_VOLUME_ID;
+    slot = (struct Fat16Entry *)TestCard_DirSlot(&card, TESTCARD_ROOT);
+    memcpy(slot->filename, "\x41T\0R\0A\0C\0WAV", 11);
+    slot->attributes = FAT_ATTR_LFN;
+    slot = (struct Fat16Entry *)TestCard_DirSlot(&card, TESTCARD_ROOT);
+    memcpy(slot->filename, "\xE5ONE    WAV", 11);
+    slot->attributes = 0x20;
+    slot->starting_cluster = 2;
+    slot->filesize = 1;
+
+    for(i = 0; i < 150; ++i)
+    {
+        snprintf(name, sizeof(name), "T%03u.%s", i, kinds[i % 3]);
+        TestCard_AddFile(&card, TESTCARD_ROOT, name, data, sizeof(data), 0);
+    }
+    num_entries = card.dirs[TESTCARD_ROOT].num_entries;
+    root_sectors = (num_entries + FAT_ENTRIES_PER_SECTOR) / FAT_ENTRIES_PER_SECTOR;   // Up to the end marker
+
+    if(!Mount())
+        return;
+
+    Pic32_WatchSectors(card.root_sector, TESTCARD_ROOT_ENTRIES * 32 / SECTOR_SIZE);
+    Pic32_ResetStats();
+    num_found = GetFilesByExt(&fat, catalog, 200, exts, 2);
+
+    CHECK(num_found == 100, "Found %u of the 100 WAV and QOA files", num_found);
+    CHECK(pic32_sd.watched_reads == root_sectors, "Scanning %u root directory sectors read %llu",
+            root_sectors, (unsigned long long)pic32_sd.watched_reads);
+    printf("Scan: %u files found in %u directory entries, %llu sector reads\n",
+            num_found, num_entries, (unsigned long long)pic32_sd.watched_reads);
+
+    // In directory order, the TXT files left out
+    for(i = 0; i < num_found; ++i)
+    {
+        Fat_OpenCatalogEntry(&fat, &file, catalog[i]);
+        snprintf(name, sizeof(name), "T%03u    %s", ((i / 2) * 3) + (i % 2), kinds[i % 2]);
+        names_match &= (memcmp(file.filename, name, 11) == 0 && file.filesize == sizeof(data));
+    }
+    CHECK(names_match, "The catalog doesn't hold the WAV and QOA files in order");
+
+    // The catalog is limited to what it has room for
+    CHECK(GetFilesByExt(&fat, catalog, 10, exts, 2) == 10, "A 10 entry catalog wasn't filled exactly");
+    CHECK(pic32_sd.errors == 0, "%u card errors", pic32_sd.errors);
+
+}
+
+/**
+ * The catalog costs 4 bytes a track, and reopening a track from it reads
+ * no more than its directory sector and its FAT sector (plus the next FAT
+ * sector when the chain gets close to the end of that one)
+ */
+static void CheckCatalog(void)
+{
+    static FatCatalogEntry catalog[1000];
+    static char * exts[] = { "WAV" };
+    uint8_t data[3 * 4096], head[16];
+    char name[16];
+    struct FatFile file;
+    uint32_t state = 9, max_sectors = 0, i, track;
+    double seconds = 0;
+    bool matches = true;
+
+    TestCard_Format(&card, FAT_FS_FAT32, 600000, 8);
+    card.frag_percent = 30;
+    for(i = 0; i < 1000; ++i)
+    {
+        TestCard_Fill(data, sizeof(data), 100 + i);
+        snprintf(name, sizeof(name), "T%04u.WAV", i);
+        TestCard_AddFile(&card, TESTCARD_ROOT, name, data, sizeof(data), 0);
+    }
+
+    if(!Mount())
+        return;
+    CHECK(GetFilesByExt(&fat, catalog, 1000, exts, 1) == 1000, "The catalog didn't get all 1000 tracks");
+
+    for(i = 0; i < 200; ++i)
+    {
+        state = (state * 1103515245) + 12345;
+        track = (state >> 8) % 1000;
+
+        Pic32_ResetStats();
+        Fat_OpenCatalogEntry(&fat, &file, catalog[track]);
+        if(pic32_sd.sectors_read > max_sectors)
+            max_sectors = (uint32_t)pic32_sd.sectors_read;
+        seconds += pic32_sd.bus_seconds;
+
+        snprintf(name, sizeof(name), "T%04u   WAV", track);
+        TestCard_Fill(data, sizeof(data), 100 + track);
+        matches &= (memcmp(file.filename, name, 11) == 0 && Fat_read(&file, head, sizeof(head)) == sizeof(head) &&
+                memcmp(head, data, sizeof(head)) == 0);
+    }
+
+    CHECK(sizeof(FatCatalogEntry) == 4, "A catalog entry is %u bytes", (unsigned)sizeof(FatCatalogEntry));
+    CHECK(matches, "A track opened from the catalog wasn't the right file");
+    CHECK(max_sectors <= 3, "Opening a track read %u sectors", max_sectors);
+    CHECK(pic32_sd.errors == 0, "%u card errors", pic32_sd.errors);
+
+    printf("Catalog: %u bytes a track (%u KiB for %u), one %u byte cursor, opens read at most %u sectors in %.0fus on the bus\n",
+            (unsigned)sizeof(FatCatalogEntry), (unsigned)(LIBRARY_MAX_FILES * sizeof(FatCatalogEntry) / 1024), LIBRARY_MAX_FILES,
+            (unsigned)sizeof(struct FatFile), max_sectors, seconds * 1e6 / 200);
+}
+
+/**
+ * Following a long chain through the FAT window reads each FAT sector once,
+ * and leaves the metadata cache alone
+ */
+static void CheckFatWindow(void)
+{
+    static uint8_t data[4 * 1024 * 1024];
+    struct FatFile file;
+    uint32_t cluster, first_sector, last_sector, hits, misses;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 65536, 4);
+    TestCard_Fill(data, sizeof(data), 6);
+    card.frag_percent = 40;
+    cluster = TestCard_AddFile(&card, TESTCARD_ROOT, "LONG.WAV", data, sizeof(data), 0);
+
+    // The chain only goes forwards, so it covers every FAT sector from its first to its last
+    first_sector = cluster / (SECTOR_SIZE / 2);
+    while(TestCard_FatEntry(&card, cluster) < 0xFFF8)
+        cluster = TestCard_FatEntry(&card, cluster);
+    last_sector = cluster / (SECTOR_SIZE / 2);
+
+    if(!Mount())
+        return;
+    Pic32_WatchSectors(card.fat_sector, card.fat_sectors);
+    CHECK(Fat_open(&fat, &file, "LONG    ", "WAV"), "LONG.WAV didn't open");
+
+    Pic32_ResetStats();
+    hits = sd_cache_hits;
+    misses = sd_cache_misses;
+    CHECK(ReadMatches(&file, data, sizeof(data)), "LONG.WAV read back wrong");
+
+    CHECK(pic32_sd.watched_reads <= last_sector - first_sector + 1,
+            "Following a chain over %u FAT sectors read %llu", last_sector - first_sector + 1,
+            (unsigned long long)pic32_sd.watched_reads);
+    CHECK(sd_cache_hits == hits && sd_cache_misses == misses, "Following the chain went through the metadata cache");
+    CHECK(pic32_sd.errors == 0, "%u card errors", pic32_sd.errors);
+
+    printf("FAT window: a %u cluster chain over %u FAT sectors took %llu FAT sector reads\n",
+            file.num_clusters + 1, last_sector - first_sector + 1, (unsigned long long)pic32_sd.watched_reads);
+}
+
+/**
+ * FAT32: a root directory that's a cluster chain, clusters past 16 bits,
+ * the FSInfo hints, and a file whose chain goes on over several FAT sectors
+ * still read a whole run at a time
+ */
+static void CheckFat32(void)
+{
+    static uint8_t data[1024 * 1024], high[64 * 1024], back[1024 * 1024];
+    struct FatExtent runs[FAT_MAX_EXTENTS];
+    char name[16];
+    struct FatFile file;
+    uint32_t high_cluster, num_runs, fat_sectors, i;
+    double seconds;
+
+    TestCard_Format(&card, FAT_FS_FAT32, 600000, 8);
+    TestCard_Fill(data, sizeof(data), 7);
+    TestCard_Fill(high, sizeof(high), 8);
+
+    // Enough files that the root directory goes past its first cluster
+    card.frag_percent = 20;
+    for(i = 0; i < 200; ++i)
+    {
+        snprintf(name, sizeof(name), "F%03u.TXT", i);
+        TestCard_AddFile(&card, TESTCARD_ROOT, name, data, 10, 0);
+    }
+    TestCard_AddFile(&card, TESTCARD_ROOT, "SONG.WAV", data, sizeof(data), 0);
+    card.next_free = 70000;
+    high_cluster = TestCard_AddFile(&card, TESTCARD_ROOT, "HIGH.WAV", high, sizeof(high), 0);
+    card.frag_percent = 0;
+    TestCard_AddFile(&card, TESTCARD_ROOT, "LONG.WAV", data, sizeof(data), 0);
+
+    if(!Mount())
+        return;
+
+    CHECK(fat.root_cluster == card.root_cluster, "The root directory is at cluster %u, not %u", fat.root_cluster, card.root_cluster);
+    CHECK(fat.next_free == card.next_free && fat.free_clusters == card.num_clusters + 2 - card.next_free,
+            "FSInfo said %u free from %u, the card has %u from %u", fat.free_clusters, fat.next_free,
+            card.num_clusters + 2 - card.next_free, card.next_free);
+
+    CHECK(Fat_open(&fat, &file, "HIGH    ", "WAV"), "HIGH.WAV, after 200 entries, didn't open");
+    CHECK(file.starting_cluster == high_cluster, "HIGH.WAV opened at cluster %u, not %u", file.starting_cluster, high_cluster);
+    CHECK(ReadMatches(&file, high, sizeof(high)), "HIGH.WAV read back wrong");
+
+    CHECK(Fat_open(&fat, &file, "SONG    ", "WAV"), "SONG.WAV didn't open");
+    Pic32_ResetStats();
+    CHECK(ReadMatches(&file, data, sizeof(data)), "SONG.WAV read back wrong");
+    seconds = pic32_sd.bus_seconds;
+    CHECK(pic32_sd.errors == 0, "%u card errors", pic32_sd.errors);
+
+    printf("FAT32: 1MiB in %u runs read at %.2fMB/s on the bus\n", file.num_extents, sizeof(data) / seconds / 1e6);
+
+    // 256 clusters in a row, their FAT entries two sectors' worth: one
+    // transaction, and the FAT looked at only as far as the chain goes
+    CHECK(Fat_open(&fat, &file, "LONG    ", "WAV"), "LONG.WAV didn't open");
+    num_runs = CountRuns(file.starting_cluster, runs, FAT_MAX_EXTENTS);
+    fat_sectors = (runs[0].start_cluster + runs[0].num_clusters - 1) / (SECTOR_SIZE / 4) -
+            runs[0].start_cluster / (SECTOR_SIZE / 4) + 1;
+    CHECK(num_runs == 1 && fat_sectors > 1, "LONG.WAV is in %u runs over %u FAT sectors, the check needs 1 over several",
+            num_runs, fat_sectors);
+    Pic32_WatchSectors(card.fat_sector, card.fat_sectors);
+    Pic32_ResetStats();
+    read_data_calls = 0;
+    CHECK(Fat_read(&file, back, sizeof(back)) == sizeof(back) && memcmp(back, data, sizeof(data)) == 0, "LONG.WAV read back wrong");
+    CHECK(read_data_calls == num_runs, "Reading LONG.WAV's %u run took %u SD_ReadData transactions", num_runs, read_data_calls);
+    CHECK(pic32_sd.watched_reads <= fat_sectors, "Reading LONG.WAV read %llu FAT sectors, its chain is in %u",
+            (unsigned long long)pic32_sd.watched_reads, fat_sectors);
+
+    // And the same read a cluster at a time, the way the player goes, keeps the CMD18 going
+    Fat_seek(&file, 0, FAT_SEEK_SET);
+    Pic32_ResetStats();
+    CHECK(ReadMatches(&file, data, sizeof(data)), "LONG.WAV read back wrong the second time");
+    CHECK(pic32_sd.commands[18] == 1, "Reading LONG.WAV %u bytes at a time took %u CMD18s", READ_SIZE, pic32_sd.commands[18]);
+}
+
+/**
+ * exFAT on a 64GiB card: long names fold to 8.3, NoFatChain files are read
+ * without the FAT, and files past 4GiB are where they should be
+ */
+static void CheckExFat(void)
+{
+    static uint8_t near[2 * 1024 * 1024], far[512 * 1024], chained[512 * 1024];
+    struct FatFile file;
+    uint32_t far_cluster;
+    double mount_seconds, open_seconds, read_seconds;
+
+    TestCard_Format(&card, FAT_FS_EXFAT, (64ull << 30) / SECTOR_SIZE - TESTCARD_PART_START, 256);
+    TestCard_Fill(near, sizeof(near), 9);
+    TestCard_Fill(far, sizeof(far), 10);
+    TestCard_Fill(chained, sizeof(chained), 11);
+    TestCard_AddFile(&card, TESTCARD_ROOT, "Contiguous Song.wav", near, sizeof(near), TESTCARD_CONTIGUOUS);
+    card.frag_percent = 30;
+    TestCard_AddFile(&card, TESTCARD_ROOT, "chained.wav", chained, sizeof(chained), 0);
+    card.next_free = card.num_clusters - 64;
+    far_cluster = TestCard_AddFile(&card, TESTCARD_ROOT, "The Last Track On The Card.v2.wav", far, sizeof(far), TESTCARD_CONTIGUOUS);
+
+    if(!Mount())
+        return;
+    mount_seconds = pic32_sd.bus_seconds;
+    Pic32_WatchSectors(card.fat_sector, card.fat_sectors);
+
+    CHECK(Fat_open(&fat, &file, "CONTIGUO", "WAV"), "\"Contiguous Song.wav\" didn't open as CONTIGUO.WAV");
+    CHECK(file.num_extents == 1, "A NoFatChain file mapped to %u extents", file.num_extents);
+    Pic32_ResetStats();
+    CHECK(ReadMatches(&file, near, sizeof(near)), "CONTIGUO.WAV read back wrong");
+    read_seconds = pic32_sd.bus_seconds;
+    CHECK(pic32_sd.watched_reads == 0, "Reading a NoFatChain file read %llu FAT sectors", (unsigned long long)pic32_sd.watched_reads);
+
+    // The ".v2" isn't the extension, the last dot is
+    Pic32_ResetStats();
+    CHECK(Fat_open(&fat, &file, "THE LAST", "WAV"), "\"The Last Track On The Card.v2.wav\" didn't open as THE LAST.WAV");
+    open_seconds = pic32_sd.bus_seconds;
+    CHECK(pic32_sd.watched_reads == 0, "Opening a NoFatChain file read %llu FAT sectors", (unsigned long long)pic32_sd.watched_reads);
+    CHECK(file.starting_cluster == far_cluster, "THE LAST.WAV opened at cluster %u, not %u", file.starting_cluster, far_cluster);
+    CHECK(ReadMatches(&file, far, sizeof(far)), "THE LAST.WAV, %.1fGiB into the card, read back wrong",
+            (double)card.data_sector * SECTOR_SIZE / (1 << 30) + (double)(far_cluster - 2) * card.cluster_sectors * SECTOR_SIZE / (1 << 30));
+
+    // Without NoFatChain the FAT is followed as usual
+    CHECK(Fat_open(&fat, &file, "CHAINED ", "WAV"), "chained.wav didn't open");
+    CHECK(ReadMatches(&file, chained, sizeof(chained)), "chained.wav read back wrong");
+    CHECK(pic32_sd.errors == 0, "%u card errors", pic32_sd.errors);
+
+    printf("exFAT: mounting took %.1fms and opening a file %.0fus on the bus, a NoFatChain file read at %.2fMB/s\n",
+            mount_seconds * 1e3, open_seconds * 1e6, sizeof(near) / read_seconds / 1e6);
+}
+
+/**
+ * Bit 7 of the attributes is reserved on FAT, a card that has it set is
+ * still read through the FAT
+ */
+static void CheckReservedAttribute(void)
+{
+    static uint8_t data[256 * 1024];
+    struct Fat16Entry * entry;
+    struct FatFile file;
+
+    TestCard_Format(&card, FAT_FS_FAT32, 600000, 8);
+    TestCard_Fill(data, sizeof(data), 12);
+    card.frag_percent = 50;
+    TestCard_AddFile(&card, TESTCARD_ROOT, "ODD.WAV", data, sizeof(data), 0);
+
+    entry = (struct Fat16Entry *)TestCard_Cluster(&card, card.root_cluster) + card.dirs[TESTCARD_ROOT].num_entries - 1;
+    entry->attributes |= FAT_ATTR_CONTIGUOUS;
+
+    if(!Mount())
+        return;
+
+    CHECK(Fat_open(&fat, &file, "ODD     ", "WAV"), "ODD.WAV didn't open");
+    CHECK(file.num_extents > 1, "ODD.WAV, in pieces, was mapped to %u extent", file.num_extents);
+    CHECK(ReadMatches(&file, data, sizeof(data)), "ODD.WAV was read as if it were contiguous");
+}
+
+/**
+ * Checks a scan found exactly the files given, in the order given
+ */
+static bool FoundInOrder(const FatCatalogEntry * catalog, uint16_t num_found, const uint32_t * clusters, uint32_t num_files)
+{
+    struct Fat16Entry entry;
+    uint32_t i;
+
+    if(num_found != num_files)
+        return false;
+
+    for(i = 0; i < num_files; ++i)
+    {
+        Fat_ReadCatalogEntry(&fat, catalog[i], &entry);
+        if(Fat_EntryCluster(&fat, &entry) != clusters[i])
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * An artist/album library of 5060 WAVs in 300 folders is scanned depth
+ * first, every file found once and in directory order
+ */
+static void CheckTree(void)
+{
+    static char * exts[] = { "WAV" };
+    static uint32_t clusters[5100];
+    static FatCatalogEntry catalog[5100];
+    uint8_t data[100];
+    char name[16];
+    uint32_t num_files = 0, artist, album, i;
+    uint32_t artist_dir, album_dir;
+    uint16_t num_found;
+
+    TestCard_Format(&card, FAT_FS_FAT32, 600000, 8);
+    TestCard_Fill(data, sizeof(data), 13);
+    card.frag_percent = 10;
+
+    // Each directory's files go in before its subdirectories, so the order
+    // they're made in is the order a depth first scan finds them
+    for(i = 0; i < 20; ++i, ++num_files)
+    {
+        snprintf(name, sizeof(name), "R%03u.WAV", i);
+        clusters[num_files] = TestCard_AddFile(&card, TESTCARD_ROOT, name, data, sizeof(data), 0);
+    }
+    for(artist = 0; artist < 30; ++artist)
+    {
+        snprintf(name, sizeof(name), "ARTIST%02u", artist);
+        artist_dir = TestCard_AddDir(&card, TESTCARD_ROOT, name, 0);
+        for(i = 0; i < 6; ++i, ++num_files)
+        {
+            snprintf(name, sizeof(name), "LIVE%u.WAV", i);
+            clusters[num_files] = TestCard_AddFile(&card, artist_dir, name, data, sizeof(data), 0);
+        }
+
+        for(album = 0; album < 9; ++album)
+        {
+            snprintf(name, sizeof(name), "ALBUM%u", album);
+            album_dir = TestCard_AddDir(&card, artist_dir, name, 0);
+            TestCard_AddFile(&card, album_dir, "COVER.JPG", data, sizeof(data), 0);
+            for(i = 0; i < 18; ++i, ++num_files)
+            {
+                snprintf(name, sizeof(name), "TRACK%02u.WAV", i);
+                clusters[num_files] = TestCard_AddFile(&card, album_dir, name, data, sizeof(data), 0);
+            }
+        }
+    }
+
+    if(!Mount())
+        return;
+
+    Pic32_ResetStats();
+    num_found = GetFilesByExt(&fat, catalog, 5100, exts, 1);
+    CHECK(FoundInOrder(catalog, num_found, clusters, num_files), "Found %u of %u files, or not in order", num_found, num_files);
+    CHECK(pic32_sd.errors == 0, "%u card errors", pic32_sd.errors);
+
+    printf("Tree: %u files in %u folders, %llu sectors read in %.0fms on the bus, %u bytes of scanner state\n",
+            num_found, card.num_dirs - 1, (unsigned long long)pic32_sd.sectors_read, pic32_sd.bus_seconds * 1e3,
+            (unsigned)(sizeof(struct FatDirIter) + (FAT_MAX_DEPTH * sizeof(struct FatDirPos))));
+
+    // A full catalog stops the scan wherever it is
+    CHECK(GetFilesByExt(&fat, catalog, 100, exts, 1) == 100 && FoundInOrder(catalog, 100, clusters, 100),
+            "A 100 entry catalog didn't get the first 100 files");
+}
+
+/**
+ * Directories nested deeper than FAT_MAX_DEPTH are passed over, and the
+ * scan carries on in the root afterwards
+ */
+static void CheckDeepTree(void)
+{
+    static char * exts[] = { "WAV" };
+    FatCatalogEntry catalog[16];
+    uint32_t clusters[FAT_MAX_DEPTH + 1];
+    uint32_t dirs[FAT_MAX_DEPTH + 3];
+    uint8_t data[100];
+    char name[16];
+    uint16_t num_found;
+    uint32_t i;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 32768, 4);
+    TestCard_Fill(data, sizeof(data), 14);
+
+    dirs[0] = TESTCARD_ROOT;
+    for(i = 1; i < FAT_MAX_DEPTH + 3; ++i)
+    {
+        snprintf(name, sizeof(name), "LEVEL%u", i);
+        dirs[i] = TestCard_AddDir(&card, dirs[i - 1], name, 0);
+    }
+
+    // Found from the deepest level that's looked at back up to the root
+    for(i = FAT_MAX_DEPTH + 2; i > 0; --i)
+    {
+        snprintf(name, sizeof(name), "L%u.WAV", i);
+        if(i <= FAT_MAX_DEPTH)
+            clusters[FAT_MAX_DEPTH - i] = TestCard_AddFile(&card, dirs[i], name, data, sizeof(data), 0);
+        else
+            TestCard_AddFile(&card, dirs[i], name, data, sizeof(data), 0);
+    }
+    clusters[FAT_MAX_DEPTH] = TestCard_AddFile(&card, TESTCARD_ROOT, "ROOT.WAV", data, sizeof(data), 0);
+
+    if(!Mount())
+        return;
+
+    num_found = GetFilesByExt(&fat, catalog, 16, exts, 1);
+    CHECK(FoundInOrder(catalog, num_found, clusters, FAT_MAX_DEPTH + 1),
+            "Found %u files, the %u levels that fit and the root's", num_found, FAT_MAX_DEPTH);
+}
+
+/**
+ * Contiguous exFAT directories are stepped through without the FAT, even
+ * when the files in them are in pieces
+ */
+static void CheckContiguousDirs(void)
+{
+    static char * exts[] = { "WAV" };
+    FatCatalogEntry catalog[64];
+    uint32_t clusters[64];
+    uint8_t data[10000];
+    char name[32];
+    uint32_t num_files = 0, dir, i, j;
+    uint16_t num_found;
+
+    TestCard_Format(&card, FAT_FS_EXFAT, 262144, 8);
+    TestCard_Fill(data, sizeof(data), 15);
+    card.frag_percent = 50;
+
+    for(i = 0; i < 5; ++i)
+    {
+        snprintf(name, sizeof(name), "Album Number %u", i);
+        dir = TestCard_AddDir(&card, TESTCARD_ROOT, name, TESTCARD_CONTIGUOUS);
+        for(j = 0; j < 8; ++j, ++num_files)
+        {
+            snprintf(name, sizeof(name), "Track %u.wav", j);
+            clusters[num_files] = TestCard_AddFile(&card, dir, name, data, sizeof(data), 0);
+        }
+
+        dir = TestCard_AddDir(&card, dir, "Bonus Disc", TESTCARD_CONTIGUOUS);
+        for(j = 0; j < 2; ++j, ++num_files)
+        {
+            snprintf(name, sizeof(name), "Bonus %u.wav", j);
+            clusters[num_files] = TestCard_AddFile(&card, dir, name, data, sizeof(data), 0);
+        }
+    }
+
+    if(!Mount())
+        return;
+
+    // The root is chained, all in the first FAT sector
+    Pic32_WatchSectors(card.fat_sector + 1, card.fat_sectors - 1);
+    Pic32_ResetStats();
+    num_found = GetFilesByExt(&fat, catalog, 64, exts, 1);
+    CHECK(FoundInOrder(catalog, num_found, clusters, num_files), "Found %u of %u files, or not in order", num_found, num_files);
+    CHECK(pic32_sd.watched_reads == 0, "Scanning contiguous directories read %llu FAT sectors", (unsigned long long)pic32_sd.watched_reads);
+}
+
+/**
+ * Boots with the card as it is now and tries to open it
+ *
+ * In a process of its own, so nothing read from an earlier version of the
+ * card is left in the sector cache.
+ */
+static bool Opens(void)
+{
+    pid_t pid;
+    int status = 0;
+
+    Pic32_InsertCard(card.image, card.size);
+    fflush(stdout);
+    if((pid = fork()) == 0)
+    {
+        InitSD();
+        _exit(OpenFirstFatPartition(&fat) ? 0 : 1);
+    }
+
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Boot sectors that would have the FAT code reading garbage are turned away
+ */
+static void CheckBadBootSectors(void)
+{
+    static const char * const why[] = {
+        "never formatted", "4096 byte sectors", "no sectors per cluster",
+        "the root past the end", "FATs bigger than the volume", "NTFS",
+    };
+    struct Fat32BootSector * boot;
+    struct Fat32BootSector good;
+    struct PartitionTable * table;
+    unsigned i;
+
+    TestCard_Format(&card, FAT_FS_FAT32, 600000, 8);
+    boot = (struct Fat32BootSector *)(card.image + ((uint64_t)TESTCARD_PART_START * SECTOR_SIZE));
+    table = (struct PartitionTable *)(card.image + 0x1BE);
+    good = *boot;
+
+    CHECK(Opens(), "The card didn't open before it was broken");
+
+    for(i = 0; i < sizeof(why) / sizeof(why[0]); ++i)
+    {
+        *boot = good;
+        table->partition_type = 0x0C;
+        switch(i)
+        {
+            case 0: memset(boot, 0, sizeof(*boot)); break;
+            case 1: boot->sector_size = 4096; break;
+            case 2: boot->num_sectors_per_cluster = 0; break;
+            case 3: boot->root_cluster = card.num_clusters + 2; break;
+            case 4: boot->reserved_sectors = 0xFFFF; boot->fat_num_sectors = 600000; break;
+            case 5: table->partition_type = 7; break;
+        }
+
+        CHECK(!Opens(), "A boot sector with %s was taken", why[i]);
+    }
+
+    // FAT12 is laid out like FAT16, there are just fewer clusters
+    TestCard_Free(&card);
+    TestCard_Format(&card, FAT_FS_FAT16, 8192, 4);
+    CHECK(!Opens(), "A FAT12 sized volume was taken");
+}
+
+int main(void)
+{
+    Check_Boot("Extent map", CheckExtentMap);
+    Check_Boot("Seek", CheckSeek);
+    Check_Boot("Scan", CheckScan);
+    Check_Boot("Catalog", CheckCatalog);
+    Check_Boot("FAT window", CheckFatWindow);
+    Check_Boot("FAT32", CheckFat32);
+    Check_Boot("Bad boot sectors", CheckBadBootSectors);
+    Check_Boot("exFAT", CheckExFat);
+    Check_Boot("Reserved attribute", CheckReservedAttribute);
+    Check_Boot("Tree", CheckTree);
+    Check_Boot("Deep tree", CheckDeepTree);
+    Check_Boot("Contiguous directories", CheckContiguousDirs);
+
+    return Check_Result("test_fat");
+}
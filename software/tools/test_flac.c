@@ -0,0 +1,257 @@
+/*
+ * File:   test_flac.c
+ *
+ * Created on October 17, 2026
+ *
+ * Checks the firmware's FLAC decoder (flac.c) bit for bit against the
+ * reference encoders. The files in flac/ were made by libFLAC (through
+ * libsndfile) and by FFmpeg's encoder, and each one's STREAMINFO carries
+ * the MD5 of the audio that went in, which is what the reference decoder
+ * verifies its output against. Each is streamed off the simulated card
+ * through Flac_Read, in reads of every size, and the MD5 of what comes out
+ * has to match. Also checks a damaged frame header is skipped cleanly, and
+ * reports what decoding costs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "testcard.h"
+#include "md5.h"
+#include "flac.h"
+#include "fat.h"
+#include "sd.h"
+#include "wav.h"
+
+#define FIXTURE_DIR "flac/"
+#define MAX_FIXTURE_SIZE (64 * 1024)
+#define MAX_FRAMES 16384
+
+// Most frames asked for in one Flac_Read
+#define MAX_READ 300
+
+// Where the MD5 of the audio is, in the STREAMINFO block straight after "fLaC"
+#define STREAMINFO_MD5 26
+
+// The 16 bit files in flac/ and what each one exercises
+struct Fixture {
+    const char * name;
+    uint32_t sample_rate;
+    uint8_t channels;
+    uint32_t frames;
+    const char * made_with;
+};
+
+static const struct Fixture fixtures[] = {
+    { "LF5S44", 44100, 2, 9000, "libFLAC -5, 4096 blocks, mid/side" },
+    { "LF8S48", 48000, 2, 10000, "libFLAC -8, silence and full scale noise (constant and verbatim)" },
+    { "LF0M22", 22050, 1, 6000, "libFLAC -0 mono, 1152 blocks of fixed predictors" },
+    { "LFWAST", 44100, 2, 8000, "libFLAC -5, 3 wasted bits" },
+    { "FF32LP", 44100, 2, 7000, "FFmpeg, order 20-32 LPC, 1000 frame blocks" },
+    { "FFLEFT", 32000, 2, 7000, "FFmpeg, left/side, 4608 blocks" },
+    { "FFRIGH", 16000, 2, 7000, "FFmpeg, right/side, 192 blocks" },
+    { "FFMID", 44100, 2, 7000, "FFmpeg, mid/side, fixed predictors only" },
+};
+#define NUM_FIXTURES (sizeof(fixtures) / sizeof(fixtures[0]))
+
+static struct TestCard card;
+static struct FatPartition fat;
+static struct FlacDecoder dec;
+
+static uint8_t files[NUM_FIXTURES + 1][MAX_FIXTURE_SIZE];
+static uint32_t file_sizes[NUM_FIXTURES + 1];
+
+static bool LoadFixture(uint32_t f)
+{
+    char path[64];
+    FILE * in;
+
+    snprintf(path, sizeof(path), FIXTURE_DIR "%s.fla", fixtures[f].name);
+    for(char * c = path + strlen(FIXTURE_DIR); *c; c++)
+        *c = (*c >= 'A' && *c <= 'Z') ? *c + ('a' - 'A') : *c;
+
+    in = fopen(path, "rb");
+    if(in == NULL)
+        return false;
+    file_sizes[f] = fread(files[f], 1, MAX_FIXTURE_SIZE, in);
+    fclose(in);
+
+    return file_sizes[f] > STREAMINFO_MD5 + 16 && file_sizes[f] < MAX_FIXTURE_SIZE && memcmp(files[f], "fLaC", 4) == 0;
+}
+
+/**
+ * Opens a file on the card and decodes it all, in reads of random sizes
+ *
+ * @return Frames decoded, 0 if it wouldn't open
+ */
+static uint32_t Decode(const char * name, struct WavInfo * info, int16_t * out)
+{
+    struct FatStream stream;
+    struct FatFile file;
+    char padded[9];
+    uint32_t got = 0, n;
+
+    snprintf(padded, sizeof(padded), "%-8s", name);
+    if(!Fat_open(&fat, &file, padded, "FLA") || !Flac_ReadInfo(&file, info))
+        return 0;
+
+    Flac_Init(&dec, info);
+    Fat_OpenStream(&stream, &file, info->data_size);
+    while(got < MAX_FRAMES && (n = Flac_Read(&dec, &stream, &out[got * 2], 1 + (rand() % MAX_READ))) > 0)
+        got += n;
+
+    return got;
+}
+
+/**
+ * Finds the header of frame 1, the first one numbered 1 that looks like frame 0's
+ */
+static uint32_t FindFrame1(const uint8_t * data, uint32_t size, uint32_t first)
+{
+    uint32_t i;
+
+    for(i = first + 4; i + 4 < size; i++)
+    {
+        if(data[i] == 0xFF && data[i + 1] == data[first + 1] && data[i + 2] == data[first + 2] &&
+                data[i + 3] == data[first + 3] && data[i + 4] == 0x01)
+            return i;
+    }
+
+    return 0;
+}
+
+/**
+ * Every fixture decodes to the audio its encoder hashed, reading each
+ * sector of the file once
+ */
+static void CheckFixtures(void)
+{
+    static int16_t out[MAX_FRAMES * 2], mono[MAX_FRAMES];
+    const struct Fixture * fixture;
+    struct WavInfo info;
+    struct Md5 md5;
+    uint8_t digest[16];
+    uint64_t sectors;
+    uint32_t f, i, got, split;
+    double bus_seconds, audio_seconds, ns;
+    struct timespec start, end;
+    char name[16];
+
+    TestCard_Format(&card, FAT_FS_FAT16, 65536, 4);
+    card.frag_percent = 20;
+    for(f = 0; f < NUM_FIXTURES; ++f)
+    {
+        CHECK(LoadFixture(f), "Couldn't load " FIXTURE_DIR "%s", fixtures[f].name);
+        snprintf(name, sizeof(name), "%s.FLA", fixtures[f].name);
+        TestCard_AddFile(&card, TESTCARD_ROOT, name, files[f], file_sizes[f], 0);
+    }
+
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat), "The card didn't open");
+
+    for(f = 0; f < NUM_FIXTURES; ++f)
+    {
+        fixture = &fixtures[f];
+        Pic32_ResetStats();
+        Pic32_WatchSectors(card.fat_sector, card.fat_sectors * card.num_fats);
+        got = Decode(fixture->name, &info, out);
+        bus_seconds = pic32_sd.bus_seconds;
+        sectors = pic32_sd.sectors_read - pic32_sd.watched_reads;
+
+        CHECK(info.sample_rate == fixture->sample_rate && info.channels == fixture->channels && info.bits_per_sample == 16 &&
+                info.frames == fixture->frames, "%s reads as %uHz, %u channels, %u bits, %u frames", fixture->name,
+                info.sample_rate, info.channels, info.bits_per_sample, info.frames);
+        CHECK(got == fixture->frames, "%s decoded to %u frames of %u", fixture->name, got, fixture->frames);
+
+        // FLAC's MD5 is of the samples as they are, little endian and interleaved
+        Md5_Init(&md5);
+        if(fixture->channels == 1)
+        {
+            for(i = 0, split = 0; i < got; i++)
+            {
+                mono[i] = out[i * 2];
+                split += out[(i * 2) + 1] != out[i * 2];
+            }
+            CHECK(split == 0, "%u frames of %s aren't the same both sides", split, fixture->name);
+            Md5_Update(&md5, mono, got * 2);
+        }
+        else
+            Md5_Update(&md5, out, got * 4);
+        Md5_Final(&md5, digest);
+        CHECK(memcmp(digest, files[f] + STREAMINFO_MD5, 16) == 0, "%s doesn't match its encoder's MD5", fixture->name);
+
+        // The bit reader takes whole sectors, and never the same one twice
+        CHECK(sectors <= (file_sizes[f] + SECTOR_SIZE - 1) / SECTOR_SIZE + 1, "%s read %llu sectors for %u bytes",
+                fixture->name, (unsigned long long)sectors, file_sizes[f]);
+
+        // What decoding costs: on the host, and in card bandwidth against the same track as a WAV
+        audio_seconds = (double)got / fixture->sample_rate;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        Decode(fixture->name, &info, out);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+        printf("%-6s %-64s %5.1fns a frame on the host, %6.0f bytes/s off the card (WAV %6.0f), %4.1fms of SPI a second\n",
+                fixture->name, fixture->made_with, ns / got, file_sizes[f] / audio_seconds,
+                (double)fixture->sample_rate * fixture->channels * 2, bus_seconds / audio_seconds * 1e3);
+    }
+}
+
+/**
+ * A frame whose header is damaged is skipped, and decoding carries on from
+ * the next one with nothing else lost
+ */
+static void CheckDamagedFrame(void)
+{
+    static int16_t clean[MAX_FRAMES * 2], damaged[MAX_FRAMES * 2];
+    struct WavInfo info;
+    uint32_t frame0, frame1, clean_frames, damaged_frames, block;
+    bool last;
+
+    CHECK(LoadFixture(0), "Couldn't load " FIXTURE_DIR "%s", fixtures[0].name);
+    memcpy(files[NUM_FIXTURES], files[0], file_sizes[0]);
+    file_sizes[NUM_FIXTURES] = file_sizes[0];
+
+    // The first frame comes after the last metadata block
+    frame0 = 4;
+    do
+    {
+        last = files[0][frame0] & 0x80;
+        frame0 += 4 + ((files[0][frame0 + 1] << 16) | (files[0][frame0 + 2] << 8) | files[0][frame0 + 3]);
+    } while(!last && frame0 < file_sizes[0]);
+    frame1 = FindFrame1(files[0], file_sizes[0], frame0);
+    CHECK(files[0][frame0] == 0xFF && frame1 != 0, "Couldn't find the frames of %s", fixtures[0].name);
+    if(frame1 == 0)
+        return;
+    files[NUM_FIXTURES][frame1 + 2] ^= 0x01;      // The sample rate code, caught by the header's CRC-8
+
+    TestCard_Format(&card, FAT_FS_FAT16, 65536, 4);
+    TestCard_AddFile(&card, TESTCARD_ROOT, "CLEAN.FLA", files[0], file_sizes[0], 0);
+    TestCard_AddFile(&card, TESTCARD_ROOT, "DAMAGED.FLA", files[NUM_FIXTURES], file_sizes[NUM_FIXTURES], 0);
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat), "The card didn't open");
+
+    clean_frames = Decode("CLEAN", &info, clean);
+    damaged_frames = Decode("DAMAGED", &info, damaged);
+    block = (files[0][frame0 + 2] >> 4 == 12) ? 4096 : 0;
+
+    CHECK(block != 0 && damaged_frames == clean_frames - block, "With frame 1 damaged %u frames of %u came out", damaged_frames, clean_frames);
+    CHECK(memcmp(damaged, clean, block * 4) == 0, "Frame 0 changed when frame 1 was damaged");
+    CHECK(memcmp(damaged + (block * 2), clean + (block * 4), (clean_frames - (2 * block)) * 4) == 0,
+            "What came after the damaged frame doesn't match");
+}
+
+int main(void)
+{
+    srand(9);
+    Check_Boot("Fixtures", CheckFixtures);
+    Check_Boot("Damaged frame", CheckDamagedFrame);
+    return Check_Result("test_flac");
+}
@@ -0,0 +1,284 @@
+/*
+ * File:   test_gapless.c
+ *
+ * Created on October 17, 2026
+ *
+ * Plays a card through the player in main.c on the simulated PIC32 and
+ * checks what SPI1 sends: tracks at the same rate follow each other with
+ * not one frame of silence between them and nothing written to the DAC,
+ * whatever the codec, and a file that can't be played is skipped without a
+ * sound. Only a change of rate drains the ring, mutes and reclocks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "testcard.h"
+#include "player.h"
+
+// The player, with its main() out of the way, and its pause() out of unistd.h's
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#define main Firmware_Main
+#define pause Firmware_Pause
+#include "main.c"
+#undef main
+#undef pause
+#pragma GCC diagnostic pop
+
+#define MAX_TRACK_FRAMES 16384
+#define MAX_FILE_SIZE (64 * 1024)
+#define CAPTURE_FRAMES (1024 * 1024)
+
+// A track on the card, in catalog order
+struct PlaylistTrack {
+    const char * name;          // 8.3, as it's put on the card
+    const char * fixture;       // Where it comes from, or NULL to make a WAV
+    uint32_t sample_rate;
+    uint8_t channels;
+    uint8_t bits;
+    uint32_t frames;
+};
+
+static const struct PlaylistTrack playlist[] = {
+    { "A.WAV", NULL, 44100, 2, 16, 10001 },
+    { "JUNK.WAV", NULL, 0, 0, 0, 0 },
+    { "B.QOA", "qoa/qs44.qoa", 44100, 2, 16, 12345 },
+    { "C.FLA", "flac/lf5s44.fla", 44100, 2, 16, 9000 },
+    { "D.WAV", NULL, 44100, 1, 8, 3333 },
+    { "E.WAV", NULL, 44100, 2, 24, 2222 },
+    { "F.WAV", NULL, 22050, 1, 16, 3000 },
+    { "G.WAV", NULL, 22050, 2, 16, 2500 },
+};
+#define NUM_TRACKS (sizeof(playlist) / sizeof(playlist[0]))
+
+// Runs of tracks that play out at the same rate, so have to join without a gap
+static const uint8_t runs[][6] = { { 0, 2, 3, 4, 5, 0xFF }, { 6, 7, 0xFF }, { 0, 0xFF } };
+#define NUM_RUNS (sizeof(runs) / sizeof(runs[0]))
+
+static struct TestCard card;
+static uint8_t files[NUM_TRACKS][MAX_FILE_SIZE];
+static uint32_t file_sizes[NUM_TRACKS];
+static int16_t expected[NUM_TRACKS][MAX_TRACK_FRAMES * 2];
+static uint32_t expected_frames[NUM_TRACKS];
+static int16_t capture[CAPTURE_FRAMES * 2];
+
+static void Put16(uint8_t * p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void Put32(uint8_t * p, uint32_t v)
+{
+    Put16(p, v & 0xFFFF);
+    Put16(p + 2, v >> 16);
+}
+
+/**
+ * Makes a WAV of a tone with a little noise on it, that never hits zero on both sides
+ *
+ * @return Its size
+ */
+static uint32_t MakeWav(const struct PlaylistTrack * track, uint8_t * wav)
+{
+    uint32_t bytes = track->bits / 8, data_size = track->frames * track->channels * bytes;
+    uint32_t i, c, b;
+    int32_t sample;
+
+    memcpy(wav, "RIFF", 4);
+    Put32(wav + 4, 36 + data_size);
+    memcpy(wav + 8, "WAVEfmt ", 8);
+    Put32(wav + 16, 16);
+    Put16(wav + 20, WAV_FORMAT_PCM);
+    Put16(wav + 22, track->channels);
+    Put32(wav + 24, track->sample_rate);
+    Put32(wav + 28, track->sample_rate * track->channels * bytes);
+    Put16(wav + 32, track->channels * bytes);
+    Put16(wav + 34, track->bits);
+    memcpy(wav + 36, "data", 4);
+    Put32(wav + 40, data_size);
+
+    for(i = 0; i < track->frames; i++)
+    {
+        for(c = 0; c < track->channels; c++)
+        {
+            sample = ((int32_t)(((i * (40 + (c * 7))) % 400) * 80) - 16000 + (rand() % 512)) | 0x100;
+            sample *= 1 << 16;
+            for(b = 0; b < bytes; b++)
+                wav[44 + (((i * track->channels) + c) * bytes) + b] = sample >> (32 - (8 * (bytes - b)));
+            if(bytes == 1)
+                wav[44 + (i * track->channels) + c] ^= 0x80;
+        }
+    }
+
+    return 44 + data_size;
+}
+
+static bool LoadFixture(const char * path, uint8_t * data, uint32_t * size)
+{
+    FILE * in = fopen(path, "rb");
+
+    if(in == NULL)
+        return false;
+    *size = fread(data, 1, MAX_FILE_SIZE, in);
+    fclose(in);
+
+    return *size > 0 && *size < MAX_FILE_SIZE;
+}
+
+/**
+ * Decodes a track on its own, straight through its decoder
+ *
+ * @return Its frames, 0 if it can't be played
+ */
+static uint32_t DecodeAlone(const char * name, int16_t * out)
+{
+    static struct FlacDecoder flac_dec;
+    struct QoaDecoder qoa_dec;
+    struct PcmConverter pcm_conv;
+    struct FatStream stream;
+    struct WavInfo info;
+    struct FatFile file;
+    char padded[9], ext[4];
+    const char * dot = strchr(name, '.');
+    uint32_t got = 0, n = 1;
+
+    snprintf(padded, sizeof(padded), "%-8.*s", (int)(dot - name), name);
+    snprintf(ext, sizeof(ext), "%s", dot + 1);
+    if(!Fat_open(&fat, &file, padded, ext))
+        return 0;
+
+    if(Wav_ReadInfo(&file, &info) && Pcm_SelectConverter(&pcm_conv, &info))
+    {
+        Fat_OpenStream(&stream, &file, info.data_size);
+        while(got < MAX_TRACK_FRAMES && (n = Pcm_Read(&pcm_conv, &stream, &out[got * 2], 100)) > 0)
+            got += n;
+    }
+    else if(Flac_ReadInfo(&file, &info))
+    {
+        Flac_Init(&flac_dec, &info);
+        Fat_OpenStream(&stream, &file, info.data_size);
+        while(got < MAX_TRACK_FRAMES && (n = Flac_Read(&flac_dec, &stream, &out[got * 2], 100)) > 0)
+            got += n;
+    }
+    else if(Qoa_ReadInfo(&file, &info))
+    {
+        Qoa_Init(&qoa_dec, &info);
+        Fat_OpenStream(&stream, &file, info.data_size);
+        while(got < MAX_TRACK_FRAMES && (n = Qoa_Read(&qoa_dec, &stream, &out[got * 2], 100)) > 0)
+            got += n;
+    }
+
+    return got;
+}
+
+/**
+ * Finds where a track starts in what was sent, from a frame on
+ */
+static uint32_t FindTrack(uint32_t from, uint8_t t)
+{
+    uint32_t i, match = (expected_frames[t] < 64) ? expected_frames[t] : 64;
+
+    for(i = from; i + match <= pic32_i2s.num_frames && i + match <= CAPTURE_FRAMES; i++)
+    {
+        if(memcmp(&capture[i * 2], expected[t], match * 4) == 0)
+            return i;
+    }
+
+    return UINT32_MAX;
+}
+
+/**
+ * Every run of same rate tracks comes out back to back, bit for bit, with
+ * no silence at the joins and nothing said to the DAC, right round the card
+ * and back to the start
+ */
+static void CheckJoins(void)
+{
+    const struct PlaylistTrack * track;
+    uint32_t t, r, k, i, pos, start, end, mismatch, silent;
+    uint32_t total = 0;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 65536, 4);
+    card.frag_percent = 20;
+    for(t = 0; t < NUM_TRACKS; t++)
+    {
+        track = &playlist[t];
+        if(track->fixture != NULL)
+            CHECK(LoadFixture(track->fixture, files[t], &file_sizes[t]), "Couldn't load %s", track->fixture);
+        else if(track->channels == 0)
+        {
+            // Has a RIFF header and nothing else that makes sense
+            memcpy(files[t], "RIFF", 4);
+            memset(files[t] + 4, 0x5A, 300);
+            file_sizes[t] = 304;
+        }
+        else
+            file_sizes[t] = MakeWav(track, files[t]);
+        TestCard_AddFile(&card, TESTCARD_ROOT, track->name, files[t], file_sizes[t], 0);
+    }
+
+    // What each track is on its own
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat), "The card didn't open");
+    for(t = 0; t < NUM_TRACKS; t++)
+    {
+        expected_frames[t] = DecodeAlone(playlist[t].name, expected[t]);
+        CHECK(expected_frames[t] == playlist[t].frames, "%s decodes to %u frames on its own", playlist[t].name, expected_frames[t]);
+        total += expected_frames[t];
+    }
+
+    Player_Boot(card.image, card.size, capture, CAPTURE_FRAMES);
+    Player_Run(total + 20000);
+
+    // Each run starts after the last, and every frame of it is there in order
+    for(r = 0, pos = 0; r < NUM_RUNS; r++)
+    {
+        start = FindTrack(pos, runs[r][0]);
+        CHECK(start != UINT32_MAX, "%s never started (run %u)", playlist[runs[r][0]].name, r);
+        if(start == UINT32_MAX)
+            return;
+
+        for(k = 0, end = start, mismatch = UINT32_MAX; runs[r][k] != 0xFF; k++)
+        {
+            t = runs[r][k];
+            if(end + expected_frames[t] > CAPTURE_FRAMES || memcmp(&capture[end * 2], expected[t], expected_frames[t] * 4) != 0)
+            {
+                mismatch = t;
+                break;
+            }
+            end += expected_frames[t];
+        }
+        CHECK(mismatch == UINT32_MAX, "Run %u breaks at %s, %u frames in", r, (mismatch == UINT32_MAX) ? "" : playlist[mismatch].name, end - start);
+
+        for(i = start, silent = 0; i < end; i++)
+            silent += (capture[i * 2] == 0 && capture[(i * 2) + 1] == 0);
+        CHECK(silent == 0, "Run %u has %u silent frames", r, silent);
+
+        printf("Run %u: %u tracks, %u frames from frame %u, %u of them silent\n", r, k, end - start, start, silent);
+        pos = end;
+    }
+
+    // Only the rate changes (44.1KHz to 22.05KHz and back) go through nextSong and the DAC
+    CHECK(player_stats.songs_ended == 2, "The ring was drained for %u track changes", player_stats.songs_ended);
+    CHECK(player_stats.stray_dac_writes == 0, "%u DAC writes while tracks were playing", player_stats.stray_dac_writes);
+    CHECK(player_stats.stray_underruns == 0 && pic32_i2s.late_frames == 0, "%u underruns and %u late frames while tracks were playing",
+            player_stats.stray_underruns, pic32_i2s.late_frames);
+
+    printf("%u frames sent, %u passes of the loop, longest FillRing %.2fms, %u underruns at the rate changes\n",
+            pic32_i2s.num_frames, player_stats.passes, player_stats.worst_fill * 1e3, audio_ring.underruns);
+}
+
+int main(void)
+{
+    srand(23);
+    Check_Boot("Joins", CheckJoins);
+    return Check_Result("test_gapless");
+}
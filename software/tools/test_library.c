@@ -0,0 +1,302 @@
+/*
+ * File:   test_library.c
+ *
+ * Created on October 17, 2026
+ *
+ * Boots the firmware's library.c over and over on the same simulated card,
+ * the way main does it, and checks when the index is trusted, when the card
+ * is scanned again, and how long it takes to get to the first sample.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "testcard.h"
+#include "fat.h"
+#include "library.h"
+#include "sd.h"
+
+// What the player reads before the first sample goes out
+#define FIRST_READ 4096
+
+#define NUM_FOLDERS 20
+#define TRACKS_PER_FOLDER 50
+#define TRACK_SIZE (16 * 1024)
+
+static struct TestCard card;
+
+// What a boot did, sent back from the process it ran in
+struct BootResult {
+    bool mounted;
+    bool loaded;                // The index was used, no scan
+    uint16_t num_files;
+    uint8_t first_read[FIRST_READ];
+    double seconds;             // Bus time from reset to the first sample's data
+    uint64_t sectors_read;
+    double catalog_seconds;     // Bus time spent getting the catalog, by loading or scanning
+    uint64_t catalog_sectors;
+    uint64_t fat_reads;         // FAT sectors read opening and starting track 0
+};
+
+/**
+ * Boots like main: mount, load the index or scan and save it, then open
+ * track 0 and read the start of it
+ *
+ * Each boot is a process of its own, so nothing is left in the caches from
+ * the last one, but what it writes to the card stays.
+ *
+ * @param use_index False to scan without looking at or writing the index,
+ *                  like a player without library.c
+ */
+static struct BootResult Boot(bool use_index)
+{
+    static char * exts[] = { "WAV" };
+    static FatCatalogEntry catalog[LIBRARY_MAX_FILES];
+    static struct BootResult result;
+    struct FatPartition fat;
+    struct LibraryIndex library;
+    struct FatFile file;
+    int fds[2];
+    pid_t pid;
+
+    memset(&result, 0, sizeof(result));
+    Pic32_InsertCard(card.image, card.size);
+    fflush(stdout);
+    if(pipe(fds) != 0 || (pid = fork()) < 0)
+        return result;
+
+    if(pid == 0)
+    {
+        close(fds[0]);
+        InitSD();
+        result.mounted = OpenFirstFatPartition(&fat);
+        if(result.mounted)
+        {
+            result.catalog_seconds = pic32_sd.bus_seconds;
+            result.catalog_sectors = pic32_sd.sectors_read;
+            if(use_index)
+            {
+                result.loaded = Library_Open(&library, &fat, LIBRARY_MAX_FILES) && Library_Load(&library, catalog, &result.num_files);
+                if(!result.loaded)
+                {
+                    result.num_files = GetFilesByExt(&fat, catalog, LIBRARY_MAX_FILES, exts, 1);
+                    Library_Save(&library, catalog, result.num_files);
+                }
+            }
+            else
+            {
+                memset(&library, 0, sizeof(library));
+                library.part = &fat;
+                result.num_files = GetFilesByExt(&fat, catalog, LIBRARY_MAX_FILES, exts, 1);
+            }
+            result.catalog_seconds = pic32_sd.bus_seconds - result.catalog_seconds;
+            result.catalog_sectors = pic32_sd.sectors_read - result.catalog_sectors;
+
+            if(result.num_files > 0)
+            {
+                Pic32_WatchSectors(card.fat_sector, card.fat_sectors * card.num_fats);
+                Library_OpenTrack(&library, &file, catalog, 0);
+                Fat_read(&file, result.first_read, FIRST_READ);
+                result.fat_reads = pic32_sd.watched_reads;
+            }
+        }
+
+        result.seconds = pic32_sd.bus_seconds;
+        result.sectors_read = pic32_sd.sectors_read;
+        _exit(write(fds[1], &result, sizeof(result)) == sizeof(result) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    if(read(fds[0], &result, sizeof(result)) != sizeof(result))
+        result.mounted = false;
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    return result;
+}
+
+/**
+ * Moves next_free past whatever the firmware allocated (the index file), so
+ * files added afterwards don't land on it
+ */
+static void SkipUsedClusters(void)
+{
+    uint32_t cluster;
+
+    for(cluster = card.num_clusters + 1; cluster >= card.next_free; --cluster)
+    {
+        if(TestCard_FatEntry(&card, cluster) != 0)
+        {
+            card.next_free = cluster + 1;
+            break;
+        }
+    }
+}
+
+/**
+ * Looks for an entry in the root directory by its space padded 8.3 name
+ */
+static struct Fat16Entry * FindRootEntry(const char * name)
+{
+    struct Fat16Entry * entry;
+    uint32_t per_cluster = card.cluster_sectors * FAT_ENTRIES_PER_SECTOR;
+    uint32_t i, j;
+
+    for(i = 0; i < TESTCARD_DIR_CLUSTERS; ++i)
+    {
+        entry = (struct Fat16Entry *)TestCard_Cluster(&card, card.dirs[TESTCARD_ROOT].clusters[i]);
+        for(j = 0; j < per_cluster && entry[j].filename[0] != 0; ++j)
+        {
+            if(memcmp(entry[j].filename, name, 11) == 0)
+                return &entry[j];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * A card of 1000 tracks in 20 folders, fragmented, with track 0 being the
+ * first file in the root
+ */
+static void MakeLibrary(enum FatFsType fs_type, uint8_t * first_track)
+{
+    static uint8_t data[TRACK_SIZE];
+    char name[16];
+    uint32_t folder, i, dir;
+
+    TestCard_Format(&card, fs_type, 600000, 8);
+    card.frag_percent = 20;
+
+    TestCard_Fill(first_track, TRACK_SIZE, 1000);
+    TestCard_AddFile(&card, TESTCARD_ROOT, "FIRST.WAV", first_track, TRACK_SIZE, 0);
+    for(folder = 0; folder < NUM_FOLDERS; ++folder)
+    {
+        snprintf(name, sizeof(name), "ALBUM%02u", folder);
+        dir = TestCard_AddDir(&card, TESTCARD_ROOT, name, 0);
+        for(i = 0; i < TRACKS_PER_FOLDER - (folder == 0); ++i)
+        {
+            snprintf(name, sizeof(name), "TRACK%02u.WAV", i);
+            TestCard_Fill(data, TRACK_SIZE, (folder * TRACKS_PER_FOLDER) + i);
+            TestCard_AddFile(&card, dir, name, data, TRACK_SIZE, 0);
+        }
+    }
+}
+
+/**
+ * The first boot scans and writes the index, the next ones load it and get
+ * to the first sample sooner, without reading the FAT. Checking the stamp
+ * reads every directory a scan does, so next to a plain scan (no index at
+ * all) loading isn't any quicker, what's saved is walking the FAT on opens.
+ */
+static void CheckIndexedBoot(void)
+{
+    static uint8_t first_track[TRACK_SIZE];
+    struct BootResult scan, indexed, rescan;
+
+    MakeLibrary(FAT_FS_FAT32, first_track);
+
+    scan = Boot(true);
+    CHECK(scan.mounted && !scan.loaded, "The first boot didn't scan");
+    CHECK(scan.num_files == NUM_FOLDERS * TRACKS_PER_FOLDER, "The scan found %u tracks", scan.num_files);
+    CHECK(memcmp(scan.first_read, first_track, FIRST_READ) == 0, "Track 0 read back wrong after a scan");
+
+    indexed = Boot(true);
+    CHECK(indexed.loaded, "The second boot didn't use the index");
+    CHECK(indexed.num_files == scan.num_files, "The index had %u tracks, the scan found %u", indexed.num_files, scan.num_files);
+    CHECK(memcmp(indexed.first_read, first_track, FIRST_READ) == 0, "Track 0 read back wrong from the index");
+    CHECK(indexed.fat_reads == 0, "Opening track 0 from the index read %llu FAT sectors", (unsigned long long)indexed.fat_reads);
+    CHECK(indexed.seconds < scan.seconds, "Booting from the index took %.1fms, scanning %.1fms", indexed.seconds * 1e3, scan.seconds * 1e3);
+
+    // Still there a boot later
+    CHECK(Boot(true).loaded, "The third boot didn't use the index");
+
+    rescan = Boot(false);
+    CHECK(!rescan.loaded && rescan.num_files == scan.num_files, "Scanning without the index found %u tracks", rescan.num_files);
+    CHECK(memcmp(rescan.first_read, first_track, FIRST_READ) == 0, "Track 0 read back wrong without the index");
+    CHECK(indexed.catalog_sectors >= rescan.catalog_sectors,
+            "Loading the index read %llu sectors, a scan %llu, so the stamp missed directories",
+            (unsigned long long)indexed.catalog_sectors, (unsigned long long)rescan.catalog_sectors);
+    CHECK(rescan.fat_reads > 0, "Opening track 0 without the index read no FAT sectors, the check needs some");
+
+    printf("Boot to first sample: %.1fms (%llu sectors) scanning and saving, %.1fms (%llu sectors) from the index, %.1fms (%llu sectors) scanning\n",
+            scan.seconds * 1e3, (unsigned long long)scan.sectors_read,
+            indexed.seconds * 1e3, (unsigned long long)indexed.sectors_read,
+            rescan.seconds * 1e3, (unsigned long long)rescan.sectors_read);
+    printf("Getting the catalog: %.1fms (%llu sectors) from the index, %.1fms (%llu sectors) scanning, "
+            "and opening track 0 read %llu and %llu FAT sectors\n",
+            indexed.catalog_seconds * 1e3, (unsigned long long)indexed.catalog_sectors,
+            rescan.catalog_seconds * 1e3, (unsigned long long)rescan.catalog_sectors,
+            (unsigned long long)indexed.fat_reads, (unsigned long long)rescan.fat_reads);
+}
+
+/**
+ * Adding, renaming or rewriting a file in any folder means a rescan, after
+ * which the index is trusted again
+ */
+static void CheckCardChanges(void)
+{
+    static uint8_t first_track[TRACK_SIZE], data[TRACK_SIZE];
+    struct Fat16Entry * entry;
+    struct BootResult result;
+    uint32_t folder = NUM_FOLDERS - 1;
+
+    MakeLibrary(FAT_FS_FAT32, first_track);
+    Boot(true);
+    SkipUsedClusters();
+
+    // A new track in the last folder
+    TestCard_Fill(data, TRACK_SIZE, 5000);
+    TestCard_AddFile(&card, folder + 1, "NEW.WAV", data, TRACK_SIZE, 0);
+    result = Boot(true);
+    CHECK(!result.loaded && result.num_files == NUM_FOLDERS * TRACKS_PER_FOLDER + 1,
+            "After adding a track the boot %s %u tracks", result.loaded ? "loaded" : "scanned", result.num_files);
+    CHECK(Boot(true).loaded, "The index wasn't trusted after the rescan");
+
+    // Renamed in place (the last entry in the folder)
+    entry = (struct Fat16Entry *)TestCard_Cluster(&card, card.dirs[folder + 1].clusters[0]) + card.dirs[folder + 1].num_entries - 1;
+    entry->filename[0] = 'X';
+    CHECK(!Boot(true).loaded, "The index was trusted after a rename");
+
+    // Rewritten shorter
+    entry->filesize -= SECTOR_SIZE;
+    CHECK(!Boot(true).loaded, "The index was trusted after a file changed size");
+
+    // A header that was never finished is never trusted
+    CHECK(Boot(true).loaded, "The index wasn't trusted after the rescans");
+    entry = FindRootEntry(LIBRARY_FILENAME LIBRARY_EXT);
+    CHECK(entry != NULL, "There's no index file in the root directory");
+    if(entry == NULL)
+        return;
+    ((struct LibraryHeader *)TestCard_Cluster(&card, ((uint32_t)entry->starting_cluster_high << 16) | entry->starting_cluster))->magic = 0;
+    result = Boot(true);
+    CHECK(!result.loaded && result.num_files == NUM_FOLDERS * TRACKS_PER_FOLDER + 1, "A cleared header was trusted");
+}
+
+/**
+ * exFAT cards don't get an index, every boot scans and still plays
+ */
+static void CheckExFatScans(void)
+{
+    static uint8_t first_track[TRACK_SIZE];
+    struct BootResult result;
+
+    MakeLibrary(FAT_FS_EXFAT, first_track);
+    Boot(true);
+    result = Boot(true);
+    CHECK(result.mounted && !result.loaded, "An exFAT card used an index");
+    CHECK(result.num_files == NUM_FOLDERS * TRACKS_PER_FOLDER, "The scan found %u tracks", result.num_files);
+    CHECK(memcmp(result.first_read, first_track, FIRST_READ) == 0, "Track 0 read back wrong");
+}
+
+int main(void)
+{
+    Check_Boot("Indexed boot", CheckIndexedBoot);
+    Check_Boot("Card changes", CheckCardChanges);
+    Check_Boot("exFAT", CheckExFatScans);
+    return Check_Result("test_library");
+}
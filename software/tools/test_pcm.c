@@ -0,0 +1,323 @@
+/*
+ * File:   test_pcm.c
+ *
+ * Created on October 17, 2026
+ *
+ * Checks the firmware's sample conversion kernels (pcm.c) bit for bit: a
+ * few golden vectors per format, then whole tracks streamed off the
+ * simulated card through Pcm_Read (so the in place layouts are used)
+ * against a straightforward reference conversion. Also times each kernel
+ * on the host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "testcard.h"
+#include "fat.h"
+#include "pcm.h"
+#include "sd.h"
+#include "wav.h"
+
+#define TRACK_FRAMES 5000
+
+// A format there's a kernel for
+struct PcmFormat {
+    const char * name;
+    uint16_t format;
+    uint16_t bits;
+};
+
+static const struct PcmFormat formats[] = {
+    { "u8", WAV_FORMAT_PCM, 8 },
+    { "s16", WAV_FORMAT_PCM, 16 },
+    { "s24", WAV_FORMAT_PCM, 24 },
+    { "s32", WAV_FORMAT_PCM, 32 },
+    { "float", WAV_FORMAT_IEEE_FLOAT, 32 },
+};
+#define NUM_FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+// One sample in, what it should come out as
+struct Golden {
+    uint8_t format_index;
+    uint8_t in[4];
+    int16_t out;
+};
+
+#define F32(x) { (x) & 0xFF, ((x) >> 8) & 0xFF, ((x) >> 16) & 0xFF, (x) >> 24 }
+
+static const struct Golden golden[] = {
+    { 0, { 0x00 }, -32768 }, { 0, { 0x80 }, 0 }, { 0, { 0xFF }, 32512 }, { 0, { 0x7F }, -256 },
+    { 1, { 0x34, 0x12 }, 0x1234 }, { 1, { 0x00, 0x80 }, -32768 }, { 1, { 0xFF, 0xFF }, -1 },
+    { 2, { 0xFF, 0x34, 0x12 }, 0x1234 }, { 2, { 0x00, 0x00, 0x80 }, -32768 }, { 2, { 0xFF, 0xFF, 0x7F }, 32767 },
+    { 3, { 0xFF, 0xFF, 0x34, 0x12 }, 0x1234 }, { 3, { 0x00, 0x00, 0x00, 0x80 }, -32768 },
+    { 4, F32(0x3F800000u), 32767 },     // 1.0
+    { 4, F32(0xBF800000u), -32768 },    // -1.0
+    { 4, F32(0x3F000000u), 16384 },     // 0.5
+    { 4, F32(0xBF000000u), -16384 },    // -0.5
+    { 4, F32(0x3F7FFFFFu), 32767 },     // Just under 1.0
+    { 4, F32(0x38000000u), 1 },         // 2^-15, one step
+    { 4, F32(0x37FFFFFFu), 0 },         // Just under one step
+    { 4, F32(0xB8000000u), -1 },
+    { 4, F32(0x00000000u), 0 },
+    { 4, F32(0x80000000u), 0 },         // -0.0
+    { 4, F32(0x40000000u), 32767 },     // 2.0, clipped
+    { 4, F32(0xC0000000u), -32768 },
+    { 4, F32(0x7F800000u), 32767 },     // Infinities
+    { 4, F32(0xFF800000u), -32768 },
+    { 4, F32(0x7FC00000u), 32767 },     // NaN
+    { 4, F32(0x00000001u), 0 },         // Denormal
+};
+
+static struct TestCard card;
+static struct FatPartition fat;
+
+static void SetInfo(struct WavInfo * info, const struct PcmFormat * format, uint16_t channels)
+{
+    memset(info, 0, sizeof(struct WavInfo));
+    info->format = format->format;
+    info->channels = channels;
+    info->sample_rate = 44100;
+    info->bits_per_sample = format->bits;
+    info->valid_bits = format->bits;
+    info->block_align = channels * (format->bits / 8);
+}
+
+/**
+ * What a sample should convert to, worked out the long way
+ */
+static int16_t Reference(const uint8_t * p, const struct PcmFormat * format)
+{
+    double v;
+    float f;
+
+    if(format->format == WAV_FORMAT_IEEE_FLOAT)
+    {
+        memcpy(&f, p, sizeof(f));
+        if(isnan(f))
+            return signbit(f) ? -32768 : 32767;
+        v = trunc((double)f * 32768.0);
+        if(v >= 32767.0)
+            return 32767;
+        if(v <= -32768.0)
+            return -32768;
+        return (int16_t)v;
+    }
+
+    if(format->bits == 8)
+        return (int16_t)((p[0] - 128) * 256);
+
+    // The most significant 16 bits
+    return (int16_t)(p[(format->bits / 8) - 2] | (p[(format->bits / 8) - 1] << 8));
+}
+
+/**
+ * Fills samples with a mix of noise and the values that trip conversions up
+ */
+static void FillSamples(uint8_t * data, uint32_t num_samples, const struct PcmFormat * format)
+{
+    uint32_t i, pick;
+    float f;
+
+    TestCard_Fill(data, num_samples * (format->bits / 8), format->bits + format->format);
+    if(format->format != WAV_FORMAT_IEEE_FLOAT)
+        return;
+
+    for(i = 0; i < num_samples; ++i)
+    {
+        memcpy(&pick, data + (i * 4), sizeof(pick));
+        switch(pick % 5)
+        {
+            case 0: f = ((float)(pick >> 8) / (1 << 24)) * 4.0f - 2.0f; break;        // Some out of range
+            case 1: f = ldexpf((float)(pick >> 8) / (1 << 24), -(int)(pick % 31)); break;   // Tiny
+            case 2: f = (pick & 0x100) ? 1.0f : -1.0f; break;
+            case 3: f = ldexpf((pick & 0x100) ? 1.0f : -1.0f, -15) * ((pick >> 9) % 4); break;
+            default: f = ((float)(pick >> 8) / (1 << 24)) * 2.0f - 1.0f; break;
+        }
+        memcpy(data + (i * 4), &f, sizeof(f));
+    }
+}
+
+/**
+ * The golden vectors, each put through the mono and the stereo kernel
+ */
+static void CheckGolden(void)
+{
+    struct PcmConverter pcm;
+    struct WavInfo info;
+    uint8_t in[16] __attribute__((aligned(4)));
+    int16_t out[4] __attribute__((aligned(4)));
+    const struct Golden * g;
+    uint32_t i, bytes;
+
+    for(i = 0; i < sizeof(golden) / sizeof(golden[0]); ++i)
+    {
+        g = &golden[i];
+        bytes = formats[g->format_index].bits / 8;
+
+        SetInfo(&info, &formats[g->format_index], 1);
+        Pcm_SelectConverter(&pcm, &info);
+        memcpy(in, g->in, bytes);
+        pcm.convert(out, in, 1);
+        CHECK(out[0] == g->out && out[1] == g->out, "%s mono: golden vector %u gave %d, %d not %d",
+                formats[g->format_index].name, i, out[0], out[1], g->out);
+
+        // In the right channel, with the left one something else
+        SetInfo(&info, &formats[g->format_index], 2);
+        Pcm_SelectConverter(&pcm, &info);
+        memset(in, 0, sizeof(in));
+        memcpy(in + bytes, g->in, bytes);
+        pcm.convert(out, in, 1);
+        CHECK(out[1] == g->out, "%s stereo: golden vector %u gave %d not %d", formats[g->format_index].name, i, out[1], g->out);
+    }
+}
+
+/**
+ * Formats there isn't a kernel for are turned down
+ */
+static void CheckSelection(void)
+{
+    static const struct PcmFormat odd[] = {
+        { "s12", WAV_FORMAT_PCM, 12 }, { "s20", WAV_FORMAT_PCM, 20 }, { "f64", WAV_FORMAT_IEEE_FLOAT, 64 },
+        { "ima", WAV_FORMAT_IMA_ADPCM, 4 }, { "flac", WAV_FORMAT_FLAC, 16 },
+    };
+    struct PcmConverter pcm;
+    struct WavInfo info;
+    uint32_t i;
+
+    for(i = 0; i < sizeof(odd) / sizeof(odd[0]); ++i)
+    {
+        SetInfo(&info, &odd[i], 2);
+        CHECK(!Pcm_SelectConverter(&pcm, &info) && pcm.convert == NULL, "There's a kernel for %s", odd[i].name);
+    }
+
+    SetInfo(&info, &formats[1], 3);
+    CHECK(!Pcm_SelectConverter(&pcm, &info), "There's a kernel for 3 channels");
+
+    // 16 bit samples padded out to 3 bytes each
+    SetInfo(&info, &formats[1], 2);
+    info.block_align = 6;
+    CHECK(!Pcm_SelectConverter(&pcm, &info), "A frame that isn't its samples back to back was taken");
+}
+
+/**
+ * Every kernel streams a whole track off the card through Pcm_Read, in
+ * reads of every size, and matches the reference
+ */
+static void CheckTracks(void)
+{
+    static uint8_t data[NUM_FORMATS][2][TRACK_FRAMES * PCM_MAX_IN_FRAME_SIZE];
+    static AudioFrame buffer[PCM_BUFFER_FRAMES];
+    struct PcmConverter pcm;
+    struct FatStream stream;
+    struct WavInfo info;
+    struct FatFile file;
+    uint32_t f, c, frame, n, want, read_size;
+    char name[16];
+    bool matches;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 32768, 4);
+    card.frag_percent = 20;
+    for(f = 0; f < NUM_FORMATS; ++f)
+    {
+        for(c = 0; c < 2; ++c)
+        {
+            FillSamples(data[f][c], TRACK_FRAMES * (c + 1), &formats[f]);
+            snprintf(name, sizeof(name), "PCM%u%u.RAW", f, c + 1);
+            TestCard_AddFile(&card, TESTCARD_ROOT, name, data[f][c], TRACK_FRAMES * (c + 1) * (formats[f].bits / 8), 0);
+        }
+    }
+
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat), "The card didn't open");
+
+    for(f = 0; f < NUM_FORMATS; ++f)
+    {
+        for(c = 0; c < 2; ++c)
+        {
+            snprintf(name, sizeof(name), "PCM%u%u   ", f, c + 1);
+            SetInfo(&info, &formats[f], c + 1);
+            if(!Fat_open(&fat, &file, name, "RAW") || !Pcm_SelectConverter(&pcm, &info))
+            {
+                CHECK(false, "Couldn't start %s %s", formats[f].name, c ? "stereo" : "mono");
+                continue;
+            }
+
+            Fat_OpenStream(&stream, &file, file.filesize);
+            matches = true;
+            frame = 0;
+            read_size = 1;
+            while(matches && (n = Pcm_Read(&pcm, &stream, (int16_t *)buffer, read_size)) > 0)
+            {
+                want = (TRACK_FRAMES - frame < read_size) ? TRACK_FRAMES - frame : read_size;
+                matches = (n == want);
+                for(uint32_t i = 0; matches && i < n; ++i, ++frame)
+                {
+                    const uint8_t * in = data[f][c] + (frame * info.block_align);
+                    matches = (buffer[i].left == Reference(in, &formats[f]) &&
+                            buffer[i].right == Reference(in + (c ? info.block_align / 2 : 0), &formats[f]));
+                }
+
+                // 1, 2, 3 ... up to a whole block and back round
+                read_size = (read_size % PCM_BUFFER_FRAMES) + 1;
+            }
+
+            CHECK(matches && frame == TRACK_FRAMES, "%s %s differs from the reference at frame %u",
+                    formats[f].name, c ? "stereo" : "mono", frame);
+        }
+    }
+}
+
+/**
+ * How long each kernel takes per frame on the host (a block at a time, the
+ * best of many runs)
+ */
+static void TimeKernels(void)
+{
+    static uint8_t in[PCM_BUFFER_FRAMES * PCM_MAX_IN_FRAME_SIZE] __attribute__((aligned(4)));
+    static AudioFrame out[PCM_BUFFER_FRAMES];
+    struct PcmConverter pcm;
+    struct WavInfo info;
+    struct timespec start, end;
+    double best, ns;
+    uint32_t f, c, run;
+
+    for(f = 0; f < NUM_FORMATS; ++f)
+    {
+        for(c = 1; c <= 2; ++c)
+        {
+            SetInfo(&info, &formats[f], c);
+            Pcm_SelectConverter(&pcm, &info);
+            FillSamples(in, PCM_BUFFER_FRAMES * c, &formats[f]);
+
+            best = 1e9;
+            for(run = 0; run < 2000; ++run)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                pcm.convert((int16_t *)out, in, PCM_BUFFER_FRAMES);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+                if(ns < best)
+                    best = ns;
+            }
+
+            printf("PCM %-5s %s: %.2fns a frame on the host\n", formats[f].name, (c == 1) ? "mono  " : "stereo", best / PCM_BUFFER_FRAMES);
+        }
+    }
+}
+
+int main(void)
+{
+    CheckGolden();
+    CheckSelection();
+    Check_Boot("Tracks", CheckTracks);
+    TimeKernels();
+    return Check_Result("test_pcm");
+}
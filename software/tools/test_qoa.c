@@ -0,0 +1,232 @@
+/*
+ * File:   test_qoa.c
+ *
+ * Created on October 17, 2026
+ *
+ * Checks the firmware's QOA decoder (qoa.c) bit for bit against FFmpeg's.
+ * The files in qoa/ were made by a Python port of the reference qoa.h
+ * encoder, and each one's decode by FFmpeg 7.0.2 (which agreed with a port
+ * of qoa.h's decoder) is kept here as an MD5. Each is streamed off the
+ * simulated card through Qoa_Read, in reads of every size, and has to come
+ * out the same. Also checks a file cut short stops on a slice, and reports
+ * what QOA costs against 16 bit PCM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "testcard.h"
+#include "md5.h"
+#include "qoa.h"
+#include "fat.h"
+#include "sd.h"
+#include "wav.h"
+
+#define FIXTURE_DIR "qoa/"
+#define MAX_FIXTURE_SIZE (16 * 1024)
+#define MAX_FRAMES 16384
+
+// Most frames asked for in one Qoa_Read
+#define MAX_READ 300
+
+// The files in qoa/, and the MD5 of FFmpeg's decode of each (16 bit little endian, interleaved)
+struct Fixture {
+    const char * name;
+    uint32_t sample_rate;
+    uint8_t channels;
+    uint32_t frames;
+    const char * md5;
+    const char * what;
+};
+
+static const struct Fixture fixtures[] = {
+    { "QS44", 44100, 2, 12345, "1d7ec37dfd42185cd00e0bf7fe2ffde7", "3 QOA frames, the last ending on a 5 frame slice" },
+    { "QM22", 22050, 1, 6000, "77d889a74740f74f6f84c0c955be5309", "mono, 2 QOA frames" },
+    { "Q7", 48000, 2, 7, "576d9d65ee7b78e96a0381fd7c687127", "7 frames, one short slice" },
+    { "QLOUD", 44100, 2, 10240, "70b6b33b12a9758d2efbc6a998d83374", "silence, full scale square waves and noise" },
+};
+#define NUM_FIXTURES (sizeof(fixtures) / sizeof(fixtures[0]))
+
+static struct TestCard card;
+static struct FatPartition fat;
+static struct QoaDecoder dec;
+
+static uint8_t files[NUM_FIXTURES][MAX_FIXTURE_SIZE];
+static uint32_t file_sizes[NUM_FIXTURES];
+
+static bool LoadFixture(uint32_t f)
+{
+    char path[64];
+    FILE * in;
+
+    snprintf(path, sizeof(path), FIXTURE_DIR "%s.qoa", fixtures[f].name);
+    for(char * c = path + strlen(FIXTURE_DIR); *c; c++)
+        *c = (*c >= 'A' && *c <= 'Z') ? *c + ('a' - 'A') : *c;
+
+    in = fopen(path, "rb");
+    if(in == NULL)
+        return false;
+    file_sizes[f] = fread(files[f], 1, MAX_FIXTURE_SIZE, in);
+    fclose(in);
+
+    return file_sizes[f] > QOA_FILE_HEADER_SIZE && file_sizes[f] < MAX_FIXTURE_SIZE && memcmp(files[f], "qoaf", 4) == 0;
+}
+
+/**
+ * Opens a file on the card and decodes it all, in reads of random sizes
+ *
+ * @return Frames decoded, 0 if it wouldn't open
+ */
+static uint32_t Decode(const char * name, struct WavInfo * info, int16_t * out)
+{
+    struct FatStream stream;
+    struct FatFile file;
+    char padded[9];
+    uint32_t got = 0, n;
+
+    snprintf(padded, sizeof(padded), "%-8s", name);
+    if(!Fat_open(&fat, &file, padded, "QOA") || !Qoa_ReadInfo(&file, info))
+        return 0;
+
+    Qoa_Init(&dec, info);
+    Fat_OpenStream(&stream, &file, info->data_size);
+    while(got < MAX_FRAMES && (n = Qoa_Read(&dec, &stream, &out[got * 2], 1 + (rand() % MAX_READ))) > 0)
+        got += n;
+
+    return got;
+}
+
+/**
+ * What FFmpeg's decode hashes to, from the MD5 of a decode into 16 bit stereo
+ */
+static void Digest(const struct Fixture * fixture, const int16_t * out, uint32_t frames, char hex[33])
+{
+    static int16_t mono[MAX_FRAMES];
+    struct Md5 md5;
+    uint8_t digest[16];
+    uint32_t i;
+
+    Md5_Init(&md5);
+    if(fixture->channels == 1)
+    {
+        for(i = 0; i < frames; i++)
+            mono[i] = out[i * 2];
+        Md5_Update(&md5, mono, frames * 2);
+    }
+    else
+        Md5_Update(&md5, out, frames * 4);
+    Md5_Final(&md5, digest);
+
+    for(i = 0; i < 16; i++)
+        sprintf(&hex[i * 2], "%02x", digest[i]);
+}
+
+/**
+ * Every fixture decodes to what FFmpeg made of it, reading each sector of
+ * the file once
+ */
+static void CheckFixtures(void)
+{
+    static int16_t out[MAX_FRAMES * 2];
+    const struct Fixture * fixture;
+    struct WavInfo info;
+    uint64_t sectors;
+    uint32_t f, i, got, split;
+    double bus_seconds, audio_seconds, ns;
+    struct timespec start, end;
+    char name[16], hex[33];
+
+    TestCard_Format(&card, FAT_FS_FAT16, 65536, 4);
+    card.frag_percent = 20;
+    for(f = 0; f < NUM_FIXTURES; ++f)
+    {
+        CHECK(LoadFixture(f), "Couldn't load " FIXTURE_DIR "%s", fixtures[f].name);
+        snprintf(name, sizeof(name), "%s.QOA", fixtures[f].name);
+        TestCard_AddFile(&card, TESTCARD_ROOT, name, files[f], file_sizes[f], 0);
+    }
+
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat), "The card didn't open");
+
+    for(f = 0; f < NUM_FIXTURES; ++f)
+    {
+        fixture = &fixtures[f];
+        Pic32_ResetStats();
+        Pic32_WatchSectors(card.fat_sector, card.fat_sectors * card.num_fats);
+        got = Decode(fixture->name, &info, out);
+        bus_seconds = pic32_sd.bus_seconds;
+        sectors = pic32_sd.sectors_read - pic32_sd.watched_reads;
+
+        CHECK(info.sample_rate == fixture->sample_rate && info.channels == fixture->channels && info.bits_per_sample == 16 &&
+                info.frames == fixture->frames, "%s reads as %uHz, %u channels, %u bits, %u frames", fixture->name,
+                info.sample_rate, info.channels, info.bits_per_sample, info.frames);
+        CHECK(got == fixture->frames, "%s decoded to %u frames of %u", fixture->name, got, fixture->frames);
+
+        Digest(fixture, out, got, hex);
+        CHECK(strcmp(hex, fixture->md5) == 0, "%s decodes to %s, FFmpeg's decode is %s", fixture->name, hex, fixture->md5);
+
+        for(i = 0, split = 0; fixture->channels == 1 && i < got; i++)
+            split += out[(i * 2) + 1] != out[i * 2];
+        CHECK(split == 0, "%u frames of %s aren't the same both sides", split, fixture->name);
+
+        CHECK(sectors <= (file_sizes[f] + SECTOR_SIZE - 1) / SECTOR_SIZE + 1, "%s read %llu sectors for %u bytes",
+                fixture->name, (unsigned long long)sectors, file_sizes[f]);
+
+        // What it takes to stream, against 16 bit PCM of the same track
+        audio_seconds = (double)got / fixture->sample_rate;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        Decode(fixture->name, &info, out);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+        printf("%-5s %-48s %6.0f bytes/s off the card (16 bit PCM %6.0f), %4.1fms of SPI a second, %5.1fns a frame on the host\n",
+                fixture->name, fixture->what, file_sizes[f] / audio_seconds, (double)fixture->sample_rate * fixture->channels * 2,
+                bus_seconds / audio_seconds * 1e3, ns / got);
+    }
+}
+
+/**
+ * A file cut short part way through a slice plays up to the last whole
+ * slice and stops there
+ */
+static void CheckTruncated(void)
+{
+    static int16_t whole[MAX_FRAMES * 2], cut[MAX_FRAMES * 2];
+    struct WavInfo info;
+    uint32_t whole_frames, cut_frames, size;
+
+    CHECK(LoadFixture(0), "Couldn't load " FIXTURE_DIR "%s", fixtures[0].name);
+
+    // Into the second QOA frame, 3 bytes into one of its slices
+    size = file_sizes[0] / 2 + 3;
+    size -= (size - QOA_FILE_HEADER_SIZE) % QOA_SLICE_SIZE;
+    size += 3;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 65536, 4);
+    TestCard_AddFile(&card, TESTCARD_ROOT, "WHOLE.QOA", files[0], file_sizes[0], 0);
+    TestCard_AddFile(&card, TESTCARD_ROOT, "CUT.QOA", files[0], size, 0);
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat), "The card didn't open");
+
+    whole_frames = Decode("WHOLE", &info, whole);
+    cut_frames = Decode("CUT", &info, cut);
+
+    CHECK(cut_frames > 5120 && cut_frames < whole_frames && cut_frames % QOA_SLICE_LEN == 0,
+            "Cut short, %u frames of %u came out", cut_frames, whole_frames);
+    CHECK(memcmp(cut, whole, cut_frames * 4) == 0, "Cut short, the frames that came out changed");
+}
+
+int main(void)
+{
+    srand(22);
+    Check_Boot("Fixtures", CheckFixtures);
+    Check_Boot("Truncated", CheckTruncated);
+    return Check_Result("test_qoa");
+}
@@ -0,0 +1,354 @@
+/*
+ * File:   test_resample.c
+ *
+ * Created on October 17, 2026
+ *
+ * Checks the firmware's fixed point resampler (resample.c) against the same
+ * Kaiser windowed sinc worked out in double precision at the exact position
+ * of every output frame, then measures what each quality preset does to a
+ * signal: THD+N of a 1KHz tone, passband ripple, and how much of a tone
+ * above the new Nyquist rate aliases back when going down in rate. Also
+ * checks block boundaries don't change the output, and times each preset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "check.h"
+#include "resample.h"
+
+// Input frames in each test signal, and the output frames at either end left
+// out of measurements while the filter fills up and empties
+#define SIGNAL_FRAMES 24000
+#define EDGE_FRAMES 100
+
+// The DMA block size the player resamples into
+#define BLOCK_FRAMES 128
+
+// What resample.c's presets are built from, for the reference filter
+struct Preset {
+    const char * name;
+    unsigned taps;
+    double passband;            // Cutoff, as a fraction of the lower Nyquist rate
+    double beta;
+
+    // What it has to manage
+    double max_thdn_db;
+    double ripple_band;         // Fraction of the lower Nyquist rate the ripple is measured up to
+    double max_ripple_db;       // Going down in rate droops the most, the window is fewer output frames long
+    double max_alias_db;
+};
+
+static const struct Preset presets[] = {
+    { "low", 8, 0.80, 5.0, -50.0, 0.25, 0.5, -12.0 },        // RESAMPLE_QUALITY_LOW
+    { "medium", 16, 0.88, 7.0, -72.0, 0.50, 0.3, -18.0 },    // RESAMPLE_QUALITY_MEDIUM
+    { "high", 32, 0.93, 9.0, -72.0, 0.70, 0.2, -28.0 },      // RESAMPLE_QUALITY_HIGH
+};
+
+// Rates the DAC has no plan for, and what DAC_ClosestSampleRate makes of them
+static const uint32_t rate_pairs[][2] = {
+    { 11025, 16000 }, { 12000, 16000 }, { 37800, 44100 },
+    { 64000, 88200 }, { 176400, 96000 }, { 192000, 96000 },
+};
+
+static struct Resampler rs;
+static int16_t in[SIGNAL_FRAMES * 2];
+static int16_t out[SIGNAL_FRAMES * 4 * 2];
+
+/**
+ * Resamples a whole signal the way the player does, an output block at a
+ * time with the input coming in whatever lumps the decoder gives
+ *
+ * @param lumps Give the input in random sized lumps instead of all at once
+ *
+ * @return The output frames made
+ */
+static uint32_t Run(const int16_t * signal, uint32_t frames, int16_t * output, uint32_t max_frames, bool lumps)
+{
+    uint32_t pos = 0, made = 0, used, block, lump;
+
+    while(made < max_frames && pos < frames)
+    {
+        block = (max_frames - made < BLOCK_FRAMES) ? max_frames - made : BLOCK_FRAMES;
+        lump = lumps ? 1 + (uint32_t)(rand() % 150) : frames - pos;
+        if(lump > frames - pos)
+            lump = frames - pos;
+
+        made += Resample_Process(&rs, &output[made * 2], block, &signal[pos * 2], lump, &used);
+        pos += used;
+    }
+
+    return made;
+}
+
+/**
+ * Fills the input with a tone, and an unrelated one on the right
+ */
+static void MakeTone(uint32_t rate, double freq, double amplitude)
+{
+    uint32_t i;
+
+    for(i = 0; i < SIGNAL_FRAMES; i++)
+    {
+        in[i * 2] = (int16_t)lrint(amplitude * sin(2 * M_PI * freq * i / rate));
+        in[(i * 2) + 1] = (int16_t)lrint(amplitude * 0.5 * sin(2 * M_PI * 997.0 * i / rate));
+    }
+}
+
+/**
+ * Fits a sine at a frequency to the left channel, away from the edges
+ *
+ * @param amplitude Set to the sine's amplitude
+ *
+ * @return The RMS of what's left over, noise and distortion
+ */
+static double FitSine(const int16_t * signal, uint32_t frames, double freq, double * amplitude)
+{
+    double ss = 0, cc = 0, sc = 0, ys = 0, yc = 0, a, b, s, c, det, residual = 0, v;
+    uint32_t i;
+
+    for(i = EDGE_FRAMES; i < frames - EDGE_FRAMES; i++)
+    {
+        s = sin(2 * M_PI * freq * i);
+        c = cos(2 * M_PI * freq * i);
+        ss += s * s;
+        cc += c * c;
+        sc += s * c;
+        ys += signal[i * 2] * s;
+        yc += signal[i * 2] * c;
+    }
+
+    det = (ss * cc) - (sc * sc);
+    a = ((ys * cc) - (yc * sc)) / det;
+    b = ((yc * ss) - (ys * sc)) / det;
+
+    for(i = EDGE_FRAMES; i < frames - EDGE_FRAMES; i++)
+    {
+        v = signal[i * 2] - (a * sin(2 * M_PI * freq * i)) - (b * cos(2 * M_PI * freq * i));
+        residual += v * v;
+    }
+
+    *amplitude = sqrt((a * a) + (b * b));
+    return sqrt(residual / (frames - (2 * EDGE_FRAMES)));
+}
+
+static double BesselI0(double x)
+{
+    double sum = 1, term = 1;
+    int k;
+
+    for(k = 1; k < 40; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+/**
+ * The fixed point output against the filter worked out in double precision
+ * at exactly where each output frame falls, on music-like input (two tones
+ * and noise)
+ *
+ * @return How far below the signal the difference is, in dB
+ */
+static double CompareToReference(const struct Preset * preset, uint32_t in_rate, uint32_t out_rate, double * lsb_rms)
+{
+    double half = preset->taps / 2.0, cutoff = 0.5 * preset->passband, t0, frac, t, x, h, acc, sum, diff;
+    double error = 0, signal = 0;
+    uint32_t i, m, made, k, count = 0;
+    int64_t n, n0;
+    int channel;
+
+    if(out_rate < in_rate)
+        cutoff = cutoff * out_rate / in_rate;
+
+    for(i = 0; i < SIGNAL_FRAMES; i++)
+    {
+        in[i * 2] = (int16_t)lrint((9000 * sin(2 * M_PI * 997.0 * i / in_rate)) +
+                (6000 * sin(2 * M_PI * 0.3 * fmin(in_rate, out_rate) * i / in_rate)) + ((rand() % 2001) - 1000));
+        in[(i * 2) + 1] = (int16_t)lrint((12000 * sin(2 * M_PI * 0.2 * fmin(in_rate, out_rate) * i / in_rate)) + ((rand() % 2001) - 1000));
+    }
+
+    made = Run(in, SIGNAL_FRAMES, out, sizeof(out) / sizeof(out[0]) / 2, true);
+
+    for(m = EDGE_FRAMES; m < made - EDGE_FRAMES; m++)
+    {
+        t0 = (double)m * in_rate / out_rate;
+        n0 = (int64_t)floor(t0);
+        frac = t0 - n0;
+
+        for(channel = 0; channel < 2; channel++)
+        {
+            acc = sum = 0;
+            for(k = 0; k < preset->taps; k++)
+            {
+                n = n0 - (int64_t)(half - 1) + k;
+                t = k - (half - 1) - frac;
+                x = t / half;
+                if(x <= -1 || x >= 1)
+                    continue;
+                h = (t == 0) ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+                h *= BesselI0(preset->beta * sqrt(1 - (x * x))) / BesselI0(preset->beta);
+                sum += h;
+                acc += h * ((n >= 0 && n < SIGNAL_FRAMES) ? in[(n * 2) + channel] : 0);
+            }
+
+            diff = out[(m * 2) + channel] - (acc / sum);
+            error += diff * diff;
+            signal += (acc / sum) * (acc / sum);
+            count++;
+        }
+    }
+
+    *lsb_rms = sqrt(error / count);
+    return 10 * log10(signal / error);
+}
+
+/**
+ * Every preset at every pair of rates: close to the double precision
+ * reference, clean, flat, and not letting much alias through
+ */
+static void CheckQuality(void)
+{
+    const struct Preset * preset;
+    double snr, lsb_rms, amplitude, residual, thdn, gain, low, high, nyquist, alias, power;
+    uint32_t q, p, k, made, i, in_rate, out_rate;
+
+    for(q = 0; q < sizeof(presets) / sizeof(presets[0]); q++)
+    {
+        preset = &presets[q];
+        printf("%s (%u taps)\n", preset->name, preset->taps);
+
+        for(p = 0; p < sizeof(rate_pairs) / sizeof(rate_pairs[0]); p++)
+        {
+            in_rate = rate_pairs[p][0];
+            out_rate = rate_pairs[p][1];
+            nyquist = fmin(in_rate, out_rate) / 2;
+            memset(&rs, 0, sizeof(rs));
+            Resample_Configure(&rs, in_rate, out_rate, q);
+            CHECK(rs.taps == preset->taps, "The %s preset has %u taps", preset->name, rs.taps);
+
+            snr = CompareToReference(preset, in_rate, out_rate, &lsb_rms);
+            CHECK(snr > 65, "%s %u to %u is only %.1fdB from the double precision reference", preset->name, in_rate, out_rate, snr);
+
+            // A 1KHz tone at -1dBFS
+            Resample_Reset(&rs);
+            MakeTone(in_rate, 1000, 32767 * pow(10, -1 / 20.0));
+            made = Run(in, SIGNAL_FRAMES, out, sizeof(out) / sizeof(out[0]) / 2, true);
+            residual = FitSine(out, made, 1000.0 / out_rate, &amplitude);
+            thdn = 20 * log10(residual / (amplitude / sqrt(2)));
+            CHECK(thdn < preset->max_thdn_db, "%s %u to %u has %.1fdB THD+N", preset->name, in_rate, out_rate, thdn);
+
+            // Gain across the passband
+            low = 1e9;
+            high = -1e9;
+            for(k = 1; k <= 10; k++)
+            {
+                Resample_Reset(&rs);
+                MakeTone(in_rate, nyquist * preset->ripple_band * k / 10, 16000);
+                made = Run(in, SIGNAL_FRAMES, out, sizeof(out) / sizeof(out[0]) / 2, false);
+                FitSine(out, made, nyquist * preset->ripple_band * k / 10 / out_rate, &amplitude);
+                gain = 20 * log10(amplitude / 16000);
+                low = fmin(low, gain);
+                high = fmax(high, gain);
+            }
+            CHECK(high - low < preset->max_ripple_db && fabs(high) < preset->max_ripple_db,
+                    "%s %u to %u has %+.3f to %+.3fdB of ripple up to %.0fHz", preset->name, in_rate, out_rate, low, high, nyquist * preset->ripple_band);
+
+            printf("  %6u to %-6u  %5.1fdB from the reference (%.2f LSB RMS)  THD+N %6.1fdB  %+.3f to %+.3fdB up to %5.0fHz",
+                    in_rate, out_rate, snr, lsb_rms, thdn, low, high, nyquist * preset->ripple_band);
+
+            // A tone 15% above the new Nyquist rate, which should be filtered out
+            if(out_rate < in_rate)
+            {
+                Resample_Reset(&rs);
+                MakeTone(in_rate, out_rate / 2 * 1.15, 16000);
+                made = Run(in, SIGNAL_FRAMES, out, sizeof(out) / sizeof(out[0]) / 2, false);
+                for(power = 0, i = EDGE_FRAMES; i < made - EDGE_FRAMES; i++)
+                    power += (double)out[i * 2] * out[i * 2];
+                alias = 20 * log10(sqrt(power / (made - (2 * EDGE_FRAMES))) / (16000 / sqrt(2)));
+                CHECK(alias < preset->max_alias_db, "%s %u to %u lets an alias through at %.1fdB", preset->name, in_rate, out_rate, alias);
+                printf("  alias %.1fdB", alias);
+            }
+            printf("\n");
+        }
+    }
+}
+
+/**
+ * The output doesn't depend on how the input is lumped together or where
+ * the blocks fall, the position never drifts, and a reset starts over
+ */
+static void CheckBlocks(void)
+{
+    static int16_t whole[SIGNAL_FRAMES * 4 * 2];
+    uint32_t p, q, made_whole, made, expected;
+
+    for(q = 0; q < sizeof(presets) / sizeof(presets[0]); q++)
+    {
+        for(p = 0; p < sizeof(rate_pairs) / sizeof(rate_pairs[0]); p++)
+        {
+            memset(&rs, 0, sizeof(rs));
+            Resample_Configure(&rs, rate_pairs[p][0], rate_pairs[p][1], q);
+            MakeTone(rate_pairs[p][0], 1234, 20000);
+            made_whole = Run(in, SIGNAL_FRAMES, whole, sizeof(whole) / sizeof(whole[0]) / 2, false);
+
+            Resample_Reset(&rs);
+            made = Run(in, SIGNAL_FRAMES, out, sizeof(out) / sizeof(out[0]) / 2, true);
+            CHECK(made == made_whole && memcmp(out, whole, made * 4) == 0,
+                    "%s %u to %u changes with the input's lumps", presets[q].name, rate_pairs[p][0], rate_pairs[p][1]);
+
+            // Output frame m is at input frame m * in_rate / out_rate, and the window runs taps / 2 ahead of it
+            expected = (uint32_t)(((uint64_t)(SIGNAL_FRAMES - (presets[q].taps / 2)) * rate_pairs[p][1] + rate_pairs[p][0] - 1) / rate_pairs[p][0]);
+            CHECK(made_whole >= expected - 1 && made_whole <= expected + 1, "%s %u to %u made %u frames out of %u, not %u",
+                    presets[q].name, rate_pairs[p][0], rate_pairs[p][1], made_whole, SIGNAL_FRAMES, expected);
+        }
+    }
+}
+
+/**
+ * How long each preset takes per output frame on the host
+ */
+static void Benchmark(void)
+{
+    struct timespec start, end;
+    double ns, best;
+    uint32_t q, i, made = 0;
+    int run;
+
+    for(i = 0; i < SIGNAL_FRAMES * 2; i++)
+        in[i] = rand();
+
+    printf("Host time per output frame, 44100 to 48000:");
+    for(q = 0; q < sizeof(presets) / sizeof(presets[0]); q++)
+    {
+        best = 1e30;
+        for(run = 0; run < 5; run++)
+        {
+            memset(&rs, 0, sizeof(rs));
+            Resample_Configure(&rs, 44100, 48000, q);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            made = Run(in, SIGNAL_FRAMES, out, sizeof(out) / sizeof(out[0]) / 2, false);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+            best = fmin(best, ns / made);
+        }
+        printf("  %s %.1fns (%u multiply-accumulates)", presets[q].name, best, presets[q].taps * 2);
+    }
+    printf("\n");
+}
+
+int main(void)
+{
+    srand(1);
+    Check_Boot("Quality", CheckQuality);
+    Check_Boot("Blocks", CheckBlocks);
+    Benchmark();
+    return Check_Result("test_resample");
+}
@@ -0,0 +1,235 @@
+/*
+ * File:   test_ring.c
+ *
+ * Created on October 17, 2026
+ *
+ * Checks the audio ring rides out the card stalling. main.c plays a track
+ * of each codec round and round on the simulated PIC32, with decoding
+ * charged to the clock (decode_cost.h), while the card holds up a read
+ * every 100 to 200ms. The longest stall each codec gets through without
+ * the ring running dry is found for the AUDIO_RING_BLOCKS it's built with,
+ * and has to be at least RING_STALL_MS. Build with -DAUDIO_RING_BLOCKS=n
+ * to see what another depth buys.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "testcard.h"
+#include "player.h"
+#include "decode_cost.h"
+
+// The player, with its main() out of the way, and its pause() out of unistd.h's
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#define main Firmware_Main
+#define pause Firmware_Pause
+#include "main.c"
+#undef main
+#undef pause
+#pragma GCC diagnostic pop
+
+#define SAMPLE_RATE 44100
+#define MAX_FILE_SIZE (64 * 1024)
+#define CAPTURE_FRAMES 1024
+
+// Stalls every codec has to get through with the default ring
+#define RING_STALL_MS 30
+
+// Audio played in each trial
+#define TRIAL_SECONDS 3.0
+
+// How finely the longest stall is found
+#define STALL_STEP_MS 0.25
+
+// A track of each codec, all at 44.1KHz stereo so none of them is resampled
+struct RingTrack {
+    const char * name;          // 8.3, as it's put on the card
+    const char * fixture;       // Where it comes from, or NULL to make a 16 bit WAV
+    const char * what;
+};
+
+static const struct RingTrack ring_tracks[] = {
+    { "PCM.WAV", NULL, "16 bit PCM" },
+    { "IMA.WAV", "adpcm/ima.wav", "IMA ADPCM" },
+    { "QS44.QOA", "qoa/qs44.qoa", "QOA" },
+    { "LF5S44.FLA", "flac/lf5s44.fla", "FLAC, 4096 frame blocks" },
+};
+#define NUM_TRACKS (sizeof(ring_tracks) / sizeof(ring_tracks[0]))
+
+static struct TestCard cards[NUM_TRACKS];
+static uint8_t file[MAX_FILE_SIZE];
+static int16_t capture[CAPTURE_FRAMES * 2];
+
+static void Put16(uint8_t * p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void Put32(uint8_t * p, uint32_t v)
+{
+    Put16(p, v & 0xFFFF);
+    Put16(p + 2, v >> 16);
+}
+
+/**
+ * Makes a 16 bit stereo WAV of a tone
+ *
+ * @return Its size
+ */
+static uint32_t MakeWav(uint8_t * wav, uint32_t frames)
+{
+    uint32_t data_size = frames * 4, i;
+
+    memcpy(wav, "RIFF", 4);
+    Put32(wav + 4, 36 + data_size);
+    memcpy(wav + 8, "WAVEfmt ", 8);
+    Put32(wav + 16, 16);
+    Put16(wav + 20, WAV_FORMAT_PCM);
+    Put16(wav + 22, 2);
+    Put32(wav + 24, SAMPLE_RATE);
+    Put32(wav + 28, SAMPLE_RATE * 4);
+    Put16(wav + 32, 4);
+    Put16(wav + 34, 16);
+    memcpy(wav + 36, "data", 4);
+    Put32(wav + 40, data_size);
+
+    for(i = 0; i < frames * 2; i++)
+        Put16(wav + 44 + (i * 2), (int16_t)(10000 * sin(i * 0.031)));
+
+    return 44 + data_size;
+}
+
+/**
+ * Puts each track on a card of its own, which it loops round on
+ */
+static bool MakeCards(void)
+{
+    FILE * in;
+    uint32_t t, size;
+
+    for(t = 0; t < NUM_TRACKS; t++)
+    {
+        if(ring_tracks[t].fixture == NULL)
+            size = MakeWav(file, 12000);
+        else
+        {
+            in = fopen(ring_tracks[t].fixture, "rb");
+            if(in == NULL)
+                return false;
+            size = fread(file, 1, MAX_FILE_SIZE, in);
+            fclose(in);
+        }
+
+        TestCard_Format(&cards[t], FAT_FS_FAT16, 65536, 4);
+        cards[t].frag_percent = 20;
+        TestCard_AddFile(&cards[t], TESTCARD_ROOT, ring_tracks[t].name, file, size, 0);
+    }
+
+    return true;
+}
+
+/**
+ * Plays a track for TRIAL_SECONDS with the card stalling for so long every
+ * 100 to 200ms, at the same moments whatever the length
+ *
+ * Each trial is a boot of its own in a process of its own, as Check_Boot
+ * does it, so none of the firmware's statics carry over.
+ *
+ * @return The blocks of silence sent, 255 at most, or -1 if the stalls
+ *         didn't all happen
+ */
+static int Trial(uint32_t t, double stall_ms)
+{
+    uint32_t stalls = 0, boot_underruns, underruns;
+    double next_stall;
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if(pid == 0)
+    {
+        srand(25);
+        Player_Boot(cards[t].image, cards[t].size, capture, CAPTURE_FRAMES);
+
+        // main() starts the DMA before the ring's filled, so it boots into silence
+        Player_Pass();
+        boot_underruns = audio_ring.underruns;
+
+        next_stall = 0.1;
+        while(pic32_i2s.num_frames < TRIAL_SECONDS * SAMPLE_RATE)
+        {
+            if(pic32_seconds >= next_stall)
+            {
+                Pic32_StallCard(stall_ms / 1e3);
+                next_stall = pic32_seconds + 0.1 + (rand() % 100) / 1e3;
+                stalls++;
+            }
+            Player_Pass();
+        }
+
+        underruns = audio_ring.underruns - boot_underruns + (pic32_i2s.late_frames > 0);
+        if(stall_ms > 0 && pic32_sd.stalls + 1 < stalls)
+            _exit(254);
+        _exit((underruns < 253) ? underruns : 253);
+    }
+
+    waitpid(pid, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) == 254)
+        return -1;
+
+    return WEXITSTATUS(status);
+}
+
+/**
+ * Every codec rides out a RING_STALL_MS stall, and the longest it can is
+ * found, along with what too long a stall does
+ */
+static void CheckStalls(void)
+{
+    double ring_ms = AUDIO_RING_BLOCKS * AUDIO_BLOCK_FRAMES * 1e3 / SAMPLE_RATE;
+    double low, high, mid;
+    uint32_t t;
+    int underruns;
+
+    CHECK(MakeCards(), "Couldn't make the cards");
+
+    printf("A ring of %u blocks (%u bytes, %.1fms at 44.1KHz) rides out card stalls of\n", AUDIO_RING_BLOCKS,
+            (uint32_t)sizeof(audio_ring.blocks), ring_ms);
+    for(t = 0; t < NUM_TRACKS; t++)
+    {
+        underruns = Trial(t, 0);
+        CHECK(underruns == 0, "%s: %d underruns with the card never stalling", ring_tracks[t].what, underruns);
+
+        underruns = Trial(t, RING_STALL_MS);
+        CHECK(underruns == 0, "%s: %d underruns with %dms stalls", ring_tracks[t].what, underruns, RING_STALL_MS);
+
+        underruns = Trial(t, ring_ms + 5);
+        CHECK(underruns > 0, "%s: %d underruns with stalls longer than the ring", ring_tracks[t].what, underruns);
+
+        // Between the longest stall got through and the shortest that wasn't
+        for(low = 0, high = ceil(ring_ms + 5); high - low > STALL_STEP_MS; )
+        {
+            mid = (low + high) / 2;
+            if(Trial(t, mid) == 0)
+                low = mid;
+            else
+                high = mid;
+        }
+        printf("  %5.1fms playing %s\n", low, ring_tracks[t].what);
+    }
+}
+
+int main(void)
+{
+    Check_Boot("Stalls", CheckStalls);
+    return Check_Result("test_ring");
+}
@@ -0,0 +1,320 @@
+/*
+ * File:   test_sd.c
+ *
+ * Created on October 17, 2026
+ *
+ * Runs the firmware's sd.c against the simulated card in pic32_sim.c and
+ * checks what it reads, and what it costs to read it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "sd.h"
+
+// A 1MiB card
+#define CARD_SECTORS 2048
+
+// Most CPU SPI transfers a DMA sector read should take (command, response,
+// waiting for the token, the CRC), a polled read was over 512
+#define MAX_CPU_BYTES_PER_SECTOR 32
+
+static uint8_t card[CARD_SECTORS * SECTOR_SIZE];
+static uint8_t expected[CARD_SECTORS * SECTOR_SIZE];
+
+/**
+ * Fills the card with bytes that differ from sector to sector and within each one
+ */
+static void FillCard(void)
+{
+    uint32_t state = 0x12345678;
+    size_t i;
+
+    for(i = 0; i < sizeof(card); ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        card[i] = state >> 24;
+    }
+    memcpy(expected, card, sizeof(card));
+}
+
+static void CheckInit(void)
+{
+    InitSD();
+
+    CHECK(strstr(pic32_uart_log, "Card is initialized") != NULL, "InitSD didn't finish: %s", pic32_uart_log);
+    CHECK(strstr(pic32_uart_log, "rror") == NULL, "InitSD reported an error: %s", pic32_uart_log);
+    CHECK(pic32_sd.errors == 0, "%u card errors during init", pic32_sd.errors);
+}
+
+/**
+ * Single sectors come off the card through the DMA, not SPI_Write
+ */
+static void CheckReadSector(void)
+{
+    static const uint32_t sectors[] = { 0, 1, 777, CARD_SECTORS - 1 };
+    uint8_t buffer[SECTOR_SIZE];
+    unsigned i;
+
+    for(i = 0; i < sizeof(sectors) / sizeof(sectors[0]); ++i)
+    {
+        Pic32_ResetStats();
+        memset(buffer, 0, sizeof(buffer));
+
+        SD_ReadSector(buffer, sectors[i]);
+
+        CHECK(memcmp(buffer, expected + (sectors[i] * SECTOR_SIZE), SECTOR_SIZE) == 0,
+                "SD_ReadSector(%u) read the wrong data", sectors[i]);
+        CHECK(pic32_sd.dma_bytes == SECTOR_SIZE && pic32_sd.dma_transfers == 1,
+                "SD_ReadSector(%u) moved %llu bytes in %u DMA transfers", sectors[i],
+                (unsigned long long)pic32_sd.dma_bytes, pic32_sd.dma_transfers);
+        CHECK(pic32_sd.dma_dest == (uintptr_t)buffer, "SD_ReadSector(%u) didn't DMA into the buffer", sectors[i]);
+        CHECK(pic32_sd.cpu_bytes <= MAX_CPU_BYTES_PER_SECTOR,
+                "SD_ReadSector(%u) clocked %llu bytes through the CPU", sectors[i],
+                (unsigned long long)pic32_sd.cpu_bytes);
+        CHECK(pic32_sd.commands[17] == 1, "SD_ReadSector(%u) sent %u CMD17s", sectors[i], pic32_sd.commands[17]);
+        CHECK(pic32_sd.errors == 0, "%u card errors in SD_ReadSector(%u)", pic32_sd.errors, sectors[i]);
+    }
+
+    printf("SD_ReadSector: %llu CPU bytes, %.1fus on the bus\n",
+            (unsigned long long)pic32_sd.cpu_bytes, pic32_sd.bus_seconds * 1e6);
+}
+
+/**
+ * A run of sectors is one CMD18, each sector its own DMA block
+ */
+static void CheckReadMultiSectors(void)
+{
+    static uint8_t buffer[16][SECTOR_SIZE];
+    const uint32_t start = 1000;
+
+    Pic32_ResetStats();
+    SD_ReadMultiSectors(buffer, start, 16);
+
+    CHECK(memcmp(buffer, expected + (start * SECTOR_SIZE), sizeof(buffer)) == 0,
+            "SD_ReadMultiSectors read the wrong data");
+    CHECK(pic32_sd.dma_bytes == sizeof(buffer) && pic32_sd.dma_transfers == 16,
+            "SD_ReadMultiSectors moved %llu bytes in %u DMA transfers",
+            (unsigned long long)pic32_sd.dma_bytes, pic32_sd.dma_transfers);
+    CHECK(pic32_sd.dma_dest == (uintptr_t)buffer[15], "The last sector wasn't DMAed into place");
+    CHECK(pic32_sd.commands[18] == 1 && pic32_sd.commands[12] == 1,
+            "SD_ReadMultiSectors sent %u CMD18s and %u CMD12s", pic32_sd.commands[18], pic32_sd.commands[12]);
+    CHECK(pic32_sd.cpu_bytes <= 16 * MAX_CPU_BYTES_PER_SECTOR,
+            "SD_ReadMultiSectors clocked %llu bytes through the CPU", (unsigned long long)pic32_sd.cpu_bytes);
+    CHECK(pic32_sd.errors == 0, "%u card errors in SD_ReadMultiSectors", pic32_sd.errors);
+
+    printf("SD_ReadMultiSectors: %.1f CPU bytes and %.1fus on the bus per sector\n",
+            pic32_sd.cpu_bytes / 16.0, pic32_sd.bus_seconds * 1e6 / 16);
+}
+
+/**
+ * Refills that follow on from each other share one CMD18, only a jump restarts it
+ */
+static void CheckStreamRead(void)
+{
+    uint8_t buffer[1][SECTOR_SIZE];
+    double single_seconds;
+    uint32_t i;
+    bool matches = true;
+
+    // What a refill costs without the session
+    Pic32_ResetStats();
+    SD_ReadSector(buffer[0], 100);
+    single_seconds = pic32_sd.bus_seconds;
+
+    Pic32_ResetStats();
+    for(i = 0; i < 64; ++i)
+    {
+        SD_StreamRead(buffer, 100 + i, 1);
+        matches &= memcmp(buffer, expected + ((100 + i) * SECTOR_SIZE), SECTOR_SIZE) == 0;
+    }
+
+    CHECK(matches, "SD_StreamRead read the wrong data");
+    CHECK(pic32_sd.commands[18] == 1 && pic32_sd.commands[12] == 0 && pic32_sd.commands[17] == 0,
+            "64 sequential sectors sent %u CMD18s, %u CMD12s and %u CMD17s",
+            pic32_sd.commands[18], pic32_sd.commands[12], pic32_sd.commands[17]);
+    CHECK(pic32_sd.bus_seconds / 64 < single_seconds,
+            "A streamed sector took %.1fus, a CMD17 read %.1fus", pic32_sd.bus_seconds * 1e6 / 64, single_seconds * 1e6);
+
+    printf("SD_StreamRead: %.1fus on the bus per sector, %.1fus with a CMD17 each\n",
+            pic32_sd.bus_seconds * 1e6 / 64, single_seconds * 1e6);
+
+    // A jump stops the session and starts a new one
+    Pic32_ResetStats();
+    SD_StreamRead(buffer, 500, 1);
+    CHECK(memcmp(buffer, expected + (500 * SECTOR_SIZE), SECTOR_SIZE) == 0, "SD_StreamRead after a jump read the wrong data");
+    CHECK(pic32_sd.commands[12] == 1 && pic32_sd.commands[18] == 1,
+            "A jump sent %u CMD12s and %u CMD18s", pic32_sd.commands[12], pic32_sd.commands[18]);
+
+    // Anything else stops it first
+    Pic32_ResetStats();
+    SD_ReadSector(buffer[0], 501);
+    CHECK(memcmp(buffer, expected + (501 * SECTOR_SIZE), SECTOR_SIZE) == 0, "SD_ReadSector after a stream read the wrong data");
+    CHECK(pic32_sd.commands[12] == 1, "SD_ReadSector didn't stop the stream");
+
+    // Stopping twice only sends one CMD12
+    Pic32_ResetStats();
+    SD_StreamRead(buffer, 502, 1);
+    SD_StreamStop();
+    SD_StreamStop();
+    CHECK(pic32_sd.commands[12] == 1, "Two SD_StreamStops sent %u CMD12s", pic32_sd.commands[12]);
+    CHECK(pic32_sd.errors == 0, "%u card errors while streaming", pic32_sd.errors);
+}
+
+/**
+ * Small repeated reads (FAT entries, directory entries) come out of the LRU
+ * cache, and writes keep it in step with the card
+ */
+static void CheckReadCached(void)
+{
+    static uint8_t sectors[2][SECTOR_SIZE];
+    uint8_t entry[32], data[SECTOR_SIZE];
+    uint32_t hits = sd_cache_hits, misses = sd_cache_misses;
+    uint32_t i;
+    bool matches = true;
+
+    // A FAT walk: two byte entries all through the same two sectors
+    Pic32_ResetStats();
+    for(i = 0; i < 512; ++i)
+    {
+        SD_ReadCached(entry, (1200 * SECTOR_SIZE) + (i * 2), 2);
+        matches &= memcmp(entry, expected + (1200 * SECTOR_SIZE) + (i * 2), 2) == 0;
+    }
+
+    CHECK(matches, "SD_ReadCached read the wrong data");
+    CHECK(sd_cache_misses - misses == 2 && sd_cache_hits - hits == 510,
+            "512 FAT entries over 2 sectors took %u misses and %u hits",
+            sd_cache_misses - misses, sd_cache_hits - hits);
+    CHECK(pic32_sd.sectors_read == 2, "512 FAT entries read %llu sectors off the card",
+            (unsigned long long)pic32_sd.sectors_read);
+
+    // Bulk reads go around it
+    misses = sd_cache_misses;
+    SD_ReadData(data, 1500 * SECTOR_SIZE, SECTOR_SIZE);
+    SD_ReadCached(entry, 1200 * SECTOR_SIZE, 2);
+    CHECK(sd_cache_misses == misses, "SD_ReadData pushed a sector out of the cache");
+
+    // Once it's full the least recently used sector goes
+    for(i = 1; i <= SD_CACHE_SECTORS; ++i)
+        SD_ReadCached(entry, (1300 + i) * SECTOR_SIZE, sizeof(entry));
+    SD_ReadCached(entry, (1301 + SD_CACHE_SECTORS) * SECTOR_SIZE, sizeof(entry));
+    misses = sd_cache_misses;
+    SD_ReadCached(entry, 1302 * SECTOR_SIZE, sizeof(entry));
+    CHECK(sd_cache_misses == misses, "A sector used since the oldest one went too");
+    SD_ReadCached(entry, 1301 * SECTOR_SIZE, sizeof(entry));
+    CHECK(sd_cache_misses == misses + 1, "The least recently used sector wasn't the one to go");
+
+    // A cached sector that's written reads back as written, from RAM and from the card
+    memset(sectors, 0xA5, sizeof(sectors));
+    SD_ReadCached(entry, 1400 * SECTOR_SIZE, sizeof(entry));
+    CHECK(SD_WriteSector(sectors[0], 1400), "The card didn't take SD_WriteSector");
+    SD_ReadCached(entry, 1400 * SECTOR_SIZE, sizeof(entry));
+    CHECK(memcmp(entry, sectors[0], sizeof(entry)) == 0, "The cache still held the sector from before the write");
+    CHECK(memcmp(card + (1400 * SECTOR_SIZE), sectors[0], SECTOR_SIZE) == 0, "SD_WriteSector didn't reach the card");
+
+    memset(sectors[1], 0x5A, SECTOR_SIZE);
+    CHECK(SD_WriteMultiSectors((const uint8_t (*)[SECTOR_SIZE])sectors, 1400, 2), "The card didn't take SD_WriteMultiSectors");
+    SD_ReadCached(entry, 1401 * SECTOR_SIZE, sizeof(entry));
+    CHECK(memcmp(entry, sectors[1], sizeof(entry)) == 0, "SD_WriteMultiSectors didn't reach the card");
+    SD_ReadCached(entry, 1400 * SECTOR_SIZE, sizeof(entry));
+    CHECK(memcmp(entry, sectors[0], sizeof(entry)) == 0, "The cache lost the sector SD_WriteMultiSectors rewrote");
+    memcpy(expected + (1400 * SECTOR_SIZE), sectors, sizeof(sectors));
+
+    CHECK(pic32_sd.errors == 0, "%u card errors reading through the cache", pic32_sd.errors);
+}
+
+/**
+ * A sector aligned refill is DMAed straight into the caller's buffer
+ */
+static void CheckReadDataAligned(void)
+{
+    static uint8_t buffer[4][SECTOR_SIZE];
+
+    Pic32_ResetStats();
+    SD_ReadData(buffer[0], 600 * SECTOR_SIZE, SECTOR_SIZE);
+    CHECK(memcmp(buffer[0], expected + (600 * SECTOR_SIZE), SECTOR_SIZE) == 0, "An aligned SD_ReadData read the wrong data");
+    CHECK(pic32_sd.dma_transfers == 1 && pic32_sd.dma_dest == (uintptr_t)buffer[0],
+            "An aligned sector went through %u DMA transfers, not straight into the buffer", pic32_sd.dma_transfers);
+
+    Pic32_ResetStats();
+    SD_ReadData(buffer, 601 * SECTOR_SIZE, sizeof(buffer));
+    CHECK(memcmp(buffer, expected + (601 * SECTOR_SIZE), sizeof(buffer)) == 0, "An aligned multi-sector SD_ReadData read the wrong data");
+    CHECK(pic32_sd.dma_transfers == 4 && pic32_sd.dma_dest == (uintptr_t)buffer[3],
+            "4 aligned sectors went through %u DMA transfers, not straight into the buffer", pic32_sd.dma_transfers);
+
+    // Only a partial sector needs the bounce buffer
+    Pic32_ResetStats();
+    SD_ReadData(buffer[0], (610 * SECTOR_SIZE) + 3, 100);
+    CHECK(memcmp(buffer[0], expected + (610 * SECTOR_SIZE) + 3, 100) == 0, "An unaligned SD_ReadData read the wrong data");
+    CHECK(pic32_sd.dma_transfers == 1 && pic32_sd.dma_dest != (uintptr_t)buffer[0],
+            "A partial sector was DMAed into the caller's buffer");
+}
+
+/**
+ * Reads of any length at any offset match the image
+ */
+static void CheckReadDataAnywhere(void)
+{
+    static uint8_t buffer[8 * SECTOR_SIZE + 2];
+    uint32_t state = 1;
+    uint64_t start;
+    size_t size;
+    unsigned i, bad = 0;
+
+    Pic32_ResetStats();
+    for(i = 0; i < 2000; ++i)
+    {
+        state = (state * 1103515245) + 12345;
+        size = (state >> 8) % sizeof(buffer);
+        state = (state * 1103515245) + 12345;
+        start = ((uint64_t)(state >> 4) % (sizeof(card) - size));
+
+        // Every fourth read starts on a sector boundary, like a refill
+        if(i % 4 == 3)
+            start = start & ~(uint64_t)(SECTOR_SIZE - 1);
+
+        memset(buffer, 0xCC, sizeof(buffer));
+        SD_ReadData(buffer, start, size);
+        if(memcmp(buffer, expected + start, size) != 0 || buffer[size] != 0xCC)
+            bad++;
+    }
+
+    CHECK(bad == 0, "%u of 2000 SD_ReadData reads at random offsets and lengths were wrong", bad);
+    CHECK(pic32_sd.errors == 0, "%u card errors in the random reads", pic32_sd.errors);
+
+    // A read that ends partway through a sector and one that carries on from there
+    Pic32_ResetStats();
+    SD_ReadData(buffer, (700 * SECTOR_SIZE) + 10, 300);
+    SD_ReadData(buffer + 300, (700 * SECTOR_SIZE) + 310, SECTOR_SIZE);
+    CHECK(memcmp(buffer, expected + (700 * SECTOR_SIZE) + 10, 300 + SECTOR_SIZE) == 0, "Follow on reads read the wrong data");
+    CHECK(pic32_sd.sectors_read == 2 && pic32_sd.commands[18] == 1,
+            "Follow on reads over 2 sectors read %llu sectors with %u CMD18s",
+            (unsigned long long)pic32_sd.sectors_read, pic32_sd.commands[18]);
+
+    // Nothing at all
+    Pic32_ResetStats();
+    SD_ReadData(buffer, 800 * SECTOR_SIZE, 0);
+    CHECK(pic32_sd.sectors_read == 0 && pic32_sd.cpu_bytes == 0, "An empty read touched the card");
+}
+
+int main(void)
+{
+    FillCard();
+    Pic32_InsertCard(card, sizeof(card));
+
+    CheckInit();
+    CheckReadSector();
+    CheckReadMultiSectors();
+    CheckStreamRead();
+    CheckReadCached();
+    CheckReadDataAligned();
+    CheckReadDataAnywhere();
+
+    return Check_Result("test_sd");
+}
@@ -0,0 +1,334 @@
+/*
+ * File:   test_wav.c
+ *
+ * Created on October 17, 2026
+ *
+ * Runs the firmware's RIFF walker (Wav_ReadInfo) over a corpus of the WAV
+ * layouts found in the wild, stored on a fragmented simulated card, and
+ * checks it finds exactly where the samples start and stop.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "check.h"
+#include "pic32_sim.h"
+#include "testcard.h"
+#include "fat.h"
+#include "sd.h"
+#include "wav.h"
+
+#define MAX_WAV_SIZE (80 * 1024)
+
+// A WAV file being put together a chunk at a time
+struct WavBuilder {
+    uint8_t data[MAX_WAV_SIZE];
+    uint32_t size;
+    uint32_t data_offset;   // Where the data chunk's samples went
+};
+
+// What the walker should make of a file
+struct WavCase {
+    const char * what;
+    bool valid;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint16_t valid_bits;
+    uint32_t channel_mask;
+    uint32_t data_offset;
+    uint32_t data_size;
+    uint32_t frames;
+};
+
+static struct TestCard card;
+static struct FatPartition fat;
+
+static void Put16(uint8_t * p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void Put32(uint8_t * p, uint32_t value)
+{
+    Put16(p, value & 0xFFFF);
+    Put16(p + 2, value >> 16);
+}
+
+static void Wav_Begin(struct WavBuilder * wav, const char * riff, const char * wave)
+{
+    memset(wav, 0, sizeof(struct WavBuilder));
+    memcpy(wav->data, riff, 4);
+    memcpy(wav->data + 8, wave, 4);
+    wav->size = 12;
+}
+
+/**
+ * Adds a chunk, padded to an even size, with a size field that can lie
+ */
+static void Wav_ChunkSized(struct WavBuilder * wav, const char * id, const void * payload, uint32_t size, uint32_t size_field)
+{
+    memcpy(wav->data + wav->size, id, 4);
+    Put32(wav->data + wav->size + 4, size_field);
+    wav->size += 8;
+
+    if(memcmp(id, "data", 4) == 0)
+        wav->data_offset = wav->size;
+
+    if(payload != NULL)
+        memcpy(wav->data + wav->size, payload, size);
+    else
+        TestCard_Fill(wav->data + wav->size, size, wav->size);
+    wav->size += size + (size & 1);
+}
+
+static void Wav_Chunk(struct WavBuilder * wav, const char * id, const void * payload, uint32_t size)
+{
+    Wav_ChunkSized(wav, id, payload, size, size);
+}
+
+/**
+ * Adds a fmt chunk, WAVE_FORMAT_EXTENSIBLE if valid_bits is set
+ */
+static void Wav_Fmt(struct WavBuilder * wav, uint16_t format, uint16_t channels, uint32_t rate, uint16_t bits,
+        uint16_t valid_bits, uint32_t channel_mask)
+{
+    uint8_t fmt[40];
+    uint16_t block_align = channels * ((bits + 7) / 8);
+
+    memset(fmt, 0, sizeof(fmt));
+    Put16(fmt, (valid_bits != 0) ? WAV_FORMAT_EXTENSIBLE : format);
+    Put16(fmt + 2, channels);
+    Put32(fmt + 4, rate);
+    Put32(fmt + 8, rate * block_align);
+    Put16(fmt + 12, (format == WAV_FORMAT_IMA_ADPCM) ? 512 : block_align);
+    Put16(fmt + 14, bits);
+
+    if(valid_bits != 0)
+    {
+        Put16(fmt + 16, 22);
+        Put16(fmt + 18, valid_bits);
+        Put32(fmt + 20, channel_mask);
+        Put16(fmt + 24, format);
+        memcpy(fmt + 26, "\x00\x00\x10\x00\x80\x00\x00\xAA\x00\x38\x9B\x71", 12);
+        Wav_Chunk(wav, "fmt ", fmt, 40);
+    }
+    else if(format == WAV_FORMAT_IEEE_FLOAT)
+        Wav_Chunk(wav, "fmt ", fmt, 18);    // With a zero cbSize, as most tools write it
+    else
+        Wav_Chunk(wav, "fmt ", fmt, 16);
+}
+
+static void Wav_End(struct WavBuilder * wav)
+{
+    Put32(wav->data + 4, wav->size - 8);
+}
+
+/**
+ * Builds the corpus onto the card, filling in where each file's samples are
+ *
+ * @return How many files there are
+ */
+static uint32_t BuildCorpus(struct WavCase * cases, struct WavBuilder * wavs)
+{
+    static const uint8_t fact[4] = { 0xE8, 0x03, 0, 0 };
+    static uint8_t junk[64 * 1024];
+    struct WavBuilder * wav;
+    struct WavCase * c;
+    uint32_t n = 0;
+    char name[16];
+
+    memset(junk, 'j', sizeof(junk));
+
+#define NEXT(description) (c = &cases[n], wav = &wavs[n], memset(c, 0, sizeof(*c)), c->what = description, n++)
+
+    NEXT("a canonical 44 byte header");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 44100, 16, 0, 0);
+    Wav_Chunk(wav, "data", NULL, 4000);
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_PCM, 2, 44100, 16, 0, 44, 4000, 1000 };
+
+    NEXT("a LIST chunk before the data");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 44100, 16, 0, 0);
+    Wav_Chunk(wav, "LIST", junk, 1010);
+    Wav_Chunk(wav, "data", NULL, 4000);
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_PCM, 2, 44100, 16, 0, 1062, 4000, 1000 };
+
+    NEXT("bext and fact chunks, and a partial frame");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Chunk(wav, "bext", junk, 602);
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 48000, 24, 0, 0);
+    Wav_Chunk(wav, "fact", fact, 4);
+    Wav_Chunk(wav, "data", NULL, 4001);
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_PCM, 2, 48000, 24, 0, 0, 3996, 666 };
+
+    NEXT("WAVE_FORMAT_EXTENSIBLE, 20 bits in 24");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 96000, 24, 20, 0x3);
+    Wav_Chunk(wav, "data", NULL, 3996);
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_PCM, 2, 96000, 20, 0x3, 68, 3996, 666 };
+
+    NEXT("float with an 18 byte fmt chunk and a fact chunk");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_IEEE_FLOAT, 2, 44100, 32, 0, 0);
+    Wav_Chunk(wav, "fact", fact, 4);
+    Wav_Chunk(wav, "data", NULL, 8000);
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_IEEE_FLOAT, 2, 44100, 32, 0, 58, 8000, 1000 };
+
+    NEXT("an odd sized chunk and its pad byte");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 1, 22050, 16, 0, 0);
+    Wav_Chunk(wav, "junk", junk, 5);
+    Wav_Chunk(wav, "data", NULL, 4000);
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_PCM, 1, 22050, 16, 0, 58, 4000, 2000 };
+
+    NEXT("a LIST chunk after the data");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 44100, 16, 0, 0);
+    Wav_Chunk(wav, "data", NULL, 4000);
+    Wav_Chunk(wav, "LIST", junk, 300);
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_PCM, 2, 44100, 16, 0, 44, 4000, 1000 };
+
+    NEXT("a data size bigger than the file");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 44100, 16, 0, 0);
+    Wav_ChunkSized(wav, "data", NULL, 3999, 0x7FFFFFFF);
+    wav->size--;    // No pad byte, the file really ends there
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_PCM, 2, 44100, 16, 0, 44, 3996, 999 };
+
+    NEXT("a data size never filled in");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 44100, 16, 0, 0);
+    Wav_ChunkSized(wav, "data", NULL, 4000, 0);
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_PCM, 2, 44100, 16, 0, 44, 4000, 1000 };
+
+    NEXT("a 64KiB bext chunk, seeked over");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 44100, 16, 0, 0);
+    Wav_Chunk(wav, "bext", junk, sizeof(junk));
+    Wav_Chunk(wav, "data", NULL, 4000);
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_PCM, 2, 44100, 16, 0, 44 + 8 + sizeof(junk), 4000, 1000 };
+
+    NEXT("IMA ADPCM, whose frames its decoder counts");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_IMA_ADPCM, 1, 22050, 4, 0, 0);
+    Wav_Chunk(wav, "fact", fact, 4);
+    Wav_Chunk(wav, "data", NULL, 2048);
+    *c = (struct WavCase){ c->what, true, WAV_FORMAT_IMA_ADPCM, 1, 22050, 4, 0, 56, 2048, 0 };
+
+    NEXT("data before fmt");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Chunk(wav, "data", NULL, 4000);
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 44100, 16, 0, 0);
+
+    NEXT("a big endian RIFX file");
+    Wav_Begin(wav, "RIFX", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 44100, 16, 0, 0);
+    Wav_Chunk(wav, "data", NULL, 4000);
+
+    NEXT("an AVI");
+    Wav_Begin(wav, "RIFF", "AVI ");
+    Wav_Chunk(wav, "data", NULL, 4000);
+
+    NEXT("a chunk running off the end before the data");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 44100, 16, 0, 0);
+    Wav_ChunkSized(wav, "LIST", junk, 100, 1000000);
+    Wav_Chunk(wav, "data", NULL, 4000);
+
+    NEXT("no data chunk");
+    Wav_Begin(wav, "RIFF", "WAVE");
+    Wav_Fmt(wav, WAV_FORMAT_PCM, 2, 44100, 16, 0, 0);
+    Wav_Chunk(wav, "LIST", junk, 100);
+
+#undef NEXT
+
+    card.frag_percent = 30;
+    for(uint32_t i = 0; i < n; ++i)
+    {
+        Wav_End(&wavs[i]);
+        if(cases[i].valid && cases[i].data_offset == 0)
+            cases[i].data_offset = wavs[i].data_offset;
+
+        snprintf(name, sizeof(name), "W%02u.WAV", i);
+        TestCard_AddFile(&card, TESTCARD_ROOT, name, wavs[i].data, wavs[i].size, 0);
+    }
+
+    return n;
+}
+
+/**
+ * Every file in the corpus is walked, and the file is left at its first
+ * sample
+ */
+static void CheckCorpus(void)
+{
+    static struct WavCase cases[32];
+    static struct WavBuilder wavs[32];
+    struct WavInfo info;
+    struct FatFile file;
+    uint8_t first[16];
+    uint64_t bytes;
+    char name[16];
+    uint32_t num_cases, i;
+    bool valid;
+
+    TestCard_Format(&card, FAT_FS_FAT16, 65536, 1);
+    num_cases = BuildCorpus(cases, wavs);
+
+    Pic32_InsertCard(card.image, card.size);
+    InitSD();
+    CHECK(OpenFirstFatPartition(&fat), "The card didn't open");
+
+    for(i = 0; i < num_cases; ++i)
+    {
+        snprintf(name, sizeof(name), "W%02u     ", i);
+        if(!Fat_open(&fat, &file, name, "WAV"))
+        {
+            CHECK(false, "W%02u.WAV (%s) didn't open", i, cases[i].what);
+            continue;
+        }
+
+        Pic32_ResetStats();
+        valid = Wav_ReadInfo(&file, &info);
+        bytes = pic32_sd.cpu_bytes + pic32_sd.dma_bytes;
+        if(!cases[i].valid)
+        {
+            CHECK(!valid, "A file with %s was taken for a WAV", cases[i].what);
+            continue;
+        }
+
+        CHECK(valid, "A file with %s wasn't read", cases[i].what);
+        if(!valid)
+            continue;
+
+        CHECK(info.format == cases[i].format && info.channels == cases[i].channels &&
+                info.sample_rate == cases[i].sample_rate && info.valid_bits == cases[i].valid_bits &&
+                info.channel_mask == cases[i].channel_mask,
+                "A file with %s read as format %u, %u channels at %uHz, %u bits, mask %u", cases[i].what,
+                info.format, info.channels, info.sample_rate, info.valid_bits, info.channel_mask);
+        CHECK(info.data_offset == cases[i].data_offset && info.data_size == cases[i].data_size && info.frames == cases[i].frames,
+                "A file with %s has %u bytes (%u frames) of samples at %u, not %u (%u) at %u", cases[i].what,
+                info.data_size, info.frames, info.data_offset, cases[i].data_size, cases[i].frames, cases[i].data_offset);
+
+        CHECK(Fat_read(&file, first, sizeof(first)) == sizeof(first) &&
+                memcmp(first, wavs[i].data + cases[i].data_offset, sizeof(first)) == 0,
+                "A file with %s wasn't left at its first sample", cases[i].what);
+
+        // Walking the chunks costs their headers, not their contents
+        CHECK(bytes < 4 * SECTOR_SIZE + 1024, "A file with %s cost %llu bytes off the card to walk",
+                cases[i].what, (unsigned long long)bytes);
+    }
+
+    printf("WAV corpus: %u layouts walked\n", num_cases);
+}
+
+int main(void)
+{
+    Check_Boot("Corpus", CheckCorpus);
+    return Check_Result("test_wav");
+}
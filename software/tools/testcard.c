@@ -0,0 +1,550 @@
+/*
+ * File:   testcard.c
+ *
+ * Created on October 17, 2026
+ *
+ * The layouts follow what a PC would write closely enough for the firmware
+ * to read them: an MBR with one partition, two FATs (one on exFAT), an
+ * FSInfo sector on FAT32, "." and ".." in FAT subdirectories and entry sets
+ * on exFAT. Nothing the firmware doesn't look at is filled in (exFAT's
+ * allocation bitmap, up-case table, set checksums and name hashes).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "testcard.h"
+
+#define FAT16_RESERVED_SECTORS 1
+#define FAT32_RESERVED_SECTORS 32
+#define FAT32_FSINFO_SECTOR 1
+#define FAT32_BACKUP_BOOT_SECTOR 6
+
+// Sectors from the start of an exFAT partition to its FAT
+#define EXFAT_FAT_OFFSET 128
+
+#define EXFAT_ENTRY_LABEL 0x83
+#define EXFAT_FLAG_ALLOCATION_POSSIBLE 0x01
+
+#define ATTR_ARCHIVE 0x20
+
+static uint8_t * Card_Sector(struct TestCard * card, uint64_t sector);
+static uint32_t Card_Random(struct TestCard * card);
+static uint32_t Card_Alloc(struct TestCard * card, uint32_t num_clusters, uint8_t flags);
+static uint32_t Card_NextCluster(struct TestCard * card, uint32_t cluster, uint8_t flags);
+static void Card_UpdateFsInfo(struct TestCard * card);
+static void Dir_AddEntry(struct TestCard * card, uint32_t dir, const char * name, uint8_t attributes,
+        uint32_t cluster, uint64_t size, uint8_t flags);
+static void FatName(const char * name, char filename[8], char ext[3]);
+static void WriteMbr(struct TestCard * card, uint8_t partition_type, uint64_t part_sectors);
+static void FormatFat(struct TestCard * card, uint64_t part_sectors);
+static void FormatExFat(struct TestCard * card, uint64_t part_sectors);
+
+/**
+ * Makes a blank card with one freshly formatted partition on it
+ *
+ * @param card The card to make
+ * @param fs_type What to format it with
+ * @param part_sectors The size of the partition (the card is TESTCARD_PART_START bigger)
+ * @param cluster_sectors Sectors in each cluster (a power of two)
+ *
+ * @return False if the image couldn't be mapped
+ */
+bool TestCard_Format(struct TestCard * card, enum FatFsType fs_type, uint64_t part_sectors, uint32_t cluster_sectors)
+{
+    memset(card, 0, sizeof(struct TestCard));
+    card->size = (TESTCARD_PART_START + part_sectors) * SECTOR_SIZE;
+    card->image = mmap(NULL, card->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(card->image == MAP_FAILED)
+    {
+        card->image = NULL;
+        return false;
+    }
+
+    card->fs_type = fs_type;
+    card->cluster_sectors = cluster_sectors;
+    card->next_free = 2;
+    card->random = 0x9E3779B9;
+
+    if(fs_type == FAT_FS_EXFAT)
+        FormatExFat(card, part_sectors);
+    else
+        FormatFat(card, part_sectors);
+
+    return true;
+}
+
+void TestCard_Free(struct TestCard * card)
+{
+    if(card->image != NULL)
+        munmap(card->image, card->size);
+    card->image = NULL;
+}
+
+/**
+ * Makes an empty subdirectory
+ *
+ * @param card The card
+ * @param parent The directory to make it in
+ * @param name Its name (8 characters at most on FAT)
+ * @param flags TESTCARD_CONTIGUOUS or zero
+ *
+ * @return The new directory's handle
+ */
+uint32_t TestCard_AddDir(struct TestCard * card, uint32_t parent, const char * name, uint8_t flags)
+{
+    uint32_t handle = card->num_dirs++;
+    struct TestDir * dir = &card->dirs[handle];
+    struct Fat16Entry * entry;
+    uint32_t cluster, i;
+
+    if(handle >= TESTCARD_MAX_DIRS)
+    {
+        fprintf(stderr, "testcard: too many directories\n");
+        exit(2);
+    }
+
+    cluster = Card_Alloc(card, TESTCARD_DIR_CLUSTERS, flags);
+    for(i = 0; i < TESTCARD_DIR_CLUSTERS; ++i)
+    {
+        dir->clusters[i] = cluster;
+        cluster = Card_NextCluster(card, cluster, flags);
+    }
+    dir->num_entries = 0;
+    dir->max_entries = TESTCARD_DIR_CLUSTERS * card->cluster_sectors * (SECTOR_SIZE / 32);
+
+    if(card->fs_type != FAT_FS_EXFAT)
+    {
+        // "." and "..", the root is cluster zero even on FAT32
+        for(i = 0; i < 2; ++i)
+        {
+            cluster = (i == 0) ? dir->clusters[0] : ((parent == TESTCARD_ROOT) ? 0 : card->dirs[parent].clusters[0]);
+            entry = (struct Fat16Entry *)TestCard_DirSlot(card, handle);
+            memset(entry->filename, ' ', 8);
+            memset(entry->ext, ' ', 3);
+            memset(entry->filename, '.', i + 1);
+            entry->attributes = FAT_ATTR_DIRECTORY;
+            entry->starting_cluster = (uint16_t)cluster;
+            entry->starting_cluster_high = (card->fs_type == FAT_FS_FAT32) ? (uint16_t)(cluster >> 16) : 0;
+        }
+    }
+
+    Dir_AddEntry(card, parent, name, FAT_ATTR_DIRECTORY, dir->clusters[0],
+            (card->fs_type == FAT_FS_EXFAT) ? (uint64_t)TESTCARD_DIR_CLUSTERS * card->cluster_sectors * SECTOR_SIZE : 0, flags);
+
+    return handle;
+}
+
+/**
+ * Stores a file on the card
+ *
+ * @param card The card
+ * @param dir The directory to put it in
+ * @param name Its name, 8.3 on FAT (e.g. "TRACK01.WAV")
+ * @param data What's in it
+ * @param size Its size in bytes
+ * @param flags TESTCARD_CONTIGUOUS or zero
+ *
+ * @return The file's first cluster (zero if it's empty)
+ */
+uint32_t TestCard_AddFile(struct TestCard * card, uint32_t dir, const char * name, const void * data, uint32_t size, uint8_t flags)
+{
+    uint32_t cluster_size = card->cluster_sectors * SECTOR_SIZE;
+    uint32_t num_clusters = (size + cluster_size - 1) / cluster_size;
+    uint32_t first = 0, cluster, offset, i;
+
+    if(num_clusters > 0)
+    {
+        first = cluster = Card_Alloc(card, num_clusters, flags);
+        for(i = 0, offset = 0; i < num_clusters; ++i, offset += cluster_size)
+        {
+            memcpy(TestCard_Cluster(card, cluster), (const uint8_t *)data + offset,
+                    (size - offset < cluster_size) ? size - offset : cluster_size);
+            cluster = Card_NextCluster(card, cluster, flags);
+        }
+    }
+
+    Dir_AddEntry(card, dir, name, ATTR_ARCHIVE, first, size, flags);
+
+    return first;
+}
+
+/**
+ * Allocates clusters without putting anything in them
+ *
+ * @param card The card
+ * @param num_clusters How many
+ * @param flags TESTCARD_CONTIGUOUS or zero
+ *
+ * @return The first cluster
+ */
+uint32_t TestCard_Alloc(struct TestCard * card, uint32_t num_clusters, uint8_t flags)
+{
+    return Card_Alloc(card, num_clusters, flags);
+}
+
+uint32_t TestCard_FatEntry(struct TestCard * card, uint32_t cluster)
+{
+    uint8_t * fat = Card_Sector(card, card->fat_sector);
+
+    if(card->fs_type == FAT_FS_FAT16)
+        return fat[cluster * 2] | ((uint32_t)fat[(cluster * 2) + 1] << 8);
+
+    return fat[cluster * 4] | ((uint32_t)fat[(cluster * 4) + 1] << 8) |
+            ((uint32_t)fat[(cluster * 4) + 2] << 16) | ((uint32_t)fat[(cluster * 4) + 3] << 24);
+}
+
+/**
+ * Sets a cluster's entry in every copy of the FAT
+ */
+void TestCard_SetFatEntry(struct TestCard * card, uint32_t cluster, uint32_t value)
+{
+    uint8_t * fat;
+    uint8_t i, j, width = (card->fs_type == FAT_FS_FAT16) ? 2 : 4;
+
+    for(i = 0; i < card->num_fats; ++i)
+    {
+        fat = Card_Sector(card, card->fat_sector + ((uint64_t)i * card->fat_sectors));
+        for(j = 0; j < width; ++j)
+            fat[(cluster * width) + j] = (uint8_t)(value >> (8 * j));
+    }
+}
+
+uint8_t * TestCard_Cluster(struct TestCard * card, uint32_t cluster)
+{
+    return Card_Sector(card, card->data_sector + ((uint64_t)(cluster - 2) * card->cluster_sectors));
+}
+
+/**
+ * Fills a buffer with bytes that don't repeat in any way the firmware could
+ * get right by accident
+ */
+void TestCard_Fill(void * data, uint32_t size, uint32_t seed)
+{
+    uint32_t state = seed * 2654435761u + 1;
+    uint32_t i;
+
+    for(i = 0; i < size; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        ((uint8_t *)data)[i] = (uint8_t)(state >> 24);
+    }
+}
+
+static uint8_t * Card_Sector(struct TestCard * card, uint64_t sector)
+{
+    if((sector + 1) * SECTOR_SIZE > card->size)
+    {
+        fprintf(stderr, "testcard: sector %llu is off the card\n", (unsigned long long)sector);
+        exit(2);
+    }
+
+    return card->image + (sector * SECTOR_SIZE);
+}
+
+static uint32_t Card_Random(struct TestCard * card)
+{
+    card->random ^= card->random << 13;
+    card->random ^= card->random >> 17;
+    card->random ^= card->random << 5;
+    return card->random;
+}
+
+/**
+ * Takes clusters from next_free, skipping some if the card is meant to be
+ * fragmented, and chains them together in the FAT (unless they're a
+ * contiguous exFAT file, which isn't in the FAT at all)
+ */
+static uint32_t Card_Alloc(struct TestCard * card, uint32_t num_clusters, uint8_t flags)
+{
+    bool fragment = !(flags & TESTCARD_CONTIGUOUS) && card->frag_percent > 0;
+    bool chain = !(flags & TESTCARD_CONTIGUOUS) || card->fs_type != FAT_FS_EXFAT;
+    uint32_t end_of_chain = (card->fs_type == FAT_FS_FAT16) ? 0xFFFF : 0x0FFFFFFF;
+    uint32_t first = 0, prev = 0, i;
+
+    if(card->fs_type == FAT_FS_EXFAT)
+        end_of_chain = 0xFFFFFFFF;
+
+    for(i = 0; i < num_clusters; ++i)
+    {
+        if(fragment && (Card_Random(card) % 100) < card->frag_percent)
+            card->next_free += 1 + (Card_Random(card) % 3);
+
+        if(card->next_free >= card->num_clusters + 2)
+        {
+            fprintf(stderr, "testcard: out of clusters\n");
+            exit(2);
+        }
+
+        if(i == 0)
+            first = card->next_free;
+        else if(chain)
+            TestCard_SetFatEntry(card, prev, card->next_free);
+
+        prev = card->next_free++;
+    }
+
+    if(chain && num_clusters > 0)
+        TestCard_SetFatEntry(card, prev, end_of_chain);
+
+    Card_UpdateFsInfo(card);
+
+    return first;
+}
+
+static uint32_t Card_NextCluster(struct TestCard * card, uint32_t cluster, uint8_t flags)
+{
+    if((flags & TESTCARD_CONTIGUOUS) && card->fs_type == FAT_FS_EXFAT)
+        return cluster + 1;
+
+    return TestCard_FatEntry(card, cluster);
+}
+
+static void Card_UpdateFsInfo(struct TestCard * card)
+{
+    struct FatFsInfo * info;
+
+    if(card->fs_type != FAT_FS_FAT32)
+        return;
+
+    info = (struct FatFsInfo *)Card_Sector(card, TESTCARD_PART_START + FAT32_FSINFO_SECTOR);
+    info->lead_sig = FAT_FSINFO_LEAD_SIG;
+    info->struct_sig = FAT_FSINFO_STRUCT_SIG;
+    info->free_count = card->num_clusters + 2 - card->next_free;
+    info->next_free = card->next_free;
+    info->trail_sig = 0xAA550000;
+}
+
+/**
+ * Takes the next free 32 byte slot in a directory, for writing entries
+ * TestCard_AddFile wouldn't (deleted files, long names, volume labels)
+ *
+ * @param card The card
+ * @param handle The directory
+ *
+ * @return The slot, zeroed
+ */
+uint8_t * TestCard_DirSlot(struct TestCard * card, uint32_t handle)
+{
+    struct TestDir * dir = &card->dirs[handle];
+    uint32_t offset = dir->num_entries * 32;
+    uint32_t cluster_size = card->cluster_sectors * SECTOR_SIZE;
+
+    if(dir->num_entries >= dir->max_entries)
+    {
+        fprintf(stderr, "testcard: directory %u is full\n", handle);
+        exit(2);
+    }
+    dir->num_entries++;
+
+    if(handle == TESTCARD_ROOT && card->fs_type == FAT_FS_FAT16)
+        return Card_Sector(card, card->root_sector) + offset;
+
+    return TestCard_Cluster(card, dir->clusters[offset / cluster_size]) + (offset % cluster_size);
+}
+
+/**
+ * Writes a directory entry (an entry set on exFAT)
+ */
+static void Dir_AddEntry(struct TestCard * card, uint32_t dir, const char * name, uint8_t attributes,
+        uint32_t cluster, uint64_t size, uint8_t flags)
+{
+    struct Fat16Entry * entry;
+    struct ExFatFileEntry * file;
+    struct ExFatStreamEntry * stream;
+    struct ExFatNameEntry * name_entry;
+    uint8_t name_length = (uint8_t)strlen(name);
+    uint8_t num_names = (name_length + EXFAT_NAME_CHARS - 1) / EXFAT_NAME_CHARS;
+    uint8_t i, j;
+
+    if(card->fs_type != FAT_FS_EXFAT)
+    {
+        entry = (struct Fat16Entry *)TestCard_DirSlot(card, dir);
+        FatName(name, entry->filename, entry->ext);
+        entry->attributes = attributes;
+        entry->starting_cluster = (uint16_t)cluster;
+        entry->starting_cluster_high = (card->fs_type == FAT_FS_FAT32) ? (uint16_t)(cluster >> 16) : 0;
+        entry->filesize = (uint32_t)size;
+        return;
+    }
+
+    file = (struct ExFatFileEntry *)TestCard_DirSlot(card, dir);
+    stream = (struct ExFatStreamEntry *)TestCard_DirSlot(card, dir);
+
+    file->type = EXFAT_ENTRY_FILE;
+    file->secondary_count = 1 + num_names;
+    file->attributes = attributes;
+
+    stream->type = EXFAT_ENTRY_STREAM;
+    stream->flags = EXFAT_FLAG_ALLOCATION_POSSIBLE | ((flags & TESTCARD_CONTIGUOUS) ? EXFAT_FLAG_NO_FAT_CHAIN : 0);
+    stream->name_length = name_length;
+    stream->valid_data_length = size;
+    stream->first_cluster = cluster;
+    stream->data_length = size;
+
+    for(i = 0; i < num_names; ++i)
+    {
+        name_entry = (struct ExFatNameEntry *)TestCard_DirSlot(card, dir);
+        name_entry->type = EXFAT_ENTRY_NAME;
+        for(j = 0; j < EXFAT_NAME_CHARS && (i * EXFAT_NAME_CHARS) + j < name_length; ++j)
+            name_entry->name[j] = (uint8_t)name[(i * EXFAT_NAME_CHARS) + j];
+    }
+}
+
+/**
+ * Turns "name.ext" into a space padded, upper case 8.3 name
+ */
+static void FatName(const char * name, char filename[8], char ext[3])
+{
+    const char * dot = strrchr(name, '.');
+    uint8_t i;
+
+    memset(filename, ' ', 8);
+    memset(ext, ' ', 3);
+
+    for(i = 0; i < 8 && name[i] != '\0' && &name[i] != dot; ++i)
+        filename[i] = (name[i] >= 'a' && name[i] <= 'z') ? name[i] - ('a' - 'A') : name[i];
+
+    for(i = 0; dot != NULL && i < 3 && dot[i + 1] != '\0'; ++i)
+        ext[i] = (dot[i + 1] >= 'a' && dot[i + 1] <= 'z') ? dot[i + 1] - ('a' - 'A') : dot[i + 1];
+}
+
+static void WriteMbr(struct TestCard * card, uint8_t partition_type, uint64_t part_sectors)
+{
+    uint8_t * mbr = Card_Sector(card, 0);
+    struct PartitionTable * table = (struct PartitionTable *)(mbr + 0x1BE);
+
+    table->partition_type = partition_type;
+    table->start_sector = TESTCARD_PART_START;
+    table->length_sectors = (part_sectors > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)part_sectors;
+    mbr[510] = 0x55;
+    mbr[511] = 0xAA;
+}
+
+/**
+ * FAT16 or FAT32, whichever card->fs_type says (the cluster count is what
+ * the firmware goes by, so it's up to the caller to pick a size that fits)
+ */
+static void FormatFat(struct TestCard * card, uint64_t part_sectors)
+{
+    bool fat32 = (card->fs_type == FAT_FS_FAT32);
+    uint32_t total = (uint32_t)part_sectors;
+    uint32_t reserved = fat32 ? FAT32_RESERVED_SECTORS : FAT16_RESERVED_SECTORS;
+    uint32_t root_sectors = fat32 ? 0 : (TESTCARD_ROOT_ENTRIES * 32) / SECTOR_SIZE;
+    uint32_t entry_size = fat32 ? 4 : 2;
+    struct Fat32BootSector * boot = (struct Fat32BootSector *)Card_Sector(card, TESTCARD_PART_START);
+    struct Fat16BootSector * boot16 = (struct Fat16BootSector *)boot;
+    uint32_t i;
+
+    card->num_fats = 2;
+    card->num_clusters = (total - reserved - root_sectors) / card->cluster_sectors;
+    card->fat_sectors = (((card->num_clusters + 2) * entry_size) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    card->num_clusters = (total - reserved - root_sectors - (card->num_fats * card->fat_sectors)) / card->cluster_sectors;
+    card->fat_sector = TESTCARD_PART_START + reserved;
+    card->root_sector = card->fat_sector + (card->num_fats * card->fat_sectors);
+    card->data_sector = card->root_sector + root_sectors;
+
+    memcpy(boot->jump, "\xEB\x58\x90", 3);
+    memcpy(boot->oem, "MSWIN4.1", 8);
+    boot->sector_size = SECTOR_SIZE;
+    boot->num_sectors_per_cluster = (uint8_t)card->cluster_sectors;
+    boot->reserved_sectors = (uint16_t)reserved;
+    boot->num_fats = card->num_fats;
+    boot->media_descriptor = 0xF8;
+    boot->chs_sectors_per_track = 63;
+    boot->chs_num_heads = 255;
+    boot->num_hidden_sectors = TESTCARD_PART_START;
+    boot->total_num_sectors = total;
+    boot->boot_sector_sig = 0xAA55;
+
+    TestCard_SetFatEntry(card, 0, fat32 ? 0x0FFFFFF8 : 0xFFF8);
+    TestCard_SetFatEntry(card, 1, fat32 ? 0x0FFFFFFF : 0xFFFF);
+
+    card->num_dirs = 1;
+    if(fat32)
+    {
+        boot->fat_num_sectors = card->fat_sectors;
+        boot->fsinfo_sector = FAT32_FSINFO_SECTOR;
+        boot->backup_boot_sector = FAT32_BACKUP_BOOT_SECTOR;
+        boot->boot_sig = 0x29;
+        memcpy(boot->filesystem_type, "FAT32   ", 8);
+
+        card->root_cluster = Card_Alloc(card, TESTCARD_DIR_CLUSTERS, 0);
+        boot->root_cluster = card->root_cluster;
+        for(i = 0; i < TESTCARD_DIR_CLUSTERS; ++i)
+            card->dirs[TESTCARD_ROOT].clusters[i] = (i == 0) ? card->root_cluster :
+                    TestCard_FatEntry(card, card->dirs[TESTCARD_ROOT].clusters[i - 1]);
+        card->dirs[TESTCARD_ROOT].max_entries = TESTCARD_DIR_CLUSTERS * card->cluster_sectors * (SECTOR_SIZE / 32);
+
+        memcpy(Card_Sector(card, TESTCARD_PART_START + FAT32_BACKUP_BOOT_SECTOR), boot, SECTOR_SIZE);
+        WriteMbr(card, 0x0C, part_sectors);
+    }
+    else
+    {
+        boot16->num_root_entries = TESTCARD_ROOT_ENTRIES;
+        boot16->fat_num_sectors = (uint16_t)card->fat_sectors;
+        boot16->boot_sig = 0x29;
+        memcpy(boot16->filesystem_type, "FAT16   ", 8);
+
+        card->dirs[TESTCARD_ROOT].max_entries = TESTCARD_ROOT_ENTRIES;
+        WriteMbr(card, 0x06, part_sectors);
+    }
+}
+
+static void FormatExFat(struct TestCard * card, uint64_t part_sectors)
+{
+    struct ExFatBootSector * boot = (struct ExFatBootSector *)Card_Sector(card, TESTCARD_PART_START);
+    uint32_t heap_offset, i;
+    uint8_t shift = 0;
+    uint8_t * label;
+
+    while((1u << shift) < card->cluster_sectors)
+        shift++;
+
+    card->num_fats = 1;
+    card->num_clusters = (uint32_t)((part_sectors - EXFAT_FAT_OFFSET) / card->cluster_sectors);
+    card->fat_sectors = (((card->num_clusters + 2) * 4) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    heap_offset = EXFAT_FAT_OFFSET + card->fat_sectors;
+    heap_offset = ((heap_offset + card->cluster_sectors - 1) / card->cluster_sectors) * card->cluster_sectors;
+    card->num_clusters = (uint32_t)((part_sectors - heap_offset) / card->cluster_sectors);
+    card->fat_sector = TESTCARD_PART_START + EXFAT_FAT_OFFSET;
+    card->data_sector = TESTCARD_PART_START + heap_offset;
+
+    memcpy(boot->jump, "\xEB\x76\x90", 3);
+    memcpy(boot->oem, "EXFAT   ", 8);
+    boot->partition_offset = TESTCARD_PART_START;
+    boot->volume_length = part_sectors;
+    boot->fat_offset = EXFAT_FAT_OFFSET;
+    boot->fat_length = card->fat_sectors;
+    boot->cluster_heap_offset = heap_offset;
+    boot->cluster_count = card->num_clusters;
+    boot->volume_serial = 0x1234;
+    boot->fs_revision = 0x100;
+    boot->bytes_per_sector_shift = 9;
+    boot->sectors_per_cluster_shift = shift;
+    boot->num_fats = 1;
+    boot->drive_select = 0x80;
+    boot->boot_sector_sig = 0xAA55;
+
+    TestCard_SetFatEntry(card, 0, 0xFFFFFFF8);
+    TestCard_SetFatEntry(card, 1, 0xFFFFFFFF);
+
+    card->num_dirs = 1;
+    card->root_cluster = Card_Alloc(card, TESTCARD_DIR_CLUSTERS, 0);
+    boot->root_cluster = card->root_cluster;
+    for(i = 0; i < TESTCARD_DIR_CLUSTERS; ++i)
+        card->dirs[TESTCARD_ROOT].clusters[i] = (i == 0) ? card->root_cluster :
+                TestCard_FatEntry(card, card->dirs[TESTCARD_ROOT].clusters[i - 1]);
+    card->dirs[TESTCARD_ROOT].max_entries = TESTCARD_DIR_CLUSTERS * card->cluster_sectors * (SECTOR_SIZE / 32);
+
+    // An empty volume label, which has to be skipped over like any other non-file entry
+    label = TestCard_DirSlot(card, TESTCARD_ROOT);
+    label[0] = EXFAT_ENTRY_LABEL;
+
+    WriteMbr(card, 0x07, part_sectors);
+}
@@ -0,0 +1,78 @@
+/*
+ * File:   testcard.h
+ *
+ * Created on October 17, 2026
+ *
+ * Builds FAT16, FAT32 and exFAT card images in RAM for the checks, with
+ * files and subdirectories put wherever a check needs them (fragmented,
+ * contiguous, far into the card). Images are mapped without reserving
+ * memory, so a card can be bigger than 4GiB as long as little of it is
+ * written. They're shared with forked processes, so what one boot writes
+ * is there for the next.
+ */
+
+#ifndef TESTCARD_H
+#define	TESTCARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fat.h"
+
+// Where the partition starts, like cardprep and the SD association formatter
+#define TESTCARD_PART_START 2048
+
+// Entries in the FAT16 root directory
+#define TESTCARD_ROOT_ENTRIES 512
+
+// Clusters given to every directory when it's made (the root included)
+#define TESTCARD_DIR_CLUSTERS 16
+
+// Directories a card has room for
+#define TESTCARD_MAX_DIRS 320
+
+// The root directory's handle
+#define TESTCARD_ROOT 0
+
+// TestCard_AddFile and TestCard_AddDir flags
+#define TESTCARD_CONTIGUOUS 0x01    // Never fragmented, and NoFatChain on exFAT
+
+struct TestDir {
+    uint32_t clusters[TESTCARD_DIR_CLUSTERS];   // None for the FAT16 root
+    uint32_t num_entries;       // 32 byte slots used
+    uint32_t max_entries;
+};
+
+struct TestCard {
+    uint8_t * image;
+    uint64_t size;              // In bytes
+    enum FatFsType fs_type;
+    uint32_t cluster_sectors;
+    uint32_t num_clusters;
+    uint32_t fat_sector;        // From the start of the card
+    uint32_t fat_sectors;       // In one FAT
+    uint8_t num_fats;
+    uint32_t root_sector;       // The FAT16 root directory
+    uint32_t data_sector;       // Cluster 2
+    uint32_t root_cluster;      // FAT32 and exFAT
+
+    // Chained allocations skip 1-3 clusters this often before each cluster
+    uint8_t frag_percent;
+    uint32_t next_free;         // Where the next allocation starts
+    uint32_t random;
+
+    struct TestDir dirs[TESTCARD_MAX_DIRS];
+    uint32_t num_dirs;
+};
+
+bool TestCard_Format(struct TestCard * card, enum FatFsType fs_type, uint64_t part_sectors, uint32_t cluster_sectors);
+void TestCard_Free(struct TestCard * card);
+uint32_t TestCard_AddDir(struct TestCard * card, uint32_t parent, const char * name, uint8_t flags);
+uint32_t TestCard_AddFile(struct TestCard * card, uint32_t dir, const char * name, const void * data, uint32_t size, uint8_t flags);
+uint8_t * TestCard_DirSlot(struct TestCard * card, uint32_t dir);
+uint32_t TestCard_Alloc(struct TestCard * card, uint32_t num_clusters, uint8_t flags);
+uint32_t TestCard_FatEntry(struct TestCard * card, uint32_t cluster);
+void TestCard_SetFatEntry(struct TestCard * card, uint32_t cluster, uint32_t value);
+uint8_t * TestCard_Cluster(struct TestCard * card, uint32_t cluster);
+void TestCard_Fill(void * data, uint32_t size, uint32_t seed);
+
+#endif	/* TESTCARD_H */